@@ -8,13 +8,19 @@
 #include "vm_display.h"
 #include "vm_disk.h"
 #include "vm_snapshot.h"
+#include "vm_snapfile.h"
 #include "vm_arch.h"
+#include "vm_bcache.h"
+#include "vm_exec.h"
+#include "vm_wheel.h"
+#include "vm_prof.h"
 #include "mem_asm.h"
-#include "priority_queue.h"
+#include "mem_domain.h"
 #include "../drivers/drivers.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #ifdef VM_SDL
 #include "vm_sdl.h"
@@ -22,419 +28,502 @@
 
 #ifdef VM_ENABLE
 
+/* Virtual time (vm_host.vm_clock) is counted in retired guest instructions
+ * and carries over between runs. A "cycle" of vm_run_cycles is one quantum;
+ * the PIT ticks once per quantum, the text display refreshes every 64 and a
+ * checkpoint is taken every 500, all on multiples of their period, so the
+ * same guest sees the same device timing however its run is split. */
 #define VM_QUANTUM 64
 #define VM_CHECKPOINT_INTERVAL 500
-#define PQ_PRIO_CPU 0
-#define PQ_PRIO_DISPLAY 1
-#define PQ_PRIO_TIMER 2
-#define PQ_PRIO_CHECKPOINT 3
-
-static vm_host_t s_host;
-static priority_queue_t s_vm_pq;
-static unsigned s_run_cycles;
-
-static uint32_t get_reg32(vm_cpu_t *cpu, int r) {
-    uint32_t *regs[] = { &cpu->eax, &cpu->ecx, &cpu->edx, &cpu->ebx,
-                         &cpu->esp, &cpu->ebp, &cpu->esi, &cpu->edi };
-    return (r >= 0 && r < 8) ? *regs[r] : 0;
-}
-
-static void set_reg32(vm_cpu_t *cpu, int r, uint32_t v) {
-    uint32_t *regs[] = { &cpu->eax, &cpu->ecx, &cpu->edx, &cpu->ebx,
-                         &cpu->esp, &cpu->ebp, &cpu->esi, &cpu->edi };
-    if (r >= 0 && r < 8) *regs[r] = v;
-}
-
-static uint8_t get_reg8_lo(vm_cpu_t *cpu, int r) {
-    return (uint8_t)(get_reg32(cpu, r) & 0xFF);
-}
+#define VM_TICK_STEP 1
+#define VM_TIMER_PERIOD VM_QUANTUM
+#define VM_DISPLAY_PERIOD ((uint64_t)VM_QUANTUM * 64)
+#define VM_CHECKPOINT_PERIOD ((uint64_t)VM_QUANTUM * VM_CHECKPOINT_INTERVAL)
+/* Wall-clock length of one PIT tick while the guest idles in HLT. */
+#define VM_IDLE_TICK_NS 1000000ULL
 
-static void set_reg8_lo(vm_cpu_t *cpu, int r, uint8_t v) {
-    uint32_t x = get_reg32(cpu, r);
-    set_reg32(cpu, r, (x & 0xFFFFFF00) | v);
-}
+/* One guest: its RAM and vCPU (host), decoded-block cache, device
+ * deadlines and the per-guest device, disk and checkpoint state. A context
+ * runs on one thread at a time; every entry point binds its states to the
+ * calling thread first. The legacy vm_* calls drive s_vm, whose NULL states
+ * select each module's process default. */
+struct vm_ctx {
+    vm_host_t host;
+    vm_bcache_t bcache;
+    vm_dispatch_t dispatch;
+    vm_wheel_t wheel;
+    vm_wheel_event_t ev_timer, ev_display, ev_checkpoint;
+    vm_io_state_t *io;
+    vm_disk_state_t *disk;
+    vm_snapshot_state_t *snap;
+    FILE *serial;
+    int display;
+    int booted;
+};
 
-static uint32_t guest_eip_linear(vm_cpu_t *cpu) {
-    return vm_cpu_linear_addr(cpu->cs, cpu->eip);
-}
+static vm_ctx_t s_vm = { .dispatch = VM_DISPATCH_THREADED, .display = 1 };
 
-static uint32_t translate_addr(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t linear) {
-    return vm_cpu_translate(mem->ram, mem->size, cpu->cr0, cpu->cr3, linear);
+static void vm_ctx_bind(vm_ctx_t *ctx) {
+    vm_io_bind(ctx->io);
+    vm_disk_bind(ctx->disk);
+    vm_snapshot_bind(ctx->snap);
 }
 
-static int execute(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
-    switch (in->op) {
-    case VM_OP_NOP:
-        return 0;
-    case VM_OP_HLT:
-        cpu->halted = 1;
-        return 0;
-    case VM_OP_IN:
-        set_reg8_lo(cpu, 0, (uint8_t)vm_io_in(mem, (uint32_t)in->imm, 1));
-        return 0;
-    case VM_OP_OUT:
-        vm_io_out(mem, (uint32_t)in->imm, get_reg8_lo(cpu, 0), 1);
-        return 0;
-    case VM_OP_IN_DX: {
-        uint32_t port = get_reg32(cpu, 2) & 0xFFFF;
-        uint32_t v = vm_io_in(mem, port, 4);
-        set_reg32(cpu, 0, v);
-        return 0;
-    }
-    case VM_OP_OUT_DX: {
-        uint32_t port = get_reg32(cpu, 2) & 0xFFFF;
-        vm_io_out(mem, port, get_reg32(cpu, 0), 4);
-        return 0;
-    }
-    case VM_OP_MOV:
-        if (in->dst_reg >= 0 && in->src_reg < 0)
-            set_reg32(cpu, in->dst_reg, in->imm);
-        return 0;
-    case VM_OP_PUSH: {
-        cpu->esp -= 4;
-        uint32_t v = get_reg32(cpu, in->dst_reg);
-        uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
-        uint32_t phys = translate_addr(cpu, mem, lin);
-        vm_mem_write(mem, phys, &v, 4);
-        return 0;
-    }
-    case VM_OP_POP: {
-        uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
-        uint32_t phys = translate_addr(cpu, mem, lin);
-        uint32_t v;
-        vm_mem_read(mem, phys, &v, 4);
-        cpu->esp += 4;
-        set_reg32(cpu, in->dst_reg, v);
-        return 0;
-    }
-    case VM_OP_JMP:
-        cpu->eip += (int32_t)(int8_t)in->imm + in->size;
-        return 0;
-    case VM_OP_RET: {
-        uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
-        uint32_t phys = translate_addr(cpu, mem, lin);
-        uint16_t ip;
-        vm_mem_read(mem, phys, &ip, 2);
-        cpu->esp += 2;
-        cpu->eip = ip;
-        return 0;
-    }
-    case VM_OP_INT: {
-        uint16_t flags = (uint16_t)(cpu->eflags & 0xFFFF);
-        uint16_t cs = (uint16_t)cpu->cs;
-        uint16_t ip = (uint16_t)cpu->eip;
-        cpu->esp -= 2;
-        vm_mem_write(mem, translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp)), &flags, 2);
-        cpu->esp -= 2;
-        vm_mem_write(mem, translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp)), &cs, 2);
-        cpu->esp -= 2;
-        vm_mem_write(mem, translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp)), &ip, 2);
-        uint32_t ivt = (uint32_t)(in->imm & 0xFF) * 4;
-        uint32_t ivt_phys = translate_addr(cpu, mem, ivt);
-        if (ivt_phys + 4 <= mem->size) {
-            vm_mem_read(mem, ivt_phys, &ip, 2);
-            vm_mem_read(mem, ivt_phys + 2, &cs, 2);
-            cpu->eip = ip;
-            cpu->cs = cs;
-        }
-        return 0;
-    }
-    case VM_OP_IRET: {
-        uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
-        uint32_t phys = translate_addr(cpu, mem, lin);
-        uint16_t ip, cs, flags;
-        vm_mem_read(mem, phys, &ip, 2);
-        cpu->esp += 2;
-        phys = translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp));
-        vm_mem_read(mem, phys, &cs, 2);
-        cpu->esp += 2;
-        phys = translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp));
-        vm_mem_read(mem, phys, &flags, 2);
-        cpu->esp += 2;
-        cpu->eip = ip;
-        cpu->cs = cs;
-        cpu->eflags = (cpu->eflags & 0xFFFF0000) | flags;
-        return 0;
-    }
-    case VM_OP_STOSB: {
-        uint32_t lin = vm_cpu_linear_addr(cpu->es, (uint32_t)(cpu->edi & 0xFFFF));
-        uint32_t phys = translate_addr(cpu, mem, lin);
-        uint8_t v = get_reg8_lo(cpu, 0);
-        vm_mem_write8(mem, phys, v);
-        cpu->edi = (cpu->edi & 0xFFFF0000) | ((cpu->edi + 1) & 0xFFFF);
-        return 0;
-    }
-    case VM_OP_INC: {
-        if (in->dst_reg >= 0 && in->dst_reg < 8) {
-            uint32_t v = get_reg32(cpu, in->dst_reg) + 1;
-            set_reg32(cpu, in->dst_reg, v);
-        }
-        return 0;
-    }
-    case VM_OP_DEC: {
-        if (in->dst_reg >= 0 && in->dst_reg < 8) {
-            uint32_t v = get_reg32(cpu, in->dst_reg) - 1;
-            set_reg32(cpu, in->dst_reg, v);
-        }
-        return 0;
+/* Bring up devices, RAM, block cache and (with a path) the disk image on
+ * the bound states. On failure everything started here is torn down. */
+static int vm_ctx_start(vm_ctx_t *ctx, const char *disk_path, unsigned int disk_size_mb,
+                        unsigned int ram_size_mb, int ram_thp) {
+    size_t ram_size = ram_size_mb ? (size_t)ram_size_mb * 1024 * 1024 : GUEST_RAM_SIZE;
+    vm_io_init();
+    vm_io_set_serial(ctx->serial);
+    if (vm_host_create_sized(&ctx->host, ram_size, ram_thp ? VM_MEM_THP : 0) != 0) {
+        vm_io_shutdown();
+        return -1;
     }
-    case VM_OP_CMP: {
-        uint8_t al = get_reg8_lo(cpu, 0);
-        uint8_t imm = (uint8_t)(in->imm & 0xFF);
-        if (al == imm)
-            cpu->eflags |= 0x40;
-        else
-            cpu->eflags &= ~0x40;
-        return 0;
+    if (vm_bcache_init(&ctx->bcache, vm_host_mem(&ctx->host)) != 0) {
+        vm_host_destroy(&ctx->host);
+        vm_io_shutdown();
+        return -1;
     }
-    case VM_OP_TEST: {
-        uint8_t al = get_reg8_lo(cpu, 0);
-        uint8_t imm = (uint8_t)(in->imm & 0xFF);
-        if ((al & imm) == 0)
-            cpu->eflags |= 0x40;
-        else
-            cpu->eflags &= ~0x40;
-        return 0;
+    {
+        /* VM_DISPATCH=switch selects the reference switch dispatcher. */
+        const char *mode = getenv("VM_DISPATCH");
+        ctx->dispatch = (mode && strcmp(mode, "switch") == 0) ? VM_DISPATCH_SWITCH : VM_DISPATCH_THREADED;
+        vm_exec_bind(&ctx->bcache);
+        vm_prof_reset();
     }
-    case VM_OP_JZ:
-        if (cpu->eflags & 0x40)
-            cpu->eip += (int32_t)(int8_t)in->imm + in->size;
-        return 0;
-    case VM_OP_JNZ:
-        if (!(cpu->eflags & 0x40))
-            cpu->eip += (int32_t)(int8_t)in->imm + in->size;
-        return 0;
-    case VM_OP_ADD:
-        if (in->dst_reg >= 0 && in->dst_reg < 8) {
-            uint32_t a = get_reg32(cpu, in->dst_reg);
-            uint32_t b = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : (uint32_t)(int32_t)(int8_t)in->imm;
-            uint32_t r = a + b;
-            set_reg32(cpu, in->dst_reg, r);
-            cpu->eflags = (cpu->eflags & ~0x40) | ((r == 0) ? 0x40 : 0);
-        }
-        return 0;
-    case VM_OP_SUB:
-        if (in->dst_reg >= 0 && in->dst_reg < 8) {
-            uint32_t a = get_reg32(cpu, in->dst_reg);
-            uint32_t b = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : (uint32_t)(int32_t)(int8_t)in->imm;
-            uint32_t r = a - b;
-            set_reg32(cpu, in->dst_reg, r);
-            cpu->eflags = (cpu->eflags & ~0x40) | ((r == 0) ? 0x40 : 0);
-        }
-        return 0;
-    case VM_OP_MOV_CR:
-        if (in->imm == 0) {
-            uint32_t crval = (in->dst_reg == 0) ? cpu->cr0 : (in->dst_reg == 3) ? cpu->cr3 : 0;
-            if (in->src_reg >= 0 && in->src_reg < 8) set_reg32(cpu, in->src_reg, crval);
-        } else {
-            uint32_t val = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : 0;
-            if (in->dst_reg == 0) cpu->cr0 = val;
-            else if (in->dst_reg == 3) cpu->cr3 = val;
-        }
-        return 0;
-    default:
+    if (disk_path && vm_disk_init(disk_path, disk_size_mb ? disk_size_mb : VM_DISK_DEFAULT_SIZE_MB) != 0) {
+        vm_bcache_destroy(&ctx->bcache);
+        vm_host_destroy(&ctx->host);
+        vm_io_shutdown();
         return -1;
+    }
+    if (ctx->display)
+        vm_display_reset();
+    ctx->booted = 1;
+    return 0;
 }
+
+static void vm_ctx_halt(vm_ctx_t *ctx) {
+    if (!ctx->booted) return;
+    vm_io_set_host(NULL);
+    vm_disk_shutdown();
+    vm_snapshot_shutdown();
+    vm_bcache_destroy(&ctx->bcache);
+    vm_host_destroy(&ctx->host);
+    vm_io_shutdown();
+    ctx->booted = 0;
 }
 
 int vm_boot(void) {
     vm_arch_state_t arch_state = {0};
-    vm_io_init();
-    if (vm_host_create(&s_host) != 0) {
-        vm_io_shutdown();
+    const char *path = getenv("VM_DISK_IMAGE");
+    if (!path) path = "vm_disk.img";
+    /* VM_RAM_MB sizes guest RAM (default 16); VM_RAM_THP=1 asks for THP. */
+    const char *ram = getenv("VM_RAM_MB");
+    const char *thp = getenv("VM_RAM_THP");
+    unsigned int ram_mb = ram ? (unsigned int)strtoul(ram, NULL, 10) : 0;
+    vm_ctx_bind(&s_vm);
+    if (vm_ctx_start(&s_vm, path, VM_DISK_DEFAULT_SIZE_MB, ram_mb, thp && atoi(thp) != 0) != 0)
         return -1;
-    }
-    {
-        const char *path = getenv("VM_DISK_IMAGE");
-        if (!path) path = "vm_disk.img";
-        if (vm_disk_init(path, VM_DISK_DEFAULT_SIZE_MB) != 0) {
-            vm_host_destroy(&s_host);
-            vm_io_shutdown();
-            return -1;
-        }
-    }
 #ifdef VM_SDL
     if (vm_sdl_init() != 0 || vm_sdl_create_window(2) != 0)
         vm_sdl_shutdown();
 #endif
-    vm_arch_collect(&s_host, &arch_state);
+    /* VM_SNAPSHOT_FILE resumes from a saved snapshot file instead of the
+     * boot image when the file exists. */
+    const char *snap = getenv("VM_SNAPSHOT_FILE");
+    if (snap && access(snap, R_OK) == 0 && vm_snapfile_load(&s_vm.host, snap) != 0)
+        fprintf(stderr, "[VM] snapshot file rejected: %s\n", snap);
+    vm_arch_collect(&s_vm.host, &arch_state);
     if (getenv("VM_VERBOSE_ARCH"))
         vm_arch_report(stdout, &arch_state);
     return 0;
 }
 
-/* Execute up to max_instructions. Returns count executed, or 0 on HLT. */
-static int vm_run_step(vm_cpu_t *cpu, vm_mem_t *mem, int max_instructions) {
-    vm_instr_t instr;
+/* Execute up to max_instructions through the configured dispatcher,
+ * delivering PIC interrupts at the block boundaries where the executor
+ * stops for them. Returns the count executed. */
+static int vm_run_step(vm_ctx_t *ctx, int max_instructions) {
+    vm_cpu_t *cpu = vm_host_cpu(&ctx->host);
+    vm_mem_t *mem = vm_host_mem(&ctx->host);
     int count = 0;
-    while (count < max_instructions && !cpu->halted) {
-        uint32_t linear = guest_eip_linear(cpu);
-        uint32_t phys = translate_addr(cpu, mem, linear);
-        if (phys + 16 > mem->size) break;
-        if (vm_decode(mem->ram, phys, mem->size, &instr) != 0) break;
-        if (execute(cpu, mem, &instr) != 0) break;
-        if (instr.op != VM_OP_JMP)
-            cpu->eip += instr.size;
-        count++;
+    while (count < max_instructions) {
+        if ((cpu->eflags & VM_FLAG_IF) && vm_io_intr()) {
+            int vector = vm_io_inta();
+            if (vector >= 0)
+                vm_exec_interrupt(cpu, mem, (uint8_t)vector);
+        }
+        int ran = vm_exec_run(cpu, mem, &ctx->bcache, max_instructions - count, ctx->dispatch);
+        count += ran;
+        if (ran == 0 || cpu->halted || !((cpu->eflags & VM_FLAG_IF) && vm_io_intr()))
+            break;
     }
     return count;
 }
 
+#ifdef VM_SDL
 static void vm_cpu_task_fn(void *arg) {
-    (void)arg;
-    vm_run_step(vm_host_cpu(&s_host), vm_host_mem(&s_host), VM_QUANTUM);
+    vm_ctx_t *ctx = arg;
+    ctx->host.vm_clock += (uint64_t)vm_run_step(ctx, VM_QUANTUM);
 }
+#endif
 
-static void vm_display_task_fn(void *arg) {
-    (void)arg;
-    vm_display_refresh(vm_host_mem(&s_host));
+/* Device deadlines on the virtual-time wheel. Each handler re-arms itself
+ * one period after the deadline that fired, so rates hold regardless of how
+ * the CPU run that reached them was chunked. */
+static void vm_timer_event_fn(void *arg, uint64_t due) {
+    vm_ctx_t *ctx = arg;
+    vm_host_tick_advance(&ctx->host, VM_TICK_STEP);
+    vm_io_poll();
+    vm_wheel_schedule(&ctx->wheel, &ctx->ev_timer, due + VM_TIMER_PERIOD);
 }
 
-#define VM_TICK_STEP 1
-static void vm_timer_task_fn(void *arg) {
-    (void)arg;
-    vm_host_tick_advance(&s_host, VM_TICK_STEP);
+static void vm_display_event_fn(void *arg, uint64_t due) {
+    vm_ctx_t *ctx = arg;
+    vm_display_refresh(vm_host_mem(&ctx->host));
+    vm_wheel_schedule(&ctx->wheel, &ctx->ev_display, due + VM_DISPLAY_PERIOD);
+}
+
+static void vm_checkpoint_event_fn(void *arg, uint64_t due) {
+    vm_ctx_t *ctx = arg;
+    vm_snapshot_save(&ctx->host);
+    vm_wheel_schedule(&ctx->wheel, &ctx->ev_checkpoint, due + VM_CHECKPOINT_PERIOD);
 }
 
-static void vm_checkpoint_task_fn(void *arg) {
-    (void)arg;
-    vm_snapshot_save(&s_host);
+/* First multiple of period after now. */
+static uint64_t vm_next_period(uint64_t now, uint64_t period) {
+    return (now / period + 1) * period;
+}
+
+static void vm_sched_start(vm_ctx_t *ctx, uint64_t now) {
+    vm_wheel_init(&ctx->wheel, now);
+    vm_wheel_event_init(&ctx->ev_timer, vm_timer_event_fn, ctx);
+    vm_wheel_event_init(&ctx->ev_display, vm_display_event_fn, ctx);
+    vm_wheel_event_init(&ctx->ev_checkpoint, vm_checkpoint_event_fn, ctx);
+    vm_wheel_schedule(&ctx->wheel, &ctx->ev_timer, vm_next_period(now, VM_TIMER_PERIOD));
+    if (ctx->display)
+        vm_wheel_schedule(&ctx->wheel, &ctx->ev_display, vm_next_period(now, VM_DISPLAY_PERIOD));
+    vm_wheel_schedule(&ctx->wheel, &ctx->ev_checkpoint, vm_next_period(now, VM_CHECKPOINT_PERIOD));
+}
+
+/* Guest-requested reset (port 0xCF9): back to the captured baseline when
+ * there is one, otherwise a cold boot of the built-in image. */
+static void vm_ctx_reboot(vm_ctx_t *ctx) {
+    if (vm_snapshot_has_baseline() && vm_snapshot_baseline_reset(&ctx->host) == 0) {
+        vm_io_baseline_restore();
+        return;
+    }
+    vm_host_reset(&ctx->host);
+}
+
+/* HLT with interrupts enabled: the vCPU idles until the PIC asserts INTR.
+ * Virtual time jumps straight to the next device deadline; with sleep set
+ * the host first blocks for the matching wall-clock time, cut short by a
+ * host event (keyboard input, device completion) so the IRQ it leads to is
+ * raised without waiting out the tick. Returns the new virtual time. */
+static uint64_t vm_idle(vm_ctx_t *ctx, uint64_t now, uint64_t limit, int sleep) {
+    vm_cpu_t *cpu = vm_host_cpu(&ctx->host);
+    uint64_t seen = vm_host_events(&ctx->host);
+    if (vm_io_intr()) {
+        cpu->halted = 0;
+        return now;
+    }
+    uint64_t deadline = vm_wheel_next(&ctx->wheel);
+    if (deadline > limit) deadline = limit;
+    if (deadline <= now) return now;
+    if (sleep && deadline != VM_WHEEL_NONE) {
+        uint64_t ns = (deadline - now) * VM_IDLE_TICK_NS / VM_TIMER_PERIOD;
+        vm_host_wait(&ctx->host, seen, ns);
+    }
+    ctx->host.vm_clock = deadline;
+    vm_wheel_advance(&ctx->wheel, deadline);
+    if (vm_io_intr()) cpu->halted = 0;
+    return deadline;
+}
+
+/* Run the CPU until it stops or until `limit` instructions of virtual time
+ * have passed. Between device deadlines the CPU runs uninterrupted; a reset
+ * request is honoured at the next one (at most VM_TIMER_PERIOD away). HLT
+ * stops the run only with IF clear; otherwise the vCPU idles (sleeping on
+ * the host when idle_sleep is set) until an interrupt is pending. */
+static void vm_run_until(vm_ctx_t *ctx, uint64_t limit, int idle_sleep) {
+    vm_cpu_t *cpu = vm_host_cpu(&ctx->host);
+    uint64_t *clock = &ctx->host.vm_clock;
+    uint64_t now = *clock;
+    if (limit != VM_WHEEL_NONE)
+        limit = (limit < VM_WHEEL_NONE - now) ? now + limit : VM_WHEEL_NONE;
+    vm_sched_start(ctx, now);
+    for (; now < limit; *clock = now) {
+        if (vm_io_reset_requested()) {
+            vm_io_clear_reset();
+            vm_ctx_reboot(ctx);
+            now = *clock;      /* a baseline reset rewinds time */
+            vm_sched_start(ctx, now);
+            continue;
+        }
+        if (cpu->halted) {
+            if (!(cpu->eflags & VM_FLAG_IF))
+                break;
+            now = vm_idle(ctx, now, limit, idle_sleep);
+            continue;
+        }
+        uint64_t deadline = vm_wheel_next(&ctx->wheel);
+        if (deadline > limit) deadline = limit;
+        uint64_t span = deadline > now ? deadline - now : 0;
+        int ran = span ? vm_run_step(ctx, (int)span) : 0;
+        if (cpu->halted) {
+            now += (uint64_t)ran;
+            continue;
+        }
+        /* A stalled CPU (undecodable fetch) still lets time reach the
+         * deadline so devices keep running. */
+        now += (ran > 0) ? (uint64_t)ran : span;
+        *clock = now;          /* checkpoints taken below record it */
+        vm_wheel_advance(&ctx->wheel, now);
+    }
+    *clock = now;
 }
 
 void vm_run(void) {
-    vm_cpu_t *cpu = vm_host_cpu(&s_host);
-    vm_io_set_host(&s_host);
+    vm_ctx_bind(&s_vm);
+    vm_io_set_host(&s_vm.host);
 
 #ifdef VM_SDL
+    vm_cpu_t *cpu = vm_host_cpu(&s_vm.host);
     if (vm_sdl_is_active()) {
-        while (!cpu->halted && !vm_sdl_is_quit()) {
+        while (!vm_sdl_is_quit()) {
             if (vm_io_reset_requested()) {
                 vm_io_clear_reset();
-                vm_host_reset(&s_host);
+                vm_ctx_reboot(&s_vm);
             }
-            vm_sdl_poll_events(&s_host);
-            if (!vm_host_is_paused(&s_host))
-                vm_cpu_task_fn(NULL);
-            vm_host_tick_advance(&s_host, VM_TICK_STEP);
+            if (cpu->halted) {
+                if (!(cpu->eflags & VM_FLAG_IF))
+                    break;
+                /* Idle in HLT: block on window input for at most one tick. */
+                vm_sdl_wait_events(&s_vm.host, (int)(VM_IDLE_TICK_NS / 1000000ULL));
+            } else {
+                vm_sdl_poll_events(&s_vm.host);
+                if (!vm_host_is_paused(&s_vm.host))
+                    vm_cpu_task_fn(&s_vm);
+            }
+            vm_host_tick_advance(&s_vm.host, VM_TICK_STEP);
+            vm_io_poll();
+            if (cpu->halted && vm_io_intr())
+                cpu->halted = 0;
             if (!cpu->halted)
-                vm_sdl_present(&s_host);
+                vm_sdl_present(&s_vm.host);
         }
     } else
 #endif
     {
-        pq_task_t task;
-        s_run_cycles = 0;
-        pq_init(&s_vm_pq);
-        pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-        /* Layer-scan: run one task from each non-empty layer per round (secondary tie-breaker) */
-        while (!cpu->halted) {
-            if (vm_io_reset_requested()) {
-                vm_io_clear_reset();
-                vm_host_reset(&s_host);
-                pq_init(&s_vm_pq);
-                pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-                continue;
-            }
-            if (pq_is_empty(&s_vm_pq))
-                break;
-            for (int layer = 0; layer < PQ_NUM_PRIORITIES; layer++) {
-                if (pq_pop_from_layer(&s_vm_pq, layer, &task) != 0)
-                    continue;
-                if (task.fn)
-                    task.fn(task.arg);
-                if (task.fn == vm_cpu_task_fn && !cpu->halted) {
-                    s_run_cycles++;
-                    pq_push(&s_vm_pq, PQ_PRIO_DISPLAY, vm_display_task_fn, NULL);
-                    pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-                    pq_push(&s_vm_pq, PQ_PRIO_TIMER, vm_timer_task_fn, NULL);
-                    if (s_run_cycles % VM_CHECKPOINT_INTERVAL == 0)
-                        pq_push(&s_vm_pq, PQ_PRIO_CHECKPOINT, vm_checkpoint_task_fn, NULL);
-                }
-            }
-        }
+        vm_run_until(&s_vm, VM_WHEEL_NONE, 1);
     }
 
+    vm_io_flush();
+    vm_prof_report(stderr);
     vm_io_set_host(NULL);
 }
 
 void vm_run_cycles(unsigned int max_cycles) {
-    vm_cpu_t *cpu = vm_host_cpu(&s_host);
-    vm_io_set_host(&s_host);
-
-    pq_task_t task;
-    s_run_cycles = 0;
-    pq_init(&s_vm_pq);
-    pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-    while (!cpu->halted && s_run_cycles < max_cycles) {
-        if (vm_io_reset_requested()) {
-            vm_io_clear_reset();
-            vm_host_reset(&s_host);
-            pq_init(&s_vm_pq);
-            pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-            continue;
-        }
-        if (pq_is_empty(&s_vm_pq))
-            break;
-        for (int layer = 0; layer < PQ_NUM_PRIORITIES; layer++) {
-            if (pq_pop_from_layer(&s_vm_pq, layer, &task) != 0)
-                continue;
-            if (task.fn)
-                task.fn(task.arg);
-            if (task.fn == vm_cpu_task_fn && !cpu->halted) {
-                s_run_cycles++;
-                pq_push(&s_vm_pq, PQ_PRIO_DISPLAY, vm_display_task_fn, NULL);
-                pq_push(&s_vm_pq, PQ_PRIO_CPU, vm_cpu_task_fn, NULL);
-                pq_push(&s_vm_pq, PQ_PRIO_TIMER, vm_timer_task_fn, NULL);
-                if (s_run_cycles % VM_CHECKPOINT_INTERVAL == 0)
-                    pq_push(&s_vm_pq, PQ_PRIO_CHECKPOINT, vm_checkpoint_task_fn, NULL);
-            }
-        }
-    }
-
-    vm_io_set_host(NULL);
+    vm_ctx_run_cycles(&s_vm, max_cycles);
 }
 
 void vm_stop(void) {
-    vm_io_set_host(NULL);
-    vm_disk_shutdown();
-    vm_snapshot_shutdown();
+    vm_ctx_bind(&s_vm);
 #ifdef VM_SDL
     vm_sdl_shutdown();
 #endif
-    vm_host_destroy(&s_host);
-    vm_io_shutdown();
+    vm_ctx_halt(&s_vm);
 }
 
 void vm_step_one(void) {
-    vm_run_step(vm_host_cpu(&s_host), vm_host_mem(&s_host), 1);
+    vm_ctx_step_one(&s_vm);
 }
 
 int vm_save_checkpoint(void) {
-    return vm_snapshot_save(&s_host);
+    return vm_ctx_save_checkpoint(&s_vm);
 }
 
 int vm_restore_checkpoint(void) {
-    return vm_snapshot_restore(&s_host);
+    return vm_ctx_restore_checkpoint(&s_vm);
+}
+
+int vm_run_back(uint64_t n) {
+    return vm_ctx_run_back(&s_vm, n);
+}
+
+int vm_save_snapshot_file(const char *path) {
+    return vm_ctx_save_snapshot_file(&s_vm, path);
+}
+
+int vm_load_snapshot_file(const char *path) {
+    return vm_ctx_load_snapshot_file(&s_vm, path);
 }
 
 int vm_load_disk(const char *path) {
-    if (!path) return -1;
+    return vm_ctx_load_disk(&s_vm, path);
+}
+
+uint32_t vm_state_checksum(void) {
+    return vm_ctx_state_checksum(&s_vm);
+}
+
+vm_ctx_t *vm_ctx_create(const vm_ctx_config_t *cfg) {
+    static const vm_ctx_config_t defaults = {0};
+    char ckpt_path[256];
+    if (!cfg) cfg = &defaults;
+    /* A truncated prefix could name another guest's overlays. */
+    if (cfg->disk_path && (size_t)snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", cfg->disk_path) >= sizeof(ckpt_path))
+        return NULL;
+    vm_ctx_t *ctx = mem_domain_alloc(MEM_DOMAIN_DRIVER, sizeof(*ctx));
+    if (!ctx) return NULL;
+    asm_mem_zero(ctx, sizeof(*ctx));
+    ctx->serial = cfg->serial;
+    ctx->display = cfg->display;
+    ctx->io = vm_io_state_create();
+    ctx->disk = vm_disk_state_create();
+    ctx->snap = vm_snapshot_state_create(cfg->disk_path ? ckpt_path : NULL);
+    if (!ctx->io || !ctx->disk || !ctx->snap) {
+        vm_ctx_destroy(ctx);
+        return NULL;
+    }
+    vm_ctx_bind(ctx);
+    if (vm_ctx_start(ctx, cfg->disk_path, cfg->disk_size_mb, cfg->ram_size_mb, cfg->ram_thp) != 0) {
+        vm_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void vm_ctx_destroy(vm_ctx_t *ctx) {
+    if (!ctx || ctx == &s_vm) return;
+    vm_ctx_bind(ctx);
+    vm_ctx_halt(ctx);
+    vm_snapshot_state_destroy(ctx->snap);
+    vm_disk_state_destroy(ctx->disk);
+    vm_io_state_destroy(ctx->io);
+    vm_ctx_bind(&s_vm);
+    mem_domain_free(MEM_DOMAIN_DRIVER, ctx);
+}
+
+int vm_ctx_load(vm_ctx_t *ctx, const void *image, size_t len) {
+    if (!ctx || !image) return -1;
+    vm_ctx_bind(ctx);
+    vm_io_init();
+    vm_io_set_serial(ctx->serial);
+    vm_host_reset(&ctx->host);
+    /* Guest reset keeps time and pending input; a new guest starts clean,
+     * without the previous guest's checkpoints. */
+    vm_snapshot_discard();
+    ctx->host.vm_ticks = 0;
+    ctx->host.vm_clock = 0;
+    ctx->host.kbd_head = ctx->host.kbd_tail = 0;
+    return vm_load_binary(vm_host_mem(&ctx->host), GUEST_LOAD_ADDR, image, len);
+}
+
+int vm_ctx_capture_baseline(vm_ctx_t *ctx) {
+    if (!ctx) return -1;
+    vm_ctx_bind(ctx);
+    if (vm_snapshot_baseline_capture(&ctx->host) != 0) return -1;
+    return vm_io_baseline_capture();
+}
+
+int vm_ctx_reset(vm_ctx_t *ctx) {
+    if (!ctx) return -1;
+    vm_ctx_bind(ctx);
+    if (vm_snapshot_baseline_reset(&ctx->host) != 0) return -1;
+    return vm_io_baseline_restore();
+}
+
+void vm_ctx_run(vm_ctx_t *ctx) {
+    if (!ctx) return;
+    vm_ctx_bind(ctx);
+    vm_io_set_host(&ctx->host);
+    vm_run_until(ctx, VM_WHEEL_NONE, 1);
+    vm_io_flush();
+    vm_io_set_host(NULL);
+}
+
+void vm_ctx_run_cycles(vm_ctx_t *ctx, unsigned int max_cycles) {
+    if (!ctx) return;
+    vm_ctx_bind(ctx);
+    vm_io_set_host(&ctx->host);
+    vm_run_until(ctx, (uint64_t)max_cycles * VM_QUANTUM, 0);
+    vm_io_flush();
+    vm_io_set_host(NULL);
+}
+
+void vm_ctx_step_one(vm_ctx_t *ctx) {
+    if (!ctx) return;
+    vm_ctx_bind(ctx);
+    ctx->host.vm_clock += (uint64_t)vm_run_step(ctx, 1);
+}
+
+int vm_ctx_save_checkpoint(vm_ctx_t *ctx) {
+    if (!ctx) return -1;
+    vm_ctx_bind(ctx);
+    return vm_snapshot_save(&ctx->host);
+}
+
+int vm_ctx_restore_checkpoint(vm_ctx_t *ctx) {
+    if (!ctx) return -1;
+    vm_ctx_bind(ctx);
+    return vm_snapshot_restore(&ctx->host);
+}
+
+int vm_ctx_save_snapshot_file(vm_ctx_t *ctx, const char *path) {
+    if (!ctx || !path) return -1;
+    vm_ctx_bind(ctx);
+    return vm_snapfile_save(&ctx->host, path);
+}
+
+int vm_ctx_load_snapshot_file(vm_ctx_t *ctx, const char *path) {
+    if (!ctx || !path) return -1;
+    vm_ctx_bind(ctx);
+    return vm_snapfile_load(&ctx->host, path);
+}
+
+int vm_ctx_run_back(vm_ctx_t *ctx, uint64_t n) {
+    if (!ctx) return -1;
+    vm_ctx_bind(ctx);
+    uint64_t now = ctx->host.vm_clock;
+    if (n > now) return -1;
+    uint64_t target = now - n;
+    int age = vm_snapshot_find_generation(target);
+    if (age < 0 || vm_snapshot_restore_generation(&ctx->host, age) != 0) return -1;
+    /* Replay without idle sleeps: virtual time alone decides the path. */
+    vm_io_set_host(&ctx->host);
+    vm_run_until(ctx, target - ctx->host.vm_clock, 0);
+    vm_io_flush();
+    vm_io_set_host(NULL);
+    return ctx->host.vm_clock == target ? 0 : -1;
+}
+
+int vm_ctx_load_disk(vm_ctx_t *ctx, const char *path) {
+    if (!ctx || !path) return -1;
+    vm_ctx_bind(ctx);
     vm_disk_shutdown();
     return vm_disk_init(path, VM_DISK_DEFAULT_SIZE_MB);
 }
 
-uint32_t vm_state_checksum(void) {
-    vm_mem_t *mem = vm_host_mem(&s_host);
+uint32_t vm_ctx_state_checksum(vm_ctx_t *ctx) {
+    if (!ctx) return 0;
+    vm_mem_t *mem = vm_host_mem(&ctx->host);
     if (!mem || !mem->ram) return 0;
     uint32_t sum = 0;
-    const vm_cpu_t *c = &s_host.cpu;
+    const vm_cpu_t *c = &ctx->host.cpu;
     sum ^= c->eax ^ c->ecx ^ c->edx ^ c->ebx;
     sum ^= c->esp ^ c->ebp ^ c->esi ^ c->edi;
-    sum ^= c->eip ^ c->cs ^ c->eflags;
-    sum ^= (uint32_t)s_host.vm_ticks;
+    sum ^= c->eip ^ c->cs ^ vm_cpu_eflags(c);
+    sum ^= (uint32_t)ctx->host.vm_ticks;
     for (size_t i = 0; i < mem->size && i < 65536; i += 256)
         sum ^= mem->ram[i];
     return sum;
 }
 
+struct vm_host *vm_ctx_host(vm_ctx_t *ctx) {
+    return ctx ? &ctx->host : NULL;
+}
+
 #endif
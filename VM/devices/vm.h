@@ -2,6 +2,26 @@
 #define VM_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct vm_host;
+
+/* Independent guest instance: own RAM, vCPU, devices, disk image and
+ * checkpoint slot. Contexts may run concurrently on separate threads; a
+ * single context must not be driven from two threads at once. The vm_*
+ * calls without a context operate on the process default guest (the shell's
+ * embedded VM and the SDL window). */
+typedef struct vm_ctx vm_ctx_t;
+
+typedef struct vm_ctx_config {
+    const char *disk_path;      /* NULL: no disk; checkpoint overlays at <path>.ckpt.N */
+    unsigned int disk_size_mb;  /* 0: VM_DISK_DEFAULT_SIZE_MB */
+    unsigned int ram_size_mb;   /* 0: 16MB; host memory is used only as touched */
+    int ram_thp;                /* advise transparent huge pages for guest RAM */
+    FILE *serial;               /* guest serial output; NULL: stdout */
+    int display;                /* refresh the host text display (one guest at most) */
+} vm_ctx_config_t;
 
 #ifdef VM_ENABLE
 
@@ -12,9 +32,45 @@ void vm_stop(void);
 void vm_step_one(void);
 int vm_save_checkpoint(void);
 int vm_restore_checkpoint(void);
+int vm_run_back(uint64_t n);
+int vm_save_snapshot_file(const char *path);
+int vm_load_snapshot_file(const char *path);
 uint32_t vm_state_checksum(void);
 int vm_load_disk(const char *path);
 
+/* cfg NULL: no disk, serial to stdout, no display. */
+vm_ctx_t *vm_ctx_create(const vm_ctx_config_t *cfg);
+void vm_ctx_destroy(vm_ctx_t *ctx);
+/* Reset the guest (RAM, vCPU, devices) and load a boot image at 0x7C00;
+ * a context is reused this way for batches of short guests. */
+int vm_ctx_load(vm_ctx_t *ctx, const void *image, size_t len);
+/* Fork-server reset: capture the loaded guest (RAM, vCPU, devices) once;
+ * each vm_ctx_reset then restores only the RAM pages written since, plus
+ * CPU and device registers. A guest reset through port 0xCF9 also returns
+ * to the baseline. The disk image is not rolled back. */
+int vm_ctx_capture_baseline(vm_ctx_t *ctx);
+int vm_ctx_reset(vm_ctx_t *ctx);
+void vm_ctx_run(vm_ctx_t *ctx);
+void vm_ctx_run_cycles(vm_ctx_t *ctx, unsigned int max_cycles);
+void vm_ctx_step_one(vm_ctx_t *ctx);
+int vm_ctx_save_checkpoint(vm_ctx_t *ctx);
+int vm_ctx_restore_checkpoint(vm_ctx_t *ctx);
+/* Reverse execution: move the guest n instructions of virtual time back by
+ * restoring the newest checkpoint generation at or before that point and
+ * replaying forward to it. Replay is exact unless host input arrived in
+ * between; serial output in the replayed span is emitted again. The disk
+ * goes back with each generation's overlay. Fails if the target predates
+ * every generation kept, or if the disk has changed since the generation
+ * and was attached (vm_ctx_load_disk) after it. */
+int vm_ctx_run_back(vm_ctx_t *ctx, uint64_t n);
+/* Whole guest, disk included, to and from a compressed snapshot file
+ * (vm_snapfile.h). Loading needs the same RAM and disk sizes. */
+int vm_ctx_save_snapshot_file(vm_ctx_t *ctx, const char *path);
+int vm_ctx_load_snapshot_file(vm_ctx_t *ctx, const char *path);
+int vm_ctx_load_disk(vm_ctx_t *ctx, const char *path);
+uint32_t vm_ctx_state_checksum(vm_ctx_t *ctx);
+struct vm_host *vm_ctx_host(vm_ctx_t *ctx);
+
 #else
 
 static inline int vm_boot(void) { (void)0; return -1; }
@@ -24,8 +80,27 @@ static inline void vm_stop(void) { (void)0; }
 static inline void vm_step_one(void) { (void)0; }
 static inline int vm_save_checkpoint(void) { (void)0; return -1; }
 static inline int vm_restore_checkpoint(void) { (void)0; return -1; }
+static inline int vm_run_back(uint64_t n) { (void)n; return -1; }
+static inline int vm_save_snapshot_file(const char *path) { (void)path; return -1; }
+static inline int vm_load_snapshot_file(const char *path) { (void)path; return -1; }
 static inline uint32_t vm_state_checksum(void) { return 0; }
 static inline int vm_load_disk(const char *path) { (void)path; return -1; }
+static inline vm_ctx_t *vm_ctx_create(const vm_ctx_config_t *cfg) { (void)cfg; return NULL; }
+static inline void vm_ctx_destroy(vm_ctx_t *ctx) { (void)ctx; }
+static inline int vm_ctx_load(vm_ctx_t *ctx, const void *image, size_t len) { (void)ctx; (void)image; (void)len; return -1; }
+static inline int vm_ctx_capture_baseline(vm_ctx_t *ctx) { (void)ctx; return -1; }
+static inline int vm_ctx_reset(vm_ctx_t *ctx) { (void)ctx; return -1; }
+static inline void vm_ctx_run(vm_ctx_t *ctx) { (void)ctx; }
+static inline void vm_ctx_run_cycles(vm_ctx_t *ctx, unsigned int n) { (void)ctx; (void)n; }
+static inline void vm_ctx_step_one(vm_ctx_t *ctx) { (void)ctx; }
+static inline int vm_ctx_save_checkpoint(vm_ctx_t *ctx) { (void)ctx; return -1; }
+static inline int vm_ctx_restore_checkpoint(vm_ctx_t *ctx) { (void)ctx; return -1; }
+static inline int vm_ctx_run_back(vm_ctx_t *ctx, uint64_t n) { (void)ctx; (void)n; return -1; }
+static inline int vm_ctx_save_snapshot_file(vm_ctx_t *ctx, const char *path) { (void)ctx; (void)path; return -1; }
+static inline int vm_ctx_load_snapshot_file(vm_ctx_t *ctx, const char *path) { (void)ctx; (void)path; return -1; }
+static inline int vm_ctx_load_disk(vm_ctx_t *ctx, const char *path) { (void)ctx; (void)path; return -1; }
+static inline uint32_t vm_ctx_state_checksum(vm_ctx_t *ctx) { (void)ctx; return 0; }
+static inline struct vm_host *vm_ctx_host(vm_ctx_t *ctx) { (void)ctx; return NULL; }
 
 #endif
 
@@ -0,0 +1,117 @@
+/* Decoded basic-block cache: decode once, execute many times. */
+#include "vm_bcache.h"
+#include "mem_domain.h"
+#include "mem_asm.h"
+
+#define VM_DECODE_GUARD 16   /* vm_decode may look this far past addr */
+
+static uint32_t bcache_slot(uint32_t phys) {
+    return (phys ^ (phys >> 9)) & (VM_BCACHE_ENTRIES - 1);
+}
+
+static void bcache_code_write(void *ctx, uint32_t page) {
+    vm_bcache_invalidate_page((vm_bcache_t *)ctx, page);
+}
+
+int vm_instr_ends_block(const vm_instr_t *in) {
+    switch (in->op) {
+    case VM_OP_HLT:
+    case VM_OP_JMP:
+    case VM_OP_JZ:
+    case VM_OP_JNZ:
+    case VM_OP_RET:
+    case VM_OP_INT:
+    case VM_OP_IRET:
+    case VM_OP_MOV_CR:   /* may toggle paging: next fetch must be retranslated */
+        return 1;
+    case VM_OP_MOVS:     /* REP forms re-execute themselves run by run */
+    case VM_OP_STOS:
+    case VM_OP_LODS:
+    case VM_OP_CMPS:
+    case VM_OP_SCAS:
+        return in->imm != VM_REP_NONE;
+    default:
+        return 0;
+    }
+}
+
+int vm_bcache_init(vm_bcache_t *bc, vm_mem_t *mem) {
+    if (!bc || !mem || !mem->ram) return -1;
+    asm_mem_zero(bc, sizeof(*bc));
+    bc->blocks = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_BCACHE_ENTRIES * sizeof(vm_bblock_t));
+    if (!bc->blocks) return -1;
+    if (vm_mem_code_watch(mem, bcache_code_write, bc) != 0) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, bc->blocks);
+        bc->blocks = NULL;
+        return -1;
+    }
+    bc->mem = mem;
+    vm_bcache_flush(bc);
+    return 0;
+}
+
+void vm_bcache_destroy(vm_bcache_t *bc) {
+    if (!bc) return;
+    if (bc->mem)
+        vm_mem_code_unwatch(bc->mem);
+    if (bc->blocks)
+        mem_domain_free(MEM_DOMAIN_DRIVER, bc->blocks);
+    asm_mem_zero(bc, sizeof(*bc));
+}
+
+void vm_bcache_flush(vm_bcache_t *bc) {
+    if (!bc || !bc->blocks) return;
+    for (int i = 0; i < VM_BCACHE_ENTRIES; i++)
+        bc->blocks[i].valid = 0;
+    if (bc->mem && bc->mem->code_pages)
+        asm_mem_zero(bc->mem->code_pages, vm_mem_page_count(bc->mem));
+}
+
+void vm_bcache_invalidate_page(vm_bcache_t *bc, uint32_t page) {
+    if (!bc || !bc->blocks) return;
+    for (int i = 0; i < VM_BCACHE_ENTRIES; i++) {
+        vm_bblock_t *b = &bc->blocks[i];
+        if (b->valid && page >= b->page_lo && page <= b->page_hi) {
+            b->valid = 0;
+            bc->invalidations++;
+        }
+    }
+}
+
+static int bcache_fill(vm_bcache_t *bc, vm_bblock_t *b, uint32_t phys) {
+    vm_mem_t *mem = bc->mem;
+    uint32_t pc = phys;
+    uint32_t page = phys >> VM_PAGE_SHIFT;
+    b->count = 0;
+    while (b->count < VM_BCACHE_MAX_INSNS) {
+        if (pc + VM_DECODE_GUARD > mem->size) break;
+        if ((pc >> VM_PAGE_SHIFT) != page) break;
+        vm_instr_t *in = &b->insns[b->count];
+        if (vm_decode(mem->ram, pc, mem->size, in) != 0) break;
+        in->handler = bc->bind ? bc->bind(in->op) : NULL;
+        b->count++;
+        pc += in->size;
+        if (vm_instr_ends_block(in)) break;
+    }
+    if (b->count == 0) return -1;
+    b->phys = phys;
+    b->page_lo = page;
+    b->page_hi = (pc - 1) >> VM_PAGE_SHIFT;
+    for (uint32_t p = b->page_lo; p <= b->page_hi; p++)
+        vm_mem_mark_code(mem, p);
+    b->valid = 1;
+    return 0;
+}
+
+vm_bblock_t *vm_bcache_lookup(vm_bcache_t *bc, uint32_t phys) {
+    if (!bc || !bc->blocks || !bc->mem) return NULL;
+    vm_bblock_t *b = &bc->blocks[bcache_slot(phys)];
+    if (b->valid && b->phys == phys) {
+        bc->hits++;
+        return b;
+    }
+    bc->misses++;
+    b->valid = 0;
+    if (bcache_fill(bc, b, phys) != 0) return NULL;
+    return b;
+}
@@ -0,0 +1,47 @@
+#ifndef VM_BCACHE_H
+#define VM_BCACHE_H
+
+#include "vm_decode.h"
+#include "vm_mem.h"
+#include <stdint.h>
+
+/* Decoded basic-block cache. Blocks are keyed by physical entry address,
+ * end after the first control-flow instruction and never start an
+ * instruction on a different page than the entry (so paging can remap the
+ * next page). Writes to a page holding a block invalidate it via the
+ * vm_mem code watch. */
+#define VM_BCACHE_ENTRIES   256   /* power of two, direct-mapped */
+#define VM_BCACHE_MAX_INSNS 32
+
+typedef struct vm_bblock {
+    uint32_t phys;          /* physical address of first instruction */
+    uint32_t page_lo;       /* first and last page touched by the bytes */
+    uint32_t page_hi;
+    unsigned int count;
+    int valid;
+    vm_instr_t insns[VM_BCACHE_MAX_INSNS];
+} vm_bblock_t;
+
+/* Returns the dispatch handler for op; stored in vm_instr_t.handler as each
+ * instruction is decoded (see vm_exec_bind). */
+typedef const void *(*vm_bcache_bind_fn)(vm_opcode_t op);
+
+typedef struct vm_bcache {
+    vm_bblock_t *blocks;
+    vm_mem_t *mem;
+    vm_bcache_bind_fn bind;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+} vm_bcache_t;
+
+int vm_bcache_init(vm_bcache_t *bc, vm_mem_t *mem);
+void vm_bcache_destroy(vm_bcache_t *bc);
+void vm_bcache_flush(vm_bcache_t *bc);
+void vm_bcache_invalidate_page(vm_bcache_t *bc, uint32_t page);
+/* Returns the block starting at phys, decoding it on a miss; NULL if the
+ * first instruction cannot be decoded. */
+vm_bblock_t *vm_bcache_lookup(vm_bcache_t *bc, uint32_t phys);
+int vm_instr_ends_block(const vm_instr_t *in);
+
+#endif /* VM_BCACHE_H */
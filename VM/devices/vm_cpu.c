@@ -10,8 +10,59 @@ void vm_cpu_init(vm_cpu_t *cpu) {
     cpu->ds = cpu->es = cpu->ss = 0;
     cpu->fs = cpu->gs = 0;
     cpu->eflags = 0;
+    cpu->lazy.op = VM_LAZY_NONE;
     cpu->cr0 = cpu->cr3 = 0;
+    cpu->idt_base = 0;
+    cpu->idt_limit = 0x3FF;
     cpu->halted = 0;
+    vm_cpu_tlb_flush(cpu);
+    cpu->tlb.hits = cpu->tlb.misses = cpu->tlb.flushes = 0;
+}
+
+static uint32_t parity_even(uint32_t v) {
+    v &= 0xFF;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return !(v & 1);
+}
+
+uint32_t vm_cpu_eflags(const vm_cpu_t *cpu) {
+    const vm_lazy_flags_t *lz = &cpu->lazy;
+    if (lz->op == VM_LAZY_NONE) return cpu->eflags;
+    uint32_t sign = 1U << (lz->size * 8 - 1);
+    uint32_t a = lz->src1, b = lz->src2, r = lz->result;
+    uint32_t f = 0;
+    if (r == 0) f |= VM_FLAG_ZF;
+    if (r & sign) f |= VM_FLAG_SF;
+    if (parity_even(r)) f |= VM_FLAG_PF;
+    switch (lz->op) {
+    case VM_LAZY_ADD:
+        if (r < a) f |= VM_FLAG_CF;
+        if ((a ^ r) & (b ^ r) & sign) f |= VM_FLAG_OF;
+        if ((a ^ b ^ r) & 0x10) f |= VM_FLAG_AF;
+        break;
+    case VM_LAZY_SUB:
+        if (a < b) f |= VM_FLAG_CF;
+        if ((a ^ b) & (a ^ r) & sign) f |= VM_FLAG_OF;
+        if ((a ^ b ^ r) & 0x10) f |= VM_FLAG_AF;
+        break;
+    default:
+        break;
+    }
+    return (cpu->eflags & ~VM_FLAGS_ARITH) | f;
+}
+
+void vm_cpu_flags_commit(vm_cpu_t *cpu) {
+    if (!cpu || cpu->lazy.op == VM_LAZY_NONE) return;
+    cpu->eflags = vm_cpu_eflags(cpu);
+    cpu->lazy.op = VM_LAZY_NONE;
+}
+
+void vm_cpu_set_eflags(vm_cpu_t *cpu, uint32_t value) {
+    if (!cpu) return;
+    cpu->eflags = value;
+    cpu->lazy.op = VM_LAZY_NONE;
 }
 
 /* Real mode: linear = seg*16 + offset */
@@ -20,8 +71,12 @@ uint32_t vm_cpu_linear_addr(uint32_t seg, uint32_t offset) {
 }
 
 /* 32-bit paging: linear[31:22]=PDE, [21:12]=PTE, [11:0]=offset.
- * PDE/PTE: bits [31:12]=base, [0]=P, [1]=R/W, [2]=U/S. */
-uint32_t vm_cpu_translate(uint8_t *ram, size_t ram_size, uint32_t cr0, uint32_t cr3, uint32_t linear) {
+ * PDE/PTE: bits [31:12]=base, [0]=P, [1]=R/W, [2]=U/S.
+ * perms_out receives the VM_TLB_* kinds the mapping allows (0 if not
+ * present). The guest always runs at CPL 0, so R/W only restricts writes
+ * when CR0.WP is set; there is no NX, so every present page is fetchable. */
+static uint32_t page_walk(uint8_t *ram, size_t ram_size, uint32_t cr0, uint32_t cr3, uint32_t linear, uint32_t *perms_out) {
+    *perms_out = 0;
     if (!(cr0 & VM_CR0_PG)) return linear;
     if (!ram || ram_size < 4096) return linear;
     uint32_t pd_base = cr3 & 0xFFFFF000U;
@@ -38,5 +93,54 @@ uint32_t vm_cpu_translate(uint8_t *ram, size_t ram_size, uint32_t cr0, uint32_t
     uint32_t pte;
     asm_mem_copy(&pte, ram + pte_addr, 4);
     if (!(pte & 1)) return linear;
+    *perms_out = VM_TLB_R | VM_TLB_X;
+    if (!(cr0 & VM_CR0_WP) || (pde & pte & 2))
+        *perms_out |= VM_TLB_W;
     return (pte & 0xFFFFF000U) + (linear & 0xFFF);
 }
+
+uint32_t vm_cpu_translate(uint8_t *ram, size_t ram_size, uint32_t cr0, uint32_t cr3, uint32_t linear) {
+    uint32_t perms;
+    return page_walk(ram, ram_size, cr0, cr3, linear, &perms);
+}
+
+void vm_cpu_tlb_flush(vm_cpu_t *cpu) {
+    if (!cpu) return;
+    for (int i = 0; i < VM_TLB_ENTRIES; i++)
+        cpu->tlb.entries[i].perms = 0;
+    cpu->tlb.flushes++;
+}
+
+void vm_cpu_write_cr0(vm_cpu_t *cpu, uint32_t value) {
+    if (!cpu) return;
+    if ((cpu->cr0 ^ value) & (VM_CR0_PG | VM_CR0_WP))
+        vm_cpu_tlb_flush(cpu);
+    cpu->cr0 = value;
+}
+
+void vm_cpu_write_cr3(vm_cpu_t *cpu, uint32_t value) {
+    if (!cpu) return;
+    vm_cpu_tlb_flush(cpu);
+    cpu->cr3 = value;
+}
+
+uint32_t vm_cpu_translate_access(vm_cpu_t *cpu, uint8_t *ram, size_t ram_size, uint32_t linear, vm_access_t access) {
+    if (!(cpu->cr0 & VM_CR0_PG)) return linear;
+    uint32_t vpn = linear >> 12;
+    vm_tlb_entry_t *e = &cpu->tlb.entries[vpn & (VM_TLB_ENTRIES - 1)];
+    if (e->vpn == vpn && (e->perms & (uint32_t)access)) {
+        cpu->tlb.hits++;
+        return e->frame | (linear & 0xFFF);
+    }
+    cpu->tlb.misses++;
+    uint32_t perms;
+    uint32_t phys = page_walk(ram, ram_size, cpu->cr0, cpu->cr3, linear, &perms);
+    /* Only successful walks are cached; a write to a read-only page still
+     * translates (no #PF yet) but walks each time. */
+    if (perms & (uint32_t)access) {
+        e->vpn = vpn;
+        e->frame = phys & 0xFFFFF000U;
+        e->perms = perms;
+    }
+    return phys;
+}
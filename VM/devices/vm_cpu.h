@@ -14,20 +14,113 @@
 #define VM_REG_EDI 7
 
 #define VM_CR0_PE  0x00000001U  /* Protected mode enable */
+#define VM_CR0_WP  0x00010000U  /* Supervisor writes honour R/W */
 #define VM_CR0_PG  0x80000000U  /* Paging enable */
 
+#define VM_FLAG_CF 0x0001U
+#define VM_FLAG_PF 0x0004U
+#define VM_FLAG_AF 0x0010U
+#define VM_FLAG_ZF 0x0040U
+#define VM_FLAG_SF 0x0080U
+#define VM_FLAG_TF 0x0100U
+#define VM_FLAG_IF 0x0200U
+#define VM_FLAG_DF 0x0400U
+#define VM_FLAG_OF 0x0800U
+#define VM_FLAGS_ARITH (VM_FLAG_CF | VM_FLAG_PF | VM_FLAG_AF | VM_FLAG_ZF | VM_FLAG_SF | VM_FLAG_OF)
+
+/* Lazy arithmetic flags. A flag-setting op records its kind, width and
+ * (width-masked) operands and result; CF/PF/AF/ZF/SF/OF are derived only
+ * when something reads them. While kind != VM_LAZY_NONE those bits of
+ * eflags are stale; vm_cpu_eflags gives the architectural value. */
+typedef enum {
+    VM_LAZY_NONE,
+    VM_LAZY_ADD,
+    VM_LAZY_SUB,     /* SUB and CMP */
+    VM_LAZY_LOGIC,   /* AND/OR/XOR/TEST: CF=OF=AF=0 */
+} vm_lazy_op_t;
+
+typedef struct vm_lazy_flags {
+    uint32_t op;         /* vm_lazy_op_t */
+    uint32_t size;       /* operand width in bytes: 1, 2 or 4 */
+    uint32_t src1, src2, result;
+} vm_lazy_flags_t;
+
+/* Software TLB: direct-mapped on virtual page number. Each entry carries
+ * the access kinds it may satisfy; a miss (or a kind the entry lacks)
+ * falls back to the page-table walk. Flushed on CR3 writes and on CR0
+ * PG/WP changes. */
+#define VM_TLB_ENTRIES 64
+#define VM_TLB_R 0x1U
+#define VM_TLB_W 0x2U
+#define VM_TLB_X 0x4U
+
+typedef enum {
+    VM_ACCESS_READ  = VM_TLB_R,
+    VM_ACCESS_WRITE = VM_TLB_W,
+    VM_ACCESS_FETCH = VM_TLB_X,
+} vm_access_t;
+
+typedef struct vm_tlb_entry {
+    uint32_t vpn;        /* linear >> 12 */
+    uint32_t frame;      /* physical page base */
+    uint32_t perms;      /* VM_TLB_*; 0 = empty */
+} vm_tlb_entry_t;
+
+typedef struct vm_tlb {
+    vm_tlb_entry_t entries[VM_TLB_ENTRIES];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t flushes;
+} vm_tlb_t;
+
 typedef struct vm_cpu {
     uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
     uint32_t eip;
     uint32_t cs, ds, es, ss, fs, gs;
-    uint32_t eflags;
+    uint32_t eflags;     /* arithmetic bits may be stale, see lazy */
+    vm_lazy_flags_t lazy;
     uint32_t cr0, cr3;   /* CR0.PE, CR0.PG; CR3 = page directory base */
+    uint32_t idt_base, idt_limit;   /* IDTR: the IVT in real mode */
     int halted;
+    vm_tlb_t tlb;        /* saved with the CPU so a restore keeps it coherent */
 } vm_cpu_t;
 
 void vm_cpu_init(vm_cpu_t *cpu);
 uint32_t vm_cpu_linear_addr(uint32_t seg, uint32_t offset);
 /* Translate linear to physical when paging enabled. Returns linear if PG=0 or invalid. */
 uint32_t vm_cpu_translate(uint8_t *ram, size_t ram_size, uint32_t cr0, uint32_t cr3, uint32_t linear);
+/* TLB-backed translate for the vCPU; same results as vm_cpu_translate. */
+uint32_t vm_cpu_translate_access(vm_cpu_t *cpu, uint8_t *ram, size_t ram_size, uint32_t linear, vm_access_t access);
+void vm_cpu_tlb_flush(vm_cpu_t *cpu);
+
+static inline uint32_t vm_lazy_mask(uint32_t size) {
+    return size >= 4 ? 0xFFFFFFFFU : (1U << (size * 8)) - 1;
+}
+
+/* Record a flag-setting result; no flags are computed here. */
+static inline void vm_cpu_set_lazy(vm_cpu_t *cpu, vm_lazy_op_t op, uint32_t size,
+                                   uint32_t a, uint32_t b, uint32_t r) {
+    uint32_t m = vm_lazy_mask(size);
+    cpu->lazy.op = op;
+    cpu->lazy.size = size;
+    cpu->lazy.src1 = a & m;
+    cpu->lazy.src2 = b & m;
+    cpu->lazy.result = r & m;
+}
+
+/* ZF straight from the pending result, for Jcc without a full fold. */
+static inline int vm_cpu_zf(const vm_cpu_t *cpu) {
+    if (cpu->lazy.op != VM_LAZY_NONE) return cpu->lazy.result == 0;
+    return (cpu->eflags & VM_FLAG_ZF) != 0;
+}
+
+/* Architectural EFLAGS with any pending arithmetic flags applied. */
+uint32_t vm_cpu_eflags(const vm_cpu_t *cpu);
+/* Fold pending flags into cpu->eflags (before it is pushed or saved). */
+void vm_cpu_flags_commit(vm_cpu_t *cpu);
+/* Replace EFLAGS wholesale (POPF/IRET), discarding pending flags. */
+void vm_cpu_set_eflags(vm_cpu_t *cpu, uint32_t value);
+void vm_cpu_write_cr0(vm_cpu_t *cpu, uint32_t value);
+void vm_cpu_write_cr3(vm_cpu_t *cpu, uint32_t value);
 
 #endif /* VM_CPU_H */
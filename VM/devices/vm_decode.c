@@ -79,6 +79,46 @@ static int decode_mov_r32_imm32(uint8_t *mem, uint32_t addr, vm_instr_t *out) {
     return 0;
 }
 
+/* Port I/O and string ops with 0x66 (16-bit) and/or 0xF3/0xF2 (REP/REPNE)
+ * prefixes. Unprefixed wide forms are 32-bit in this VM, so 0x66 selects
+ * the word width. */
+static int decode_prefixed(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
+    int opsize16 = 0, rep = VM_REP_NONE;
+    unsigned n = 0;
+    while (n < 3 && addr + n < mem_size &&
+           (mem[addr + n] == 0x66 || mem[addr + n] == 0xF3 || mem[addr + n] == 0xF2)) {
+        if (mem[addr + n] == 0x66) opsize16 = 1;
+        else rep = (mem[addr + n] == 0xF3) ? VM_REP_E : VM_REP_NE;
+        n++;
+    }
+    if (addr + n >= mem_size) return -1;
+    int wide = opsize16 ? 2 : 4;
+    uint8_t b = mem[addr + n];
+    switch (b) {
+    case 0xED: out->op = VM_OP_IN_DX;  out->mem_size = wide; break;
+    case 0xEF: out->op = VM_OP_OUT_DX; out->mem_size = wide; break;
+    case 0x6C: out->op = VM_OP_INS;    out->mem_size = 1; break;
+    case 0x6D: out->op = VM_OP_INS;    out->mem_size = wide; break;
+    case 0x6E: out->op = VM_OP_OUTS;   out->mem_size = 1; break;
+    case 0x6F: out->op = VM_OP_OUTS;   out->mem_size = wide; break;
+    case 0xA4: case 0xA5: out->op = VM_OP_MOVS; break;
+    case 0xA6: case 0xA7: out->op = VM_OP_CMPS; break;
+    case 0xAA: case 0xAB: out->op = VM_OP_STOS; break;
+    case 0xAC: case 0xAD: out->op = VM_OP_LODS; break;
+    case 0xAE: case 0xAF: out->op = VM_OP_SCAS; break;
+    default: return -1;
+    }
+    if (b >= 0xA4) {
+        out->mem_size = (b & 1) ? wide : 1;
+        out->imm = (uint32_t)rep;
+    } else {
+        if (rep && out->op != VM_OP_INS && out->op != VM_OP_OUTS) return -1;
+        out->imm = rep ? 1 : 0;
+    }
+    out->size = n + 1;
+    return 0;
+}
+
 int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
     if (!mem || !out || mem_size < 2) return -1;
     if (mem[addr] == 0x0F) {
@@ -104,6 +144,15 @@ int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
             out->size = 2 + n;
             return 0;
         }
+        if (b1 == 0x01) { /* LIDT m16&32: absolute disp32 form only */
+            int n = decode_modrm(mem, addr + 2, mem_size, &out->modrm, &out->sib);
+            if (n < 0 || out->modrm.reg != 3 || out->modrm.mod != 0 || out->modrm.rm != 5) return -1;
+            out->op = VM_OP_LIDT;
+            out->dst_reg = out->src_reg = -1;
+            out->mem_addr = (uint32_t)out->modrm.disp;
+            out->size = 2 + n;
+            return 0;
+        }
         return -1;
     }
     out->op = VM_OP_UNKNOWN;
@@ -125,6 +174,12 @@ int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
     case 0xF4: /* HLT */
         out->op = VM_OP_HLT;
         return 0;
+    case 0xFA: /* CLI */
+        out->op = VM_OP_CLI;
+        return 0;
+    case 0xFB: /* STI */
+        out->op = VM_OP_STI;
+        return 0;
     case 0xE4: /* IN al, imm8 */
         out->op = VM_OP_IN;
         out->imm = b1;
@@ -135,14 +190,29 @@ int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
         out->imm = b1;
         out->size = 2;
         return 0;
-    case 0xED: /* IN EAX, DX (32-bit) */
+    case 0xEC: /* IN AL, DX */
         out->op = VM_OP_IN_DX;
-        out->size = 1;
+        out->mem_size = 1;
         return 0;
-    case 0xEF: /* OUT DX, EAX (32-bit) */
+    case 0xEE: /* OUT DX, AL */
         out->op = VM_OP_OUT_DX;
-        out->size = 1;
+        out->mem_size = 1;
         return 0;
+    case 0x66: /* operand-size prefix */
+    case 0xF3: /* REP/REPE prefix */
+    case 0xF2: /* REPNE prefix */
+    case 0xED: /* IN EAX, DX (32-bit) */
+    case 0xEF: /* OUT DX, EAX (32-bit) */
+    case 0x6C: /* INSB */
+    case 0x6D: /* INSD */
+    case 0x6E: /* OUTSB */
+    case 0x6F: /* OUTSD */
+    case 0xA4: case 0xA5: /* MOVSB/MOVSD */
+    case 0xA6: case 0xA7: /* CMPSB/CMPSD */
+    case 0xAA: case 0xAB: /* STOSB/STOSD */
+    case 0xAC: case 0xAD: /* LODSB/LODSD */
+    case 0xAE: case 0xAF: /* SCASB/SCASD */
+        return decode_prefixed(mem, addr, mem_size, out);
     case 0xEB: /* JMP rel8 */
         out->op = VM_OP_JMP;
         out->imm = (int8_t)b1;
@@ -159,9 +229,6 @@ int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out) {
     case 0xCF: /* IRET */
         out->op = VM_OP_IRET;
         return 0;
-    case 0xAA: /* STOSB */
-        out->op = VM_OP_STOSB;
-        return 0;
     case 0x3C: /* CMP al, imm8 */
         out->op = VM_OP_CMP;
         out->dst_reg = 0;
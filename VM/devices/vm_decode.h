@@ -9,8 +9,8 @@ typedef enum {
     VM_OP_HLT,
     VM_OP_IN,
     VM_OP_OUT,
-    VM_OP_IN_DX,   /* IN EAX, DX (32-bit) */
-    VM_OP_OUT_DX,  /* OUT DX, EAX (32-bit) */
+    VM_OP_IN_DX,   /* IN AL/AX/EAX, DX; mem_size=width */
+    VM_OP_OUT_DX,  /* OUT DX, AL/AX/EAX; mem_size=width */
     VM_OP_MOV,
     VM_OP_ADD,
     VM_OP_SUB,
@@ -26,11 +26,25 @@ typedef enum {
     VM_OP_INT,
     VM_OP_IRET,
     VM_OP_RET,
-    VM_OP_STOSB,
+    VM_OP_STOS,    /* STOSB/W/D; mem_size=width, imm=VM_REP_* */
     VM_OP_MOV_CR,
+    VM_OP_INS,     /* INSB/INSW/INSD; imm=1 with REP, mem_size=width */
+    VM_OP_OUTS,    /* OUTSB/OUTSW/OUTSD; imm=1 with REP, mem_size=width */
+    VM_OP_MOVS,    /* MOVS/LODS/CMPS/SCAS: mem_size=width, imm=VM_REP_* */
+    VM_OP_LODS,
+    VM_OP_CMPS,
+    VM_OP_SCAS,
+    VM_OP_CLI,
+    VM_OP_STI,
+    VM_OP_LIDT,    /* mem_addr = disp32 (DS-relative) */
     VM_OP_UNKNOWN,
 } vm_opcode_t;
 
+/* String-op repeat prefix, kept in vm_instr_t.imm. */
+#define VM_REP_NONE 0
+#define VM_REP_E    1   /* F3: REP / REPE */
+#define VM_REP_NE   2   /* F2: REPNE */
+
 typedef enum {
     VM_OPND_NONE,
     VM_OPND_REG8,
@@ -69,6 +83,7 @@ typedef struct vm_instr {
     unsigned int size;  /* instruction length in bytes */
     vm_modrm_t modrm;
     vm_sib_t sib;
+    const void *handler;  /* threaded-dispatch target, bound by the block cache */
 } vm_instr_t;
 
 int vm_decode(uint8_t *mem, uint32_t addr, size_t mem_size, vm_instr_t *out);
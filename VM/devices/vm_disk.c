@@ -1,19 +1,239 @@
-/* Virtual disk: raw sector file. ASM for buffer ops. */
+/* Virtual disk: raw sector file behind a file descriptor (pread/pwrite)
+ * with a bounded write-back sector cache. Dirty sectors reach the backing
+ * files on eviction, on vm_disk_flush (guest FLUSH CACHE), at a checkpoint
+ * and at shutdown. While checkpoints are open, writes land in the newest
+ * of a chain of copy-on-write overlay files instead of the image. ASM for buffer ops. */
 #include "vm_disk.h"
 #include "common.h"
 #include "fs_jail.h"
 #include "mem_domain.h"
 #include "mem_asm.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define SECTOR_SIZE 512
 #define VM_DISK_PATH_MAX 256
+#define VM_DISK_COPY_CHUNK 65536
 
-static FILE *s_vm_disk_fp;
-static uint32_t s_vm_disk_sectors;
-static char s_vm_disk_path[VM_DISK_PATH_MAX];
+typedef struct vm_disk_line {
+    uint32_t lba;
+    uint8_t valid;
+    uint8_t dirty;
+} vm_disk_line_t;
+
+/* Overlay of one checkpoint: a sector written after it (and before the
+ * next checkpoint) lives in fd at its own offset (a sparse file) and has
+ * its bit set in map. */
+typedef struct vm_disk_overlay {
+    int fd;
+    uint8_t *map;
+    uint32_t count;         /* bits set in map */
+    char path[VM_DISK_PATH_MAX];
+} vm_disk_overlay_t;
+
+/* Backing image and cache of one guest. */
+struct vm_disk_state {
+    int fd;
+    uint32_t sectors;
+    char path[VM_DISK_PATH_MAX];
+    uint64_t gen;
+    /* Direct-mapped on lba: consecutive sectors land in consecutive lines,
+     * so a dirty run of lines is also one contiguous buffer for a single
+     * pwrite. */
+    vm_disk_line_t lines[VM_DISK_CACHE_SECTORS];
+    uint8_t *data;
+    /* Open checkpoints, oldest first. The image holds the oldest one;
+     * overlay k turns checkpoint k into checkpoint k + 1, and the newest
+     * takes the writes. */
+    vm_disk_overlay_t ovl[VM_DISK_CHECKPOINTS];
+    int ovl_count;
+};
+
+static vm_disk_state_t s_disk_default = { .fd = -1 };
+static _Thread_local vm_disk_state_t *s_disk = &s_disk_default;
+
+static int pread_full(int fd, void *buf, size_t n, off_t off) {
+    uint8_t *p = buf;
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) {                /* past EOF reads as zeros */
+            asm_mem_zero(p, n);
+            return 0;
+        }
+        p += r; n -= (size_t)r; off += r;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const void *buf, size_t n, off_t off) {
+    const uint8_t *p = buf;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w; n -= (size_t)w; off += w;
+    }
+    return 0;
+}
+
+static int ovl_has(const vm_disk_overlay_t *o, uint32_t lba) {
+    return (o->map[lba >> 3] >> (lba & 7)) & 1;
+}
+
+static int ovl_find(const char *path) {
+    for (int k = 0; k < s_disk->ovl_count; k++) {
+        if (strcmp(s_disk->ovl[k].path, path) == 0) return k;
+    }
+    return -1;
+}
+
+/* Sectors [lba, lba + n) go to the newest overlay when a checkpoint is
+ * open, to the image otherwise. */
+static int sectors_write(uint32_t lba, const void *buf, uint32_t n) {
+    off_t off = (off_t)lba * SECTOR_SIZE;
+    if (s_disk->ovl_count == 0) return pwrite_full(s_disk->fd, buf, (size_t)n * SECTOR_SIZE, off);
+    vm_disk_overlay_t *o = &s_disk->ovl[s_disk->ovl_count - 1];
+    if (pwrite_full(o->fd, buf, (size_t)n * SECTOR_SIZE, off) != 0) return -1;
+    for (uint32_t k = lba; k < lba + n; k++) {
+        if (ovl_has(o, k)) continue;
+        o->map[k >> 3] |= (uint8_t)(1u << (k & 7));
+        o->count++;
+    }
+    return 0;
+}
+
+/* The newest overlay holding the sector wins; the image has the rest. */
+static int sector_read(uint32_t lba, void *buf) {
+    int fd = s_disk->fd;
+    for (int k = s_disk->ovl_count - 1; k >= 0; k--) {
+        if (ovl_has(&s_disk->ovl[k], lba)) { fd = s_disk->ovl[k].fd; break; }
+    }
+    return pread_full(fd, buf, SECTOR_SIZE, (off_t)lba * SECTOR_SIZE);
+}
+
+/* Forget everything written since the overlay's checkpoint. */
+static int ovl_discard(vm_disk_overlay_t *o) {
+    asm_mem_zero(o->map, ((size_t)s_disk->sectors + 7) / 8);
+    o->count = 0;
+    return ftruncate(o->fd, 0) == 0 ? 0 : -1;
+}
+
+/* Copy the overlay's sectors into the image, a run of marked sectors at a
+ * time: cost follows what was written, not the image size. */
+static int ovl_merge(const vm_disk_overlay_t *o) {
+    if (o->count == 0) return 0;
+    void *buf = mem_domain_alloc(MEM_DOMAIN_FS, VM_DISK_COPY_CHUNK);
+    if (!buf) return -1;
+    const uint32_t max_run = VM_DISK_COPY_CHUNK / SECTOR_SIZE;
+    int err = 0;
+    uint32_t lba = 0;
+    while (lba < s_disk->sectors && !err) {
+        if (o->map[lba >> 3] == 0) { lba = (lba | 7) + 1; continue; }
+        if (!ovl_has(o, lba)) { lba++; continue; }
+        uint32_t n = 1;
+        while (n < max_run && lba + n < s_disk->sectors && ovl_has(o, lba + n))
+            n++;
+        size_t len = (size_t)n * SECTOR_SIZE;
+        off_t off = (off_t)lba * SECTOR_SIZE;
+        if (pread_full(o->fd, buf, len, off) != 0 || pwrite_full(s_disk->fd, buf, len, off) != 0)
+            err = -1;
+        lba += n;
+    }
+    mem_domain_free(MEM_DOMAIN_FS, buf);
+    return err;
+}
+
+/* Close the overlay; remove its file when its content is no longer
+ * needed (merged or discarded). */
+static void ovl_close(vm_disk_overlay_t *o, int remove_file) {
+    close(o->fd);
+    if (remove_file) unlink(o->path);
+    mem_domain_free(MEM_DOMAIN_FS, o->map);
+    asm_mem_zero(o, sizeof(*o));
+    o->fd = -1;
+}
+
+/* Fold the n oldest overlays into the image, oldest first, and close
+ * them. Stops at the first one that fails to merge. */
+static int ovls_merge(int n) {
+    int done = 0;
+    while (done < n && ovl_merge(&s_disk->ovl[done]) == 0) {
+        ovl_close(&s_disk->ovl[done], 1);
+        done++;
+    }
+    memmove(&s_disk->ovl[0], &s_disk->ovl[done], (size_t)(s_disk->ovl_count - done) * sizeof(s_disk->ovl[0]));
+    s_disk->ovl_count -= done;
+    return done == n ? 0 : -1;
+}
+
+static uint8_t *line_data(uint32_t idx) {
+    return s_disk->data + (size_t)idx * SECTOR_SIZE;
+}
+
+static int line_writeback(uint32_t idx) {
+    vm_disk_line_t *l = &s_disk->lines[idx];
+    if (!l->valid || !l->dirty) return 0;
+    if (sectors_write(l->lba, line_data(idx), 1) != 0) return -1;
+    l->dirty = 0;
+    return 0;
+}
+
+static void cache_drop(void) {
+    for (uint32_t i = 0; i < VM_DISK_CACHE_SECTORS; i++)
+        s_disk->lines[i].valid = s_disk->lines[i].dirty = 0;
+}
+
+/* Write back all dirty lines, coalescing lba-contiguous runs. */
+static int cache_writeback(void) {
+    int err = 0;
+    uint32_t i = 0;
+    while (i < VM_DISK_CACHE_SECTORS) {
+        vm_disk_line_t *l = &s_disk->lines[i];
+        if (!l->valid || !l->dirty) { i++; continue; }
+        uint32_t n = 1;
+        while (i + n < VM_DISK_CACHE_SECTORS) {
+            vm_disk_line_t *next = &s_disk->lines[i + n];
+            if (!next->valid || !next->dirty || next->lba != l->lba + n) break;
+            n++;
+        }
+        if (sectors_write(l->lba, line_data(i), n) != 0) {
+            err = -1;
+        } else {
+            for (uint32_t k = 0; k < n; k++)
+                s_disk->lines[i + k].dirty = 0;
+        }
+        i += n;
+    }
+    return err;
+}
+
+vm_disk_state_t *vm_disk_state_create(void) {
+    vm_disk_state_t *st = mem_domain_alloc(MEM_DOMAIN_FS, sizeof(*st));
+    if (!st) return NULL;
+    asm_mem_zero(st, sizeof(*st));
+    st->fd = -1;
+    return st;
+}
+
+void vm_disk_state_destroy(vm_disk_state_t *st) {
+    if (!st || st == &s_disk_default) return;
+    vm_disk_state_t *prev = s_disk;
+    s_disk = st;
+    vm_disk_shutdown();
+    s_disk = (prev == st) ? &s_disk_default : prev;
+    mem_domain_free(MEM_DOMAIN_FS, st);
+}
+
+void vm_disk_bind(vm_disk_state_t *st) {
+    s_disk = st ? st : &s_disk_default;
+}
 
 int vm_disk_init(const char *path, unsigned int size_mb) {
     if (!path || size_mb == 0) return -1;
@@ -22,106 +242,151 @@ int vm_disk_init(const char *path, unsigned int size_mb) {
         return -1;
     }
     vm_disk_shutdown();
-    mem_domain_zero(s_vm_disk_path, sizeof(s_vm_disk_path));
-    strncpy(s_vm_disk_path, path, VM_DISK_PATH_MAX - 1);
-    s_vm_disk_path[VM_DISK_PATH_MAX - 1] = '\0';
-    s_vm_disk_fp = fopen(path, "r+b");
-    if (!s_vm_disk_fp)
-        s_vm_disk_fp = fopen(path, "w+b");
-    if (!s_vm_disk_fp) return -1;
+    mem_domain_zero(s_disk->path, sizeof(s_disk->path));
+    strncpy(s_disk->path, path, VM_DISK_PATH_MAX - 1);
+    s_disk->path[VM_DISK_PATH_MAX - 1] = '\0';
+    if (!s_disk->data) {
+        s_disk->data = mem_domain_alloc(MEM_DOMAIN_FS, (size_t)VM_DISK_CACHE_SECTORS * SECTOR_SIZE);
+        if (!s_disk->data) return -1;
+    }
+    cache_drop();
+    s_disk->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (s_disk->fd < 0) return -1;
     size_t target = (size_t)size_mb * 1024 * 1024;
-    if (fseek(s_vm_disk_fp, 0, SEEK_END) != 0) { fclose(s_vm_disk_fp); s_vm_disk_fp = NULL; return -1; }
-    long pos = ftell(s_vm_disk_fp);
-    if (pos < 0) { fclose(s_vm_disk_fp); s_vm_disk_fp = NULL; return -1; }
-    if ((size_t)pos < target) {
-        void *zeros = mem_domain_alloc(MEM_DOMAIN_FS, 65536);
-        if (!zeros) { fclose(s_vm_disk_fp); s_vm_disk_fp = NULL; return -1; }
-        asm_mem_zero(zeros, 65536);
-        for (size_t n = (size_t)pos; n < target; n += 65536) {
-            size_t chunk = (target - n) < 65536 ? (target - n) : 65536;
-            if (fwrite(zeros, 1, chunk, s_vm_disk_fp) != chunk) {
-                mem_domain_free(MEM_DOMAIN_FS, zeros);
-                fclose(s_vm_disk_fp);
-                s_vm_disk_fp = NULL;
-                return -1;
-            }
-        }
-        mem_domain_free(MEM_DOMAIN_FS, zeros);
-        fflush(s_vm_disk_fp);
+    struct stat st;
+    if (fstat(s_disk->fd, &st) != 0) { close(s_disk->fd); s_disk->fd = -1; return -1; }
+    /* Grow sparse: the tail is a hole that reads as zeros and takes no
+     * space until written. posix_fallocate covers filesystems where
+     * ftruncate cannot extend a file. */
+    if ((size_t)st.st_size < target && ftruncate(s_disk->fd, (off_t)target) != 0 &&
+        posix_fallocate(s_disk->fd, st.st_size, (off_t)(target - (size_t)st.st_size)) != 0) {
+        close(s_disk->fd);
+        s_disk->fd = -1;
+        return -1;
     }
-    s_vm_disk_sectors = (uint32_t)(target / SECTOR_SIZE);
+    s_disk->sectors = (uint32_t)(target / SECTOR_SIZE);
+    s_disk->gen++;
     return 0;
 }
 
 void vm_disk_shutdown(void) {
-    if (s_vm_disk_fp) {
-        fclose(s_vm_disk_fp);
-        s_vm_disk_fp = NULL;
+    if (s_disk->fd >= 0) {
+        cache_writeback();
+        /* The image is left as the guest last saw it; an overlay that
+         * failed to merge keeps its file. */
+        ovls_merge(s_disk->ovl_count);
+        while (s_disk->ovl_count > 0)
+            ovl_close(&s_disk->ovl[--s_disk->ovl_count], 0);
+        close(s_disk->fd);
+        s_disk->fd = -1;
     }
-    s_vm_disk_sectors = 0;
+    cache_drop();
+    if (s_disk->data) {
+        mem_domain_free(MEM_DOMAIN_FS, s_disk->data);
+        s_disk->data = NULL;
+    }
+    s_disk->sectors = 0;
 }
 
 int vm_disk_read_sector(uint32_t lba, void *buf) {
-    if (!s_vm_disk_fp || !buf || lba >= s_vm_disk_sectors) return -1;
-    if (fseek(s_vm_disk_fp, (long)lba * SECTOR_SIZE, SEEK_SET) != 0) return -1;
-    if (fread(buf, 1, SECTOR_SIZE, s_vm_disk_fp) != SECTOR_SIZE) return -1;
+    if (s_disk->fd < 0 || !buf || lba >= s_disk->sectors) return -1;
+    uint32_t idx = lba & (VM_DISK_CACHE_SECTORS - 1);
+    vm_disk_line_t *l = &s_disk->lines[idx];
+    if (!l->valid || l->lba != lba) {
+        if (line_writeback(idx) != 0) return -1;
+        l->valid = 0;
+        if (sector_read(lba, line_data(idx)) != 0) return -1;
+        l->lba = lba;
+        l->valid = 1;
+        l->dirty = 0;
+    }
+    asm_mem_copy(buf, line_data(idx), SECTOR_SIZE);
     return 0;
 }
 
 int vm_disk_write_sector(uint32_t lba, const void *buf) {
-    if (!s_vm_disk_fp || !buf || lba >= s_vm_disk_sectors) return -1;
-    if (fseek(s_vm_disk_fp, (long)lba * SECTOR_SIZE, SEEK_SET) != 0) return -1;
-    if (fwrite(buf, 1, SECTOR_SIZE, s_vm_disk_fp) != SECTOR_SIZE) return -1;
-    fflush(s_vm_disk_fp);
+    if (s_disk->fd < 0 || !buf || lba >= s_disk->sectors) return -1;
+    uint32_t idx = lba & (VM_DISK_CACHE_SECTORS - 1);
+    vm_disk_line_t *l = &s_disk->lines[idx];
+    if (l->valid && l->lba != lba && line_writeback(idx) != 0) return -1;
+    s_disk->gen++;
+    asm_mem_copy(line_data(idx), buf, SECTOR_SIZE);
+    l->lba = lba;
+    l->valid = 1;
+    l->dirty = 1;
     return 0;
 }
 
-int vm_disk_is_active(void) {
-    return s_vm_disk_fp != NULL;
-}
-
-int vm_disk_snapshot_save(const char *dest_path) {
-    if (!s_vm_disk_fp || !dest_path) return -1;
-    FILE *src = fopen(s_vm_disk_path, "rb");
-    if (!src) return -1;
-    FILE *dst = fopen(dest_path, "wb");
-    if (!dst) { fclose(src); return -1; }
-    size_t size = (size_t)s_vm_disk_sectors * SECTOR_SIZE;
-    void *buf = mem_domain_alloc(MEM_DOMAIN_FS, 65536);
-    if (!buf) { fclose(src); fclose(dst); return -1; }
-    int err = 0;
-    for (size_t n = 0; n < size; n += 65536) {
-        size_t chunk = (size - n) < 65536 ? (size - n) : 65536;
-        if (fread(buf, 1, chunk, src) != chunk) { err = -1; break; }
-        if (fwrite(buf, 1, chunk, dst) != chunk) { err = -1; break; }
+int vm_disk_flush(void) {
+    if (s_disk->fd < 0) return -1;
+    if (cache_writeback() != 0) return -1;
+    for (int k = 0; k < s_disk->ovl_count; k++) {
+        if (fdatasync(s_disk->ovl[k].fd) != 0) return -1;
     }
-    mem_domain_free(MEM_DOMAIN_FS, buf);
-    fclose(src);
-    fclose(dst);
-    return err;
+    return fdatasync(s_disk->fd) == 0 ? 0 : -1;
 }
 
-int vm_disk_snapshot_restore(const char *src_path) {
-    if (!s_vm_disk_fp || !src_path) return -1;
-    fflush(s_vm_disk_fp);
-    fclose(s_vm_disk_fp);
-    s_vm_disk_fp = NULL;
-    FILE *src = fopen(src_path, "rb");
-    if (!src) return -1;
-    FILE *dst = fopen(s_vm_disk_path, "wb");
-    if (!dst) { fclose(src); return -1; }
-    size_t size = (size_t)s_vm_disk_sectors * SECTOR_SIZE;
-    void *buf = mem_domain_alloc(MEM_DOMAIN_FS, 65536);
-    if (!buf) { fclose(src); fclose(dst); return -1; }
-    int err = 0;
-    for (size_t n = 0; n < size; n += 65536) {
-        size_t chunk = (size - n) < 65536 ? (size - n) : 65536;
-        if (fread(buf, 1, chunk, src) != chunk) { err = -1; break; }
-        if (fwrite(buf, 1, chunk, dst) != chunk) { err = -1; break; }
+int vm_disk_is_active(void) {
+    return s_disk->fd >= 0;
+}
+
+uint32_t vm_disk_sectors(void) {
+    return s_disk->fd >= 0 ? s_disk->sectors : 0;
+}
+
+int vm_disk_snapshot_save(const char *overlay_path) {
+    if (s_disk->fd < 0 || !overlay_path || ovl_find(overlay_path) >= 0) return -1;
+    if (cache_writeback() != 0) return -1;
+    /* A full chain folds its oldest checkpoint into the image. */
+    if (s_disk->ovl_count == VM_DISK_CHECKPOINTS && ovls_merge(1) != 0) return -1;
+    vm_disk_overlay_t *o = &s_disk->ovl[s_disk->ovl_count];
+    size_t map_len = ((size_t)s_disk->sectors + 7) / 8;
+    o->map = mem_domain_alloc(MEM_DOMAIN_FS, map_len);
+    if (!o->map) return -1;
+    asm_mem_zero(o->map, map_len);
+    o->count = 0;
+    o->fd = open(overlay_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (o->fd < 0) {
+        mem_domain_free(MEM_DOMAIN_FS, o->map);
+        o->map = NULL;
+        return -1;
     }
-    mem_domain_free(MEM_DOMAIN_FS, buf);
-    fclose(src);
-    fclose(dst);
-    s_vm_disk_fp = fopen(s_vm_disk_path, "r+b");
-    return (s_vm_disk_fp && err == 0) ? 0 : -1;
+    strncpy(o->path, overlay_path, VM_DISK_PATH_MAX - 1);
+    o->path[VM_DISK_PATH_MAX - 1] = '\0';
+    s_disk->ovl_count++;
+    return 0;
+}
+
+int vm_disk_snapshot_restore(const char *overlay_path) {
+    int k = (s_disk->fd >= 0 && overlay_path) ? ovl_find(overlay_path) : -1;
+    if (k < 0) return -1;
+    cache_drop();   /* cached sectors may postdate the checkpoint */
+    s_disk->gen++;
+    while (s_disk->ovl_count > k + 1)
+        ovl_close(&s_disk->ovl[--s_disk->ovl_count], 1);
+    return ovl_discard(&s_disk->ovl[k]);
+}
+
+int vm_disk_snapshot_merge(const char *overlay_path) {
+    int k = (s_disk->fd >= 0 && overlay_path) ? ovl_find(overlay_path) : -1;
+    if (k < 0) return -1;
+    return ovls_merge(k + 1);
+}
+
+int vm_disk_commit(void) {
+    if (s_disk->fd < 0) return -1;
+    if (cache_writeback() != 0) return -1;
+    return ovls_merge(s_disk->ovl_count);
+}
+
+int vm_disk_checkpoints(void) {
+    return s_disk->fd >= 0 ? s_disk->ovl_count : 0;
+}
+
+uint32_t vm_disk_overlay_sectors(void) {
+    return vm_disk_checkpoints() > 0 ? s_disk->ovl[s_disk->ovl_count - 1].count : 0;
+}
+
+uint64_t vm_disk_generation(void) {
+    return s_disk->gen;
 }
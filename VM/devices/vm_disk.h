@@ -5,14 +5,48 @@
 
 #define VM_DISK_DEFAULT_SIZE_MB 2
 #define VM_DISK_SECTOR_SIZE 512
+#define VM_DISK_CACHE_SECTORS 256   /* write-back cache lines (power of two) */
+#define VM_DISK_CHECKPOINTS 8       /* overlays open at once */
+
+/* Virtual disk: raw binary file, fixed size. Single backing file per VM.
+ * Writes are cached; they reach the file on eviction, vm_disk_flush,
+ * snapshot save and shutdown (through the newest overlay while a
+ * checkpoint is open, see vm_disk_snapshot_save). */
+/* One backing image per guest: vm_disk_bind selects the instance the
+ * calling thread's vm_disk_* calls act on (NULL: the process default). */
+typedef struct vm_disk_state vm_disk_state_t;
+vm_disk_state_t *vm_disk_state_create(void);
+void vm_disk_state_destroy(vm_disk_state_t *st);
+void vm_disk_bind(vm_disk_state_t *st);
 
-/* Virtual disk: raw binary file, fixed size. Single backing file per VM. */
 int vm_disk_init(const char *path, unsigned int size_mb);
 void vm_disk_shutdown(void);
 int vm_disk_read_sector(uint32_t lba, void *buf);
 int vm_disk_write_sector(uint32_t lba, const void *buf);
+int vm_disk_flush(void);
 int vm_disk_is_active(void);
-int vm_disk_snapshot_save(const char *dest_path);
-int vm_disk_snapshot_restore(const char *src_path);
+/* Image size in sectors (0 when no image is attached). */
+uint32_t vm_disk_sectors(void);
+/* Disk checkpoints are copy-on-write and stack: snapshot_save starts a
+ * new overlay at overlay_path (a path not already in the chain); from then
+ * on written sectors go to it (tracked in a sector bitmap) and the older
+ * overlays and the image hold the earlier checkpoints. snapshot_restore
+ * returns to the checkpoint saved at overlay_path, discarding its overlay
+ * and every newer one; snapshot_merge folds that checkpoint and the older
+ * ones into the image; commit merges them all. Each costs in proportion to
+ * the sectors written in the overlays it touches. Past
+ * VM_DISK_CHECKPOINTS, a save merges the oldest first. Shutdown commits;
+ * merged and discarded overlay files are removed. */
+int vm_disk_snapshot_save(const char *overlay_path);
+int vm_disk_snapshot_restore(const char *overlay_path);
+int vm_disk_snapshot_merge(const char *overlay_path);
+int vm_disk_commit(void);
+/* Open checkpoints (0 when none). */
+int vm_disk_checkpoints(void);
+/* Sectors held in the newest overlay (0 when no checkpoint is open). */
+uint32_t vm_disk_overlay_sectors(void);
+/* Changes on every sector write and every (re)attach; equal values mean
+ * the image content has not changed in between. */
+uint64_t vm_disk_generation(void);
 
 #endif /* VM_DISK_H */
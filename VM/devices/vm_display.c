@@ -1,10 +1,18 @@
-/* GPU/VGA: copy guest 0xb8000 to display via asm_mem_copy */
+/* GPU/VGA: hand guest 0xb8000 to the display driver when it changes.
+ * A persistent shadow of the last frame sent replaces the per-refresh
+ * buffer; an unchanged frame costs one compare and no driver call. */
 #include "vm_display.h"
 #include "vm_mem.h"
 #include "mem_asm.h"
-#include "mem_domain.h"
 #include "drivers/drivers.h"
-#include <stdlib.h>
+#include <string.h>
+
+static uint16_t s_vga_shadow[GUEST_VGA_SIZE / 2];
+static int s_vga_shadow_valid;
+
+void vm_display_reset(void) {
+    s_vga_shadow_valid = 0;
+}
 
 void vm_display_refresh(vm_mem_t *mem) {
     if (!mem || !mem->ram) return;
@@ -12,10 +20,14 @@ void vm_display_refresh(vm_mem_t *mem) {
     if (!g_display_driver) return;
     if (!g_display_driver->refresh_vga) return;
 
-    /* Copy guest VGA buffer via ASM (no memcpy) */
-    uint16_t *buf = mem_domain_alloc(MEM_DOMAIN_USER, GUEST_VGA_SIZE);
-    if (!buf) return;
-    asm_mem_copy(buf, mem->ram + GUEST_VGA_BASE, GUEST_VGA_SIZE);
-    g_display_driver->refresh_vga(g_display_driver, buf);
-    mem_domain_free(MEM_DOMAIN_USER, buf);
+    const uint8_t *vga = mem->ram + GUEST_VGA_BASE;
+    if (s_vga_shadow_valid && memcmp(s_vga_shadow, vga, GUEST_VGA_SIZE) == 0)
+        return;
+    /* First frame since reset: the terminal holds unrelated output, so
+     * clear it and let the driver repaint everything. */
+    if (!s_vga_shadow_valid && g_display_driver->clear)
+        g_display_driver->clear(g_display_driver);
+    asm_mem_copy(s_vga_shadow, vga, GUEST_VGA_SIZE);
+    s_vga_shadow_valid = 1;
+    g_display_driver->refresh_vga(g_display_driver, s_vga_shadow);
 }
@@ -4,5 +4,7 @@
 #include "vm_mem.h"
 
 void vm_display_refresh(vm_mem_t *mem);
+/* Force a cleared, full repaint on the next refresh (new VM run). */
+void vm_display_reset(void);
 
 #endif /* VM_DISPLAY_H */
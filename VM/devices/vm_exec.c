@@ -0,0 +1,784 @@
+/* Guest instruction execution: per-op bodies plus switch and threaded
+ * dispatch over the decoded block cache. */
+#include "vm_exec.h"
+#include "vm_io.h"
+#include "vm_prof.h"
+#include "mem_asm.h"
+#include <pthread.h>
+
+typedef int (*vm_op_fn)(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in);
+
+static uint32_t get_reg32(vm_cpu_t *cpu, int r) {
+    uint32_t *regs[] = { &cpu->eax, &cpu->ecx, &cpu->edx, &cpu->ebx,
+                         &cpu->esp, &cpu->ebp, &cpu->esi, &cpu->edi };
+    return (r >= 0 && r < 8) ? *regs[r] : 0;
+}
+
+static void set_reg32(vm_cpu_t *cpu, int r, uint32_t v) {
+    uint32_t *regs[] = { &cpu->eax, &cpu->ecx, &cpu->edx, &cpu->ebx,
+                         &cpu->esp, &cpu->ebp, &cpu->esi, &cpu->edi };
+    if (r >= 0 && r < 8) *regs[r] = v;
+}
+
+static uint8_t get_reg8_lo(vm_cpu_t *cpu, int r) {
+    return (uint8_t)(get_reg32(cpu, r) & 0xFF);
+}
+
+static void set_reg8_lo(vm_cpu_t *cpu, int r, uint8_t v) {
+    uint32_t x = get_reg32(cpu, r);
+    set_reg32(cpu, r, (x & 0xFFFFFF00) | v);
+}
+
+static uint32_t guest_eip_linear(vm_cpu_t *cpu) {
+    return vm_cpu_linear_addr(cpu->cs, cpu->eip);
+}
+
+static uint32_t translate_addr(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t linear, vm_access_t access) {
+    return vm_cpu_translate_access(cpu, mem->ram, mem->size, linear, access);
+}
+
+/* One element at linear lin through buf. When it crosses a page, the part
+ * on the next page goes to the frame that page maps to (found through the
+ * element's last byte), not to the bytes after the first frame. */
+static int elem_access(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t lin, uint8_t *buf, uint32_t w, vm_access_t access) {
+    uint32_t first = VM_PAGE_SIZE - (lin & (VM_PAGE_SIZE - 1));
+    if (first > w) first = w;
+    uint32_t p0 = translate_addr(cpu, mem, lin, access);
+    uint32_t p1 = 0;
+    if (first < w)
+        p1 = translate_addr(cpu, mem, lin + w - 1, access) - (w - 1 - first);
+    if (access == VM_ACCESS_WRITE) {
+        if (vm_mem_write(mem, p0, buf, first) != 0) return -1;
+        return first < w ? vm_mem_write(mem, p1, buf + first, w - first) : 0;
+    }
+    if (vm_mem_read(mem, p0, buf, first) != 0) return -1;
+    return first < w ? vm_mem_read(mem, p1, buf + first, w - first) : 0;
+}
+
+/* INS/OUTS (optionally REP) with real-mode 16-bit SI/DI/CX. Forward runs
+ * are handed to vm_io in page- and segment-bounded chunks, so a REP INSW of
+ * a whole sector costs one translation and one port call per page. */
+static void exec_string_io(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    int is_in = (in->op == VM_OP_INS);
+    uint32_t width = (uint32_t)in->mem_size;
+    uint32_t port = cpu->edx & 0xFFFF;
+    uint32_t count = in->imm ? (cpu->ecx & 0xFFFF) : 1;
+    int down = (cpu->eflags & VM_FLAG_DF) != 0;
+    uint32_t *index = is_in ? &cpu->edi : &cpu->esi;
+    while (count > 0) {
+        uint32_t off = *index & 0xFFFF;
+        uint32_t lin = vm_cpu_linear_addr(is_in ? cpu->es : cpu->ds, off);
+        vm_access_t access = is_in ? VM_ACCESS_WRITE : VM_ACCESS_READ;
+        uint32_t n = 1, done;
+        if ((lin & (VM_PAGE_SIZE - 1)) + width > VM_PAGE_SIZE) {
+            /* The element straddles a page: one port access, split. */
+            uint8_t tmp[4] = {0};
+            uint32_t v = 0;
+            if (is_in) {
+                v = vm_io_in(mem, port, (int)width);
+                asm_mem_copy(tmp, &v, width);
+                done = elem_access(cpu, mem, lin, tmp, width, access) == 0;
+            } else {
+                done = elem_access(cpu, mem, lin, tmp, width, access) == 0;
+                asm_mem_copy(&v, tmp, width);
+                if (done) vm_io_out(mem, port, v, (int)width);
+            }
+        } else {
+            uint32_t phys = translate_addr(cpu, mem, lin, access);
+            if (!down) {
+                uint32_t room = VM_PAGE_SIZE - (lin & (VM_PAGE_SIZE - 1));
+                if (0x10000 - off < room) room = 0x10000 - off;
+                n = room / width;
+                if (n == 0) n = 1;
+                if (n > count) n = count;
+            }
+            done = is_in ? vm_io_in_string(mem, port, phys, (int)width, n)
+                         : vm_io_out_string(mem, port, phys, (int)width, n);
+        }
+        uint32_t step = done * width;
+        off = down ? off - step : off + step;
+        *index = (*index & 0xFFFF0000) | (off & 0xFFFF);
+        count -= done;
+        if (in->imm) cpu->ecx = (cpu->ecx & 0xFFFF0000) | count;
+        if (done < n) break;   /* ran off guest RAM */
+    }
+}
+
+/* Elements of a string run starting at seg:off that stay inside one page
+ * and inside the 64K segment, capped at max. Stores the physical address of
+ * the first element in *phys and a RAM pointer to it in *ptr; when the
+ * element straddles a boundary or the run leaves guest RAM, *ptr is NULL and
+ * the caller handles a single element through elem_access. */
+static uint32_t string_run(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t seg, uint32_t off, uint32_t w,
+                           int down, uint32_t max, vm_access_t access, uint8_t **ptr, uint32_t *phys) {
+    uint32_t lin = vm_cpu_linear_addr(seg, off);
+    uint32_t pg = lin & (VM_PAGE_SIZE - 1);
+    uint32_t room;
+    *phys = translate_addr(cpu, mem, lin, access);
+    *ptr = NULL;
+    if (pg + w > VM_PAGE_SIZE || off + w > 0x10000)
+        return 1;
+    if (!down) {
+        room = VM_PAGE_SIZE - pg;
+        if (0x10000 - off < room) room = 0x10000 - off;
+        room /= w;
+    } else {
+        room = (pg < off ? pg : off) / w + 1;
+    }
+    if (room > max) room = max;
+    uint32_t lo = down ? *phys - (room - 1) * w : *phys;
+    if (lo > *phys || (size_t)lo + (size_t)room * w > mem->size)
+        return 1;
+    *ptr = mem->ram + *phys;
+    return room;
+}
+
+static uint32_t load_elem(const uint8_t *p, uint32_t w) {
+    uint32_t v = p[0];
+    if (w >= 2) v |= (uint32_t)p[1] << 8;
+    if (w == 4) v |= (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    return v;
+}
+
+static void store_elem(uint8_t *p, uint32_t w, uint32_t v) {
+    for (uint32_t i = 0; i < w; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void set_acc(vm_cpu_t *cpu, uint32_t w, uint32_t v) {
+    if (w == 1) set_reg8_lo(cpu, 0, (uint8_t)v);
+    else if (w == 2) cpu->eax = (cpu->eax & 0xFFFF0000) | (v & 0xFFFF);
+    else cpu->eax = v;
+}
+
+/* MOVS/STOS/LODS/CMPS/SCAS with real-mode 16-bit SI/DI/CX. One execution
+ * handles one run that stays inside a page and a segment for each operand,
+ * done in bulk on guest RAM (asm_mem_copy, asm_block_fill). A REP form with
+ * elements left over rewinds EIP so it runs again: CX/SI/DI and the flags
+ * are exact at every run boundary, and the run loop may stop between runs.
+ * An element outside guest RAM faults: -1, with SI/DI/CX and EIP left on
+ * the faulting element. */
+static int exec_string(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    vm_opcode_t op = in->op;
+    uint32_t w = (uint32_t)in->mem_size;
+    uint32_t count = in->imm ? (cpu->ecx & 0xFFFF) : 1;
+    if (count == 0) return 0;
+    int down = (cpu->eflags & VM_FLAG_DF) != 0;
+    int use_src = (op == VM_OP_MOVS || op == VM_OP_LODS || op == VM_OP_CMPS);
+    int use_dst = (op != VM_OP_LODS);
+    int dst_write = (op == VM_OP_MOVS || op == VM_OP_STOS);
+    uint32_t si = cpu->esi & 0xFFFF, di = cpu->edi & 0xFFFF;
+    uint8_t *sp = NULL, *dp = NULL, stmp[4], dtmp[4];
+    uint32_t sphys = 0, dphys = 0, n = count;
+    if (use_src)
+        n = string_run(cpu, mem, cpu->ds, si, w, down, n, VM_ACCESS_READ, &sp, &sphys);
+    if (use_dst)
+        n = string_run(cpu, mem, cpu->es, di, w, down, n, dst_write ? VM_ACCESS_WRITE : VM_ACCESS_READ, &dp, &dphys);
+    if (use_src && !sp) {
+        n = 1;
+        if (elem_access(cpu, mem, vm_cpu_linear_addr(cpu->ds, si), stmp, w, VM_ACCESS_READ) != 0)
+            return -1;
+        sp = stmp;
+    }
+    int dst_tmp = use_dst && !dp;
+    if (dst_tmp) {
+        n = 1;
+        if (!dst_write && elem_access(cpu, mem, vm_cpu_linear_addr(cpu->es, di), dtmp, w, VM_ACCESS_READ) != 0)
+            return -1;
+        dp = dtmp;
+    }
+
+    long step = down ? -(long)w : (long)w;
+    uint32_t bytes = n * w;
+    int stop = 0;
+    switch (op) {
+    case VM_OP_MOVS: {
+        uint8_t *s_lo = down ? sp - (bytes - w) : sp;
+        uint8_t *d_lo = down ? dp - (bytes - w) : dp;
+        if (n == 1 || s_lo + bytes <= d_lo || d_lo + bytes <= s_lo) {
+            asm_mem_copy(d_lo, s_lo, bytes);
+        } else {
+            /* Overlapping run: element order is visible to the guest. */
+            for (uint32_t j = 0; j < n; j++)
+                store_elem(dp + step * (long)j, w, load_elem(sp + step * (long)j, w));
+        }
+        break;
+    }
+    case VM_OP_STOS: {
+        uint8_t *d_lo = down ? dp - (bytes - w) : dp;
+        uint32_t v = cpu->eax;
+        if (w == 1 || (w == 2 && (uint8_t)v == (uint8_t)(v >> 8)) || (w == 4 && v == (v & 0xFF) * 0x01010101U)) {
+            asm_block_fill(d_lo, (uint8_t)v, bytes);
+        } else {
+            store_elem(d_lo, w, v);
+            for (uint32_t filled = w; filled < bytes; ) {
+                uint32_t c = bytes - filled < filled ? bytes - filled : filled;
+                asm_mem_copy(d_lo + filled, d_lo, c);
+                filled += c;
+            }
+        }
+        break;
+    }
+    case VM_OP_LODS:
+        set_acc(cpu, w, load_elem(sp + step * (long)(n - 1), w));
+        break;
+    case VM_OP_CMPS:
+    case VM_OP_SCAS: {
+        uint32_t acc = cpu->eax & vm_lazy_mask(w);
+        uint32_t a = 0, b = 0, k = 0;
+        while (k < n) {
+            a = (op == VM_OP_CMPS) ? load_elem(sp + step * (long)k, w) : acc;
+            b = load_elem(dp + step * (long)k, w);
+            k++;
+            if ((in->imm == VM_REP_E && a != b) || (in->imm == VM_REP_NE && a == b)) {
+                stop = 1;
+                break;
+            }
+        }
+        vm_cpu_set_lazy(cpu, VM_LAZY_SUB, w, a, b, a - b);
+        n = k;
+        bytes = n * w;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    if (dst_write) {
+        if (dst_tmp) {
+            if (elem_access(cpu, mem, vm_cpu_linear_addr(cpu->es, di), dtmp, w, VM_ACCESS_WRITE) != 0)
+                return -1;
+        } else {
+            vm_mem_note_write(mem, down ? dphys - (bytes - w) : dphys, bytes);
+        }
+    }
+    if (use_src) {
+        si = down ? si - bytes : si + bytes;
+        cpu->esi = (cpu->esi & 0xFFFF0000) | (si & 0xFFFF);
+    }
+    if (use_dst) {
+        di = down ? di - bytes : di + bytes;
+        cpu->edi = (cpu->edi & 0xFFFF0000) | (di & 0xFFFF);
+    }
+    if (in->imm) {
+        count -= n;
+        cpu->ecx = (cpu->ecx & 0xFFFF0000) | count;
+        if (count && !stop)
+            cpu->eip -= in->size;   /* caller adds it back: same instruction next */
+    }
+    return 0;
+}
+
+/* Per-op bodies. Each returns 0 on success; EIP is advanced by the caller
+ * (JMP sets it itself). */
+static int op_nop(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)cpu; (void)mem; (void)in;
+    return 0;
+}
+
+static int op_hlt(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem; (void)in;
+    cpu->halted = 1;
+    return 0;
+}
+
+static int op_cli(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem; (void)in;
+    cpu->eflags &= ~VM_FLAG_IF;
+    return 0;
+}
+
+static int op_sti(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem; (void)in;
+    cpu->eflags |= VM_FLAG_IF;
+    return 0;
+}
+
+static int op_in(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    set_reg8_lo(cpu, 0, (uint8_t)vm_io_in(mem, (uint32_t)in->imm, 1));
+    return 0;
+}
+
+static int op_out(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    vm_io_out(mem, (uint32_t)in->imm, get_reg8_lo(cpu, 0), 1);
+    return 0;
+}
+
+static int op_in_dx(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    uint32_t port = get_reg32(cpu, 2) & 0xFFFF;
+    uint32_t v = vm_io_in(mem, port, in->mem_size);
+    if (in->mem_size == 1) set_reg8_lo(cpu, 0, (uint8_t)v);
+    else if (in->mem_size == 2) cpu->eax = (cpu->eax & 0xFFFF0000) | (v & 0xFFFF);
+    else set_reg32(cpu, 0, v);
+    return 0;
+}
+
+static int op_out_dx(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    uint32_t port = get_reg32(cpu, 2) & 0xFFFF;
+    vm_io_out(mem, port, get_reg32(cpu, 0), in->mem_size);
+    return 0;
+}
+
+static int op_string_io(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    exec_string_io(cpu, mem, in);
+    return 0;
+}
+
+static int op_mov(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->dst_reg >= 0 && in->src_reg < 0)
+        set_reg32(cpu, in->dst_reg, in->imm);
+    return 0;
+}
+
+static int op_push(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    cpu->esp -= 4;
+    uint32_t v = get_reg32(cpu, in->dst_reg);
+    uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
+    uint32_t phys = translate_addr(cpu, mem, lin, VM_ACCESS_WRITE);
+    vm_mem_write32(mem, phys, v);
+    return 0;
+}
+
+static int op_pop(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
+    uint32_t phys = translate_addr(cpu, mem, lin, VM_ACCESS_READ);
+    uint32_t v = vm_mem_read32(mem, phys);
+    cpu->esp += 4;
+    set_reg32(cpu, in->dst_reg, v);
+    return 0;
+}
+
+static int op_jmp(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    cpu->eip += (int32_t)(int8_t)in->imm + in->size;
+    return 0;
+}
+
+static int op_ret(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)in;
+    uint32_t lin = vm_cpu_linear_addr(cpu->ss, cpu->esp);
+    uint32_t phys = translate_addr(cpu, mem, lin, VM_ACCESS_READ);
+    uint16_t ip = vm_mem_read16(mem, phys);
+    cpu->esp += 2;
+    cpu->eip = ip;
+    return 0;
+}
+
+static void stack_push(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t v, uint32_t w) {
+    cpu->esp -= w;
+    uint32_t phys = translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp), VM_ACCESS_WRITE);
+    if (w == 4) vm_mem_write32(mem, phys, v);
+    else vm_mem_write16(mem, phys, (uint16_t)v);
+}
+
+static uint32_t stack_pop(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t w) {
+    uint32_t phys = translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ss, cpu->esp), VM_ACCESS_READ);
+    uint32_t v = (w == 4) ? vm_mem_read32(mem, phys) : vm_mem_read16(mem, phys);
+    cpu->esp += w;
+    return v;
+}
+
+/* Enter the handler for `vector` through IDTR, returning to the current
+ * CS:EIP. Real mode reads a 4-byte IP:CS vector from the IVT and pushes a
+ * 16-bit frame. With CR0.PE the 8-byte gate supplies the 32-bit offset and
+ * a 32-bit frame is pushed; there is no GDT, so the gate selector is not
+ * loaded and CS is kept. Returns -1, with nothing pushed, for a vector past
+ * the IDT limit or a gate that is not present. */
+static int exec_interrupt(vm_cpu_t *cpu, vm_mem_t *mem, uint32_t vector) {
+    int pe = (cpu->cr0 & VM_CR0_PE) != 0;
+    uint32_t ent = vector * (pe ? 8u : 4u);
+    if (ent + (pe ? 7u : 3u) > cpu->idt_limit) return -1;
+    uint32_t phys = translate_addr(cpu, mem, cpu->idt_base + ent, VM_ACCESS_READ);
+    if ((size_t)phys + (pe ? 8u : 4u) > mem->size) return -1;
+    uint8_t gate[8];
+    vm_mem_read(mem, phys, gate, pe ? 8 : 4);
+    if (pe && !(gate[5] & 0x80)) return -1;
+
+    vm_cpu_flags_commit(cpu);   /* the pushed image must be architectural */
+    uint32_t w = pe ? 4 : 2;
+    stack_push(cpu, mem, cpu->eflags, w);
+    stack_push(cpu, mem, cpu->cs, w);
+    stack_push(cpu, mem, cpu->eip, w);
+    cpu->eflags &= ~VM_FLAG_TF;
+    if (pe) {
+        cpu->eip = (uint32_t)gate[0] | ((uint32_t)gate[1] << 8) |
+                   ((uint32_t)gate[6] << 16) | ((uint32_t)gate[7] << 24);
+        if ((gate[5] & 0x0F) == 0x0E)    /* interrupt gate; trap gates keep IF */
+            cpu->eflags &= ~VM_FLAG_IF;
+    } else {
+        cpu->eip = (uint32_t)gate[0] | ((uint32_t)gate[1] << 8);
+        cpu->cs = (uint32_t)gate[2] | ((uint32_t)gate[3] << 8);
+        cpu->eflags &= ~VM_FLAG_IF;
+    }
+    return 0;
+}
+
+int vm_exec_interrupt(vm_cpu_t *cpu, vm_mem_t *mem, uint8_t vector) {
+    if (!cpu || !mem || exec_interrupt(cpu, mem, vector) != 0) return -1;
+    cpu->halted = 0;
+    return 0;
+}
+
+/* INT and IRET set EIP themselves; an INT through a missing vector falls
+ * through to the next instruction. */
+static int op_int(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    cpu->eip += in->size;
+    exec_interrupt(cpu, mem, in->imm & 0xFF);
+    return 0;
+}
+
+static int op_iret(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)in;
+    if (cpu->cr0 & VM_CR0_PE) {
+        cpu->eip = stack_pop(cpu, mem, 4);
+        stack_pop(cpu, mem, 4);           /* CS: see exec_interrupt */
+        vm_cpu_set_eflags(cpu, stack_pop(cpu, mem, 4));
+        return 0;
+    }
+    cpu->eip = stack_pop(cpu, mem, 2);
+    cpu->cs = stack_pop(cpu, mem, 2);
+    vm_cpu_set_eflags(cpu, (cpu->eflags & 0xFFFF0000) | stack_pop(cpu, mem, 2));
+    return 0;
+}
+
+static int op_lidt(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    uint32_t phys = translate_addr(cpu, mem, vm_cpu_linear_addr(cpu->ds, in->mem_addr), VM_ACCESS_READ);
+    cpu->idt_limit = vm_mem_read16(mem, phys);
+    cpu->idt_base = vm_mem_read32(mem, phys + 2);
+    return 0;
+}
+
+static int op_string(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    return exec_string(cpu, mem, in);
+}
+
+static int op_inc(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->dst_reg >= 0 && in->dst_reg < 8) {
+        uint32_t v = get_reg32(cpu, in->dst_reg) + 1;
+        set_reg32(cpu, in->dst_reg, v);
+    }
+    return 0;
+}
+
+static int op_dec(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->dst_reg >= 0 && in->dst_reg < 8) {
+        uint32_t v = get_reg32(cpu, in->dst_reg) - 1;
+        set_reg32(cpu, in->dst_reg, v);
+    }
+    return 0;
+}
+
+static int op_cmp(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    uint8_t al = get_reg8_lo(cpu, 0);
+    uint8_t imm = (uint8_t)(in->imm & 0xFF);
+    vm_cpu_set_lazy(cpu, VM_LAZY_SUB, 1, al, imm, (uint32_t)(al - imm));
+    return 0;
+}
+
+static int op_test(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    uint8_t al = get_reg8_lo(cpu, 0);
+    uint8_t imm = (uint8_t)(in->imm & 0xFF);
+    vm_cpu_set_lazy(cpu, VM_LAZY_LOGIC, 1, al, imm, al & imm);
+    return 0;
+}
+
+static int op_jz(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (vm_cpu_zf(cpu))
+        cpu->eip += (int32_t)(int8_t)in->imm + in->size;
+    return 0;
+}
+
+static int op_jnz(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (!vm_cpu_zf(cpu))
+        cpu->eip += (int32_t)(int8_t)in->imm + in->size;
+    return 0;
+}
+
+static int op_add(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->dst_reg >= 0 && in->dst_reg < 8) {
+        uint32_t a = get_reg32(cpu, in->dst_reg);
+        uint32_t b = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : (uint32_t)(int32_t)(int8_t)in->imm;
+        uint32_t r = a + b;
+        set_reg32(cpu, in->dst_reg, r);
+        vm_cpu_set_lazy(cpu, VM_LAZY_ADD, 4, a, b, r);
+    }
+    return 0;
+}
+
+static int op_sub(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->dst_reg >= 0 && in->dst_reg < 8) {
+        uint32_t a = get_reg32(cpu, in->dst_reg);
+        uint32_t b = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : (uint32_t)(int32_t)(int8_t)in->imm;
+        uint32_t r = a - b;
+        set_reg32(cpu, in->dst_reg, r);
+        vm_cpu_set_lazy(cpu, VM_LAZY_SUB, 4, a, b, r);
+    }
+    return 0;
+}
+
+static int op_mov_cr(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)mem;
+    if (in->imm == 0) {
+        uint32_t crval = (in->dst_reg == 0) ? cpu->cr0 : (in->dst_reg == 3) ? cpu->cr3 : 0;
+        if (in->src_reg >= 0 && in->src_reg < 8) set_reg32(cpu, in->src_reg, crval);
+    } else {
+        uint32_t val = (in->src_reg >= 0 && in->src_reg < 8) ? get_reg32(cpu, in->src_reg) : 0;
+        if (in->dst_reg == 0) vm_cpu_write_cr0(cpu, val);
+        else if (in->dst_reg == 3) vm_cpu_write_cr3(cpu, val);
+    }
+    return 0;
+}
+
+static int op_unknown(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    (void)cpu; (void)mem; (void)in;
+    return -1;
+}
+
+/* ---- switch dispatch ---- */
+
+int vm_exec_instr(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in) {
+    int rc;
+    VM_PROF_INSN(in->op, guest_eip_linear(cpu));
+    switch (in->op) {
+    case VM_OP_NOP:    rc = op_nop(cpu, mem, in); break;
+    case VM_OP_HLT:    rc = op_hlt(cpu, mem, in); break;
+    case VM_OP_CLI:    rc = op_cli(cpu, mem, in); break;
+    case VM_OP_STI:    rc = op_sti(cpu, mem, in); break;
+    case VM_OP_LIDT:   rc = op_lidt(cpu, mem, in); break;
+    case VM_OP_IN:     rc = op_in(cpu, mem, in); break;
+    case VM_OP_OUT:    rc = op_out(cpu, mem, in); break;
+    case VM_OP_IN_DX:  rc = op_in_dx(cpu, mem, in); break;
+    case VM_OP_OUT_DX: rc = op_out_dx(cpu, mem, in); break;
+    case VM_OP_INS:
+    case VM_OP_OUTS:   rc = op_string_io(cpu, mem, in); break;
+    case VM_OP_MOV:    rc = op_mov(cpu, mem, in); break;
+    case VM_OP_PUSH:   rc = op_push(cpu, mem, in); break;
+    case VM_OP_POP:    rc = op_pop(cpu, mem, in); break;
+    case VM_OP_JMP:    return op_jmp(cpu, mem, in);
+    case VM_OP_RET:    rc = op_ret(cpu, mem, in); break;
+    case VM_OP_INT:    return op_int(cpu, mem, in);
+    case VM_OP_IRET:   return op_iret(cpu, mem, in);
+    case VM_OP_MOVS:
+    case VM_OP_STOS:
+    case VM_OP_LODS:
+    case VM_OP_CMPS:
+    case VM_OP_SCAS:   rc = op_string(cpu, mem, in); break;
+    case VM_OP_INC:    rc = op_inc(cpu, mem, in); break;
+    case VM_OP_DEC:    rc = op_dec(cpu, mem, in); break;
+    case VM_OP_CMP:    rc = op_cmp(cpu, mem, in); break;
+    case VM_OP_TEST:   rc = op_test(cpu, mem, in); break;
+    case VM_OP_JZ:     rc = op_jz(cpu, mem, in); break;
+    case VM_OP_JNZ:    rc = op_jnz(cpu, mem, in); break;
+    case VM_OP_ADD:    rc = op_add(cpu, mem, in); break;
+    case VM_OP_SUB:    rc = op_sub(cpu, mem, in); break;
+    case VM_OP_MOV_CR: rc = op_mov_cr(cpu, mem, in); break;
+    default:
+        return op_unknown(cpu, mem, in);
+    }
+    if (rc == 0)
+        cpu->eip += in->size;
+    return rc;
+}
+
+/* Ops whose body leaves EIP at the next instruction itself. */
+static inline int exec_sets_eip(vm_opcode_t op) {
+    return op == VM_OP_JMP || op == VM_OP_INT || op == VM_OP_IRET;
+}
+
+/* A maskable interrupt is waiting: stop at the next block boundary so the
+ * run loop can deliver it. */
+static inline int exec_irq_ready(const vm_cpu_t *cpu) {
+    return (cpu->eflags & VM_FLAG_IF) && vm_io_intr();
+}
+
+/* Fetch the block at CS:EIP. */
+static vm_bblock_t *exec_fetch(vm_cpu_t *cpu, vm_mem_t *mem, vm_bcache_t *bc) {
+    uint32_t phys = translate_addr(cpu, mem, guest_eip_linear(cpu), VM_ACCESS_FETCH);
+    return vm_bcache_lookup(bc, phys);
+}
+
+static int run_switch(vm_cpu_t *cpu, vm_mem_t *mem, vm_bcache_t *bc, int max_instructions) {
+    int count = 0;
+    while (count < max_instructions && !cpu->halted && !exec_irq_ready(cpu)) {
+        vm_bblock_t *blk = exec_fetch(cpu, mem, bc);
+        if (!blk) break;
+        for (unsigned int i = 0; i < blk->count && count < max_instructions; i++) {
+            if (vm_exec_instr(cpu, mem, &blk->insns[i]) != 0) return count;
+            count++;
+            if (!blk->valid) break;   /* self-modifying store: re-decode */
+        }
+    }
+    return count;
+}
+
+/* ---- threaded dispatch ---- */
+
+#if !VM_EXEC_COMPUTED_GOTO
+static const vm_op_fn s_op_fns[VM_OP_UNKNOWN + 1] = {
+    [VM_OP_NOP] = op_nop,       [VM_OP_HLT] = op_hlt,
+    [VM_OP_IN] = op_in,         [VM_OP_OUT] = op_out,
+    [VM_OP_IN_DX] = op_in_dx,   [VM_OP_OUT_DX] = op_out_dx,
+    [VM_OP_MOV] = op_mov,       [VM_OP_ADD] = op_add,
+    [VM_OP_SUB] = op_sub,       [VM_OP_INC] = op_inc,
+    [VM_OP_DEC] = op_dec,       [VM_OP_CMP] = op_cmp,
+    [VM_OP_TEST] = op_test,     [VM_OP_PUSH] = op_push,
+    [VM_OP_POP] = op_pop,       [VM_OP_JMP] = op_jmp,
+    [VM_OP_JZ] = op_jz,         [VM_OP_JNZ] = op_jnz,
+    [VM_OP_INT] = op_int,       [VM_OP_IRET] = op_iret,
+    [VM_OP_RET] = op_ret,       [VM_OP_STOS] = op_string,
+    [VM_OP_MOV_CR] = op_mov_cr, [VM_OP_INS] = op_string_io,
+    [VM_OP_OUTS] = op_string_io, [VM_OP_MOVS] = op_string,
+    [VM_OP_LODS] = op_string,   [VM_OP_CMPS] = op_string,
+    [VM_OP_SCAS] = op_string,   [VM_OP_CLI] = op_cli,
+    [VM_OP_STI] = op_sti,       [VM_OP_LIDT] = op_lidt,
+    [VM_OP_UNKNOWN] = op_unknown,
+};
+#else
+static const void *const *s_op_labels;   /* set once, by exec_labels_init */
+#endif
+
+static int run_threaded(vm_cpu_t *cpu, vm_mem_t *mem, vm_bcache_t *bc, int max_instructions) {
+#if VM_EXEC_COMPUTED_GOTO
+    static const void *const labels[VM_OP_UNKNOWN + 1] = {
+        [VM_OP_NOP] = &&l_nop,       [VM_OP_HLT] = &&l_hlt,
+        [VM_OP_IN] = &&l_in,         [VM_OP_OUT] = &&l_out,
+        [VM_OP_IN_DX] = &&l_in_dx,   [VM_OP_OUT_DX] = &&l_out_dx,
+        [VM_OP_MOV] = &&l_mov,       [VM_OP_ADD] = &&l_add,
+        [VM_OP_SUB] = &&l_sub,       [VM_OP_INC] = &&l_inc,
+        [VM_OP_DEC] = &&l_dec,       [VM_OP_CMP] = &&l_cmp,
+        [VM_OP_TEST] = &&l_test,     [VM_OP_PUSH] = &&l_push,
+        [VM_OP_POP] = &&l_pop,       [VM_OP_JMP] = &&l_jmp,
+        [VM_OP_JZ] = &&l_jz,         [VM_OP_JNZ] = &&l_jnz,
+        [VM_OP_INT] = &&l_int,       [VM_OP_IRET] = &&l_iret,
+        [VM_OP_RET] = &&l_ret,       [VM_OP_STOS] = &&l_string,
+        [VM_OP_MOV_CR] = &&l_mov_cr, [VM_OP_INS] = &&l_string_io,
+        [VM_OP_OUTS] = &&l_string_io, [VM_OP_MOVS] = &&l_string,
+        [VM_OP_LODS] = &&l_string,   [VM_OP_CMPS] = &&l_string,
+        [VM_OP_SCAS] = &&l_string,   [VM_OP_CLI] = &&l_cli,
+        [VM_OP_STI] = &&l_sti,       [VM_OP_LIDT] = &&l_lidt,
+        [VM_OP_UNKNOWN] = &&l_unknown,
+    };
+    if (!cpu) {
+        s_op_labels = labels;
+        return 0;
+    }
+#endif
+    int count = 0;
+    while (count < max_instructions && !cpu->halted && !exec_irq_ready(cpu)) {
+        vm_bblock_t *blk = exec_fetch(cpu, mem, bc);
+        if (!blk) break;
+        vm_instr_t *in = blk->insns;
+        unsigned int n = blk->count;
+        if ((int)n > max_instructions - count)
+            n = (unsigned int)(max_instructions - count);
+        vm_instr_t *end = in + n;
+#if VM_EXEC_COMPUTED_GOTO
+/* Op body, then EIP/count bookkeeping and a direct jump to the next
+ * instruction's handler; leaves the block on its end or invalidation, and
+ * the run on a fault, as the switch path does. */
+#define VM_THREAD_OP(name, advance)                             \
+    l_##name:                                                   \
+        VM_PROF_INSN(in->op, guest_eip_linear(cpu));            \
+        if (op_##name(cpu, mem, in) != 0) return count;         \
+        if (advance) cpu->eip += in->size;                      \
+        count++;                                                \
+        if (++in == end || !blk->valid) goto block_done;        \
+        goto *in->handler;
+
+        goto *in->handler;
+        VM_THREAD_OP(nop, 1)
+        VM_THREAD_OP(hlt, 1)
+        VM_THREAD_OP(cli, 1)
+        VM_THREAD_OP(sti, 1)
+        VM_THREAD_OP(in, 1)
+        VM_THREAD_OP(out, 1)
+        VM_THREAD_OP(in_dx, 1)
+        VM_THREAD_OP(out_dx, 1)
+        VM_THREAD_OP(string_io, 1)
+        VM_THREAD_OP(mov, 1)
+        VM_THREAD_OP(push, 1)
+        VM_THREAD_OP(pop, 1)
+        VM_THREAD_OP(jmp, 0)
+        VM_THREAD_OP(ret, 1)
+        VM_THREAD_OP(int, 0)
+        VM_THREAD_OP(iret, 0)
+        VM_THREAD_OP(lidt, 1)
+        VM_THREAD_OP(string, 1)
+        VM_THREAD_OP(inc, 1)
+        VM_THREAD_OP(dec, 1)
+        VM_THREAD_OP(cmp, 1)
+        VM_THREAD_OP(test, 1)
+        VM_THREAD_OP(jz, 1)
+        VM_THREAD_OP(jnz, 1)
+        VM_THREAD_OP(add, 1)
+        VM_THREAD_OP(sub, 1)
+        VM_THREAD_OP(mov_cr, 1)
+#undef VM_THREAD_OP
+    l_unknown:
+        return count;
+    block_done:
+        continue;
+#else
+        for (; in < end; in++) {
+            VM_PROF_INSN(in->op, guest_eip_linear(cpu));
+            if (((vm_op_fn)in->handler)(cpu, mem, in) != 0) return count;
+            if (!exec_sets_eip(in->op))
+                cpu->eip += in->size;
+            count++;
+            if (!blk->valid) break;
+        }
+#endif
+    }
+    return count;
+}
+
+#if VM_EXEC_COMPUTED_GOTO
+/* The label table is exported once, whichever thread binds first. */
+static pthread_once_t s_op_labels_once = PTHREAD_ONCE_INIT;
+
+static void exec_labels_init(void) {
+    run_threaded(NULL, NULL, NULL, 0);
+}
+#endif
+
+static const void *exec_bind_op(vm_opcode_t op) {
+    if ((unsigned int)op > VM_OP_UNKNOWN) op = VM_OP_UNKNOWN;
+#if VM_EXEC_COMPUTED_GOTO
+    return s_op_labels[op];
+#else
+    return (const void *)s_op_fns[op];
+#endif
+}
+
+void vm_exec_bind(vm_bcache_t *bc) {
+    if (!bc || bc->bind == exec_bind_op) return;
+#if VM_EXEC_COMPUTED_GOTO
+    pthread_once(&s_op_labels_once, exec_labels_init);
+#endif
+    bc->bind = exec_bind_op;
+    vm_bcache_flush(bc);
+}
+
+int vm_exec_run(vm_cpu_t *cpu, vm_mem_t *mem, vm_bcache_t *bc, int max_instructions, vm_dispatch_t mode) {
+    if (!cpu || !mem || !bc) return 0;
+    if (mode == VM_DISPATCH_THREADED) {
+        vm_exec_bind(bc);
+        return run_threaded(cpu, mem, bc, max_instructions);
+    }
+    return run_switch(cpu, mem, bc, max_instructions);
+}
+
+const char *vm_dispatch_name(vm_dispatch_t mode) {
+    if (mode == VM_DISPATCH_THREADED)
+        return VM_EXEC_COMPUTED_GOTO ? "threaded (computed goto)" : "threaded (function pointer)";
+    return "switch";
+}
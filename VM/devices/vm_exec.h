@@ -0,0 +1,42 @@
+#ifndef VM_EXEC_H
+#define VM_EXEC_H
+
+#include "vm_bcache.h"
+#include "vm_cpu.h"
+#include "vm_decode.h"
+#include "vm_mem.h"
+
+/* Guest instruction execution over the decoded block cache. Both dispatch
+ * modes run the same per-op bodies:
+ *   SWITCH   - one central switch on vm_instr_t.op per instruction.
+ *   THREADED - each decoded instruction carries its handler, bound when the
+ *              block is decoded; handlers chain to the next instruction with
+ *              computed goto under GCC/Clang, or through a function-pointer
+ *              call elsewhere (or with -DVM_EXEC_NO_COMPUTED_GOTO). */
+typedef enum {
+    VM_DISPATCH_SWITCH,
+    VM_DISPATCH_THREADED,
+} vm_dispatch_t;
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_EXEC_NO_COMPUTED_GOTO)
+#define VM_EXEC_COMPUTED_GOTO 1
+#else
+#define VM_EXEC_COMPUTED_GOTO 0
+#endif
+
+/* Install handler binding on bc (flushing blocks decoded without it). */
+void vm_exec_bind(vm_bcache_t *bc);
+/* Execute one decoded instruction through the switch, EIP update included.
+ * Returns 0, or -1 for an op the executor does not implement. */
+int vm_exec_instr(vm_cpu_t *cpu, vm_mem_t *mem, vm_instr_t *in);
+/* Execute up to max_instructions from CS:EIP. Returns the count executed
+ * (HLT included); stops early on halt, on an undecodable/unknown op, or at
+ * a block boundary once IF is set and the PIC asserts INTR. */
+int vm_exec_run(vm_cpu_t *cpu, vm_mem_t *mem, vm_bcache_t *bc, int max_instructions, vm_dispatch_t mode);
+/* Deliver an external interrupt at the current instruction boundary via
+ * the IVT (real mode) or IDT (CR0.PE); wakes a halted CPU. Returns -1 if
+ * the vector has no usable entry. */
+int vm_exec_interrupt(vm_cpu_t *cpu, vm_mem_t *mem, uint8_t vector);
+const char *vm_dispatch_name(vm_dispatch_t mode);
+
+#endif /* VM_EXEC_H */
@@ -6,6 +6,7 @@
 #include "mem_asm.h"
 #include "fl/driver/driver_types.h"
 #include <stdlib.h>
+#include <time.h>
 
 static const uint8_t s_minimal_guest[] = {
     0xB0, 'F', 0xE6, 0xF8, 0xB0, 'l', 0xE6, 0xF8, 0xB0, 'i', 0xE6, 0xF8,
@@ -22,17 +23,31 @@ static const uint16_t s_vga_msg[] = {
 };
 
 int vm_host_create(vm_host_t *host) {
+    return vm_host_create_sized(host, GUEST_RAM_SIZE, 0);
+}
+
+int vm_host_create_sized(vm_host_t *host, size_t ram_size, unsigned int mem_flags) {
     if (!host) return -1;
     asm_mem_zero(host, sizeof(*host));
-    if (vm_mem_init(&host->mem) != 0) return -1;
+    if (vm_mem_init_size(&host->mem, ram_size, mem_flags) != 0) return -1;
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&host->event_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&host->event_lock, NULL);
+    }
     vm_cpu_init(&host->cpu);
     host->running = 1;
     if (vm_load_binary(&host->mem, GUEST_LOAD_ADDR, s_minimal_guest, sizeof(s_minimal_guest)) != 0) {
-        vm_mem_destroy(&host->mem);
+        vm_host_destroy(host);
         return -1;
     }
-    if (GUEST_VGA_BASE + sizeof(s_vga_msg) <= host->mem.size)
+    if (GUEST_VGA_BASE + sizeof(s_vga_msg) <= host->mem.size) {
         asm_mem_copy(host->mem.ram + GUEST_VGA_BASE, s_vga_msg, sizeof(s_vga_msg));
+        vm_mem_note_write(&host->mem, GUEST_VGA_BASE, sizeof(s_vga_msg));
+    }
     host->cpu.eip = VM_BOOT_ENTRY_IP;
     host->cpu.cs = VM_BOOT_ENTRY_CS;
     return 0;
@@ -41,6 +56,8 @@ int vm_host_create(vm_host_t *host) {
 void vm_host_destroy(vm_host_t *host) {
     if (!host) return;
     vm_mem_destroy(&host->mem);
+    pthread_cond_destroy(&host->event_cond);
+    pthread_mutex_destroy(&host->event_lock);
     asm_mem_zero(host, sizeof(*host));
 }
 
@@ -67,6 +84,7 @@ int vm_host_kbd_push(vm_host_t *host, uint8_t scancode) {
     if (next == host->kbd_head) return -1;
     host->kbd_queue[host->kbd_tail] = scancode;
     host->kbd_tail = next;
+    vm_host_notify(host);
     return 0;
 }
 
@@ -78,6 +96,47 @@ int vm_host_kbd_pop(vm_host_t *host, uint8_t *out) {
     return 0;
 }
 
+int vm_host_kbd_pending(vm_host_t *host) {
+    return host ? host->kbd_head != host->kbd_tail : 0;
+}
+
+void vm_host_notify(vm_host_t *host) {
+    if (!host) return;
+    pthread_mutex_lock(&host->event_lock);
+    host->events++;
+    pthread_cond_broadcast(&host->event_cond);
+    pthread_mutex_unlock(&host->event_lock);
+}
+
+uint64_t vm_host_events(vm_host_t *host) {
+    if (!host) return 0;
+    pthread_mutex_lock(&host->event_lock);
+    uint64_t n = host->events;
+    pthread_mutex_unlock(&host->event_lock);
+    return n;
+}
+
+int vm_host_wait(vm_host_t *host, uint64_t seen, uint64_t timeout_ns) {
+    if (!host) return 0;
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += (time_t)(timeout_ns / 1000000000ULL);
+    until.tv_nsec += (long)(timeout_ns % 1000000000ULL);
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    int woke = 0;
+    pthread_mutex_lock(&host->event_lock);
+    while (host->events == seen) {
+        if (pthread_cond_timedwait(&host->event_cond, &host->event_lock, &until) != 0)
+            break;
+    }
+    woke = host->events != seen;
+    pthread_mutex_unlock(&host->event_lock);
+    return woke;
+}
+
 void vm_host_pause(vm_host_t *host) {
     if (host) host->paused = 1;
 }
@@ -94,8 +153,10 @@ void vm_host_reset(vm_host_t *host) {
     if (!host) return;
     vm_mem_zero(&host->mem);
     vm_load_binary(&host->mem, GUEST_LOAD_ADDR, s_minimal_guest, sizeof(s_minimal_guest));
-    if (GUEST_VGA_BASE + sizeof(s_vga_msg) <= host->mem.size)
+    if (GUEST_VGA_BASE + sizeof(s_vga_msg) <= host->mem.size) {
         asm_mem_copy(host->mem.ram + GUEST_VGA_BASE, s_vga_msg, sizeof(s_vga_msg));
+        vm_mem_note_write(&host->mem, GUEST_VGA_BASE, sizeof(s_vga_msg));
+    }
     vm_cpu_init(&host->cpu);
     host->cpu.eip = VM_BOOT_ENTRY_IP;
     host->cpu.cs = VM_BOOT_ENTRY_CS;
@@ -109,5 +170,5 @@ void vm_host_dump_registers(const vm_host_t *host, FILE *out) {
     fprintf(out, "EAX=%08X ECX=%08X EDX=%08X EBX=%08X\n", c->eax, c->ecx, c->edx, c->ebx);
     fprintf(out, "ESP=%08X EBP=%08X ESI=%08X EDI=%08X\n", c->esp, c->ebp, c->esi, c->edi);
     fprintf(out, "EIP=%08X CS=%04X DS=%04X SS=%04X ES=%04X\n", c->eip, c->cs & 0xFFFF, c->ds & 0xFFFF, c->ss & 0xFFFF, c->es & 0xFFFF);
-    fprintf(out, "CR0=%08X CR3=%08X EFLAGS=%08X %s\n", c->cr0, c->cr3, c->eflags, c->halted ? "[HALTED]" : "");
+    fprintf(out, "CR0=%08X CR3=%08X EFLAGS=%08X %s\n", c->cr0, c->cr3, vm_cpu_eflags(c), c->halted ? "[HALTED]" : "");
 }
@@ -3,6 +3,7 @@
 
 #include "vm_mem.h"
 #include "vm_cpu.h"
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,11 +17,19 @@ typedef struct vm_host {
     size_t kbd_head;
     size_t kbd_tail;
     uint64_t vm_ticks;   /* deterministic virtual tick (PIT, timer) */
+    uint64_t vm_clock;   /* virtual time: retired instructions plus idle skips */
     int running;
     int paused;          /* monitor: when set, CPU not run unless step */
+    /* Host-side wake events (keyboard input, device completions) for a run
+     * loop sleeping on an idle vCPU; may be raised from any thread. */
+    pthread_mutex_t event_lock;
+    pthread_cond_t event_cond;
+    uint64_t events;
 } vm_host_t;
 
 int vm_host_create(vm_host_t *host);
+/* As vm_host_create with ram_size bytes of guest RAM (vm_mem_init_size). */
+int vm_host_create_sized(vm_host_t *host, size_t ram_size, unsigned int mem_flags);
 void vm_host_destroy(vm_host_t *host);
 vm_mem_t *vm_host_mem(vm_host_t *host);
 vm_cpu_t *vm_host_cpu(vm_host_t *host);
@@ -28,6 +37,13 @@ uint64_t vm_host_ticks(vm_host_t *host);
 void vm_host_tick_advance(vm_host_t *host, unsigned int step);
 int vm_host_kbd_push(vm_host_t *host, uint8_t scancode);
 int vm_host_kbd_pop(vm_host_t *host, uint8_t *out);
+int vm_host_kbd_pending(vm_host_t *host);
+/* Raise a wake event. vm_host_kbd_push does this itself. */
+void vm_host_notify(vm_host_t *host);
+uint64_t vm_host_events(vm_host_t *host);
+/* Sleep until an event newer than `seen` or timeout_ns elapses.
+ * Returns 1 when woken by an event, 0 on timeout. */
+int vm_host_wait(vm_host_t *host, uint64_t seen, uint64_t timeout_ns);
 void vm_host_pause(vm_host_t *host);
 void vm_host_resume(vm_host_t *host);
 int vm_host_is_paused(vm_host_t *host);
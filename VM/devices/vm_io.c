@@ -3,6 +3,8 @@
 #include "vm_cpu.h"
 #include "vm_host.h"
 #include "vm_disk.h"
+#include "vm_uart.h"
+#include "vm_pic.h"
 #include "fl/syscall.h"
 #include "mem_asm.h"
 #include "mem_domain.h"
@@ -11,32 +13,110 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
 
 /* vm_io.c requires 64-bit uintptr_t for syscall bridge (write_port_width shifts by 32) */
 _Static_assert(sizeof(uintptr_t) >= 8, "vm_io.c requires 64-bit uintptr_t");
 
-static FILE *s_serial_out;
 
 /* SECTOR_SIZE from driver_types.h */
 #define PCI_CFG_ADDR  0xCF8
 #define PCI_CFG_DATA  0xCFC
 #define PCI_CFG_RESET 0xCF9
-#define VM_PCI_DEV_MAX 4
+#define VM_PCI_DEV_MAX 5
 #define PCI_CFG_SIZE  256
 
-static uint8_t s_sector_buf[SECTOR_SIZE];
-static uint32_t s_ide_lba;
-static int s_ide_byte_idx;
-static uint8_t s_pit_mode;
-static vm_host_t *s_host;
-static uint32_t s_pci_addr;
-static int s_reset_requested;
-/* Virtual PCI config: bus 0, dev 0..3. ASM-backed via mem_domain. */
-static uint8_t *s_pci_cfg;
-static uintptr_t s_sys_no;
-static uintptr_t s_sys_args[4];
-static long s_sys_ret;
-static int s_io_inited;
+#define IDE_CMD_READ          0x20
+#define IDE_CMD_READ_NORETRY  0x21
+#define IDE_CMD_WRITE         0x30
+#define IDE_CMD_WRITE_NORETRY 0x31
+#define IDE_CMD_READ_MULTIPLE 0xC4
+#define IDE_CMD_WRITE_MULTIPLE 0xC5
+#define IDE_CMD_SET_MULTIPLE  0xC6
+#define IDE_CMD_FLUSH         0xE7
+#define IDE_CMD_FLUSH_EXT     0xEA
+#define IDE_ST_ERR  0x01
+#define IDE_ST_DRQ  0x08
+#define IDE_ST_DRDY 0x40
+#define IDE_ERR_ABRT 0x04
+#define IDE_DEFAULT_MULTIPLE 16
+
+#define VM_IRQ_PIT  0
+#define VM_IRQ_KBD  1
+#define VM_IRQ_IDE  14
+
+#define PVB_ISR_DONE 0x01
+
+typedef enum { IDE_XFER_NONE, IDE_XFER_READ, IDE_XFER_WRITE } ide_xfer_t;
+
+/* Port dispatch: port_map[port] indexes handlers; slot 0 is the unclaimed-
+ * port handler (reads 0xFF, writes ignored). */
+#define VM_IO_HANDLER_MAX 32
+typedef struct vm_io_handler {
+    vm_io_read_fn read;
+    vm_io_write_fn write;
+    void *ctx;
+} vm_io_handler_t;
+typedef struct vm_io_port_stat {
+    uint64_t reads;
+    uint64_t writes;
+} vm_io_port_stat_t;
+
+/* Guest-visible device registers: what a reset baseline captures. */
+typedef struct vm_io_dev {
+    vm_uart_t uart;
+    vm_pic_t pic;
+    uint8_t sector_buf[SECTOR_SIZE];
+    uint32_t ide_lba;
+    int ide_byte_idx;
+    /* Command state. With no command in flight the data port keeps the
+     * legacy behaviour: a single sector streamed at ide_lba. */
+    uint8_t ide_count;
+    uint8_t ide_multiple;
+    uint8_t ide_status;
+    uint8_t ide_error;
+    ide_xfer_t ide_xfer;
+    uint32_t ide_xfer_lba;
+    uint32_t ide_remaining;
+    uint8_t pit_mode;
+    uint32_t pci_addr;
+    /* Paravirtual block ring (PCI dev 4). */
+    uint32_t pvb_ring_addr;
+    uint32_t pvb_ring_size;
+    uint32_t pvb_avail;
+    uint32_t pvb_used;
+    uint32_t pvb_isr;
+    int reset_requested;
+    uintptr_t sys_no;
+    uintptr_t sys_args[4];
+    long sys_ret;
+} vm_io_dev_t;
+
+/* Device state of one guest. */
+struct vm_io_state {
+    vm_io_dev_t dev;
+    vm_host_t *host;
+    /* Virtual PCI config: bus 0, dev 0..4. ASM-backed via mem_domain. */
+    uint8_t *pci_cfg;
+    int io_inited;
+    vm_io_handler_t io_handlers[VM_IO_HANDLER_MAX];
+    unsigned io_handler_count;
+    uint8_t *port_map;
+    vm_io_port_stat_t *port_stats;
+    /* Reset baseline (vm_io_baseline_capture). */
+    vm_io_dev_t base_dev;
+    uint8_t *base_pci_cfg;
+    int has_base;
+};
+
+/* Each thread starts on the process-wide instance; vm_io_bind switches it
+ * to a guest's own. */
+static vm_io_state_t s_io_default;
+static _Thread_local vm_io_state_t *s_io = &s_io_default;
+
+/* The syscall bridge backend is shared by every guest in the process. */
+static pthread_mutex_t s_sys_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int s_sys_users;
 
 #define VM_SYS_PORT_NO      0xE0
 #define VM_SYS_PORT_ARG0    0xE1
@@ -97,7 +177,7 @@ static uintptr_t vm_sys_arg_to_host_ptr(vm_mem_t *mem, uintptr_t arg, size_t len
 }
 
 static void vm_translate_sys_args(vm_mem_t *mem, uintptr_t args[4]) {
-    switch ((fl_syscall_no_t)s_sys_no) {
+    switch ((fl_syscall_no_t)s_io->dev.sys_no) {
         case FL_SYS_WRITE:
         case FL_SYS_READ:
             args[0] = vm_sys_arg_to_host_ptr(mem, args[0], (size_t)args[1]);
@@ -113,117 +193,633 @@ static void vm_translate_sys_args(vm_mem_t *mem, uintptr_t args[4]) {
     }
 }
 
+/* Syscalls that fill a guest buffer write RAM behind vm_mem's back. */
+static void vm_sys_note_guest_write(vm_mem_t *mem) {
+    switch ((fl_syscall_no_t)s_io->dev.sys_no) {
+        case FL_SYS_READ:
+            vm_mem_note_write(mem, (uint32_t)s_io->dev.sys_args[0], (size_t)s_io->dev.sys_args[1]);
+            break;
+        case FL_SYS_PIPE_READ:
+        case FL_SYS_MSGQ_RECV:
+            vm_mem_note_write(mem, (uint32_t)s_io->dev.sys_args[1], (size_t)s_io->dev.sys_args[2]);
+            break;
+        default:
+            break;
+    }
+}
+
 static void vm_pci_init_cfg(void) {
-    if (s_pci_cfg)
-        mem_domain_free(MEM_DOMAIN_DRIVER, s_pci_cfg);
-    s_pci_cfg = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
-    if (!s_pci_cfg) return;
-    asm_mem_zero(s_pci_cfg, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
+    if (s_io->pci_cfg)
+        mem_domain_free(MEM_DOMAIN_DRIVER, s_io->pci_cfg);
+    s_io->pci_cfg = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
+    if (!s_io->pci_cfg) return;
+    asm_mem_zero(s_io->pci_cfg, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
     /* Dev 0: Host bridge - 0x1234:0x0001, class 0600 */
-    s_pci_cfg[0*PCI_CFG_SIZE + 0] = 0x34; s_pci_cfg[0*PCI_CFG_SIZE + 1] = 0x12;
-    s_pci_cfg[0*PCI_CFG_SIZE + 2] = 0x01; s_pci_cfg[0*PCI_CFG_SIZE + 3] = 0x00;
-    s_pci_cfg[0*PCI_CFG_SIZE + 9] = 0x00; s_pci_cfg[0*PCI_CFG_SIZE + 10] = 0x06; s_pci_cfg[0*PCI_CFG_SIZE + 11] = 0x00;
+    s_io->pci_cfg[0*PCI_CFG_SIZE + 0] = 0x34; s_io->pci_cfg[0*PCI_CFG_SIZE + 1] = 0x12;
+    s_io->pci_cfg[0*PCI_CFG_SIZE + 2] = 0x01; s_io->pci_cfg[0*PCI_CFG_SIZE + 3] = 0x00;
+    s_io->pci_cfg[0*PCI_CFG_SIZE + 9] = 0x00; s_io->pci_cfg[0*PCI_CFG_SIZE + 10] = 0x06; s_io->pci_cfg[0*PCI_CFG_SIZE + 11] = 0x00;
     /* Dev 1: IDE - 0x1234:0x1111, class 0101 */
-    s_pci_cfg[1*PCI_CFG_SIZE + 0] = 0x34; s_pci_cfg[1*PCI_CFG_SIZE + 1] = 0x12;
-    s_pci_cfg[1*PCI_CFG_SIZE + 2] = 0x11; s_pci_cfg[1*PCI_CFG_SIZE + 3] = 0x11;
-    s_pci_cfg[1*PCI_CFG_SIZE + 9] = 0x01; s_pci_cfg[1*PCI_CFG_SIZE + 10] = 0x01; s_pci_cfg[1*PCI_CFG_SIZE + 11] = 0x00;
+    s_io->pci_cfg[1*PCI_CFG_SIZE + 0] = 0x34; s_io->pci_cfg[1*PCI_CFG_SIZE + 1] = 0x12;
+    s_io->pci_cfg[1*PCI_CFG_SIZE + 2] = 0x11; s_io->pci_cfg[1*PCI_CFG_SIZE + 3] = 0x11;
+    s_io->pci_cfg[1*PCI_CFG_SIZE + 9] = 0x01; s_io->pci_cfg[1*PCI_CFG_SIZE + 10] = 0x01; s_io->pci_cfg[1*PCI_CFG_SIZE + 11] = 0x00;
     /* Dev 2: VGA - 0x1234:0x2222, class 0300 */
-    s_pci_cfg[2*PCI_CFG_SIZE + 0] = 0x34; s_pci_cfg[2*PCI_CFG_SIZE + 1] = 0x12;
-    s_pci_cfg[2*PCI_CFG_SIZE + 2] = 0x22; s_pci_cfg[2*PCI_CFG_SIZE + 3] = 0x22;
-    s_pci_cfg[2*PCI_CFG_SIZE + 9] = 0x00; s_pci_cfg[2*PCI_CFG_SIZE + 10] = 0x03; s_pci_cfg[2*PCI_CFG_SIZE + 11] = 0x00;
+    s_io->pci_cfg[2*PCI_CFG_SIZE + 0] = 0x34; s_io->pci_cfg[2*PCI_CFG_SIZE + 1] = 0x12;
+    s_io->pci_cfg[2*PCI_CFG_SIZE + 2] = 0x22; s_io->pci_cfg[2*PCI_CFG_SIZE + 3] = 0x22;
+    s_io->pci_cfg[2*PCI_CFG_SIZE + 9] = 0x00; s_io->pci_cfg[2*PCI_CFG_SIZE + 10] = 0x03; s_io->pci_cfg[2*PCI_CFG_SIZE + 11] = 0x00;
     /* Dev 3: KBD - 0x1234:0x3333, class 0C03 */
-    s_pci_cfg[3*PCI_CFG_SIZE + 0] = 0x34; s_pci_cfg[3*PCI_CFG_SIZE + 1] = 0x12;
-    s_pci_cfg[3*PCI_CFG_SIZE + 2] = 0x33; s_pci_cfg[3*PCI_CFG_SIZE + 3] = 0x33;
-    s_pci_cfg[3*PCI_CFG_SIZE + 9] = 0x03; s_pci_cfg[3*PCI_CFG_SIZE + 10] = 0x0C; s_pci_cfg[3*PCI_CFG_SIZE + 11] = 0x00;
+    s_io->pci_cfg[3*PCI_CFG_SIZE + 0] = 0x34; s_io->pci_cfg[3*PCI_CFG_SIZE + 1] = 0x12;
+    s_io->pci_cfg[3*PCI_CFG_SIZE + 2] = 0x33; s_io->pci_cfg[3*PCI_CFG_SIZE + 3] = 0x33;
+    s_io->pci_cfg[3*PCI_CFG_SIZE + 9] = 0x03; s_io->pci_cfg[3*PCI_CFG_SIZE + 10] = 0x0C; s_io->pci_cfg[3*PCI_CFG_SIZE + 11] = 0x00;
+    /* Dev 4: paravirtual block - 0x1234:0x4444, class 0180, BAR0 I/O, IRQ line */
+    s_io->pci_cfg[4*PCI_CFG_SIZE + 0] = 0x34; s_io->pci_cfg[4*PCI_CFG_SIZE + 1] = 0x12;
+    s_io->pci_cfg[4*PCI_CFG_SIZE + 2] = 0x44; s_io->pci_cfg[4*PCI_CFG_SIZE + 3] = 0x44;
+    s_io->pci_cfg[4*PCI_CFG_SIZE + 9] = 0x00; s_io->pci_cfg[4*PCI_CFG_SIZE + 10] = 0x80; s_io->pci_cfg[4*PCI_CFG_SIZE + 11] = 0x01;
+    s_io->pci_cfg[4*PCI_CFG_SIZE + 0x10] = (uint8_t)(VM_PVB_PORT_BASE | 1); s_io->pci_cfg[4*PCI_CFG_SIZE + 0x11] = (uint8_t)(VM_PVB_PORT_BASE >> 8);
+    s_io->pci_cfg[4*PCI_CFG_SIZE + 0x3C] = VM_PVB_IRQ; s_io->pci_cfg[4*PCI_CFG_SIZE + 0x3D] = 0x01;
+}
+
+static void vm_io_register_devices(void);
+
+/* Port map and counters are sized for the full 64K port space. */
+static void vm_io_ports_init(void) {
+    if (!s_io->port_map)
+        s_io->port_map = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_IO_PORT_COUNT);
+    if (!s_io->port_stats)
+        s_io->port_stats = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_IO_PORT_COUNT * sizeof(*s_io->port_stats));
+    asm_mem_zero(s_io->io_handlers, sizeof(s_io->io_handlers));
+    s_io->io_handler_count = 1;
+    if (!s_io->port_map || !s_io->port_stats) return;
+    asm_mem_zero(s_io->port_map, VM_IO_PORT_COUNT);
+    asm_mem_zero(s_io->port_stats, VM_IO_PORT_COUNT * sizeof(*s_io->port_stats));
+    vm_io_register_devices();
 }
 
 void vm_io_init(void) {
-    s_host = NULL;
-    s_reset_requested = 0;
-    s_pci_addr = 0;
-    asm_mem_zero(s_sector_buf, SECTOR_SIZE);
+    s_io->host = NULL;
+    s_io->dev.reset_requested = 0;
+    s_io->dev.pci_addr = 0;
+    asm_mem_zero(s_io->dev.sector_buf, SECTOR_SIZE);
     vm_pci_init_cfg();
-    s_ide_lba = 0;
-    s_ide_byte_idx = SECTOR_SIZE;
-    s_serial_out = stdout;
-    s_sys_no = 0;
-    asm_mem_zero(s_sys_args, sizeof(s_sys_args));
-    s_sys_ret = 0;
-    fl_sys_bootstrap();
-    s_io_inited = 1;
+    s_io->dev.ide_lba = 0;
+    s_io->dev.ide_byte_idx = SECTOR_SIZE;
+    s_io->dev.ide_count = 1;
+    s_io->dev.ide_multiple = IDE_DEFAULT_MULTIPLE;
+    s_io->dev.ide_status = IDE_ST_DRDY;
+    s_io->dev.ide_error = 0;
+    s_io->dev.ide_xfer = IDE_XFER_NONE;
+    s_io->dev.ide_remaining = 0;
+    s_io->dev.pvb_ring_addr = 0;
+    s_io->dev.pvb_ring_size = 0;
+    s_io->dev.pvb_avail = 0;
+    s_io->dev.pvb_used = 0;
+    s_io->dev.pvb_isr = 0;
+    vm_uart_init(&s_io->dev.uart, stdout);
+    vm_pic_init(&s_io->dev.pic);
+    s_io->dev.sys_no = 0;
+    asm_mem_zero(s_io->dev.sys_args, sizeof(s_io->dev.sys_args));
+    s_io->dev.sys_ret = 0;
+    vm_io_ports_init();
+    if (!s_io->io_inited) {
+        pthread_mutex_lock(&s_sys_lock);
+        if (s_sys_users++ == 0)
+            fl_sys_bootstrap();
+        pthread_mutex_unlock(&s_sys_lock);
+    }
+    s_io->io_inited = 1;
 }
 
 int vm_io_reset_requested(void) {
-    return s_reset_requested;
+    return s_io->dev.reset_requested;
 }
 void vm_io_clear_reset(void) {
-    s_reset_requested = 0;
+    s_io->dev.reset_requested = 0;
+}
+
+void vm_io_poll(void) {
+    vm_uart_poll(&s_io->dev.uart, vm_host_ticks(s_io->host));
+    vm_pic_raise(&s_io->dev.pic, VM_IRQ_PIT);
+    /* The controller re-asserts IRQ1 while scancodes wait, once the
+     * previous one has been serviced. */
+    if (s_io->host && vm_host_kbd_pending(s_io->host) &&
+        !(s_io->dev.pic.chip[VM_PIC_MASTER].isr & (1u << VM_IRQ_KBD)))
+        vm_pic_raise(&s_io->dev.pic, VM_IRQ_KBD);
+}
+
+void vm_io_raise_irq(unsigned int irq) {
+    vm_pic_raise(&s_io->dev.pic, irq);
+}
+
+int vm_io_intr(void) {
+    return vm_pic_intr(&s_io->dev.pic);
+}
+
+int vm_io_inta(void) {
+    return vm_pic_ack(&s_io->dev.pic);
+}
+
+void vm_io_flush(void) {
+    vm_uart_flush(&s_io->dev.uart);
 }
 
 void vm_io_shutdown(void) {
-    s_host = NULL;
-    if (s_pci_cfg) {
-        mem_domain_free(MEM_DOMAIN_DRIVER, s_pci_cfg);
-        s_pci_cfg = NULL;
+    vm_uart_flush(&s_io->dev.uart);
+    s_io->host = NULL;
+    if (s_io->pci_cfg) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, s_io->pci_cfg);
+        s_io->pci_cfg = NULL;
+    }
+    if (s_io->port_map) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, s_io->port_map);
+        s_io->port_map = NULL;
+    }
+    if (s_io->port_stats) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, s_io->port_stats);
+        s_io->port_stats = NULL;
+    }
+    if (s_io->base_pci_cfg) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, s_io->base_pci_cfg);
+        s_io->base_pci_cfg = NULL;
+    }
+    s_io->has_base = 0;
+    s_io->io_handler_count = 0;
+    if (s_io->io_inited) {
+        pthread_mutex_lock(&s_sys_lock);
+        if (--s_sys_users == 0)
+            fl_sys_shutdown();
+        pthread_mutex_unlock(&s_sys_lock);
+    }
+    s_io->io_inited = 0;
+}
+
+/* Port table, handlers and counters are left alone: only registers the
+ * guest can observe move, so a reset costs a few hundred bytes of copy. */
+int vm_io_baseline_capture(void) {
+    if (!s_io->io_inited) return -1;
+    vm_uart_flush(&s_io->dev.uart);
+    if (s_io->pci_cfg) {
+        if (!s_io->base_pci_cfg)
+            s_io->base_pci_cfg = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
+        if (!s_io->base_pci_cfg) return -1;
+        asm_mem_copy(s_io->base_pci_cfg, s_io->pci_cfg, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
     }
-    fl_sys_shutdown();
-    s_io_inited = 0;
+    asm_mem_copy(&s_io->base_dev, &s_io->dev, sizeof(s_io->dev));
+    s_io->has_base = 1;
+    return 0;
+}
+
+int vm_io_baseline_restore(void) {
+    if (!s_io->has_base) return -1;
+    vm_uart_flush(&s_io->dev.uart);
+    FILE *out = s_io->dev.uart.out;
+    asm_mem_copy(&s_io->dev, &s_io->base_dev, sizeof(s_io->dev));
+    s_io->dev.uart.out = out;
+    if (s_io->pci_cfg && s_io->base_pci_cfg)
+        asm_mem_copy(s_io->pci_cfg, s_io->base_pci_cfg, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
+    return 0;
+}
+
+/* Register blob: one explicit list of fixed-width little-endian fields
+ * drives measuring, saving and loading, so the three cannot drift apart.
+ * Host-side state (serial stream, statistics) is not part of it. */
+typedef struct regs_codec {
+    uint8_t *out;           /* save; NULL with in == NULL measures */
+    const uint8_t *in;      /* load */
+    size_t off;
+} regs_codec_t;
+
+static void rc_bytes(regs_codec_t *c, void *p, size_t n) {
+    if (c->out) asm_mem_copy(c->out + c->off, p, n);
+    else if (c->in) asm_mem_copy(p, c->in + c->off, n);
+    c->off += n;
+}
+
+static uint64_t rc_int(regs_codec_t *c, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        if (c->out) c->out[c->off + (size_t)i] = (uint8_t)(v >> (8 * i));
+        else if (c->in) v = (i ? v : 0) | ((uint64_t)c->in[c->off + (size_t)i] << (8 * i));
+    }
+    c->off += (size_t)bytes;
+    return v;
+}
+
+#define RC_FIELD(c, lval, bytes) ((lval) = rc_int((c), (uint64_t)(lval), (bytes)))
+
+static void regs_codec(regs_codec_t *c, vm_io_dev_t *d, uint8_t *pci) {
+    vm_uart_t *u = &d->uart;
+    RC_FIELD(c, u->len, 4);
+    rc_bytes(c, u->fifo, sizeof(u->fifo));
+    RC_FIELD(c, u->pending_since, 8);
+    RC_FIELD(c, u->ier, 1);
+    RC_FIELD(c, u->lcr, 1);
+    RC_FIELD(c, u->mcr, 1);
+    RC_FIELD(c, u->scr, 1);
+    RC_FIELD(c, u->dll, 1);
+    RC_FIELD(c, u->dlm, 1);
+    for (int i = 0; i < 2; i++) {
+        vm_pic_chip_t *ch = &d->pic.chip[i];
+        RC_FIELD(c, ch->irr, 1);
+        RC_FIELD(c, ch->isr, 1);
+        RC_FIELD(c, ch->imr, 1);
+        RC_FIELD(c, ch->base, 1);
+        RC_FIELD(c, ch->init_step, 1);
+        RC_FIELD(c, ch->need_icw4, 1);
+        RC_FIELD(c, ch->single, 1);
+        RC_FIELD(c, ch->auto_eoi, 1);
+        RC_FIELD(c, ch->read_isr, 1);
+    }
+    rc_bytes(c, d->sector_buf, sizeof(d->sector_buf));
+    RC_FIELD(c, d->ide_lba, 4);
+    RC_FIELD(c, d->ide_byte_idx, 4);
+    RC_FIELD(c, d->ide_count, 1);
+    RC_FIELD(c, d->ide_multiple, 1);
+    RC_FIELD(c, d->ide_status, 1);
+    RC_FIELD(c, d->ide_error, 1);
+    RC_FIELD(c, d->ide_xfer, 1);
+    RC_FIELD(c, d->ide_xfer_lba, 4);
+    RC_FIELD(c, d->ide_remaining, 4);
+    RC_FIELD(c, d->pit_mode, 1);
+    RC_FIELD(c, d->pci_addr, 4);
+    RC_FIELD(c, d->pvb_ring_addr, 4);
+    RC_FIELD(c, d->pvb_ring_size, 4);
+    RC_FIELD(c, d->pvb_avail, 4);
+    RC_FIELD(c, d->pvb_used, 4);
+    RC_FIELD(c, d->pvb_isr, 4);
+    RC_FIELD(c, d->reset_requested, 1);
+    RC_FIELD(c, d->sys_no, 8);
+    for (int i = 0; i < 4; i++)
+        RC_FIELD(c, d->sys_args[i], 8);
+    RC_FIELD(c, d->sys_ret, 8);
+    rc_bytes(c, pci, VM_PCI_DEV_MAX * PCI_CFG_SIZE);
+}
+
+/* Decode buf over a copy of the live registers (fields outside the blob
+ * keep their values) and reject values the device could not hold. */
+static int regs_decode(const void *buf, size_t len, vm_io_dev_t *d, uint8_t *pci) {
+    if (!s_io->io_inited || !buf || len != vm_io_regs_size()) return -1;
+    asm_mem_copy(d, &s_io->dev, sizeof(*d));
+    regs_codec_t c = { NULL, buf, 0 };
+    regs_codec(&c, d, pci);
+    uint32_t ring = d->pvb_ring_size;
+    if (d->uart.len > VM_UART_FIFO_SIZE || d->ide_byte_idx < 0 || d->ide_byte_idx > SECTOR_SIZE ||
+        d->ide_xfer > IDE_XFER_WRITE || ring > VM_PVB_RING_MAX || (ring & (ring - 1)))
+        return -1;
+    for (int i = 0; i < 2; i++)
+        if (d->pic.chip[i].init_step > 4) return -1;
+    return 0;
+}
+
+size_t vm_io_regs_size(void) {
+    vm_io_dev_t d;
+    asm_mem_zero(&d, sizeof(d));
+    regs_codec_t c = { NULL, NULL, 0 };
+    regs_codec(&c, &d, NULL);
+    return c.off;
+}
+
+int vm_io_regs_save(void *buf, size_t len) {
+    uint8_t pci[VM_PCI_DEV_MAX * PCI_CFG_SIZE];
+    if (!s_io->io_inited || !buf || len != vm_io_regs_size()) return -1;
+    vm_uart_flush(&s_io->dev.uart);
+    if (s_io->pci_cfg)
+        asm_mem_copy(pci, s_io->pci_cfg, sizeof(pci));
+    else
+        asm_mem_zero(pci, sizeof(pci));
+    regs_codec_t c = { buf, NULL, 0 };
+    regs_codec(&c, &s_io->dev, pci);
+    return 0;
+}
+
+int vm_io_regs_check(const void *buf, size_t len) {
+    vm_io_dev_t d;
+    uint8_t pci[VM_PCI_DEV_MAX * PCI_CFG_SIZE];
+    return regs_decode(buf, len, &d, pci);
+}
+
+int vm_io_regs_load(const void *buf, size_t len) {
+    vm_io_dev_t d;
+    uint8_t pci[VM_PCI_DEV_MAX * PCI_CFG_SIZE];
+    if (!s_io->io_inited) return -1;
+    vm_uart_flush(&s_io->dev.uart);
+    if (regs_decode(buf, len, &d, pci) != 0) return -1;
+    asm_mem_copy(&s_io->dev, &d, sizeof(d));
+    if (s_io->pci_cfg)
+        asm_mem_copy(s_io->pci_cfg, pci, sizeof(pci));
+    return 0;
+}
+
+vm_io_state_t *vm_io_state_create(void) {
+    vm_io_state_t *st = mem_domain_alloc(MEM_DOMAIN_DRIVER, sizeof(*st));
+    if (st) asm_mem_zero(st, sizeof(*st));
+    return st;
+}
+
+void vm_io_state_destroy(vm_io_state_t *st) {
+    if (!st || st == &s_io_default) return;
+    vm_io_state_t *prev = s_io;
+    s_io = st;
+    if (st->io_inited) vm_io_shutdown();
+    s_io = (prev == st) ? &s_io_default : prev;
+    mem_domain_free(MEM_DOMAIN_DRIVER, st);
+}
+
+void vm_io_bind(vm_io_state_t *st) {
+    s_io = st ? st : &s_io_default;
 }
 
 void vm_io_set_host(vm_host_t *host) {
-    s_host = host;
+    s_io->host = host;
+}
+
+void vm_io_set_serial(FILE *out) {
+    vm_uart_flush(&s_io->dev.uart);
+    s_io->dev.uart.out = out ? out : stdout;
 }
 
 int vm_io_pci_ready(void) {
-    return s_pci_cfg != NULL;
+    return s_io->pci_cfg != NULL;
 }
 
 int vm_io_serial_ready(void) {
-    return s_serial_out != NULL;
+    return s_io->dev.uart.out != NULL;
 }
 
 int vm_io_syscall_bridge_ready(void) {
-    return s_io_inited;
+    return s_io->io_inited;
 }
 
 int vm_io_host_bound(void) {
-    return s_host != NULL;
+    return s_io->host != NULL;
 }
 
 int vm_io_reset_line_ready(void) {
-    return s_io_inited;
+    return s_io->io_inited;
 }
 
-static uint8_t vm_io_in_ide(uint32_t port) {
-    if (port == 0x1f0) {
-        if (s_ide_byte_idx >= SECTOR_SIZE) {
-            if (vm_disk_is_active()) {
-                if (vm_disk_read_sector(s_ide_lba, s_sector_buf) != 0)
-                    asm_mem_zero(s_sector_buf, SECTOR_SIZE);
-            } else if (g_block_driver && g_block_driver->read_sector) {
-                if (g_block_driver->read_sector(g_block_driver, s_ide_lba, s_sector_buf) != 0)
-                    asm_mem_zero(s_sector_buf, SECTOR_SIZE);
+/* Disk backend shared by the IDE channel and the paravirtual ring: the
+ * guest's vm_disk image, else the host block driver. */
+static int blk_read(uint32_t lba, void *buf) {
+    if (vm_disk_is_active())
+        return vm_disk_read_sector(lba, buf);
+    if (g_block_driver && g_block_driver->read_sector)
+        return g_block_driver->read_sector(g_block_driver, lba, buf);
+    return -1;
+}
+
+static int blk_write(uint32_t lba, const void *buf) {
+    if (vm_disk_is_active())
+        return vm_disk_write_sector(lba, buf);
+    if (g_block_driver && g_block_driver->write_sector)
+        return g_block_driver->write_sector(g_block_driver, lba, buf);
+    return -1;
+}
+
+static void ide_load_sector(uint32_t lba) {
+    if (blk_read(lba, s_io->dev.sector_buf) != 0)
+        asm_mem_zero(s_io->dev.sector_buf, SECTOR_SIZE);
+}
+
+static void ide_store_sector(uint32_t lba) {
+    blk_write(lba, s_io->dev.sector_buf);
+}
+
+static void ide_end_command(void) {
+    s_io->dev.ide_xfer = IDE_XFER_NONE;
+    s_io->dev.ide_remaining = 0;
+    s_io->dev.ide_status &= (uint8_t)~IDE_ST_DRQ;
+}
+
+/* INTRQ: a sector is ready to read, a written sector was accepted, or a
+ * non-data command finished. */
+static void ide_irq(void) {
+    vm_pic_raise(&s_io->dev.pic, VM_IRQ_IDE);
+}
+
+/* Start a PIO transfer of the sector count (0 = 256) at the current LBA.
+ * Multiple-mode block size only changes interrupt granularity on real
+ * hardware; data still streams through the port, so it is not modelled. */
+static void ide_start_transfer(ide_xfer_t dir) {
+    s_io->dev.ide_xfer = dir;
+    s_io->dev.ide_xfer_lba = s_io->dev.ide_lba;
+    s_io->dev.ide_remaining = s_io->dev.ide_count ? s_io->dev.ide_count : 256;
+    s_io->dev.ide_status = IDE_ST_DRDY | IDE_ST_DRQ;
+    s_io->dev.ide_byte_idx = 0;
+    if (dir == IDE_XFER_READ) {
+        ide_load_sector(s_io->dev.ide_xfer_lba);
+        ide_irq();
+    }
+}
+
+static void ide_abort(void) {
+    ide_end_command();
+    s_io->dev.ide_error = IDE_ERR_ABRT;
+    s_io->dev.ide_status = IDE_ST_DRDY | IDE_ST_ERR;
+    ide_irq();
+}
+
+static void ide_command(uint8_t cmd) {
+    s_io->dev.ide_error = 0;
+    s_io->dev.ide_status = IDE_ST_DRDY;
+    switch (cmd) {
+    case IDE_CMD_READ:
+    case IDE_CMD_READ_NORETRY:
+        ide_start_transfer(IDE_XFER_READ);
+        break;
+    case IDE_CMD_WRITE:
+    case IDE_CMD_WRITE_NORETRY:
+        ide_start_transfer(IDE_XFER_WRITE);
+        break;
+    case IDE_CMD_READ_MULTIPLE:
+    case IDE_CMD_WRITE_MULTIPLE:
+        if (s_io->dev.ide_multiple == 0) { ide_abort(); break; }
+        ide_start_transfer(cmd == IDE_CMD_READ_MULTIPLE ? IDE_XFER_READ : IDE_XFER_WRITE);
+        break;
+    case IDE_CMD_SET_MULTIPLE:
+        /* Block size must be a power of two up to 128; 0 disables. */
+        if (s_io->dev.ide_count > 128 || (s_io->dev.ide_count & (s_io->dev.ide_count - 1)) != 0) { ide_abort(); break; }
+        s_io->dev.ide_multiple = s_io->dev.ide_count;
+        ide_irq();
+        break;
+    case IDE_CMD_FLUSH:
+    case IDE_CMD_FLUSH_EXT:
+        /* Push cached sectors to the image */
+        if (vm_disk_is_active())
+            vm_disk_flush();
+        ide_irq();
+        break;
+    default:
+        ide_abort();
+        break;
+    }
+}
+
+/* Data port, read side: copy n bytes of the sector stream into dst. */
+static void ide_read_bytes(uint8_t *dst, size_t n) {
+    while (n > 0) {
+        if (s_io->dev.ide_byte_idx >= SECTOR_SIZE) {
+            ide_load_sector(s_io->dev.ide_lba);
+            s_io->dev.ide_byte_idx = 0;
+        }
+        size_t chunk = (size_t)(SECTOR_SIZE - s_io->dev.ide_byte_idx);
+        if (chunk > n) chunk = n;
+        asm_mem_copy(dst, s_io->dev.sector_buf + s_io->dev.ide_byte_idx, chunk);
+        s_io->dev.ide_byte_idx += (int)chunk;
+        dst += chunk;
+        n -= chunk;
+        if (s_io->dev.ide_byte_idx >= SECTOR_SIZE && s_io->dev.ide_xfer == IDE_XFER_READ) {
+            if (--s_io->dev.ide_remaining > 0) {
+                ide_load_sector(++s_io->dev.ide_xfer_lba);
+                s_io->dev.ide_byte_idx = 0;
+                ide_irq();
+            } else {
+                ide_end_command();
+            }
+        }
+    }
+}
+
+/* Data port, write side: each completed sector goes to the backend. */
+static void ide_write_bytes(const uint8_t *src, size_t n) {
+    while (n > 0) {
+        if (s_io->dev.ide_byte_idx >= SECTOR_SIZE)
+            s_io->dev.ide_byte_idx = 0;
+        size_t chunk = (size_t)(SECTOR_SIZE - s_io->dev.ide_byte_idx);
+        if (chunk > n) chunk = n;
+        asm_mem_copy(s_io->dev.sector_buf + s_io->dev.ide_byte_idx, src, chunk);
+        s_io->dev.ide_byte_idx += (int)chunk;
+        src += chunk;
+        n -= chunk;
+        if (s_io->dev.ide_byte_idx >= SECTOR_SIZE) {
+            ide_store_sector(s_io->dev.ide_xfer == IDE_XFER_WRITE ? s_io->dev.ide_xfer_lba : s_io->dev.ide_lba);
+            asm_mem_zero(s_io->dev.sector_buf, SECTOR_SIZE);
+            if (s_io->dev.ide_xfer == IDE_XFER_WRITE) {
+                if (--s_io->dev.ide_remaining > 0) {
+                    s_io->dev.ide_xfer_lba++;
+                    s_io->dev.ide_byte_idx = 0;
+                } else {
+                    ide_end_command();
+                }
+                ide_irq();
             }
-            s_ide_byte_idx = 0;
         }
-        uint8_t v = (s_ide_byte_idx < SECTOR_SIZE) ? s_sector_buf[s_ide_byte_idx] : 0;
-        s_ide_byte_idx++;
-        return v;
     }
-    if (port == 0x1f1) return 0;
-    if (port == 0x1f2) return 1;
-    if (port == 0x1f3) return (uint8_t)(s_ide_lba);
-    if (port == 0x1f4) return (uint8_t)(s_ide_lba >> 8);
-    if (port == 0x1f5) return (uint8_t)(s_ide_lba >> 16);
-    if (port == 0x1f7) return 0x40;
+}
+
+static uint32_t vm_io_in_ide(uint32_t port, int size) {
+    if (port == 0x1f0) {
+        uint8_t b[4] = { 0, 0, 0, 0 };
+        ide_read_bytes(b, (size == 2 || size == 4) ? (size_t)size : 1);
+        return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+    if (port == 0x1f1) return s_io->dev.ide_error;
+    if (port == 0x1f2) return s_io->dev.ide_count;
+    if (port == 0x1f3) return (uint8_t)(s_io->dev.ide_lba);
+    if (port == 0x1f4) return (uint8_t)(s_io->dev.ide_lba >> 8);
+    if (port == 0x1f5) return (uint8_t)(s_io->dev.ide_lba >> 16);
+    if (port == 0x1f6) return 0xE0 | ((s_io->dev.ide_lba >> 24) & 0x0F);
+    if (port == 0x1f7) return s_io->dev.ide_status;
     return 0xFF;
 }
 
+/* One ring request. Data moves directly between guest RAM and the backend,
+ * one sector call each, with no bounce buffer. The descriptor is read once
+ * up front: a READ into a buffer that overlaps the ring may overwrite it. */
+static uint8_t pvb_request(vm_mem_t *mem, const uint8_t *d) {
+    uint8_t op = d[0];
+    uint16_t count;
+    uint32_t lba, addr;
+    asm_mem_copy(&count, d + 2, 2);
+    asm_mem_copy(&lba, d + 4, 4);
+    asm_mem_copy(&addr, d + 8, 4);
+    size_t bytes = (size_t)count * SECTOR_SIZE;
+    switch (op) {
+    case VM_PVB_OP_READ:
+    case VM_PVB_OP_WRITE:
+        break;
+    case VM_PVB_OP_FLUSH:
+        if (vm_disk_is_active() && vm_disk_flush() != 0) return VM_PVB_ST_IOERR;
+        return VM_PVB_ST_OK;
+    default:
+        return VM_PVB_ST_UNSUPP;
+    }
+    if (addr > mem->size || bytes > mem->size - addr) return VM_PVB_ST_IOERR;
+    if (vm_disk_is_active() && (lba > vm_disk_sectors() || count > vm_disk_sectors() - lba))
+        return VM_PVB_ST_IOERR;
+    uint8_t status = VM_PVB_ST_OK;
+    for (uint32_t i = 0; i < count && status == VM_PVB_ST_OK; i++) {
+        uint8_t *buf = mem->ram + addr + (size_t)i * SECTOR_SIZE;
+        int rc = op == VM_PVB_OP_READ ? blk_read(lba + i, buf) : blk_write(lba + i, buf);
+        if (rc != 0) status = VM_PVB_ST_IOERR;
+    }
+    if (op == VM_PVB_OP_READ)
+        vm_mem_note_write(mem, addr, bytes);
+    return status;
+}
+
+/* Doorbell: run every descriptor between the used and the new producer
+ * index (at most one ring's worth), then publish the used index and
+ * interrupt once for the batch. */
+static void pvb_doorbell(vm_mem_t *mem, uint32_t avail) {
+    vm_io_dev_t *dev = &s_io->dev;
+    dev->pvb_avail = avail;
+    if (!mem || !mem->ram || dev->pvb_ring_size == 0) return;
+    size_t ring_bytes = VM_PVB_RING_HDR + (size_t)dev->pvb_ring_size * VM_PVB_DESC_SIZE;
+    if (dev->pvb_ring_addr > mem->size || ring_bytes > mem->size - dev->pvb_ring_addr) return;
+    uint8_t *ring = mem->ram + dev->pvb_ring_addr;
+    uint32_t done = 0;
+    while (dev->pvb_used != avail && done < dev->pvb_ring_size) {
+        uint8_t *d = ring + VM_PVB_RING_HDR + (size_t)(dev->pvb_used & (dev->pvb_ring_size - 1)) * VM_PVB_DESC_SIZE;
+        d[1] = pvb_request(mem, d);
+        dev->pvb_used++;
+        done++;
+    }
+    if (!done) return;
+    asm_mem_copy(ring, &dev->pvb_used, 4);
+    vm_mem_note_write(mem, dev->pvb_ring_addr, ring_bytes);
+    dev->pvb_isr |= PVB_ISR_DONE;
+    vm_pic_raise(&dev->pic, VM_PVB_IRQ);
+}
+
+static uint32_t vm_io_read_pvb(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem; (void)size;
+    uint32_t v;
+    switch (port - VM_PVB_PORT_BASE) {
+    case VM_PVB_REG_RING_ADDR: return s_io->dev.pvb_ring_addr;
+    case VM_PVB_REG_RING_SIZE: return s_io->dev.pvb_ring_size;
+    case VM_PVB_REG_DOORBELL:  return s_io->dev.pvb_avail;
+    case VM_PVB_REG_USED:      return s_io->dev.pvb_used;
+    case VM_PVB_REG_ISR:
+        v = s_io->dev.pvb_isr;
+        s_io->dev.pvb_isr = 0;
+        return v;
+    case VM_PVB_REG_CAPACITY:  return vm_disk_is_active() ? vm_disk_sectors() : 0;
+    default:                   return 0xFFFFFFFFu;
+    }
+}
+
+static void vm_io_write_pvb(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)ctx; (void)size;
+    switch (port - VM_PVB_PORT_BASE) {
+    case VM_PVB_REG_RING_ADDR:
+        s_io->dev.pvb_ring_addr = value;
+        s_io->dev.pvb_avail = s_io->dev.pvb_used = 0;
+        break;
+    case VM_PVB_REG_RING_SIZE:
+        s_io->dev.pvb_ring_size = (value && value <= VM_PVB_RING_MAX && !(value & (value - 1))) ? value : 0;
+        s_io->dev.pvb_avail = s_io->dev.pvb_used = 0;
+        break;
+    case VM_PVB_REG_DOORBELL:
+        pvb_doorbell(mem, value);
+        break;
+    default:
+        break;
+    }
+}
+
 static uint8_t vm_io_in_keyboard(uint32_t port) {
     if (port == 0x60) {
-        if (s_host) {
+        if (s_io->host) {
             uint8_t sc;
-            if (vm_host_kbd_pop(s_host, &sc) == 0)
+            if (vm_host_kbd_pop(s_io->host, &sc) == 0)
                 return sc;
         }
         if (g_keyboard_driver && g_keyboard_driver->poll_scancode) {
@@ -237,130 +833,263 @@ static uint8_t vm_io_in_keyboard(uint32_t port) {
 
 static uint8_t vm_io_in_pit(uint32_t port) {
     if (port == 0x40) {
-        if (s_host)
-            return (uint8_t)(vm_host_ticks(s_host) & 0xFF);
+        if (s_io->host)
+            return (uint8_t)(vm_host_ticks(s_io->host) & 0xFF);
         if (g_timer_driver)
             return (uint8_t)(g_timer_driver->tick_count(g_timer_driver) & 0xFF);
     }
-    if (port == 0x43) return s_pit_mode;
+    if (port == 0x43) return s_io->dev.pit_mode;
     return 0;
 }
 
-static uint8_t vm_io_in_pic(uint32_t port) {
-    if (port == 0x20 || port == 0xA0) return 0;
-    if (port == 0x21 || port == 0xA1) return 0xFF;
-    return 0xFF;
-}
-
 static uint32_t vm_io_in_pci(uint32_t port) {
     if (port != PCI_CFG_DATA) return 0xFFFFFFFFu;
-    if (!(s_pci_addr & 0x80000000u)) return 0xFFFFFFFFu;
-    uint8_t bus = (s_pci_addr >> 16) & 0xFF;
-    uint8_t dev = (s_pci_addr >> 11) & 0x1F;
-    uint8_t reg = (s_pci_addr >>  2) & 0x3F;
-    if (bus != 0 || dev >= VM_PCI_DEV_MAX || !s_pci_cfg) return 0xFFFFFFFFu;
+    if (!(s_io->dev.pci_addr & 0x80000000u)) return 0xFFFFFFFFu;
+    uint8_t bus = (s_io->dev.pci_addr >> 16) & 0xFF;
+    uint8_t dev = (s_io->dev.pci_addr >> 11) & 0x1F;
+    uint8_t reg = (s_io->dev.pci_addr >>  2) & 0x3F;
+    if (bus != 0 || dev >= VM_PCI_DEV_MAX || !s_io->pci_cfg) return 0xFFFFFFFFu;
     uint32_t v = 0;
     if (reg * 4 + 4 <= PCI_CFG_SIZE) {
-        const uint8_t *cfg = s_pci_cfg + dev * PCI_CFG_SIZE;
+        const uint8_t *cfg = s_io->pci_cfg + dev * PCI_CFG_SIZE;
         v = (uint32_t)cfg[reg*4] | ((uint32_t)cfg[reg*4+1]<<8)
           | ((uint32_t)cfg[reg*4+2]<<16) | ((uint32_t)cfg[reg*4+3]<<24);
     }
     return v;
 }
 
-uint32_t vm_io_in(vm_mem_t *mem, uint32_t port, int size) {
-    (void)mem;
-    uint32_t v = 0xFF;
-    if (port >= 0x1f0 && port <= 0x1f7)
-        v = vm_io_in_ide(port);
-    else if (port == 0x60 || port == 0x64)
-        v = vm_io_in_keyboard(port);
-    else if (port >= 0x40 && port <= 0x43)
-        v = vm_io_in_pit(port);
-    else if (port == 0x20 || port == 0x21 || port == 0xA0 || port == 0xA1)
-        v = vm_io_in_pic(port);
-    else if (port == PCI_CFG_DATA && size == 4)
+static uint32_t vm_io_read_ide(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem;
+    return vm_io_in_ide(port, size);
+}
+
+static void vm_io_write_ide(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)ctx; (void)mem;
+    if (port == 0x1f3) s_io->dev.ide_lba = (s_io->dev.ide_lba & 0xFFFFFF00) | (value & 0xFF);
+    else if (port == 0x1f4) s_io->dev.ide_lba = (s_io->dev.ide_lba & 0xFFFF00FF) | ((value & 0xFF) << 8);
+    else if (port == 0x1f5) s_io->dev.ide_lba = (s_io->dev.ide_lba & 0xFF00FFFF) | ((value & 0xFF) << 16);
+    else if (port == 0x1f6) s_io->dev.ide_lba = (s_io->dev.ide_lba & 0x00FFFFFF) | ((value & 0x0F) << 24);
+    else if (port == 0x1f2) s_io->dev.ide_count = (uint8_t)(value & 0xFF);
+    else if (port == 0x1f7) ide_command((uint8_t)(value & 0xFF));
+    else if (port == 0x1f0) {
+        uint8_t b[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        ide_write_bytes(b, (size == 2 || size == 4) ? (size_t)size : 1);
+    }
+}
+
+static uint32_t vm_io_read_keyboard(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem; (void)size;
+    return vm_io_in_keyboard(port);
+}
+
+static uint32_t vm_io_read_pit(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem; (void)size;
+    return vm_io_in_pit(port);
+}
+
+static void vm_io_write_pit(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)ctx; (void)mem; (void)size;
+    if (port == 0x43) s_io->dev.pit_mode = (uint8_t)(value & 0xFF);
+    /* Port 0x40: gate/counter - ignore for now, timer_driver provides ticks */
+}
+
+static uint32_t vm_io_read_pic(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)mem; (void)size;
+    return vm_pic_read(ctx, port >= 0xA0, port & 1);
+}
+
+static void vm_io_write_pic(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)mem; (void)size;
+    vm_pic_write(ctx, port >= 0xA0, port & 1, (uint8_t)value);
+    if (!(port & 1) && (value & 0x38) == 0x20) {
+        /* OCW2 EOI: mirror to the host PIC driver as before */
+        if (g_pic_driver && g_pic_driver->eoi)
+            g_pic_driver->eoi(g_pic_driver, port == 0xA0 ? 8 : 0);
+    }
+}
+
+static uint32_t vm_io_read_serial(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)mem; (void)size;
+    return vm_uart_read(ctx, port - 0x3f8);
+}
+
+static void vm_io_write_serial(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)mem; (void)size;
+    vm_uart_write(ctx, port - 0x3f8, (uint8_t)(value & 0xFF), vm_host_ticks(s_io->host));
+}
+
+/* 0xF8: transmit-only shortcut into the same FIFO. */
+static void vm_io_write_serial_tx(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)mem; (void)port; (void)size;
+    vm_uart_tx(ctx, (uint8_t)(value & 0xFF), vm_host_ticks(s_io->host));
+}
+
+static uint32_t vm_io_read_pci(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem;
+    if (port == PCI_CFG_DATA && size == 4)
         return vm_io_in_pci(port);
-    else if (port == VM_SYS_PORT_RET)
-        return read_port_width(low32((uint64_t)s_sys_ret), size);
-    else if (port == VM_SYS_PORT_RET_HI)
-        return read_port_width(high32((uint64_t)s_sys_ret), size);
-    if (size == 1) return v & 0xFF;
-    if (size == 2) return v & 0xFFFF;
-    return v & 0xFFFFFFFFu;
+    return 0xFF;
 }
 
-void vm_io_out(vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+static void vm_io_write_pci(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)ctx; (void)mem; (void)size;
     if (port == PCI_CFG_ADDR) {
-        s_pci_addr = value;
+        s_io->dev.pci_addr = value;
+        return;
+    }
+    if (port == PCI_CFG_DATA && (s_io->dev.pci_addr & 0x80000000u)) {
+        uint8_t bus = (s_io->dev.pci_addr >> 16) & 0xFF;
+        uint8_t dev = (s_io->dev.pci_addr >> 11) & 0x1F;
+        uint8_t reg = (s_io->dev.pci_addr >>  2) & 0x3F;
+        if (bus == 0 && dev < VM_PCI_DEV_MAX && reg * 4 + 4 <= PCI_CFG_SIZE && s_io->pci_cfg) {
+            uint8_t *cfg = s_io->pci_cfg + dev * PCI_CFG_SIZE;
+            cfg[reg*4]   = (uint8_t)(value);
+            cfg[reg*4+1] = (uint8_t)(value >> 8);
+            cfg[reg*4+2] = (uint8_t)(value >> 16);
+            cfg[reg*4+3] = (uint8_t)(value >> 24);
+        }
         return;
     }
+    if (port == PCI_CFG_RESET) {
+        if ((value & 0x0E) == 0x06 || (value & 0x0E) == 0x0E)
+            s_io->dev.reset_requested = 1;
+    }
+}
+
+static uint32_t vm_io_read_sys(void *ctx, vm_mem_t *mem, uint32_t port, int size) {
+    (void)ctx; (void)mem;
+    if (port == VM_SYS_PORT_RET)
+        return read_port_width(low32((uint64_t)s_io->dev.sys_ret), size);
+    if (port == VM_SYS_PORT_RET_HI)
+        return read_port_width(high32((uint64_t)s_io->dev.sys_ret), size);
+    return 0xFF;
+}
+
+static void vm_io_write_sys(void *ctx, vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    (void)ctx;
     if (port >= VM_SYS_PORT_NO && port <= VM_SYS_PORT_ARG3) {
-        if (port == VM_SYS_PORT_NO) write_port_width(&s_sys_no, value, size);
-        else write_port_width(&s_sys_args[port - VM_SYS_PORT_ARG0], value, size);
+        if (port == VM_SYS_PORT_NO) write_port_width(&s_io->dev.sys_no, value, size);
+        else write_port_width(&s_io->dev.sys_args[port - VM_SYS_PORT_ARG0], value, size);
         return;
     }
     if (port >= VM_SYS_PORT_ARG0_HI && port <= VM_SYS_PORT_ARG3_HI) {
-        write_port_high_width(&s_sys_args[port - VM_SYS_PORT_ARG0_HI], value, size);
+        write_port_high_width(&s_io->dev.sys_args[port - VM_SYS_PORT_ARG0_HI], value, size);
         return;
     }
     if (port == VM_SYS_PORT_CALL) {
         uintptr_t args[4] = {
-            s_sys_args[0], s_sys_args[1], s_sys_args[2], s_sys_args[3]
+            s_io->dev.sys_args[0], s_io->dev.sys_args[1], s_io->dev.sys_args[2], s_io->dev.sys_args[3]
         };
         vm_translate_sys_args(mem, args);
-        long ret = fl_syscall_dispatch((fl_syscall_no_t)s_sys_no,
+        long ret = fl_syscall_dispatch((fl_syscall_no_t)s_io->dev.sys_no,
                                        args[0], args[1], args[2], args[3]);
-        s_sys_ret = ret;
-        return;
+        s_io->dev.sys_ret = ret;
+        vm_sys_note_guest_write(mem);
     }
-    if (port == PCI_CFG_DATA && (s_pci_addr & 0x80000000u)) {
-        uint8_t bus = (s_pci_addr >> 16) & 0xFF;
-        uint8_t dev = (s_pci_addr >> 11) & 0x1F;
-        uint8_t reg = (s_pci_addr >>  2) & 0x3F;
-        if (bus == 0 && dev < VM_PCI_DEV_MAX && reg * 4 + 4 <= PCI_CFG_SIZE && s_pci_cfg) {
-            uint8_t *cfg = s_pci_cfg + dev * PCI_CFG_SIZE;
-            cfg[reg*4]   = (uint8_t)(value);
-            cfg[reg*4+1] = (uint8_t)(value >> 8);
-            cfg[reg*4+2] = (uint8_t)(value >> 16);
-            cfg[reg*4+3] = (uint8_t)(value >> 24);
-        }
-        return;
-    }
-    if (port == PCI_CFG_RESET) {
-        if ((value & 0x0E) == 0x06 || (value & 0x0E) == 0x0E)
-            s_reset_requested = 1;
-        return;
+}
+
+int vm_io_register(uint32_t base, uint32_t count, vm_io_read_fn read, vm_io_write_fn write, void *ctx) {
+    if (!s_io->port_map || count == 0 || base >= VM_IO_PORT_COUNT || count > VM_IO_PORT_COUNT - base)
+        return -1;
+    if (s_io->io_handler_count >= VM_IO_HANDLER_MAX)
+        return -1;
+    for (uint32_t p = base; p < base + count; p++)
+        if (s_io->port_map[p] != 0) return -1;   /* overlapping registration */
+    uint8_t id = (uint8_t)s_io->io_handler_count++;
+    s_io->io_handlers[id].read = read;
+    s_io->io_handlers[id].write = write;
+    s_io->io_handlers[id].ctx = ctx;
+    for (uint32_t p = base; p < base + count; p++)
+        s_io->port_map[p] = id;
+    return 0;
+}
+
+static void vm_io_register_devices(void) {
+    vm_io_register(0x1f0, 8, vm_io_read_ide, vm_io_write_ide, NULL);
+    vm_io_register(VM_PVB_PORT_BASE, VM_PVB_PORT_COUNT, vm_io_read_pvb, vm_io_write_pvb, NULL);
+    vm_io_register(0x60, 1, vm_io_read_keyboard, NULL, NULL);
+    vm_io_register(0x64, 1, vm_io_read_keyboard, NULL, NULL);
+    vm_io_register(0x40, 4, vm_io_read_pit, vm_io_write_pit, NULL);
+    vm_io_register(0x20, 2, vm_io_read_pic, vm_io_write_pic, &s_io->dev.pic);
+    vm_io_register(0xA0, 2, vm_io_read_pic, vm_io_write_pic, &s_io->dev.pic);
+    vm_io_register(0x3f8, 8, vm_io_read_serial, vm_io_write_serial, &s_io->dev.uart);
+    vm_io_register(0xf8, 1, NULL, vm_io_write_serial_tx, &s_io->dev.uart);
+    vm_io_register(PCI_CFG_ADDR, 1, vm_io_read_pci, vm_io_write_pci, NULL);
+    vm_io_register(PCI_CFG_RESET, 1, vm_io_read_pci, vm_io_write_pci, NULL);
+    vm_io_register(PCI_CFG_DATA, 1, vm_io_read_pci, vm_io_write_pci, NULL);
+    vm_io_register(VM_SYS_PORT_NO, VM_SYS_PORT_RET_HI - VM_SYS_PORT_NO + 1, vm_io_read_sys, vm_io_write_sys, NULL);
+}
+
+uint32_t vm_io_in(vm_mem_t *mem, uint32_t port, int size) {
+    uint32_t v = 0xFF;
+    port &= VM_IO_PORT_COUNT - 1;
+    if (s_io->port_map) {
+        const vm_io_handler_t *h = &s_io->io_handlers[s_io->port_map[port]];
+        s_io->port_stats[port].reads++;
+        if (h->read)
+            v = h->read(h->ctx, mem, port, size);
     }
-    if (port >= 0x1f0 && port <= 0x1f7) {
-        if (port == 0x1f3) s_ide_lba = (s_ide_lba & 0xFFFFFF00) | (value & 0xFF);
-        else if (port == 0x1f4) s_ide_lba = (s_ide_lba & 0xFFFF00FF) | ((value & 0xFF) << 8);
-        else if (port == 0x1f5) s_ide_lba = (s_ide_lba & 0xFF00FFFF) | ((value & 0xFF) << 16);
-        else if (port == 0x1f0) {
-            if (s_ide_byte_idx >= SECTOR_SIZE)
-                s_ide_byte_idx = 0;
-            s_sector_buf[s_ide_byte_idx++] = (uint8_t)(value & 0xFF);
-            if (s_ide_byte_idx >= SECTOR_SIZE) {
-                if (vm_disk_is_active())
-                    vm_disk_write_sector(s_ide_lba, s_sector_buf);
-                else if (g_block_driver && g_block_driver->write_sector)
-                    g_block_driver->write_sector(g_block_driver, s_ide_lba, s_sector_buf);
-                asm_mem_zero(s_sector_buf, SECTOR_SIZE);
-            }
+    return read_port_width(v, size);
+}
+
+void vm_io_out(vm_mem_t *mem, uint32_t port, uint32_t value, int size) {
+    port &= VM_IO_PORT_COUNT - 1;
+    if (!s_io->port_map) return;
+    const vm_io_handler_t *h = &s_io->io_handlers[s_io->port_map[port]];
+    s_io->port_stats[port].writes++;
+    if (h->write)
+        h->write(h->ctx, mem, port, value, size);
+}
+
+int vm_io_port_stats(uint32_t port, uint64_t *reads, uint64_t *writes) {
+    if (!s_io->port_stats || port >= VM_IO_PORT_COUNT) return -1;
+    if (reads) *reads = s_io->port_stats[port].reads;
+    if (writes) *writes = s_io->port_stats[port].writes;
+    return 0;
+}
+
+void vm_io_port_stats_reset(void) {
+    if (s_io->port_stats)
+        asm_mem_zero(s_io->port_stats, VM_IO_PORT_COUNT * sizeof(*s_io->port_stats));
+}
+
+/* String I/O (INS/OUTS): count elements of size bytes between the port and
+ * guest physical memory at phys. The IDE data port moves whole runs with one
+ * copy; other ports fall back to one vm_io_in/vm_io_out per element. Returns
+ * the number of elements transferred (short only if phys runs off RAM). */
+uint32_t vm_io_in_string(vm_mem_t *mem, uint32_t port, uint32_t phys, int size, uint32_t count) {
+    if (!mem || !mem->ram || (size != 1 && size != 2 && size != 4)) return 0;
+    if (phys >= mem->size) return 0;
+    uint32_t fit = (uint32_t)((mem->size - phys) / (size_t)size);
+    if (count > fit) count = fit;
+    size_t bytes = (size_t)count * (size_t)size;
+    if (port == 0x1f0) {
+        ide_read_bytes(mem->ram + phys, bytes);
+        if (s_io->port_stats) s_io->port_stats[port].reads += count;
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t v = vm_io_in(mem, port, size);
+            asm_mem_copy(mem->ram + phys + (size_t)i * (size_t)size, &v, (size_t)size);
         }
-    } else if (port == 0x3f8 || port == 0xf8) {
-        if (s_serial_out) {
-            fputc((char)(value & 0xFF), s_serial_out);
-            fflush(s_serial_out);
+    }
+    vm_mem_note_write(mem, phys, bytes);
+    return count;
+}
+
+uint32_t vm_io_out_string(vm_mem_t *mem, uint32_t port, uint32_t phys, int size, uint32_t count) {
+    if (!mem || !mem->ram || (size != 1 && size != 2 && size != 4)) return 0;
+    if (phys >= mem->size) return 0;
+    uint32_t fit = (uint32_t)((mem->size - phys) / (size_t)size);
+    if (count > fit) count = fit;
+    if (port == 0x1f0) {
+        ide_write_bytes(mem->ram + phys, (size_t)count * (size_t)size);
+        if (s_io->port_stats) s_io->port_stats[port].writes += count;
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t v = 0;
+            asm_mem_copy(&v, mem->ram + phys + (size_t)i * (size_t)size, (size_t)size);
+            vm_io_out(mem, port, v, size);
         }
-    } else if (port >= 0x40 && port <= 0x43) {
-        if (port == 0x43) s_pit_mode = (uint8_t)(value & 0xFF);
-        /* Port 0x40: gate/counter - ignore for now, timer_driver provides ticks */
-    } else if (port == 0x20 || port == 0xA0) {
-        /* PIC EOI - acknowledge interrupt */
-        if (g_pic_driver && g_pic_driver->eoi)
-            g_pic_driver->eoi(g_pic_driver, port == 0xA0 ? 8 : 0);
-    } else if (port == 0x21 || port == 0xA1) {
-        /* PIC mask - ignore for host */
     }
+    return count;
 }
@@ -2,21 +2,105 @@
 #define VM_IO_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 struct vm_mem;
 struct vm_cpu;
 struct vm_host;
 
+#define VM_IO_PORT_COUNT 0x10000
+
+/* Device port handlers. Ports with no handler read as 0xFF and ignore
+ * writes; a NULL read or write callback behaves the same way. */
+typedef uint32_t (*vm_io_read_fn)(void *ctx, struct vm_mem *mem, uint32_t port, int size);
+typedef void (*vm_io_write_fn)(void *ctx, struct vm_mem *mem, uint32_t port, uint32_t value, int size);
+
+/* Device state of one guest. The calling thread works on the process-wide
+ * instance until vm_io_bind selects another (NULL restores the default);
+ * every vm_io_* call below acts on the bound instance. */
+typedef struct vm_io_state vm_io_state_t;
+vm_io_state_t *vm_io_state_create(void);
+void vm_io_state_destroy(vm_io_state_t *st);
+void vm_io_bind(vm_io_state_t *st);
+
 void vm_io_init(void);
 void vm_io_shutdown(void);
+/* Reset baseline: capture the guest-visible device registers (IDE, UART,
+ * PIC, PIT, PCI config, syscall bridge), restore them later without
+ * rebuilding the port table. The serial stream in use is kept. */
+int vm_io_baseline_capture(void);
+int vm_io_baseline_restore(void);
+/* The same registers as a blob for snapshot files: an explicit list of
+ * fixed-width little-endian fields, not the in-memory layout, so it does
+ * not follow compiler struct layout. Host-side state (the serial stream,
+ * statistics) stays out of it. vm_io_regs_check validates a blob without
+ * touching the device; load applies only a blob that passes the check.
+ * Changing the field list changes the blob: bump VM_SNAPFILE_VERSION. */
+size_t vm_io_regs_size(void);
+int vm_io_regs_save(void *buf, size_t len);
+int vm_io_regs_check(const void *buf, size_t len);
+int vm_io_regs_load(const void *buf, size_t len);
+/* Timer-driven device work (serial flush deadline); call once per tick. */
+void vm_io_poll(void);
+/* Interrupt lines into the 8259 pair (vm_pic). vm_io_poll raises IRQ0 every
+ * tick and IRQ1 while keyboard input waits; the IDE channel raises IRQ14
+ * and the paravirtual block ring VM_PVB_IRQ.
+ * vm_io_intr is the INTR pin; vm_io_inta acknowledges and returns the
+ * vector (-1 if none). */
+void vm_io_raise_irq(unsigned int irq);
+int vm_io_intr(void);
+int vm_io_inta(void);
+/* Push buffered device output to the host (VM exit). */
+void vm_io_flush(void);
 void vm_io_set_host(struct vm_host *host);
+/* Host stream for serial (COM1, port 0xF8) output; NULL selects stdout.
+ * vm_io_init resets it to stdout. */
+void vm_io_set_serial(FILE *out);
 uint32_t vm_io_in(struct vm_mem *mem, uint32_t port, int size);
 void vm_io_out(struct vm_mem *mem, uint32_t port, uint32_t value, int size);
+/* INS/OUTS: move count elements of size bytes at guest physical phys. */
+uint32_t vm_io_in_string(struct vm_mem *mem, uint32_t port, uint32_t phys, int size, uint32_t count);
+uint32_t vm_io_out_string(struct vm_mem *mem, uint32_t port, uint32_t phys, int size, uint32_t count);
+/* Claim ports [base, base+count) after vm_io_init. Fails on overlap. */
+int vm_io_register(uint32_t base, uint32_t count, vm_io_read_fn read, vm_io_write_fn write, void *ctx);
+/* Per-port access counters since vm_io_init or the last reset. */
+int vm_io_port_stats(uint32_t port, uint64_t *reads, uint64_t *writes);
+void vm_io_port_stats_reset(void);
 int vm_io_pci_ready(void);
 int vm_io_serial_ready(void);
 int vm_io_syscall_bridge_ready(void);
 int vm_io_host_bound(void);
 
+/* Paravirtual block device: PCI bus 0 dev 4 (0x1234:0x4444, class 0180),
+ * BAR0 the I/O ports at VM_PVB_PORT_BASE, interrupt line VM_PVB_IRQ. The
+ * guest keeps a ring of VM_PVB_DESC_SIZE-byte descriptors in its RAM at
+ * RING_ADDR + VM_PVB_RING_HDR: op, status, sector count (u16), lba, buffer
+ * address, and a tag the device leaves alone. It fills descriptors and
+ * writes its free-running producer index to DOORBELL; that one port write
+ * runs every queued request, moving sectors straight between guest RAM and
+ * vm_disk, then stores each status, writes the used index to the ring's
+ * first dword, sets ISR bit 0 and raises the IRQ. Registers are 32-bit;
+ * ISR clears on read. Setting RING_ADDR or RING_SIZE (a power of two up to
+ * VM_PVB_RING_MAX, else the ring is off) restarts both indices at 0. */
+#define VM_PVB_PORT_BASE     0xC000
+#define VM_PVB_PORT_COUNT    0x20
+#define VM_PVB_IRQ           11
+#define VM_PVB_RING_MAX      256
+#define VM_PVB_RING_HDR      8
+#define VM_PVB_DESC_SIZE     16
+#define VM_PVB_REG_RING_ADDR 0x00
+#define VM_PVB_REG_RING_SIZE 0x04
+#define VM_PVB_REG_DOORBELL  0x08
+#define VM_PVB_REG_USED      0x0C
+#define VM_PVB_REG_ISR       0x10
+#define VM_PVB_REG_CAPACITY  0x14   /* sectors, read-only */
+#define VM_PVB_OP_READ       0
+#define VM_PVB_OP_WRITE      1
+#define VM_PVB_OP_FLUSH      2
+#define VM_PVB_ST_OK         0
+#define VM_PVB_ST_IOERR      1      /* range outside RAM or disk, backend error */
+#define VM_PVB_ST_UNSUPP     2
+
 /* Reset: guest writes 0x06/0x0E to port 0xCF9; run loop checks and resets. */
 int vm_io_reset_requested(void);
 void vm_io_clear_reset(void);
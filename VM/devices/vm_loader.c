@@ -8,6 +8,7 @@ int vm_load_binary(vm_mem_t *mem, uint32_t addr, const void *data, size_t len) {
     if (!mem || !mem->ram || !data) return -1;
     if (addr + len > mem->size) return -1;
     asm_mem_copy(mem->ram + addr, data, len);
+    vm_mem_note_write(mem, addr, len);
     return 0;
 }
 
@@ -30,6 +31,7 @@ int vm_load_file(vm_mem_t *mem, uint32_t addr, const char *path) {
         return -1;
     }
     asm_mem_copy(mem->ram + addr, buf, (size_t)sz);
+    vm_mem_note_write(mem, addr, (size_t)sz);
     mem_domain_free(MEM_DOMAIN_USER, buf);
     return 0;
 }
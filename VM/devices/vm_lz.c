@@ -0,0 +1,121 @@
+/* LZ77 codec for snapshot files (see vm_lz.h for the format). */
+#include "vm_lz.h"
+#include "mem_asm.h"
+#include <string.h>
+
+#define VM_LZ_MIN_MATCH  4
+#define VM_LZ_HASH_BITS  12
+#define VM_LZ_WINDOW     0xFFFF
+#define VM_LZ_SKIP_SHIFT 6      /* step grows by one every 64 misses */
+
+static uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - VM_LZ_HASH_BITS);
+}
+
+size_t vm_lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* Append a 4-bit field's overflow: bytes of 255, then the remainder. */
+static int put_len(uint8_t *dst, size_t cap, size_t *op, size_t len) {
+    while (len >= 255) {
+        if (*op >= cap) return -1;
+        dst[(*op)++] = 255;
+        len -= 255;
+    }
+    if (*op >= cap) return -1;
+    dst[(*op)++] = (uint8_t)len;
+    return 0;
+}
+
+/* One sequence: literals src[lit, lit+nlit), then (if mlen) a match. */
+static int put_seq(uint8_t *dst, size_t cap, size_t *op, const uint8_t *lit, size_t nlit,
+                   size_t offset, size_t mlen) {
+    size_t ml = mlen ? mlen - VM_LZ_MIN_MATCH : 0;
+    if (*op >= cap) return -1;
+    size_t tok = (*op)++;
+    dst[tok] = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15));
+    if (nlit >= 15 && put_len(dst, cap, op, nlit - 15) != 0) return -1;
+    if (nlit > cap - *op) return -1;
+    asm_mem_copy(dst + *op, lit, nlit);
+    *op += nlit;
+    if (!mlen) return 0;
+    if (cap - *op < 2) return -1;
+    dst[(*op)++] = (uint8_t)(offset & 0xFF);
+    dst[(*op)++] = (uint8_t)(offset >> 8);
+    if (ml >= 15 && put_len(dst, cap, op, ml - 15) != 0) return -1;
+    return 0;
+}
+
+size_t vm_lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint32_t table[1u << VM_LZ_HASH_BITS];   /* position + 1; 0 = empty */
+    size_t ip = 0, anchor = 0, op = 0, misses = 0;
+    if (!src || !dst) return 0;
+    asm_mem_zero(table, sizeof(table));
+    while (n >= VM_LZ_MIN_MATCH && ip <= n - VM_LZ_MIN_MATCH) {
+        uint32_t seq = load32(src + ip);
+        uint32_t h = lz_hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+        if (ref && ip - (ref - 1) <= VM_LZ_WINDOW && load32(src + ref - 1) == seq) {
+            ref--;
+            size_t len = VM_LZ_MIN_MATCH;
+            while (ip + len < n && src[ref + len] == src[ip + len])
+                len++;
+            if (put_seq(dst, cap, &op, src + anchor, ip - anchor, ip - ref, len) != 0) return 0;
+            ip += len;
+            anchor = ip;
+            misses = 0;
+        } else {
+            /* Incompressible stretches are crossed in growing steps. */
+            ip += 1 + (misses++ >> VM_LZ_SKIP_SHIFT);
+        }
+    }
+    if (put_seq(dst, cap, &op, src + anchor, n - anchor, 0, 0) != 0) return 0;
+    return op;
+}
+
+static int get_len(const uint8_t *src, size_t n, size_t *ip, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= n) return -1;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int vm_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_len) {
+    size_t ip = 0, op = 0;
+    if (!src || !dst) return -1;
+    for (;;) {
+        if (ip >= n) return -1;             /* the last sequence is missing */
+        uint8_t tok = src[ip++];
+        size_t nlit = tok >> 4;
+        if (nlit == 15 && get_len(src, n, &ip, &nlit) != 0) return -1;
+        if (nlit > n - ip || nlit > out_len - op) return -1;
+        asm_mem_copy(dst + op, src + ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == n) break;                 /* literals-only final sequence */
+        if (n - ip < 2) return -1;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        size_t mlen = tok & 15;
+        if (mlen == 15 && get_len(src, n, &ip, &mlen) != 0) return -1;
+        mlen += VM_LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || mlen > out_len - op) return -1;
+        /* Byte order matters: an offset below the length repeats a pattern. */
+        const uint8_t *from = dst + op - offset;
+        for (size_t i = 0; i < mlen; i++)
+            dst[op + i] = from[i];
+        op += mlen;
+    }
+    return op == out_len ? 0 : -1;
+}
@@ -0,0 +1,21 @@
+#ifndef VM_LZ_H
+#define VM_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte-oriented LZ77 for snapshot files: greedy hash matching, 64KB window.
+ * Each sequence is a token (literal count << 4 | match length - 4), extra
+ * length bytes for counts of 15 and up, the literals, then a two-byte
+ * little-endian match offset; the final sequence carries literals only.
+ * Runs of one byte (zero pages) collapse to a few bytes per 64KB. */
+
+/* Worst-case compressed size of n input bytes. */
+size_t vm_lz_bound(size_t n);
+/* Returns the compressed length, or 0 if it does not fit in cap. */
+size_t vm_lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+/* Expand exactly out_len bytes; -1 on malformed input or a length
+ * mismatch. Never reads or writes outside the given buffers. */
+int vm_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out_len);
+
+#endif /* VM_LZ_H */
@@ -2,34 +2,114 @@
 #include "mem_domain.h"
 #include "mem_asm.h"
 #include <stdlib.h>
+#include <sys/mman.h>
+
+#define VM_MEM_HUGE_ALIGN ((size_t)2 * 1024 * 1024)
+
+void *vm_mem_map_zero(size_t size, unsigned int flags) {
+    if (size == 0) return NULL;
+    size_t len = size;
+    /* Huge pages need 2MB-aligned runs: over-map and trim the slack. */
+    if (flags & VM_MEM_THP) len += VM_MEM_HUGE_ALIGN;
+    uint8_t *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    if (flags & VM_MEM_THP) {
+        uint8_t *base = (uint8_t *)(((uintptr_t)p + VM_MEM_HUGE_ALIGN - 1) & ~(uintptr_t)(VM_MEM_HUGE_ALIGN - 1));
+        size_t head = (size_t)(base - p);
+        if (head) munmap(p, head);
+        munmap(base + size, len - head - size);
+        p = base;
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+}
+
+void vm_mem_unmap(void *p, size_t size) {
+    if (p && size) munmap(p, size);
+}
+
+int vm_mem_discard(void *p, size_t size) {
+    if (!p || size == 0) return 0;
+    return madvise(p, size, MADV_DONTNEED) == 0 ? 0 : -1;
+}
 
 int vm_mem_init(vm_mem_t *mem) {
+    return vm_mem_init_size(mem, GUEST_RAM_SIZE, 0);
+}
+
+int vm_mem_init_size(vm_mem_t *mem, size_t size, unsigned int flags) {
     if (!mem) return -1;
-    mem->ram = mem_domain_alloc(MEM_DOMAIN_USER, GUEST_RAM_SIZE);
+    if (size < VM_MEM_MIN_SIZE || size > VM_MEM_MAX_SIZE) return -1;
+    size = (size + VM_PAGE_SIZE - 1) & ~(size_t)(VM_PAGE_SIZE - 1);
+    mem->size = 0;
+    mem->ram = vm_mem_map_zero(size, flags);
     if (!mem->ram) return -1;
-    mem->size = GUEST_RAM_SIZE;
-    asm_mem_zero(mem->ram, mem->size);
+    mem->size = size;
+    mem->code_pages = NULL;
+    mem->code_write = NULL;
+    mem->code_write_ctx = NULL;
+    mem->base_dirty = NULL;
+    mem->base_from_zero = 0;
+    /* Fresh RAM is all zero: nothing is dirty until the guest writes. */
+    mem->dirty = mem_domain_alloc(MEM_DOMAIN_DRIVER, (vm_mem_page_count(mem) + 7) / 8);
+    if (!mem->dirty) {
+        vm_mem_unmap(mem->ram, mem->size);
+        mem->ram = NULL;
+        mem->size = 0;
+        return -1;
+    }
+    asm_mem_zero(mem->dirty, (vm_mem_page_count(mem) + 7) / 8);
+    mem->dirty_from_zero = 1;
     return 0;
 }
 
 void vm_mem_destroy(vm_mem_t *mem) {
     if (!mem) return;
+    vm_mem_code_unwatch(mem);
+    if (mem->base_dirty) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, mem->base_dirty);
+        mem->base_dirty = NULL;
+    }
+    if (mem->dirty) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, mem->dirty);
+        mem->dirty = NULL;
+    }
     if (mem->ram) {
-        mem_domain_free(MEM_DOMAIN_USER, mem->ram);
+        vm_mem_unmap(mem->ram, mem->size);
         mem->ram = NULL;
     }
     mem->size = 0;
 }
 
+/* Dropping the pages is both faster than clearing them and gives the
+ * memory back. The dirty bitmaps start over from zero rather than marking
+ * every page: checkpoint and baseline slots see dirty_from_zero and
+ * base_from_zero and drop their own pages in turn, so both stay
+ * demand-zero. Cached code is dropped. */
 void vm_mem_zero(vm_mem_t *mem) {
     if (!mem || !mem->ram) return;
-    asm_mem_zero(mem->ram, mem->size);
+    if (vm_mem_discard(mem->ram, mem->size) != 0)
+        asm_mem_zero(mem->ram, mem->size);
+    size_t pages = vm_mem_page_count(mem);
+    if (mem->dirty)
+        asm_mem_zero(mem->dirty, (pages + 7) / 8);
+    mem->base_from_zero = vm_mem_base_mark(mem) == 0;
+    for (size_t p = 0; mem->code_pages && p < pages; p++) {
+        if (!mem->code_pages[p]) continue;
+        mem->code_pages[p] = 0;
+        if (mem->code_write)
+            mem->code_write(mem->code_write_ctx, (uint32_t)p);
+    }
+    mem->dirty_from_zero = 1;
 }
 
 int vm_mem_load(vm_mem_t *mem, uint32_t guest_addr, const void *src, size_t n) {
     if (!mem || !mem->ram || !src) return -1;
     if (guest_addr + n > mem->size) return -1;
     asm_mem_copy(mem->ram + guest_addr, src, n);
+    vm_mem_note_write(mem, guest_addr, n);
     return 0;
 }
 
@@ -44,6 +124,7 @@ int vm_mem_write(vm_mem_t *mem, uint32_t guest_addr, const void *src, size_t n)
     if (!mem || !mem->ram || !src) return -1;
     if (guest_addr + n > mem->size) return -1;
     asm_mem_copy(mem->ram + guest_addr, src, n);
+    vm_mem_note_write(mem, guest_addr, n);
     return 0;
 }
 
@@ -52,17 +133,90 @@ uint8_t vm_mem_read8(vm_mem_t *mem, uint32_t guest_addr) {
     return mem->ram[guest_addr];
 }
 
-uint16_t vm_mem_read16(vm_mem_t *mem, uint32_t guest_addr) {
+uint16_t vm_mem_read16_slow(vm_mem_t *mem, uint32_t guest_addr) {
     uint16_t v;
     if (vm_mem_read(mem, guest_addr, &v, 2) != 0) return 0;
     return v;
 }
 
+uint32_t vm_mem_read32_slow(vm_mem_t *mem, uint32_t guest_addr) {
+    uint32_t v;
+    if (vm_mem_read(mem, guest_addr, &v, 4) != 0) return 0;
+    return v;
+}
+
 void vm_mem_write8(vm_mem_t *mem, uint32_t guest_addr, uint8_t v) {
     if (!mem || !mem->ram || guest_addr >= mem->size) return;
     mem->ram[guest_addr] = v;
+    vm_mem_note_write(mem, guest_addr, 1);
 }
 
-void vm_mem_write16(vm_mem_t *mem, uint32_t guest_addr, uint16_t v) {
+void vm_mem_write16_slow(vm_mem_t *mem, uint32_t guest_addr, uint16_t v) {
     vm_mem_write(mem, guest_addr, &v, 2);
 }
+
+void vm_mem_write32_slow(vm_mem_t *mem, uint32_t guest_addr, uint32_t v) {
+    vm_mem_write(mem, guest_addr, &v, 4);
+}
+
+size_t vm_mem_page_count(const vm_mem_t *mem) {
+    return mem ? (mem->size + VM_PAGE_SIZE - 1) >> VM_PAGE_SHIFT : 0;
+}
+
+void vm_mem_dirty_clear(vm_mem_t *mem) {
+    if (!mem || !mem->dirty) return;
+    size_t bytes = (vm_mem_page_count(mem) + 7) / 8;
+    if (mem->base_dirty) {
+        for (size_t i = 0; i < bytes; i++)
+            mem->base_dirty[i] |= mem->dirty[i];
+    }
+    asm_mem_zero(mem->dirty, bytes);
+    mem->dirty_from_zero = 0;
+}
+
+int vm_mem_base_mark(vm_mem_t *mem) {
+    if (!mem || !mem->ram) return -1;
+    size_t bytes = (vm_mem_page_count(mem) + 7) / 8;
+    if (!mem->base_dirty) {
+        mem->base_dirty = mem_domain_alloc(MEM_DOMAIN_DRIVER, bytes);
+        if (!mem->base_dirty) return -1;
+    }
+    asm_mem_zero(mem->base_dirty, bytes);
+    mem->base_from_zero = 0;
+    return 0;
+}
+
+void vm_mem_base_clear(vm_mem_t *mem) {
+    if (!mem || !mem->base_dirty) return;
+    asm_mem_zero(mem->base_dirty, (vm_mem_page_count(mem) + 7) / 8);
+}
+
+/* Code watch: page map is allocated lazily so plain vm_mem users pay nothing. */
+int vm_mem_code_watch(vm_mem_t *mem, vm_mem_code_write_fn fn, void *ctx) {
+    if (!mem || !mem->ram || !fn) return -1;
+    size_t pages = vm_mem_page_count(mem);
+    if (!mem->code_pages) {
+        mem->code_pages = mem_domain_alloc(MEM_DOMAIN_DRIVER, pages);
+        if (!mem->code_pages) return -1;
+    }
+    asm_mem_zero(mem->code_pages, pages);
+    mem->code_write = fn;
+    mem->code_write_ctx = ctx;
+    return 0;
+}
+
+void vm_mem_code_unwatch(vm_mem_t *mem) {
+    if (!mem) return;
+    if (mem->code_pages) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, mem->code_pages);
+        mem->code_pages = NULL;
+    }
+    mem->code_write = NULL;
+    mem->code_write_ctx = NULL;
+}
+
+void vm_mem_mark_code(vm_mem_t *mem, uint32_t page) {
+    if (!mem || !mem->code_pages) return;
+    if ((size_t)page << VM_PAGE_SHIFT >= mem->size) return;
+    mem->code_pages[page] = 1;
+}
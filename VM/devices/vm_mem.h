@@ -3,25 +3,151 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-#define GUEST_RAM_SIZE  (16 * 1024 * 1024)
+#define GUEST_RAM_SIZE  (16 * 1024 * 1024)   /* default size */
+#define VM_MEM_MIN_SIZE (1024 * 1024)          /* IVT through VGA/BIOS area */
+#define VM_MEM_MAX_SIZE ((size_t)0xFFFFF000)   /* 32-bit guest physical space */
 #define GUEST_VGA_BASE  0xb8000
 #define GUEST_VGA_SIZE  (80 * 25 * 2)
 
+#define VM_PAGE_SHIFT   12
+#define VM_PAGE_SIZE    (1u << VM_PAGE_SHIFT)
+
+/* vm_mem_init_size flags */
+#define VM_MEM_THP      0x1u                   /* advise transparent huge pages */
+
+/* Code watch: invoked once when a write lands on a page marked as holding
+ * cached decoded instructions. The mark is cleared before the call. */
+typedef void (*vm_mem_code_write_fn)(void *ctx, uint32_t page);
+
 typedef struct vm_mem {
     uint8_t *ram;
     size_t size;
+    uint8_t *dirty;                   /* bitmap, one bit per page written since last vm_mem_dirty_clear */
+    uint8_t *code_pages;              /* one byte per page; NULL = no watch */
+    vm_mem_code_write_fn code_write;
+    void *code_write_ctx;
+    /* Set while the dirty bitmap covers every page written since RAM was
+     * last all zero (init, vm_mem_zero); cleared by vm_mem_dirty_clear. */
+    int dirty_from_zero;
+    /* Pages written since vm_mem_base_mark whose bits have since left
+     * `dirty` (vm_mem_dirty_clear folds them in). NULL = not tracked. */
+    uint8_t *base_dirty;
+    /* Set by vm_mem_zero: base_dirty counts from the zeroing rather than
+     * from a baseline; cleared by vm_mem_base_mark. */
+    int base_from_zero;
 } vm_mem_t;
 
+/* Guest RAM is an anonymous private mapping: pages are zero-filled by the
+ * host on first touch, so boot cost and RSS follow what the guest uses
+ * rather than the configured size. vm_mem_init maps GUEST_RAM_SIZE;
+ * vm_mem_init_size rounds size up to a page and accepts VM_MEM_MIN_SIZE
+ * through VM_MEM_MAX_SIZE. */
 int vm_mem_init(vm_mem_t *mem);
+int vm_mem_init_size(vm_mem_t *mem, size_t size, unsigned int flags);
 void vm_mem_destroy(vm_mem_t *mem);
 void vm_mem_zero(vm_mem_t *mem);
 int vm_mem_load(vm_mem_t *mem, uint32_t guest_addr, const void *src, size_t n);
 int vm_mem_read(vm_mem_t *mem, uint32_t guest_addr, void *dst, size_t n);
 int vm_mem_write(vm_mem_t *mem, uint32_t guest_addr, const void *src, size_t n);
 uint8_t vm_mem_read8(vm_mem_t *mem, uint32_t guest_addr);
-uint16_t vm_mem_read16(vm_mem_t *mem, uint32_t guest_addr);
 void vm_mem_write8(vm_mem_t *mem, uint32_t guest_addr, uint8_t v);
-void vm_mem_write16(vm_mem_t *mem, uint32_t guest_addr, uint16_t v);
+/* Checked paths behind the inline 16/32-bit accessors below: unaligned or
+ * out-of-range addresses (which read as 0 / drop the write). */
+uint16_t vm_mem_read16_slow(vm_mem_t *mem, uint32_t guest_addr);
+uint32_t vm_mem_read32_slow(vm_mem_t *mem, uint32_t guest_addr);
+void vm_mem_write16_slow(vm_mem_t *mem, uint32_t guest_addr, uint16_t v);
+void vm_mem_write32_slow(vm_mem_t *mem, uint32_t guest_addr, uint32_t v);
+
+/* Demand-zero host mappings (guest RAM, checkpoint slots). vm_mem_discard
+ * returns a page-aligned range to the zero state and releases its memory;
+ * it returns -1 if the host cannot, leaving the contents unchanged. */
+void *vm_mem_map_zero(size_t size, unsigned int flags);
+void vm_mem_unmap(void *p, size_t size);
+int vm_mem_discard(void *p, size_t size);
+
+size_t vm_mem_page_count(const vm_mem_t *mem);
+void vm_mem_dirty_clear(vm_mem_t *mem);
+static inline int vm_mem_page_dirty(const vm_mem_t *mem, uint32_t page) {
+    return mem->dirty ? (mem->dirty[page >> 3] >> (page & 7)) & 1 : 1;
+}
+
+/* Reset baseline tracking: after vm_mem_base_mark, vm_mem_base_page_dirty
+ * reports every page written since (checkpoints clearing `dirty` do not
+ * lose them). vm_mem_base_clear starts a new interval. */
+int vm_mem_base_mark(vm_mem_t *mem);
+void vm_mem_base_clear(vm_mem_t *mem);
+static inline int vm_mem_base_page_dirty(const vm_mem_t *mem, uint32_t page) {
+    if (!mem->base_dirty) return 1;
+    return ((mem->base_dirty[page >> 3] >> (page & 7)) & 1) | vm_mem_page_dirty(mem, page);
+}
+
+int vm_mem_code_watch(vm_mem_t *mem, vm_mem_code_write_fn fn, void *ctx);
+void vm_mem_code_unwatch(vm_mem_t *mem);
+void vm_mem_mark_code(vm_mem_t *mem, uint32_t page);
+
+/* Record a store to one page: dirty bit, then the code watch. */
+static inline void vm_mem_note_page(vm_mem_t *mem, uint32_t page) {
+    if (mem->dirty)
+        mem->dirty[page >> 3] |= (uint8_t)(1u << (page & 7));
+    if (mem->code_pages && mem->code_pages[page]) {
+        mem->code_pages[page] = 0;
+        if (mem->code_write)
+            mem->code_write(mem->code_write_ctx, page);
+    }
+}
+
+/* Every path that stores into mem->ram must report the range here, including
+ * host-side writers that bypass vm_mem_write (loader, syscall bridge, restore). */
+static inline void vm_mem_note_write(vm_mem_t *mem, uint32_t guest_addr, size_t n) {
+    if (!mem || n == 0 || guest_addr >= mem->size) return;
+    if (!mem->dirty && !mem->code_pages) return;
+    size_t end = (size_t)guest_addr + n;
+    if (end > mem->size) end = mem->size;
+    uint32_t last = (uint32_t)((end - 1) >> VM_PAGE_SHIFT);
+    for (uint32_t p = guest_addr >> VM_PAGE_SHIFT; p <= last; p++)
+        vm_mem_note_page(mem, p);
+}
+
+/* 16/32-bit guest accesses. A naturally aligned access inside RAM never
+ * spans a page, so it is one host load or store (plus one page note for
+ * writes); everything else takes the checked slow path. mem must be
+ * initialized (a destroyed vm_mem has size 0 and always goes slow). */
+static inline uint16_t vm_mem_read16(vm_mem_t *mem, uint32_t guest_addr) {
+    if (!(guest_addr & 1) && (size_t)guest_addr + 2 <= mem->size) {
+        uint16_t v;
+        memcpy(&v, mem->ram + guest_addr, 2);
+        return v;
+    }
+    return vm_mem_read16_slow(mem, guest_addr);
+}
+
+static inline uint32_t vm_mem_read32(vm_mem_t *mem, uint32_t guest_addr) {
+    if (!(guest_addr & 3) && (size_t)guest_addr + 4 <= mem->size) {
+        uint32_t v;
+        memcpy(&v, mem->ram + guest_addr, 4);
+        return v;
+    }
+    return vm_mem_read32_slow(mem, guest_addr);
+}
+
+static inline void vm_mem_write16(vm_mem_t *mem, uint32_t guest_addr, uint16_t v) {
+    if (!(guest_addr & 1) && (size_t)guest_addr + 2 <= mem->size) {
+        memcpy(mem->ram + guest_addr, &v, 2);
+        vm_mem_note_page(mem, guest_addr >> VM_PAGE_SHIFT);
+        return;
+    }
+    vm_mem_write16_slow(mem, guest_addr, v);
+}
+
+static inline void vm_mem_write32(vm_mem_t *mem, uint32_t guest_addr, uint32_t v) {
+    if (!(guest_addr & 3) && (size_t)guest_addr + 4 <= mem->size) {
+        memcpy(mem->ram + guest_addr, &v, 4);
+        vm_mem_note_page(mem, guest_addr >> VM_PAGE_SHIFT);
+        return;
+    }
+    vm_mem_write32_slow(mem, guest_addr, v);
+}
 
 #endif /* VM_MEM_H */
@@ -0,0 +1,137 @@
+/* 8259A PIC pair: IRR/ISR/IMR bookkeeping and vector acknowledge. */
+#include "vm_pic.h"
+#include "mem_asm.h"
+
+static void chip_reset(vm_pic_chip_t *c, uint8_t base) {
+    asm_mem_zero(c, sizeof(*c));
+    c->imr = 0xFF;
+    c->base = base;
+}
+
+void vm_pic_init(vm_pic_t *pic) {
+    if (!pic) return;
+    chip_reset(&pic->chip[VM_PIC_MASTER], 0x08);
+    chip_reset(&pic->chip[VM_PIC_SLAVE], 0x70);
+    pic->acks = 0;
+}
+
+/* Highest-priority bit of v (bit 0 first), or -1. */
+static int lowest_bit(uint8_t v) {
+    for (int i = 0; i < 8; i++)
+        if (v & (1u << i)) return i;
+    return -1;
+}
+
+/* Line the chip would signal given its unmasked requests `req`: the
+ * highest-priority one above everything in service. */
+static int chip_best(const vm_pic_chip_t *c, uint8_t req) {
+    int r = lowest_bit((uint8_t)(req & ~c->imr));
+    if (r < 0) return -1;
+    int s = lowest_bit(c->isr);
+    return (s >= 0 && s <= r) ? -1 : r;
+}
+
+static int slave_best(const vm_pic_t *pic) {
+    const vm_pic_chip_t *s = &pic->chip[VM_PIC_SLAVE];
+    return chip_best(s, s->irr);
+}
+
+/* Master view: its own IRR plus IR2 while the slave asserts INT. */
+static int master_best(const vm_pic_t *pic) {
+    const vm_pic_chip_t *m = &pic->chip[VM_PIC_MASTER];
+    uint8_t req = m->irr;
+    if (slave_best(pic) >= 0) req |= 1u << VM_PIC_CASCADE_IRQ;
+    return chip_best(m, req);
+}
+
+void vm_pic_raise(vm_pic_t *pic, unsigned int irq) {
+    if (!pic || irq > 15) return;
+    pic->chip[irq >> 3].irr |= (uint8_t)(1u << (irq & 7));
+}
+
+int vm_pic_intr(const vm_pic_t *pic) {
+    return pic && master_best(pic) >= 0;
+}
+
+static int chip_accept(vm_pic_chip_t *c, int line) {
+    uint8_t bit = (uint8_t)(1u << line);
+    c->irr &= (uint8_t)~bit;
+    if (!c->auto_eoi) c->isr |= bit;
+    return c->base + line;
+}
+
+int vm_pic_ack(vm_pic_t *pic) {
+    if (!pic) return -1;
+    int m = master_best(pic);
+    if (m < 0) return -1;
+    pic->acks++;
+    vm_pic_chip_t *master = &pic->chip[VM_PIC_MASTER];
+    if (m == VM_PIC_CASCADE_IRQ && !(master->irr & (1u << m))) {
+        /* Cascaded: the master only records IR2 in service. */
+        if (!master->auto_eoi) master->isr |= 1u << m;
+        return chip_accept(&pic->chip[VM_PIC_SLAVE], slave_best(pic));
+    }
+    return chip_accept(master, m);
+}
+
+uint8_t vm_pic_read(vm_pic_t *pic, unsigned int chip, unsigned int a0) {
+    if (!pic || chip > 1) return 0xFF;
+    const vm_pic_chip_t *c = &pic->chip[chip];
+    if (a0) return c->imr;
+    return c->read_isr ? c->isr : c->irr;
+}
+
+static void chip_command(vm_pic_chip_t *c, uint8_t v) {
+    if (v & 0x10) {                       /* ICW1 */
+        c->irr = c->isr = c->imr = 0;
+        c->read_isr = 0;
+        c->auto_eoi = 0;
+        c->need_icw4 = v & 0x01;
+        c->single = (v & 0x02) != 0;
+        c->init_step = 2;
+        return;
+    }
+    if (v & 0x08) {                       /* OCW3 */
+        if (v & 0x02) c->read_isr = v & 0x01;
+        return;
+    }
+    switch (v & 0xE0) {                   /* OCW2 */
+    case 0x20:                            /* non-specific EOI */
+    case 0xA0: {                          /* ...with rotate: treated as plain */
+        int s = lowest_bit(c->isr);
+        if (s >= 0) c->isr &= (uint8_t)~(1u << s);
+        break;
+    }
+    case 0x60:                            /* specific EOI */
+    case 0xE0:
+        c->isr &= (uint8_t)~(1u << (v & 7));
+        break;
+    default:
+        break;
+    }
+}
+
+static void chip_data(vm_pic_chip_t *c, uint8_t v) {
+    switch (c->init_step) {
+    case 2:                               /* ICW2: vector base */
+        c->base = v & 0xF8;
+        c->init_step = !c->single ? 3 : c->need_icw4 ? 4 : 0;
+        break;
+    case 3:                               /* ICW3: cascade wiring, fixed here */
+        c->init_step = c->need_icw4 ? 4 : 0;
+        break;
+    case 4:                               /* ICW4 */
+        c->auto_eoi = (v & 0x02) != 0;
+        c->init_step = 0;
+        break;
+    default:                              /* OCW1: mask */
+        c->imr = v;
+        break;
+    }
+}
+
+void vm_pic_write(vm_pic_t *pic, unsigned int chip, unsigned int a0, uint8_t value) {
+    if (!pic || chip > 1) return;
+    if (a0) chip_data(&pic->chip[chip], value);
+    else chip_command(&pic->chip[chip], value);
+}
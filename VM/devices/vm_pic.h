@@ -0,0 +1,44 @@
+#ifndef VM_PIC_H
+#define VM_PIC_H
+
+#include <stdint.h>
+
+/* Cascaded 8259A pair: master on ports 0x20/0x21, slave on 0xA0/0xA1 wired
+ * to master IR2. Requests are edge-triggered and latch in IRR; fixed
+ * priority (IR0 highest), non-specific and specific EOI, OCW3 IRR/ISR
+ * select, ICW4 auto-EOI. Rotation, special mask and poll mode are not
+ * modelled. After vm_pic_init every line is masked with the BIOS vector
+ * bases (0x08, 0x70); an ICW1 init sequence clears the mask, as on the
+ * real part. */
+#define VM_PIC_MASTER 0
+#define VM_PIC_SLAVE  1
+#define VM_PIC_CASCADE_IRQ 2
+
+typedef struct vm_pic_chip {
+    uint8_t irr, isr, imr;
+    uint8_t base;        /* ICW2 vector base */
+    uint8_t init_step;   /* next ICW expected (2..4); 0 = operational */
+    uint8_t need_icw4;
+    uint8_t single;      /* ICW1 SNGL: no ICW3 */
+    uint8_t auto_eoi;
+    uint8_t read_isr;    /* OCW3: command-port reads return ISR */
+} vm_pic_chip_t;
+
+typedef struct vm_pic {
+    vm_pic_chip_t chip[2];
+    uint64_t acks;       /* vectors delivered through vm_pic_ack */
+} vm_pic_t;
+
+void vm_pic_init(vm_pic_t *pic);
+/* Latch a request on line irq (0..15). */
+void vm_pic_raise(vm_pic_t *pic, unsigned int irq);
+/* a0 selects the command (0) or data (1) port of the chip. */
+uint8_t vm_pic_read(vm_pic_t *pic, unsigned int chip, unsigned int a0);
+void vm_pic_write(vm_pic_t *pic, unsigned int chip, unsigned int a0, uint8_t value);
+/* INTR output: an unmasked request outranks everything in service. */
+int vm_pic_intr(const vm_pic_t *pic);
+/* INTA cycle: move the winning request into service and return its
+ * vector, or -1 when nothing is pending. */
+int vm_pic_ack(vm_pic_t *pic);
+
+#endif /* VM_PIC_H */
@@ -0,0 +1,109 @@
+/* Guest execution profiler: counters live in vm_prof (see vm_prof.h);
+ * this file resets them and renders the sorted report. */
+#include "vm_prof.h"
+#include "vm_io.h"
+#include "mem_asm.h"
+#include "mem_domain.h"
+#include <stdlib.h>
+
+#ifdef VM_PROFILE
+
+_Thread_local vm_prof_t vm_prof;
+
+static const char *const s_op_names[VM_OP_UNKNOWN + 1] = {
+    [VM_OP_NOP] = "NOP",       [VM_OP_HLT] = "HLT",
+    [VM_OP_IN] = "IN",         [VM_OP_OUT] = "OUT",
+    [VM_OP_IN_DX] = "IN DX",   [VM_OP_OUT_DX] = "OUT DX",
+    [VM_OP_MOV] = "MOV",       [VM_OP_ADD] = "ADD",
+    [VM_OP_SUB] = "SUB",       [VM_OP_INC] = "INC",
+    [VM_OP_DEC] = "DEC",       [VM_OP_CMP] = "CMP",
+    [VM_OP_TEST] = "TEST",     [VM_OP_PUSH] = "PUSH",
+    [VM_OP_POP] = "POP",       [VM_OP_JMP] = "JMP",
+    [VM_OP_JZ] = "JZ",         [VM_OP_JNZ] = "JNZ",
+    [VM_OP_INT] = "INT",       [VM_OP_IRET] = "IRET",
+    [VM_OP_RET] = "RET",       [VM_OP_STOS] = "STOS",
+    [VM_OP_MOV_CR] = "MOV CR", [VM_OP_INS] = "INS",
+    [VM_OP_OUTS] = "OUTS",     [VM_OP_MOVS] = "MOVS",
+    [VM_OP_LODS] = "LODS",     [VM_OP_CMPS] = "CMPS",
+    [VM_OP_SCAS] = "SCAS",     [VM_OP_CLI] = "CLI",
+    [VM_OP_STI] = "STI",       [VM_OP_LIDT] = "LIDT",
+    [VM_OP_UNKNOWN] = "?",
+};
+
+void vm_prof_reset(void) {
+    asm_mem_zero(&vm_prof, sizeof(vm_prof));
+    vm_io_port_stats_reset();
+}
+
+const char *vm_prof_op_name(vm_opcode_t op) {
+    if ((unsigned int)op > VM_OP_UNKNOWN || !s_op_names[op]) return "?";
+    return s_op_names[op];
+}
+
+typedef struct prof_row {
+    uint32_t key;
+    uint64_t count;
+    uint64_t extra;
+} prof_row_t;
+
+static int row_cmp(const void *a, const void *b) {
+    const prof_row_t *x = a, *y = b;
+    uint64_t cx = x->count + x->extra, cy = y->count + y->extra;
+    if (cx != cy) return cx < cy ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static double pct(uint64_t n, uint64_t total) {
+    return total ? 100.0 * (double)n / (double)total : 0.0;
+}
+
+void vm_prof_report(FILE *out) {
+    if (!out) return;
+    uint64_t total = vm_prof.total;
+    fprintf(out, "vm profile: %llu instructions\n", (unsigned long long)total);
+
+    prof_row_t ops[VM_OP_UNKNOWN + 1];
+    int nops = 0;
+    for (int i = 0; i <= VM_OP_UNKNOWN; i++)
+        if (vm_prof.ops[i]) ops[nops++] = (prof_row_t){ (uint32_t)i, vm_prof.ops[i], 0 };
+    qsort(ops, (size_t)nops, sizeof(ops[0]), row_cmp);
+    fprintf(out, "  opcodes:\n");
+    for (int i = 0; i < nops && i < VM_PROF_TOP; i++)
+        fprintf(out, "    %-8s %12llu  %5.1f%%\n", vm_prof_op_name((vm_opcode_t)ops[i].key),
+                (unsigned long long)ops[i].count, pct(ops[i].count, total));
+
+    prof_row_t *eips = mem_domain_alloc(MEM_DOMAIN_DRIVER, VM_PROF_BUCKETS * sizeof(*eips));
+    if (eips) {
+        int n = 0;
+        for (int i = 0; i < VM_PROF_BUCKETS; i++)
+            if (vm_prof.eip[i].key)
+                eips[n++] = (prof_row_t){ (vm_prof.eip[i].key - 1) << VM_PROF_BUCKET_SHIFT, vm_prof.eip[i].count, 0 };
+        qsort(eips, (size_t)n, sizeof(eips[0]), row_cmp);
+        fprintf(out, "  hot EIP (linear, %u-byte buckets):\n", 1u << VM_PROF_BUCKET_SHIFT);
+        for (int i = 0; i < n && i < VM_PROF_TOP; i++)
+            fprintf(out, "    %08X %12llu  %5.1f%%\n", eips[i].key,
+                    (unsigned long long)eips[i].count, pct(eips[i].count, total));
+        if (vm_prof.eip_overflow)
+            fprintf(out, "    (untracked) %llu\n", (unsigned long long)vm_prof.eip_overflow);
+        mem_domain_free(MEM_DOMAIN_DRIVER, eips);
+    }
+
+    prof_row_t ports[VM_PROF_TOP + 1];
+    int nports = 0;
+    for (uint32_t p = 0; p < VM_IO_PORT_COUNT; p++) {
+        uint64_t r, w;
+        if (vm_io_port_stats(p, &r, &w) != 0 || (r | w) == 0) continue;
+        ports[nports] = (prof_row_t){ p, r, w };
+        /* Keep the VM_PROF_TOP busiest by insertion into the sorted prefix. */
+        for (int i = nports; i > 0 && row_cmp(&ports[i], &ports[i - 1]) < 0; i--) {
+            prof_row_t t = ports[i]; ports[i] = ports[i - 1]; ports[i - 1] = t;
+        }
+        if (nports < VM_PROF_TOP) nports++;
+    }
+    fprintf(out, "  port I/O exits:\n");
+    for (int i = 0; i < nports; i++)
+        fprintf(out, "    %04X  in %10llu  out %10llu\n", ports[i].key,
+                (unsigned long long)ports[i].count, (unsigned long long)ports[i].extra);
+}
+
+#endif /* VM_PROFILE */
@@ -0,0 +1,62 @@
+#ifndef VM_PROF_H
+#define VM_PROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "vm_decode.h"
+
+/* Guest execution profiler, built with VM_PROFILE=1 (-DVM_PROFILE).
+ * Counts executions per decoded opcode and per guest EIP bucket
+ * (linear address >> VM_PROF_BUCKET_SHIFT); port I/O exits come from the
+ * vm_io per-port counters. vm_run prints a sorted report on exit. Without
+ * VM_PROFILE the hooks are empty macros and nothing is linked. */
+#define VM_PROF_BUCKET_SHIFT 4       /* 16-byte EIP buckets */
+#define VM_PROF_BUCKETS      4096    /* open-addressed, power of two */
+#define VM_PROF_TOP          16      /* rows per report section */
+
+#ifdef VM_PROFILE
+
+typedef struct vm_prof_bucket {
+    uint32_t key;                    /* (linear >> shift) + 1; 0 = empty */
+    uint64_t count;
+} vm_prof_bucket_t;
+
+typedef struct vm_prof {
+    uint64_t ops[VM_OP_UNKNOWN + 1];
+    vm_prof_bucket_t eip[VM_PROF_BUCKETS];
+    uint64_t eip_overflow;           /* executions whose bucket found no slot */
+    uint64_t total;
+} vm_prof_t;
+
+/* Per thread: a guest running on its own thread profiles only itself. */
+extern _Thread_local vm_prof_t vm_prof;
+
+static inline void vm_prof_insn(vm_opcode_t op, uint32_t linear) {
+    vm_prof.total++;
+    vm_prof.ops[(unsigned int)op <= VM_OP_UNKNOWN ? op : VM_OP_UNKNOWN]++;
+    uint32_t key = (linear >> VM_PROF_BUCKET_SHIFT) + 1;
+    uint32_t h = (key * 2654435761U) & (VM_PROF_BUCKETS - 1);
+    for (int probe = 0; probe < 8; probe++) {
+        vm_prof_bucket_t *b = &vm_prof.eip[(h + (uint32_t)probe) & (VM_PROF_BUCKETS - 1)];
+        if (b->key == key) { b->count++; return; }
+        if (b->key == 0) { b->key = key; b->count = 1; return; }
+    }
+    vm_prof.eip_overflow++;
+}
+
+#define VM_PROF_INSN(op, linear) vm_prof_insn((op), (linear))
+
+void vm_prof_reset(void);
+const char *vm_prof_op_name(vm_opcode_t op);
+void vm_prof_report(FILE *out);
+
+#else
+
+#define VM_PROF_INSN(op, linear) ((void)0)
+
+static inline void vm_prof_reset(void) { }
+static inline void vm_prof_report(FILE *out) { (void)out; }
+
+#endif /* VM_PROFILE */
+
+#endif /* VM_PROF_H */
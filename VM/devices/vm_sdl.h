@@ -3,13 +3,19 @@
 
 #include "vm_host.h"
 
-/* SDL2 window frontend. Requires VM_SDL=1 and libSDL2. */
+/* SDL2 window frontend. Requires VM_SDL=1 and libSDL2. Runs headless with
+ * SDL_VIDEODRIVER=dummy (software renderer fallback). */
 int vm_sdl_init(void);
 void vm_sdl_shutdown(void);
 int vm_sdl_create_window(int scale);
 void vm_sdl_present(vm_host_t *host);
 int vm_sdl_poll_events(vm_host_t *host);
+/* Block up to timeout_ms for the next window event, then handle all pending
+ * ones as vm_sdl_poll_events does. */
+int vm_sdl_wait_events(vm_host_t *host, int timeout_ms);
 int vm_sdl_is_quit(void);
 int vm_sdl_is_active(void);
+/* Texture uploads and text rows rasterized since vm_sdl_init. */
+void vm_sdl_frame_stats(uint64_t *uploads, uint64_t *rows_drawn);
 
 #endif /* VM_SDL_H */
@@ -0,0 +1,520 @@
+/* Snapshot files (see vm_snapfile.h). Save streams sections through stdio;
+ * load maps the file read-only and verifies every section, decoding each
+ * compressed payload and register blob, before it applies any, so a
+ * corrupt or foreign file leaves the guest untouched. ASM for buffer ops. */
+#include "vm_snapfile.h"
+#include "vm_mem.h"
+#include "vm_disk.h"
+#include "vm_io.h"
+#include "vm_lz.h"
+#include "mem_asm.h"
+#include "mem_domain.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VM_SNAPFILE_MAGIC    "VMSNAPF"
+#define VM_SNAPFILE_PATH_MAX 256
+#define SF_SECTOR_SIZE       VM_DISK_SECTOR_SIZE
+
+enum {
+    SF_SEC_CPU = 1,
+    SF_SEC_HOST,
+    SF_SEC_DEV,
+    SF_SEC_RAM,
+    SF_SEC_RAM_ZERO,
+    SF_SEC_DISK,
+    SF_SEC_DISK_ZERO,
+    SF_SEC_END
+};
+
+#define SF_FLAG_LZ 0x1u   /* payload is vm_lz compressed */
+
+typedef struct sf_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t ram_size;
+    uint32_t disk_sectors;   /* 0: no disk sections */
+    uint32_t crc;            /* over this header with crc = 0 */
+} sf_header_t;
+
+typedef struct sf_section {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t base;           /* first page (RAM) or sector (disk) */
+    uint64_t raw_len;        /* bytes once expanded */
+    uint64_t stored_len;     /* payload bytes that follow */
+    uint32_t crc;            /* over this header with crc = 0, then payload */
+    uint32_t reserved;
+} sf_section_t;
+
+#define SF_HEADER_LEN  32   /* encoded sizes: see header_codec, section_codec */
+#define SF_SECTION_LEN 40
+
+/* CRC-32 (IEEE), four bits at a time. */
+static uint32_t sf_crc32(uint32_t crc, const void *data, size_t n) {
+    static const uint32_t tab[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (n--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ tab[crc & 15];
+        crc = (crc >> 4) ^ tab[crc & 15];
+    }
+    return ~crc;
+}
+
+static int is_zero(const uint8_t *p, size_t n) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        acc |= v;
+        if (acc) return 0;
+    }
+    for (size_t i = n & ~(size_t)7; i < n; i++)
+        acc |= p[i];
+    return acc == 0;
+}
+
+/* ---- field encoding ----
+ *
+ * Headers and the CPU and HOST payloads are explicit lists of fixed-width
+ * little-endian fields; one codec per list measures, saves and loads, so
+ * the three cannot drift apart. Changing a list means bumping
+ * VM_SNAPFILE_VERSION. */
+
+typedef struct sf_codec {
+    uint8_t *out;           /* save; NULL with in == NULL measures */
+    const uint8_t *in;      /* load */
+    size_t off;
+} sf_codec_t;
+
+static uint64_t sf_int(sf_codec_t *c, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        if (c->out) c->out[c->off + (size_t)i] = (uint8_t)(v >> (8 * i));
+        else if (c->in) v = (i ? v : 0) | ((uint64_t)c->in[c->off + (size_t)i] << (8 * i));
+    }
+    c->off += (size_t)bytes;
+    return v;
+}
+
+/* File and section headers: their fields in order, little-endian. */
+static void header_codec(sf_codec_t *c, sf_header_t *h) {
+    if (c->out) asm_mem_copy(c->out + c->off, h->magic, sizeof(h->magic));
+    else if (c->in) asm_mem_copy(h->magic, c->in + c->off, sizeof(h->magic));
+    c->off += sizeof(h->magic);
+    h->version = (uint32_t)sf_int(c, h->version, 4);
+    h->page_size = (uint32_t)sf_int(c, h->page_size, 4);
+    h->ram_size = sf_int(c, h->ram_size, 8);
+    h->disk_sectors = (uint32_t)sf_int(c, h->disk_sectors, 4);
+    h->crc = (uint32_t)sf_int(c, h->crc, 4);
+}
+
+static void section_codec(sf_codec_t *c, sf_section_t *sec) {
+    sec->type = (uint32_t)sf_int(c, sec->type, 4);
+    sec->flags = (uint32_t)sf_int(c, sec->flags, 4);
+    sec->base = sf_int(c, sec->base, 8);
+    sec->raw_len = sf_int(c, sec->raw_len, 8);
+    sec->stored_len = sf_int(c, sec->stored_len, 8);
+    sec->crc = (uint32_t)sf_int(c, sec->crc, 4);
+    sec->reserved = (uint32_t)sf_int(c, sec->reserved, 4);
+}
+
+/* CRC of the encoded header with its crc field zero. */
+static uint32_t header_crc(const sf_header_t *hdr) {
+    uint8_t raw[SF_HEADER_LEN];
+    sf_header_t h = *hdr;
+    h.crc = 0;
+    sf_codec_t c = { raw, NULL, 0 };
+    header_codec(&c, &h);
+    return sf_crc32(0, raw, sizeof(raw));
+}
+
+static uint32_t section_crc(const sf_section_t *sec, const void *payload) {
+    uint8_t raw[SF_SECTION_LEN];
+    sf_section_t h = *sec;
+    h.crc = 0;
+    sf_codec_t c = { raw, NULL, 0 };
+    section_codec(&c, &h);
+    uint32_t crc = sf_crc32(0, raw, sizeof(raw));
+    return sf_crc32(crc, payload, (size_t)sec->stored_len);
+}
+
+static void section_get(sf_section_t *sec, const uint8_t *in) {
+    sf_codec_t c = { NULL, in, 0 };
+    section_codec(&c, sec);
+}
+
+/* Architectural registers only: EFLAGS with pending flags folded in; the
+ * TLB is flushed on load rather than stored. */
+static void cpu_codec(sf_codec_t *c, vm_cpu_t *cpu) {
+    uint32_t *regs[] = {
+        &cpu->eax, &cpu->ecx, &cpu->edx, &cpu->ebx, &cpu->esp, &cpu->ebp, &cpu->esi, &cpu->edi,
+        &cpu->eip, &cpu->cs, &cpu->ds, &cpu->es, &cpu->ss, &cpu->fs, &cpu->gs,
+        &cpu->cr0, &cpu->cr3, &cpu->idt_base, &cpu->idt_limit
+    };
+    for (size_t i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+        uint32_t v = (uint32_t)sf_int(c, *regs[i], 4);
+        if (c->in) *regs[i] = v;
+    }
+    uint32_t flags = (uint32_t)sf_int(c, vm_cpu_eflags(cpu), 4);
+    int halted = sf_int(c, (uint64_t)(cpu->halted != 0), 1) != 0;
+    if (c->in) {
+        vm_cpu_set_eflags(cpu, flags);
+        cpu->halted = halted;
+        vm_cpu_tlb_flush(cpu);
+    }
+}
+
+/* Keyboard queue, PIT ticks and virtual time. */
+static void host_codec(sf_codec_t *c, vm_host_t *host) {
+    if (c->out) asm_mem_copy(c->out + c->off, host->kbd_queue, VM_KBD_QUEUE_SIZE);
+    else if (c->in) asm_mem_copy(host->kbd_queue, c->in + c->off, VM_KBD_QUEUE_SIZE);
+    c->off += VM_KBD_QUEUE_SIZE;
+    uint64_t head = sf_int(c, host->kbd_head, 4);
+    uint64_t tail = sf_int(c, host->kbd_tail, 4);
+    uint64_t ticks = sf_int(c, host->vm_ticks, 8);
+    uint64_t clock = sf_int(c, host->vm_clock, 8);
+    if (c->in) {
+        host->kbd_head = (size_t)head % VM_KBD_QUEUE_SIZE;
+        host->kbd_tail = (size_t)tail % VM_KBD_QUEUE_SIZE;
+        host->vm_ticks = ticks;
+        host->vm_clock = clock;
+    }
+}
+
+static size_t cpu_len(void) {
+    vm_cpu_t cpu;
+    vm_cpu_init(&cpu);
+    sf_codec_t c = { NULL, NULL, 0 };
+    cpu_codec(&c, &cpu);
+    return c.off;
+}
+
+static size_t host_len(void) {
+    static vm_host_t host;
+    sf_codec_t c = { NULL, NULL, 0 };
+    host_codec(&c, &host);
+    return c.off;
+}
+
+/* ---- save ---- */
+
+typedef struct sf_writer {
+    FILE *f;
+    uint8_t *raw;            /* one chunk gathered for compression */
+    uint8_t *comp;
+    size_t comp_cap;
+    uint8_t sector[SF_SECTOR_SIZE];
+} sf_writer_t;
+
+static int put_section(sf_writer_t *w, uint32_t type, uint32_t flags, uint64_t base,
+                       uint64_t raw_len, const void *payload, size_t stored_len) {
+    sf_section_t sec = { type, flags, base, raw_len, stored_len, 0, 0 };
+    uint8_t raw[SF_SECTION_LEN];
+    sec.crc = section_crc(&sec, payload);
+    sf_codec_t c = { raw, NULL, 0 };
+    section_codec(&c, &sec);
+    if (fwrite(raw, sizeof(raw), 1, w->f) != 1) return -1;
+    if (stored_len && fwrite(payload, stored_len, 1, w->f) != 1) return -1;
+    return 0;
+}
+
+/* A chunk of data units: compressed when that shrinks it. */
+static int put_chunk(sf_writer_t *w, uint32_t type, uint64_t base, const uint8_t *raw, size_t n) {
+    size_t clen = vm_lz_compress(raw, n, w->comp, w->comp_cap);
+    if (clen && clen < n)
+        return put_section(w, type, SF_FLAG_LZ, base, n, w->comp, clen);
+    return put_section(w, type, 0, base, n, raw, n);
+}
+
+/* Unit idx of the area being written (a RAM page, a disk sector). */
+typedef const uint8_t *(*sf_unit_fn)(void *ctx, sf_writer_t *w, uint64_t idx);
+
+static const uint8_t *ram_unit(void *ctx, sf_writer_t *w, uint64_t idx) {
+    (void)w;
+    return ((vm_mem_t *)ctx)->ram + (idx << VM_PAGE_SHIFT);
+}
+
+static const uint8_t *disk_unit(void *ctx, sf_writer_t *w, uint64_t idx) {
+    (void)ctx;
+    return vm_disk_read_sector((uint32_t)idx, w->sector) == 0 ? w->sector : NULL;
+}
+
+/* Emit units [0, count) as runs: each all-zero run as one payload-free
+ * section, everything else in chunks of up to VM_SNAPFILE_CHUNK bytes. */
+static int put_runs(sf_writer_t *w, uint32_t type, uint32_t zero_type, size_t unit_size,
+                    uint64_t count, sf_unit_fn unit, void *ctx) {
+    uint64_t i = 0;
+    while (i < count) {
+        const uint8_t *u = unit(ctx, w, i);
+        if (!u) return -1;
+        uint64_t start = i;
+        if (is_zero(u, unit_size)) {
+            for (i++; i < count; i++) {
+                if (!(u = unit(ctx, w, i))) return -1;
+                if (!is_zero(u, unit_size)) break;
+            }
+            if (put_section(w, zero_type, 0, start, (i - start) * unit_size, NULL, 0) != 0) return -1;
+            continue;
+        }
+        size_t n = 0;
+        while (i < count && n + unit_size <= VM_SNAPFILE_CHUNK) {
+            if (!(u = unit(ctx, w, i))) return -1;
+            if (n && is_zero(u, unit_size)) break;
+            asm_mem_copy(w->raw + n, u, unit_size);
+            n += unit_size;
+            i++;
+        }
+        if (put_chunk(w, type, start, w->raw, n) != 0) return -1;
+    }
+    return 0;
+}
+
+static int write_file(sf_writer_t *w, vm_host_t *host, vm_mem_t *mem, uint32_t disk_sectors) {
+    sf_header_t hdr;
+    asm_mem_zero(&hdr, sizeof(hdr));
+    memcpy(hdr.magic, VM_SNAPFILE_MAGIC, sizeof(VM_SNAPFILE_MAGIC));
+    hdr.version = VM_SNAPFILE_VERSION;
+    hdr.page_size = VM_PAGE_SIZE;
+    hdr.ram_size = mem->size;
+    hdr.disk_sectors = disk_sectors;
+    hdr.crc = header_crc(&hdr);
+    sf_codec_t c = { w->raw, NULL, 0 };
+    header_codec(&c, &hdr);
+    if (fwrite(w->raw, c.off, 1, w->f) != 1) return -1;
+
+    /* Register sections are encoded in the chunk buffer; each is small. */
+    c.off = 0;
+    cpu_codec(&c, &host->cpu);
+    if (put_section(w, SF_SEC_CPU, 0, 0, c.off, w->raw, c.off) != 0) return -1;
+    c.off = 0;
+    host_codec(&c, host);
+    if (put_section(w, SF_SEC_HOST, 0, 0, c.off, w->raw, c.off) != 0) return -1;
+    size_t dev_len = vm_io_regs_size();
+    if (dev_len > VM_SNAPFILE_CHUNK || vm_io_regs_save(w->raw, dev_len) != 0) return -1;
+    if (put_section(w, SF_SEC_DEV, 0, 0, dev_len, w->raw, dev_len) != 0) return -1;
+
+    if (put_runs(w, SF_SEC_RAM, SF_SEC_RAM_ZERO, VM_PAGE_SIZE, mem->size >> VM_PAGE_SHIFT, ram_unit, mem) != 0)
+        return -1;
+    if (disk_sectors &&
+        put_runs(w, SF_SEC_DISK, SF_SEC_DISK_ZERO, SF_SECTOR_SIZE, disk_sectors, disk_unit, NULL) != 0)
+        return -1;
+    return put_section(w, SF_SEC_END, 0, 0, 0, NULL, 0);
+}
+
+int vm_snapfile_save(vm_host_t *host, const char *path) {
+    char tmp[VM_SNAPFILE_PATH_MAX];
+    if (!host || !path) return -1;
+    vm_mem_t *mem = vm_host_mem(host);
+    if (!mem || !mem->ram || mem->size == 0 || (mem->size & (VM_PAGE_SIZE - 1))) return -1;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+
+    sf_writer_t w;
+    asm_mem_zero(&w, sizeof(w));
+    w.comp_cap = vm_lz_bound(VM_SNAPFILE_CHUNK);
+    w.raw = mem_domain_alloc(MEM_DOMAIN_FS, VM_SNAPFILE_CHUNK);
+    w.comp = mem_domain_alloc(MEM_DOMAIN_FS, w.comp_cap);
+    w.f = fopen(tmp, "wb");
+    int err = (!w.raw || !w.comp || !w.f) ? -1 : 0;
+    if (!err)
+        err = write_file(&w, host, mem, vm_disk_sectors());
+    if (w.f && fclose(w.f) != 0) err = -1;
+    if (w.raw) mem_domain_free(MEM_DOMAIN_FS, w.raw);
+    if (w.comp) mem_domain_free(MEM_DOMAIN_FS, w.comp);
+    if (!err && rename(tmp, path) != 0) err = -1;
+    if (err && w.f) remove(tmp);
+    return err;
+}
+
+/* ---- load ---- */
+
+/* Expand a data section into dst (raw_len bytes). */
+static int expand(const sf_section_t *sec, const uint8_t *payload, uint8_t *dst) {
+    if (sec->flags & SF_FLAG_LZ)
+        return vm_lz_decompress(payload, (size_t)sec->stored_len, dst, (size_t)sec->raw_len);
+    asm_mem_copy(dst, payload, (size_t)sec->raw_len);
+    return 0;
+}
+
+/* Every check for one section at data + off, including decoding a
+ * compressed payload into scratch (one chunk) and validating the register
+ * blob, so that applying it afterwards cannot fail. On success *next is
+ * the offset of the following section. */
+static int check_section(const uint8_t *data, size_t size, size_t off, const sf_header_t *hdr,
+                         uint64_t *ram_next, uint64_t *disk_next, size_t *next, uint8_t *scratch) {
+    sf_section_t sec;
+    if (size - off < SF_SECTION_LEN) return -1;
+    section_get(&sec, data + off);
+    const uint8_t *payload = data + off + SF_SECTION_LEN;
+    if (sec.stored_len > size - off - SF_SECTION_LEN) return -1;
+    if (section_crc(&sec, payload) != sec.crc) return -1;
+    if (sec.flags & ~SF_FLAG_LZ) return -1;
+    if (!(sec.flags & SF_FLAG_LZ) && sec.stored_len != sec.raw_len &&
+        sec.type != SF_SEC_RAM_ZERO && sec.type != SF_SEC_DISK_ZERO)
+        return -1;
+    switch (sec.type) {
+    case SF_SEC_CPU:
+        if (sec.raw_len != cpu_len() || sec.flags) return -1;
+        break;
+    case SF_SEC_HOST:
+        if (sec.raw_len != host_len() || sec.flags) return -1;
+        break;
+    case SF_SEC_DEV:
+        if (sec.raw_len != vm_io_regs_size() || sec.flags) return -1;
+        if (vm_io_regs_check(payload, (size_t)sec.raw_len) != 0) return -1;
+        break;
+    case SF_SEC_RAM:
+    case SF_SEC_RAM_ZERO: {
+        /* Runs must tile RAM in order, so every page is restored. */
+        uint64_t pages = sec.raw_len >> VM_PAGE_SHIFT;
+        if (sec.base != *ram_next || pages == 0 || (sec.raw_len & (VM_PAGE_SIZE - 1))) return -1;
+        if (pages > (hdr->ram_size >> VM_PAGE_SHIFT) - sec.base) return -1;
+        if (sec.type == SF_SEC_RAM && sec.raw_len > VM_SNAPFILE_CHUNK) return -1;
+        if (sec.type == SF_SEC_RAM_ZERO && (sec.flags || sec.stored_len)) return -1;
+        *ram_next += pages;
+        break;
+    }
+    case SF_SEC_DISK:
+    case SF_SEC_DISK_ZERO: {
+        uint64_t count = sec.raw_len / SF_SECTOR_SIZE;
+        if (sec.base != *disk_next || count == 0 || (sec.raw_len % SF_SECTOR_SIZE)) return -1;
+        if (count > hdr->disk_sectors - sec.base) return -1;
+        if (sec.type == SF_SEC_DISK && sec.raw_len > VM_SNAPFILE_CHUNK) return -1;
+        if (sec.type == SF_SEC_DISK_ZERO && (sec.flags || sec.stored_len)) return -1;
+        *disk_next += count;
+        break;
+    }
+    case SF_SEC_END:
+        if (sec.raw_len || sec.stored_len) return -1;
+        break;
+    default:
+        return -1;
+    }
+    if ((sec.flags & SF_FLAG_LZ) && expand(&sec, payload, scratch) != 0) return -1;
+    *next = off + SF_SECTION_LEN + (size_t)sec.stored_len;
+    return (int)sec.type;
+}
+
+/* Disk sections go first, while the rest of the guest is untouched: a host
+ * write error on the image is the one failure left once checks pass. */
+static int apply_disk(const uint8_t *data, size_t off, uint8_t *buf) {
+    for (;;) {
+        sf_section_t sec;
+        section_get(&sec, data + off);
+        const uint8_t *payload = data + off + SF_SECTION_LEN;
+        off += SF_SECTION_LEN + (size_t)sec.stored_len;
+        if (sec.type == SF_SEC_END) return 0;
+        if (sec.type == SF_SEC_DISK)
+            expand(&sec, payload, buf);
+        else if (sec.type == SF_SEC_DISK_ZERO)
+            asm_mem_zero(buf, SF_SECTOR_SIZE);
+        else
+            continue;
+        for (uint64_t i = 0; i < sec.raw_len / SF_SECTOR_SIZE; i++) {
+            const uint8_t *src = sec.type == SF_SEC_DISK ? buf + i * SF_SECTOR_SIZE : buf;
+            if (vm_disk_write_sector((uint32_t)(sec.base + i), src) != 0) return -1;
+        }
+    }
+}
+
+/* Everything but the disk; every section was decoded once already. */
+static void apply_state(vm_host_t *host, vm_mem_t *mem, const uint8_t *data, size_t off) {
+    for (;;) {
+        sf_section_t sec;
+        section_get(&sec, data + off);
+        const uint8_t *payload = data + off + SF_SECTION_LEN;
+        off += SF_SECTION_LEN + (size_t)sec.stored_len;
+        sf_codec_t c = { NULL, payload, 0 };
+        switch (sec.type) {
+        case SF_SEC_CPU:
+            cpu_codec(&c, &host->cpu);
+            break;
+        case SF_SEC_HOST:
+            host_codec(&c, host);
+            break;
+        case SF_SEC_DEV:
+            vm_io_regs_load(payload, (size_t)sec.raw_len);
+            break;
+        case SF_SEC_RAM:
+            expand(&sec, payload, mem->ram + (sec.base << VM_PAGE_SHIFT));
+            break;
+        case SF_SEC_RAM_ZERO: {
+            /* Hand the pages back to the host: they read as zero again
+             * without being touched here. */
+            uint8_t *p = mem->ram + (sec.base << VM_PAGE_SHIFT);
+            if (vm_mem_discard(p, (size_t)sec.raw_len) != 0)
+                asm_mem_zero(p, (size_t)sec.raw_len);
+            break;
+        }
+        case SF_SEC_END:
+            return;
+        }
+    }
+}
+
+/* Verify everything first: a bad file must not leave a half-restored
+ * guest behind. */
+static int load_mapped(vm_host_t *host, vm_mem_t *mem, const uint8_t *data, size_t size) {
+    sf_header_t hdr;
+    sf_codec_t c = { NULL, data, 0 };
+    header_codec(&c, &hdr);
+    if (memcmp(hdr.magic, VM_SNAPFILE_MAGIC, sizeof(VM_SNAPFILE_MAGIC)) != 0 ||
+        header_crc(&hdr) != hdr.crc || hdr.version != VM_SNAPFILE_VERSION ||
+        hdr.page_size != VM_PAGE_SIZE || hdr.ram_size != mem->size ||
+        hdr.disk_sectors != vm_disk_sectors())
+        return -1;
+
+    uint8_t *buf = mem_domain_alloc(MEM_DOMAIN_FS, VM_SNAPFILE_CHUNK);
+    if (!buf) return -1;
+    uint64_t ram_next = 0, disk_next = 0;
+    unsigned int seen = 0;
+    size_t off = SF_HEADER_LEN;
+    int type;
+    do {
+        size_t next;
+        type = check_section(data, size, off, &hdr, &ram_next, &disk_next, &next, buf);
+        if (type < 0) break;
+        seen |= 1u << type;
+        off = next;
+    } while (type != SF_SEC_END);
+    unsigned int need = (1u << SF_SEC_CPU) | (1u << SF_SEC_HOST) | (1u << SF_SEC_DEV);
+    int err = (type < 0 || (seen & need) != need || ram_next != (hdr.ram_size >> VM_PAGE_SHIFT) ||
+               disk_next != hdr.disk_sectors) ? -1 : 0;
+    if (!err)
+        err = apply_disk(data, SF_HEADER_LEN, buf);
+    mem_domain_free(MEM_DOMAIN_FS, buf);
+    if (err) return -1;
+    apply_state(host, mem, data, SF_HEADER_LEN);
+    /* Every page may differ from checkpoint slots and cached code. */
+    vm_mem_note_write(mem, 0, mem->size);
+    return 0;
+}
+
+int vm_snapfile_load(vm_host_t *host, const char *path) {
+    if (!host || !path) return -1;
+    vm_mem_t *mem = vm_host_mem(host);
+    if (!mem || !mem->ram || mem->size == 0) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SF_HEADER_LEN) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    int err = load_mapped(host, mem, data, size);
+    munmap((void *)data, size);
+    return err;
+}
@@ -0,0 +1,33 @@
+#ifndef VM_SNAPFILE_H
+#define VM_SNAPFILE_H
+
+#include "vm_host.h"
+
+/* Snapshot files: the whole guest (RAM, vCPU, input queue, ticks, device
+ * registers of the bound vm_io, image of the bound vm_disk) streamed to a
+ * versioned file, so a later run can resume without booting.
+ *
+ * Layout: a header, then sections, each a fixed header plus payload with a
+ * CRC-32 over both, closed by an END section. RAM and disk are cut into
+ * runs: all-zero runs are one payload-free section, the rest are chunks of
+ * up to VM_SNAPFILE_CHUNK bytes compressed with vm_lz when that helps.
+ * File and section headers, and the CPU, HOST and DEV payloads, are
+ * explicit lists of fixed-width little-endian fields (architectural
+ * registers only: no TLB, no host pointers or statistics), so the file
+ * depends on neither struct layout nor host byte order. Any change to a
+ * list bumps the version, and a version mismatch fails the load rather
+ * than being converted. */
+#define VM_SNAPFILE_VERSION 1
+#define VM_SNAPFILE_CHUNK   (64 * 1024)
+
+/* Written to <path>.tmp and renamed into place. */
+int vm_snapfile_save(vm_host_t *host, const char *path);
+/* The guest must match the file: same RAM size, a disk of the same size
+ * when the file has one. Every section is checked and decoded before the
+ * guest is touched; after that only a host write error on the disk image
+ * can fail the load, and disk sections are applied before anything else.
+ * Zero runs are restored by discarding guest pages, so untouched
+ * memory is neither read from the file nor faulted in. */
+int vm_snapfile_load(vm_host_t *host, const char *path);
+
+#endif /* VM_SNAPFILE_H */
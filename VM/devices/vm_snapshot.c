@@ -1,73 +1,442 @@
-/* VM snapshot/checkpoint. ASM for all buffer copy. */
+/* VM snapshot/checkpoint. ASM for all buffer copy.
+ *
+ * The RAM slot always mirrors guest RAM as of the newest checkpoint, so
+ * only pages in vm_mem's dirty bitmap differ: save copies those pages into
+ * the slot, restore copies the same pages back, and both then clear the
+ * bitmap. The slot is a demand-zero mapping like guest RAM, so it only
+ * takes host memory for pages the guest has written.
+ *
+ * Older checkpoints are kept as a ring of generations. When a save
+ * overwrites a slot page, the page's previous contents are appended to the
+ * undo delta of the generation before it; walking those deltas from the
+ * newest generation backwards rebuilds any older one.
+ *
+ * Each generation also opens a vm_disk checkpoint with its own overlay
+ * (<disk path>.<ring slot>), so the disk goes back as far as RAM does; the
+ * overlay of a generation that falls out of the ring is merged into the
+ * image. */
 #include "vm_snapshot.h"
 #include "vm_mem.h"
 #include "vm_disk.h"
+#include "vm_io.h"
 #include "mem_asm.h"
 #include "mem_domain.h"
+#include <stdio.h>
 #include <string.h>
 
 #define VM_SNAPSHOT_DISK_PATH "vm_checkpoint_disk.img"
 
-static uint8_t *s_ram_copy;
-static size_t s_ram_size;
-static vm_cpu_t s_cpu_copy;
-static uint8_t s_kbd_copy[VM_KBD_QUEUE_SIZE];
-static size_t s_kbd_head, s_kbd_tail;
-static uint64_t s_ticks_copy;
-static int s_has_checkpoint;
+#define VM_SNAPSHOT_PATH_MAX 256
+
+/* One checkpoint generation: registers, plus the undo delta that turns RAM
+ * at the next generation back into RAM at this one. */
+typedef struct vm_snapshot_gen {
+    vm_cpu_t cpu;
+    uint8_t kbd[VM_KBD_QUEUE_SIZE];
+    size_t kbd_head, kbd_tail;
+    uint64_t ticks;
+    uint64_t clock;
+    uint64_t disk_gen;    /* vm_disk_generation() at the save */
+    int has_disk;         /* opened a vm_disk checkpoint */
+    uint8_t *dev;         /* vm_io registers; NULL when vm_io has none */
+    uint32_t *undo_pages;
+    uint8_t *undo_data;   /* undo_count pages, in undo_pages order */
+    size_t undo_count, undo_cap;
+} vm_snapshot_gen_t;
+
+/* Checkpoint slot of one guest. */
+struct vm_snapshot_state {
+    uint8_t *ram_copy;
+    size_t ram_size;
+    vm_snapshot_gen_t gens[VM_SNAPSHOT_GENERATIONS];
+    int gen_first;        /* ring index of the oldest generation */
+    int gen_count;
+    char disk_path[VM_SNAPSHOT_PATH_MAX];
+    /* Reset baseline: RAM image, vCPU, input and time at capture. */
+    uint8_t *base_copy;
+    size_t base_size;
+    vm_cpu_t base_cpu;
+    uint8_t base_kbd[VM_KBD_QUEUE_SIZE];
+    size_t base_kbd_head, base_kbd_tail;
+    uint64_t base_ticks, base_clock;
+    int has_base;
+};
+
+static vm_snapshot_state_t s_snap_default = { .disk_path = VM_SNAPSHOT_DISK_PATH };
+static _Thread_local vm_snapshot_state_t *s_snap = &s_snap_default;
+
+vm_snapshot_state_t *vm_snapshot_state_create(const char *disk_path) {
+    vm_snapshot_state_t *st = mem_domain_alloc(MEM_DOMAIN_DRIVER, sizeof(*st));
+    if (!st) return NULL;
+    asm_mem_zero(st, sizeof(*st));
+    strncpy(st->disk_path, disk_path ? disk_path : VM_SNAPSHOT_DISK_PATH, VM_SNAPSHOT_PATH_MAX - 1);
+    return st;
+}
+
+void vm_snapshot_state_destroy(vm_snapshot_state_t *st) {
+    if (!st || st == &s_snap_default) return;
+    vm_snapshot_state_t *prev = s_snap;
+    s_snap = st;
+    vm_snapshot_shutdown();
+    s_snap = (prev == st) ? &s_snap_default : prev;
+    mem_domain_free(MEM_DOMAIN_DRIVER, st);
+}
+
+void vm_snapshot_bind(vm_snapshot_state_t *st) {
+    s_snap = st ? st : &s_snap_default;
+}
+
+/* Generation by age: 0 is the newest. */
+static vm_snapshot_gen_t *gen_at(int age) {
+    int idx = (s_snap->gen_first + s_snap->gen_count - 1 - age) % VM_SNAPSHOT_GENERATIONS;
+    return &s_snap->gens[idx];
+}
+
+static void gen_undo_clear(vm_snapshot_gen_t *g) {
+    if (g->undo_pages) mem_domain_free(MEM_DOMAIN_DRIVER, g->undo_pages);
+    if (g->undo_data) mem_domain_free(MEM_DOMAIN_DRIVER, g->undo_data);
+    g->undo_pages = NULL;
+    g->undo_data = NULL;
+    g->undo_count = g->undo_cap = 0;
+}
+
+/* Overlay file of g's disk checkpoint. */
+static void gen_disk_path(const vm_snapshot_gen_t *g, char *out, size_t len) {
+    snprintf(out, len, "%s.%d", s_snap->disk_path, (int)(g - s_snap->gens));
+}
+
+static void gen_free(vm_snapshot_gen_t *g) {
+    gen_undo_clear(g);
+    if (g->dev) mem_domain_free(MEM_DOMAIN_DRIVER, g->dev);
+    g->dev = NULL;
+}
+
+/* Drop every generation newer than `age` (age 0 keeps them all). */
+static void gens_truncate(int age) {
+    while (age-- > 0) {
+        gen_free(gen_at(0));
+        s_snap->gen_count--;
+    }
+}
+
+/* Without generations the disk checkpoints have no use: fold them into
+ * the image. */
+static void gens_clear(void) {
+    gens_truncate(s_snap->gen_count);
+    if (vm_disk_is_active())
+        vm_disk_commit();
+    s_snap->gen_first = 0;
+}
+
+/* Record one slot page's contents in g's undo delta before it is
+ * overwritten. */
+static int gen_undo_push(vm_snapshot_gen_t *g, uint32_t page, const uint8_t *data) {
+    if (g->undo_count == g->undo_cap) {
+        size_t cap = g->undo_cap ? g->undo_cap * 2 : 16;
+        uint32_t *pages = mem_domain_alloc(MEM_DOMAIN_DRIVER, cap * sizeof(*pages));
+        uint8_t *buf = mem_domain_alloc(MEM_DOMAIN_DRIVER, cap * VM_PAGE_SIZE);
+        if (!pages || !buf) {
+            if (pages) mem_domain_free(MEM_DOMAIN_DRIVER, pages);
+            if (buf) mem_domain_free(MEM_DOMAIN_DRIVER, buf);
+            return -1;
+        }
+        if (g->undo_count) {
+            asm_mem_copy(pages, g->undo_pages, g->undo_count * sizeof(*pages));
+            asm_mem_copy(buf, g->undo_data, g->undo_count * VM_PAGE_SIZE);
+        }
+        size_t count = g->undo_count;
+        gen_undo_clear(g);
+        g->undo_pages = pages;
+        g->undo_data = buf;
+        g->undo_count = count;
+        g->undo_cap = cap;
+    }
+    g->undo_pages[g->undo_count] = page;
+    asm_mem_copy(g->undo_data + g->undo_count * VM_PAGE_SIZE, data, VM_PAGE_SIZE);
+    g->undo_count++;
+    return 0;
+}
+
+/* Copy every page set in mem's dirty bitmap; with undo set, the pages
+ * being overwritten in dst are first appended to its delta. Returns 0, or
+ * -1 if the delta could not grow (dst is then fully updated regardless). */
+static int copy_dirty_pages(uint8_t *dst, const uint8_t *src, const vm_mem_t *mem, vm_snapshot_gen_t *undo) {
+    size_t pages = vm_mem_page_count(mem);
+    int err = 0;
+    for (size_t p = 0; p < pages; p++) {
+        if (!mem->dirty[p >> 3]) {   /* skip clean runs of eight pages */
+            p |= 7;
+            continue;
+        }
+        if (!vm_mem_page_dirty(mem, (uint32_t)p)) continue;
+        size_t off = p << VM_PAGE_SHIFT;
+        size_t len = (mem->size - off) < VM_PAGE_SIZE ? (mem->size - off) : VM_PAGE_SIZE;
+        if (undo && !err && gen_undo_push(undo, (uint32_t)p, dst + off) != 0)
+            err = -1;
+        asm_mem_copy(dst + off, src + off, len);
+    }
+    return err;
+}
 
 int vm_snapshot_save(vm_host_t *host) {
     if (!host) return -1;
     vm_mem_t *mem = vm_host_mem(host);
     if (!mem || !mem->ram || mem->size == 0) return -1;
 
-    if (s_ram_copy && s_ram_size != mem->size) {
-        mem_domain_free(MEM_DOMAIN_DRIVER, s_ram_copy);
-        s_ram_copy = NULL;
-    }
-    if (!s_ram_copy) {
-        s_ram_copy = mem_domain_alloc(MEM_DOMAIN_DRIVER, mem->size);
-        if (!s_ram_copy) return -1;
-        s_ram_size = mem->size;
-    }
-    asm_mem_copy(s_ram_copy, mem->ram, mem->size);
-    asm_mem_copy(&s_cpu_copy, &host->cpu, sizeof(host->cpu));
-    asm_mem_copy(s_kbd_copy, host->kbd_queue, sizeof(host->kbd_queue));
-    s_kbd_head = host->kbd_head;
-    s_kbd_tail = host->kbd_tail;
-    s_ticks_copy = host->vm_ticks;
-    if (vm_disk_is_active())
-        vm_disk_snapshot_save(VM_SNAPSHOT_DISK_PATH);
-    s_has_checkpoint = 1;
+    if (s_snap->ram_copy && s_snap->ram_size != mem->size) {
+        vm_mem_unmap(s_snap->ram_copy, s_snap->ram_size);
+        s_snap->ram_copy = NULL;
+        gens_clear();
+    }
+    int fresh = 0;
+    if (!s_snap->ram_copy) {
+        s_snap->ram_copy = vm_mem_map_zero(mem->size, 0);
+        if (!s_snap->ram_copy) return -1;
+        s_snap->ram_size = mem->size;
+        fresh = 1;
+    } else if (mem->dirty_from_zero) {
+        /* RAM was zeroed since the last save: the generations before no
+         * longer chain to it, and the slot drops its pages the same way. */
+        gens_clear();
+        fresh = vm_mem_discard(s_snap->ram_copy, s_snap->ram_size) == 0;
+    }
+    /* A new slot reads as zero, like RAM before its first write, so only
+     * pages written since then need copying. Without a dirty bitmap there
+     * is no delta to keep, so history restarts. */
+    int has_history = s_snap->gen_count > 0;
+    if (mem->dirty && (has_history || (fresh && mem->dirty_from_zero))) {
+        /* Out of memory for the delta: older generations are lost. */
+        if (copy_dirty_pages(s_snap->ram_copy, mem->ram, mem, has_history ? gen_at(0) : NULL) != 0)
+            gens_clear();
+    } else {
+        gens_clear();
+        asm_mem_copy(s_snap->ram_copy, mem->ram, mem->size);
+    }
+    vm_mem_dirty_clear(mem);
+
+    char disk_path[VM_SNAPSHOT_PATH_MAX + 8];
+    if (s_snap->gen_count == VM_SNAPSHOT_GENERATIONS) {
+        vm_snapshot_gen_t *oldest = &s_snap->gens[s_snap->gen_first];
+        if (oldest->has_disk && vm_disk_is_active()) {
+            gen_disk_path(oldest, disk_path, sizeof(disk_path));
+            vm_disk_snapshot_merge(disk_path);
+        }
+        gen_free(oldest);
+        s_snap->gen_first = (s_snap->gen_first + 1) % VM_SNAPSHOT_GENERATIONS;
+        s_snap->gen_count--;
+    }
+    s_snap->gen_count++;
+    vm_snapshot_gen_t *g = gen_at(0);
+    asm_mem_copy(&g->cpu, &host->cpu, sizeof(host->cpu));
+    asm_mem_copy(g->kbd, host->kbd_queue, sizeof(host->kbd_queue));
+    g->kbd_head = host->kbd_head;
+    g->kbd_tail = host->kbd_tail;
+    g->ticks = host->vm_ticks;
+    g->clock = host->vm_clock;
+    size_t dev_len = vm_io_regs_size();
+    if (dev_len && !g->dev)
+        g->dev = mem_domain_alloc(MEM_DOMAIN_DRIVER, dev_len);
+    if (g->dev && vm_io_regs_save(g->dev, dev_len) != 0) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, g->dev);
+        g->dev = NULL;
+    }
+    g->has_disk = 0;
+    if (vm_disk_is_active()) {
+        gen_disk_path(g, disk_path, sizeof(disk_path));
+        g->has_disk = vm_disk_snapshot_save(disk_path) == 0;
+    }
+    g->disk_gen = vm_disk_generation();
+    return 0;
+}
+/* Rebuild generation `age`: dirty pages go back to the newest generation
+ * from the slot, then each older delta is applied to RAM and slot alike,
+ * and the generations after `age` are dropped. */
+int vm_snapshot_restore_generation(vm_host_t *host, int age) {
+    if (!host || age < 0 || age >= s_snap->gen_count || !s_snap->ram_copy) return -1;
+    vm_mem_t *mem = vm_host_mem(host);
+    if (!mem || !mem->ram || mem->size != s_snap->ram_size) return -1;
+    vm_snapshot_gen_t *g = gen_at(age);
+    /* The disk goes back first, through g's checkpoint; that also drops
+     * the newer ones. Without it (the disk was attached after g, or
+     * re-attached since) an older generation is reachable only if the disk
+     * has not changed since, and only if no newer generation holds a disk
+     * checkpoint: its overlay would stay live after the generation is
+     * dropped. */
+    int disk_active = vm_disk_is_active();
+    int disk_changed = disk_active && vm_disk_generation() != g->disk_gen;
+    int disk_rewound = 0;
+    if (g->has_disk && disk_active && (disk_changed || age > 0)) {
+        char disk_path[VM_SNAPSHOT_PATH_MAX + 8];
+        gen_disk_path(g, disk_path, sizeof(disk_path));
+        if (vm_disk_snapshot_restore(disk_path) == 0) {
+            disk_changed = 0;
+            disk_rewound = 1;
+            g->disk_gen = vm_disk_generation();
+        }
+    }
+    if (age > 0 && disk_changed) return -1;
+    for (int a = 0; a < age && disk_active && !disk_rewound; a++) {
+        if (gen_at(a)->has_disk) return -1;
+    }
+
+    /* RAM zeroed since the save has no bitmap of what differs: all of it. */
+    if (mem->dirty && !mem->dirty_from_zero) {
+        size_t pages = vm_mem_page_count(mem);
+        copy_dirty_pages(mem->ram, s_snap->ram_copy, mem, NULL);
+        /* Let the code watch see the rewritten pages. */
+        for (size_t p = 0; p < pages; p++) {
+            if (vm_mem_page_dirty(mem, (uint32_t)p))
+                vm_mem_note_write(mem, (uint32_t)(p << VM_PAGE_SHIFT), VM_PAGE_SIZE);
+        }
+    } else {
+        asm_mem_copy(mem->ram, s_snap->ram_copy, mem->size);
+        vm_mem_note_write(mem, 0, mem->size);
+    }
+    for (int a = 1; a <= age; a++) {
+        const vm_snapshot_gen_t *older = gen_at(a);
+        for (size_t i = 0; i < older->undo_count; i++) {
+            uint32_t page = older->undo_pages[i];
+            size_t off = (size_t)page << VM_PAGE_SHIFT;
+            const uint8_t *data = older->undo_data + i * VM_PAGE_SIZE;
+            asm_mem_copy(mem->ram + off, data, VM_PAGE_SIZE);
+            asm_mem_copy(s_snap->ram_copy + off, data, VM_PAGE_SIZE);
+            vm_mem_note_page(mem, page);
+        }
+    }
+    /* RAM matches the slot again. */
+    vm_mem_dirty_clear(mem);
+    gens_truncate(age);
+    gen_undo_clear(g);
+
+    asm_mem_copy(&host->cpu, &g->cpu, sizeof(host->cpu));
+    asm_mem_copy(host->kbd_queue, g->kbd, sizeof(host->kbd_queue));
+    host->kbd_head = g->kbd_head;
+    host->kbd_tail = g->kbd_tail;
+    host->vm_ticks = g->ticks;
+    host->vm_clock = g->clock;
+    if (g->dev)
+        vm_io_regs_load(g->dev, vm_io_regs_size());
     return 0;
 }
 
 int vm_snapshot_restore(vm_host_t *host) {
-    if (!host || !s_has_checkpoint || !s_ram_copy) return -1;
+    return vm_snapshot_restore_generation(host, 0);
+}
+
+int vm_snapshot_generations(void) {
+    return s_snap->gen_count;
+}
+
+int vm_snapshot_find_generation(uint64_t clock) {
+    for (int age = 0; age < s_snap->gen_count; age++) {
+        if (gen_at(age)->clock <= clock)
+            return age;
+    }
+    return -1;
+}
+
+void vm_snapshot_discard(void) {
+    gens_clear();
+    if (s_snap->ram_copy) {
+        vm_mem_unmap(s_snap->ram_copy, s_snap->ram_size);
+        s_snap->ram_copy = NULL;
+    }
+    s_snap->ram_size = 0;
+}
+
+/* Copy the pages written since the baseline mark, in either direction. */
+static size_t copy_base_pages(uint8_t *dst, const uint8_t *src, vm_mem_t *mem, int note) {
+    size_t pages = vm_mem_page_count(mem);
+    size_t copied = 0;
+    for (size_t p = 0; p < pages; p++) {
+        if (!mem->base_dirty[p >> 3] && !mem->dirty[p >> 3]) {
+            p |= 7;
+            continue;
+        }
+        if (!vm_mem_base_page_dirty(mem, (uint32_t)p)) continue;
+        size_t off = p << VM_PAGE_SHIFT;
+        size_t len = (mem->size - off) < VM_PAGE_SIZE ? (mem->size - off) : VM_PAGE_SIZE;
+        asm_mem_copy(dst + off, src + off, len);
+        if (note) vm_mem_note_page(mem, (uint32_t)p);
+        copied++;
+    }
+    return copied;
+}
+
+int vm_snapshot_baseline_capture(vm_host_t *host) {
+    if (!host) return -1;
     vm_mem_t *mem = vm_host_mem(host);
-    if (!mem || !mem->ram || mem->size != s_ram_size) return -1;
-
-    asm_mem_copy(mem->ram, s_ram_copy, mem->size);
-    asm_mem_copy(&host->cpu, &s_cpu_copy, sizeof(host->cpu));
-    asm_mem_copy(host->kbd_queue, s_kbd_copy, sizeof(host->kbd_queue));
-    host->kbd_head = s_kbd_head;
-    host->kbd_tail = s_kbd_tail;
-    host->vm_ticks = s_ticks_copy;
-    if (vm_disk_is_active())
-        vm_disk_snapshot_restore(VM_SNAPSHOT_DISK_PATH);
+    if (!mem || !mem->ram || !mem->dirty || mem->size == 0) return -1;
+
+    if (s_snap->base_copy && s_snap->base_size != mem->size) {
+        vm_mem_unmap(s_snap->base_copy, s_snap->base_size);
+        s_snap->base_copy = NULL;
+        s_snap->has_base = 0;
+    }
+    int fresh = 0;
+    if (!s_snap->base_copy) {
+        s_snap->base_copy = vm_mem_map_zero(mem->size, 0);
+        if (!s_snap->base_copy) return -1;
+        s_snap->base_size = mem->size;
+        fresh = 1;
+    }
+    /* Refresh only what moved since RAM was zeroed (dropping the slot's
+     * pages the same way), since the previous baseline, or since RAM was
+     * zero for a new slot. */
+    int zeroed = mem->base_from_zero && mem->base_dirty;
+    if (zeroed && (fresh || vm_mem_discard(s_snap->base_copy, s_snap->base_size) == 0))
+        copy_base_pages(s_snap->base_copy, mem->ram, mem, 0);
+    else if (!zeroed && s_snap->has_base && mem->base_dirty)
+        copy_base_pages(s_snap->base_copy, mem->ram, mem, 0);
+    else if (!zeroed && fresh && mem->dirty_from_zero)
+        copy_dirty_pages(s_snap->base_copy, mem->ram, mem, NULL);
+    else
+        asm_mem_copy(s_snap->base_copy, mem->ram, mem->size);
+    if (vm_mem_base_mark(mem) != 0) return -1;
+    asm_mem_copy(&s_snap->base_cpu, &host->cpu, sizeof(host->cpu));
+    asm_mem_copy(s_snap->base_kbd, host->kbd_queue, sizeof(host->kbd_queue));
+    s_snap->base_kbd_head = host->kbd_head;
+    s_snap->base_kbd_tail = host->kbd_tail;
+    s_snap->base_ticks = host->vm_ticks;
+    s_snap->base_clock = host->vm_clock;
+    s_snap->has_base = 1;
     return 0;
 }
 
+int vm_snapshot_baseline_reset(vm_host_t *host) {
+    if (!host || !s_snap->has_base) return -1;
+    vm_mem_t *mem = vm_host_mem(host);
+    if (!mem || !mem->ram || !mem->dirty || !mem->base_dirty || mem->size != s_snap->base_size) return -1;
+    if (mem->base_from_zero) return -1;     /* zeroed since: capture again */
+
+    /* Restored pages are noted as writes: checkpoints see them as changed
+     * and cached code on them is dropped; untouched code stays cached. */
+    copy_base_pages(mem->ram, s_snap->base_copy, mem, 1);
+    vm_mem_base_clear(mem);
+    asm_mem_copy(&host->cpu, &s_snap->base_cpu, sizeof(host->cpu));
+    asm_mem_copy(host->kbd_queue, s_snap->base_kbd, sizeof(host->kbd_queue));
+    host->kbd_head = s_snap->base_kbd_head;
+    host->kbd_tail = s_snap->base_kbd_tail;
+    host->vm_ticks = s_snap->base_ticks;
+    host->vm_clock = s_snap->base_clock;
+    host->paused = 0;
+    return 0;
+}
+
+int vm_snapshot_has_baseline(void) {
+    return s_snap->has_base;
+}
+
 int vm_snapshot_has_checkpoint(void) {
-    return s_has_checkpoint;
+    return s_snap->gen_count > 0;
 }
 
 void vm_snapshot_shutdown(void) {
-    if (s_ram_copy) {
-        mem_domain_free(MEM_DOMAIN_DRIVER, s_ram_copy);
-        s_ram_copy = NULL;
+    vm_snapshot_discard();
+    if (s_snap->base_copy) {
+        vm_mem_unmap(s_snap->base_copy, s_snap->base_size);
+        s_snap->base_copy = NULL;
     }
-    s_ram_size = 0;
-    s_has_checkpoint = 0;
-    /* vm_checkpoint_disk.img left on disk; could remove(VM_SNAPSHOT_DISK_PATH) */
+    s_snap->base_size = 0;
+    s_snap->has_base = 0;
 }
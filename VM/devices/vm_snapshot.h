@@ -5,9 +5,46 @@
 
 /* Snapshot/checkpoint: save and restore VM state (RAM, CPU, kbd, ticks).
  * Uses ASM for all memory copy. PQ can schedule checkpoint tasks. */
+/* One checkpoint slot per guest, selected per thread with
+ * vm_snapshot_bind (NULL: the process default). disk_path is the prefix
+ * of the slot's disk overlay files, one per generation (NULL:
+ * vm_checkpoint_disk.img). */
+typedef struct vm_snapshot_state vm_snapshot_state_t;
+vm_snapshot_state_t *vm_snapshot_state_create(const char *disk_path);
+void vm_snapshot_state_destroy(vm_snapshot_state_t *st);
+void vm_snapshot_bind(vm_snapshot_state_t *st);
+
+/* Each save adds a generation to a ring of VM_SNAPSHOT_GENERATIONS; the
+ * oldest falls out when it is full. Besides RAM, vCPU, keyboard queue and
+ * time, a generation holds the vm_io registers and, with a disk attached,
+ * a disk checkpoint. Older generations cost only the pages and sectors
+ * written between them and the next (an undo delta, a disk overlay). */
+#define VM_SNAPSHOT_GENERATIONS 8
+
 int vm_snapshot_save(vm_host_t *host);
+/* Back to the newest generation. */
 int vm_snapshot_restore(vm_host_t *host);
+/* Back to the generation `age` saves before the newest (0: newest); the
+ * ones after it are dropped, disk checkpoints included. Fails without
+ * touching the guest when the generation has no disk checkpoint (the disk
+ * was attached or re-attached later) and either the disk has changed
+ * since or a newer generation has one. */
+int vm_snapshot_restore_generation(vm_host_t *host, int age);
 int vm_snapshot_has_checkpoint(void);
+int vm_snapshot_generations(void);
+/* Age of the newest generation taken at or before virtual time `clock`
+ * (vm_host.vm_clock), -1 if none. */
+int vm_snapshot_find_generation(uint64_t clock);
+/* Forget every generation (a new guest was loaded); the baseline stays. */
+void vm_snapshot_discard(void);
+
+/* Reset baseline ("pristine" image), independent of the checkpoint: capture
+ * RAM, vCPU, keyboard queue and time once, then each reset copies back
+ * only the pages written since the capture or the previous reset. Disk
+ * contents and device registers are not part of it (vm_io has its own). */
+int vm_snapshot_baseline_capture(vm_host_t *host);
+int vm_snapshot_baseline_reset(vm_host_t *host);
+int vm_snapshot_has_baseline(void);
 void vm_snapshot_shutdown(void);
 
 #endif /* VM_SNAPSHOT_H */
@@ -0,0 +1,74 @@
+/* Text-mode rasterizer: VGA cells -> ARGB pixels, dirty rows only. */
+#include "vm_textfb.h"
+#include "vm_font.h"
+#include "mem_domain.h"
+#include "mem_asm.h"
+
+const uint32_t vm_textfb_palette[16] = {
+    0xFF000000, 0xFF0000AA, 0xFF00AA00, 0xFF00AAAA,
+    0xFFAA0000, 0xFFAA00AA, 0xFFAA5500, 0xFFAAAAAA,
+    0xFF555555, 0xFF5555FF, 0xFF55FF55, 0xFF55FFFF,
+    0xFFFF5555, 0xFFFF55FF, 0xFFFFFF55, 0xFFFFFFFF,
+};
+
+int vm_textfb_init(vm_textfb_t *fb) {
+    if (!fb) return -1;
+    asm_mem_zero(fb, sizeof(*fb));
+    fb->pixels = mem_domain_alloc(MEM_DOMAIN_DRIVER, (size_t)VM_TEXTFB_WIDTH * VM_TEXTFB_HEIGHT * 4);
+    if (!fb->pixels) return -1;
+    fb->dirty_lo = fb->dirty_hi = -1;
+    return 0;
+}
+
+void vm_textfb_destroy(vm_textfb_t *fb) {
+    if (!fb) return;
+    if (fb->pixels) {
+        mem_domain_free(MEM_DOMAIN_DRIVER, fb->pixels);
+        fb->pixels = NULL;
+    }
+    fb->valid = 0;
+}
+
+void vm_textfb_invalidate(vm_textfb_t *fb) {
+    if (fb) fb->valid = 0;
+}
+
+static void draw_cell(vm_textfb_t *fb, int row, int col, uint16_t word) {
+    unsigned char ch = (unsigned char)(word & 0xFF);
+    uint8_t attr = (uint8_t)(word >> 8);
+    uint32_t fg = vm_textfb_palette[attr & 0x0F];
+    uint32_t bg = vm_textfb_palette[(attr >> 4) & 0x0F];
+    if (ch >= 128) ch = ' ';
+    uint32_t *dst = fb->pixels + (size_t)row * VM_TEXTFB_CELL_H * VM_TEXTFB_WIDTH + (size_t)col * VM_TEXTFB_CELL_W;
+    for (int gy = 0; gy < VM_FONT_HEIGHT; gy++) {
+        unsigned char line = vm_font_8x8[ch][gy];
+        uint32_t *p = dst + (size_t)gy * 2 * VM_TEXTFB_WIDTH;
+        for (int gx = 0; gx < VM_FONT_W; gx++)
+            p[gx] = (line & (1 << (7 - gx))) ? fg : bg;
+        asm_mem_copy(p + VM_TEXTFB_WIDTH, p, VM_FONT_W * 4);   /* doubled scanline */
+    }
+}
+
+int vm_textfb_update(vm_textfb_t *fb, const uint8_t *vga) {
+    if (!fb || !fb->pixels || !vga) return 0;
+    int drawn = 0;
+    fb->dirty_lo = fb->dirty_hi = -1;
+    for (int row = 0; row < VM_TEXTFB_ROWS; row++) {
+        const uint8_t *src = vga + (size_t)row * VM_TEXTFB_COLS * 2;
+        uint16_t *shadow = fb->shadow + row * VM_TEXTFB_COLS;
+        int changed = !fb->valid;
+        for (int col = 0; col < VM_TEXTFB_COLS && !changed; col++)
+            changed = shadow[col] != (uint16_t)(src[col * 2] | (src[col * 2 + 1] << 8));
+        if (!changed) continue;
+        for (int col = 0; col < VM_TEXTFB_COLS; col++) {
+            shadow[col] = (uint16_t)(src[col * 2] | (src[col * 2 + 1] << 8));
+            draw_cell(fb, row, col, shadow[col]);
+        }
+        if (fb->dirty_lo < 0) fb->dirty_lo = row;
+        fb->dirty_hi = row;
+        drawn++;
+    }
+    fb->valid = 1;
+    fb->rows_drawn += (uint64_t)drawn;
+    return drawn;
+}
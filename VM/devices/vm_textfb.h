@@ -0,0 +1,35 @@
+#ifndef VM_TEXTFB_H
+#define VM_TEXTFB_H
+
+#include <stdint.h>
+
+/* CPU rasterizer for the 80x25 VGA text buffer into one ARGB8888 frame.
+ * A shadow of the cells drawn last lets vm_textfb_update redraw only rows
+ * whose cells changed; the dirty row span is what the frontend uploads.
+ * No SDL dependency, so it runs (and is tested) headless. */
+#define VM_TEXTFB_COLS   80
+#define VM_TEXTFB_ROWS   25
+#define VM_TEXTFB_CELL_W 8
+#define VM_TEXTFB_CELL_H 16   /* 8x8 glyph rows doubled */
+#define VM_TEXTFB_WIDTH  (VM_TEXTFB_COLS * VM_TEXTFB_CELL_W)
+#define VM_TEXTFB_HEIGHT (VM_TEXTFB_ROWS * VM_TEXTFB_CELL_H)
+
+typedef struct vm_textfb {
+    uint32_t *pixels;           /* VM_TEXTFB_WIDTH x VM_TEXTFB_HEIGHT, pitch = width */
+    uint16_t shadow[VM_TEXTFB_COLS * VM_TEXTFB_ROWS];
+    int valid;                  /* shadow matches pixels */
+    int dirty_lo, dirty_hi;     /* text rows redrawn by the last update; -1 if none */
+    uint64_t rows_drawn;
+} vm_textfb_t;
+
+extern const uint32_t vm_textfb_palette[16];
+
+int vm_textfb_init(vm_textfb_t *fb);
+void vm_textfb_destroy(vm_textfb_t *fb);
+/* Next update redraws every row. */
+void vm_textfb_invalidate(vm_textfb_t *fb);
+/* Compare vga (80x25 char/attr words, little-endian) against the shadow and
+ * rasterize changed rows. Returns the number of rows redrawn. */
+int vm_textfb_update(vm_textfb_t *fb, const uint8_t *vga);
+
+#endif /* VM_TEXTFB_H */
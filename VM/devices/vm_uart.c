@@ -0,0 +1,78 @@
+/* UART transmit FIFO: batch guest serial output into few host writes. */
+#include "vm_uart.h"
+#include "mem_asm.h"
+
+void vm_uart_init(vm_uart_t *uart, FILE *out) {
+    if (!uart) return;
+    asm_mem_zero(uart, sizeof(*uart));
+    uart->out = out;
+    uart->lcr = 0x03;   /* 8N1 */
+    uart->dll = 0x01;   /* 115200 baud */
+}
+
+void vm_uart_flush(vm_uart_t *uart) {
+    if (!uart || uart->len == 0) return;
+    if (uart->out) {
+        fwrite(uart->fifo, 1, uart->len, uart->out);
+        fflush(uart->out);
+        uart->host_writes++;
+    }
+    uart->len = 0;
+}
+
+void vm_uart_tx(vm_uart_t *uart, uint8_t byte, uint64_t now) {
+    if (!uart) return;
+    if (uart->len == 0)
+        uart->pending_since = now;
+    uart->fifo[uart->len++] = byte;
+    if (byte == '\n' || uart->len >= VM_UART_FIFO_SIZE)
+        vm_uart_flush(uart);
+}
+
+void vm_uart_poll(vm_uart_t *uart, uint64_t now) {
+    if (uart && uart->len > 0 && now - uart->pending_since >= VM_UART_FLUSH_TICKS)
+        vm_uart_flush(uart);
+}
+
+uint8_t vm_uart_read(vm_uart_t *uart, uint32_t reg) {
+    if (!uart) return 0xFF;
+    int dlab = (uart->lcr & VM_UART_LCR_DLAB) != 0;
+    switch (reg & 7) {
+    case VM_UART_THR: return dlab ? uart->dll : 0;     /* no receive path */
+    case VM_UART_IER: return dlab ? uart->dlm : uart->ier;
+    case VM_UART_IIR: return 0xC1;                     /* FIFOs on, no interrupt pending */
+    case VM_UART_LCR: return uart->lcr;
+    case VM_UART_MCR: return uart->mcr;
+    case VM_UART_LSR: {
+        uint8_t lsr = 0;
+        if (uart->len < VM_UART_FIFO_SIZE) lsr |= VM_UART_LSR_THRE;
+        if (uart->len == 0) lsr |= VM_UART_LSR_TEMT;
+        return lsr;
+    }
+    case VM_UART_MSR: return 0xB0;                     /* DCD, DSR, CTS */
+    default:          return uart->scr;
+    }
+}
+
+void vm_uart_write(vm_uart_t *uart, uint32_t reg, uint8_t value, uint64_t now) {
+    if (!uart) return;
+    int dlab = (uart->lcr & VM_UART_LCR_DLAB) != 0;
+    switch (reg & 7) {
+    case VM_UART_THR:
+        if (dlab) uart->dll = value;
+        else vm_uart_tx(uart, value, now);
+        break;
+    case VM_UART_IER:
+        if (dlab) uart->dlm = value;
+        else uart->ier = value & 0x0F;
+        break;
+    case VM_UART_IIR:
+        if (value & 0x04)   /* FCR: clear transmit FIFO */
+            uart->len = 0;
+        break;
+    case VM_UART_LCR: uart->lcr = value; break;
+    case VM_UART_MCR: uart->mcr = value & 0x1F; break;
+    case VM_UART_SCR: uart->scr = value; break;
+    default: break;        /* LSR/MSR are read-only */
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef VM_UART_H
+#define VM_UART_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* 16550-style UART, transmit side. Guest bytes collect in a tx FIFO and
+ * reach the host stream in batches: on newline, when the FIFO fills, once
+ * the oldest pending byte is VM_UART_FLUSH_TICKS of virtual time old, and
+ * on vm_uart_flush (VM exit). */
+#define VM_UART_FIFO_SIZE   256
+#define VM_UART_FLUSH_TICKS 16
+
+/* Register offsets from the base port */
+#define VM_UART_THR 0   /* THR/RBR, DLL when LCR.DLAB */
+#define VM_UART_IER 1   /* DLM when LCR.DLAB */
+#define VM_UART_IIR 2   /* IIR on read, FCR on write */
+#define VM_UART_LCR 3
+#define VM_UART_MCR 4
+#define VM_UART_LSR 5
+#define VM_UART_MSR 6
+#define VM_UART_SCR 7
+
+#define VM_UART_LSR_THRE 0x20   /* FIFO has room */
+#define VM_UART_LSR_TEMT 0x40   /* FIFO drained to host */
+#define VM_UART_LCR_DLAB 0x80
+
+typedef struct vm_uart {
+    FILE *out;
+    uint8_t fifo[VM_UART_FIFO_SIZE];
+    unsigned int len;
+    uint64_t pending_since;   /* virtual tick of the oldest unflushed byte */
+    uint8_t ier, lcr, mcr, scr, dll, dlm;
+    uint64_t host_writes;     /* batches handed to the host stream */
+} vm_uart_t;
+
+void vm_uart_init(vm_uart_t *uart, FILE *out);
+uint8_t vm_uart_read(vm_uart_t *uart, uint32_t reg);
+void vm_uart_write(vm_uart_t *uart, uint32_t reg, uint8_t value, uint64_t now);
+/* Transmit one byte (THR write without DLAB). */
+void vm_uart_tx(vm_uart_t *uart, uint8_t byte, uint64_t now);
+/* Flush if the oldest pending byte has reached its deadline. */
+void vm_uart_poll(vm_uart_t *uart, uint64_t now);
+void vm_uart_flush(vm_uart_t *uart);
+
+#endif /* VM_UART_H */
@@ -0,0 +1,95 @@
+/* Virtual-time event wheel for device deadlines. */
+#include "vm_wheel.h"
+#include "mem_asm.h"
+#include <stddef.h>
+
+static unsigned int wheel_slot(uint64_t t) {
+    return (unsigned int)(t >> VM_WHEEL_SHIFT) & (VM_WHEEL_SLOTS - 1);
+}
+
+void vm_wheel_init(vm_wheel_t *w, uint64_t now) {
+    if (!w) return;
+    asm_mem_zero(w, sizeof(*w));
+    w->now = now;
+}
+
+void vm_wheel_event_init(vm_wheel_event_t *ev, vm_wheel_fn fn, void *ctx) {
+    if (!ev) return;
+    asm_mem_zero(ev, sizeof(*ev));
+    ev->fn = fn;
+    ev->ctx = ctx;
+}
+
+static void wheel_unlink(vm_wheel_event_t *ev) {
+    *ev->pprev = ev->next;
+    if (ev->next) ev->next->pprev = ev->pprev;
+    ev->next = NULL;
+    ev->pprev = NULL;
+}
+
+void vm_wheel_cancel(vm_wheel_t *w, vm_wheel_event_t *ev) {
+    if (!w || !ev || !ev->pprev) return;
+    wheel_unlink(ev);
+    w->armed--;
+}
+
+void vm_wheel_schedule(vm_wheel_t *w, vm_wheel_event_t *ev, uint64_t deadline) {
+    if (!w || !ev) return;
+    if (ev->pprev) {
+        wheel_unlink(ev);
+        w->armed--;
+    }
+    if (deadline < w->now) deadline = w->now;
+    ev->deadline = deadline;
+    vm_wheel_event_t **head = &w->slots[wheel_slot(deadline)];
+    ev->next = *head;
+    if (*head) (*head)->pprev = &ev->next;
+    ev->pprev = head;
+    *head = ev;
+    w->armed++;
+}
+
+uint64_t vm_wheel_next(const vm_wheel_t *w) {
+    if (!w || w->armed == 0) return VM_WHEEL_NONE;
+    /* Walk one turn from the current slot; the first slot holding a deadline
+     * inside its window for this turn holds the earliest one. */
+    uint64_t base = w->now & ~(uint64_t)(VM_WHEEL_GRAN - 1);
+    for (unsigned int i = 0; i < VM_WHEEL_SLOTS; i++) {
+        uint64_t lo = base + (uint64_t)i * VM_WHEEL_GRAN;
+        uint64_t best = VM_WHEEL_NONE;
+        for (const vm_wheel_event_t *ev = w->slots[wheel_slot(lo)]; ev; ev = ev->next)
+            if (ev->deadline < lo + VM_WHEEL_GRAN && ev->deadline < best)
+                best = ev->deadline;
+        if (best != VM_WHEEL_NONE)
+            return best;
+    }
+    /* Everything is more than a turn away: take the minimum. */
+    uint64_t best = VM_WHEEL_NONE;
+    for (unsigned int s = 0; s < VM_WHEEL_SLOTS; s++)
+        for (const vm_wheel_event_t *ev = w->slots[s]; ev; ev = ev->next)
+            if (ev->deadline < best)
+                best = ev->deadline;
+    return best;
+}
+
+unsigned int vm_wheel_advance(vm_wheel_t *w, uint64_t now) {
+    if (!w || now < w->now) return 0;
+    /* w->now only moves once everything due has fired: every armed deadline
+     * stays >= w->now, which is what lets vm_wheel_next start its walk at
+     * the current slot. */
+    unsigned int fired = 0;
+    for (;;) {
+        uint64_t next = vm_wheel_next(w);
+        if (next == VM_WHEEL_NONE || next > now) break;
+        /* Fire the first event due at `next` in its slot. */
+        vm_wheel_event_t *ev = w->slots[wheel_slot(next)];
+        while (ev && ev->deadline != next) ev = ev->next;
+        wheel_unlink(ev);
+        w->armed--;
+        fired++;
+        w->fired++;
+        if (ev->fn) ev->fn(ev->ctx, next);
+    }
+    w->now = now;
+    return fired;
+}
@@ -0,0 +1,47 @@
+#ifndef VM_WHEEL_H
+#define VM_WHEEL_H
+
+#include <stdint.h>
+
+/* Hashed timer wheel keyed on virtual time (guest instructions retired).
+ * Devices arm an event for their next deadline; the run loop executes the
+ * CPU straight up to vm_wheel_next and then fires what is due. Slots are
+ * VM_WHEEL_GRAN instructions wide; deadlines further out than one turn of
+ * the wheel stay in their slot and are skipped until their turn comes. */
+#define VM_WHEEL_SLOTS 64          /* power of two */
+#define VM_WHEEL_SHIFT 6
+#define VM_WHEEL_GRAN  (1u << VM_WHEEL_SHIFT)
+#define VM_WHEEL_NONE  UINT64_MAX
+
+/* Called with the deadline that came due, so periodic events re-arm at
+ * due + period without drifting. */
+typedef void (*vm_wheel_fn)(void *ctx, uint64_t due);
+
+typedef struct vm_wheel_event {
+    uint64_t deadline;
+    vm_wheel_fn fn;
+    void *ctx;
+    struct vm_wheel_event *next;
+    struct vm_wheel_event **pprev;   /* NULL when not armed */
+} vm_wheel_event_t;
+
+typedef struct vm_wheel {
+    vm_wheel_event_t *slots[VM_WHEEL_SLOTS];
+    uint64_t now;
+    unsigned int armed;
+    uint64_t fired;
+} vm_wheel_t;
+
+void vm_wheel_init(vm_wheel_t *w, uint64_t now);
+void vm_wheel_event_init(vm_wheel_event_t *ev, vm_wheel_fn fn, void *ctx);
+/* Arm (or re-arm) ev for deadline; deadlines not after now fire on the
+ * next advance. */
+void vm_wheel_schedule(vm_wheel_t *w, vm_wheel_event_t *ev, uint64_t deadline);
+void vm_wheel_cancel(vm_wheel_t *w, vm_wheel_event_t *ev);
+/* Earliest armed deadline, or VM_WHEEL_NONE. */
+uint64_t vm_wheel_next(const vm_wheel_t *w);
+/* Move time to now and fire every event due by then, in deadline order.
+ * Callbacks may re-arm their own or other events. Returns events fired. */
+unsigned int vm_wheel_advance(vm_wheel_t *w, uint64_t now);
+
+#endif /* VM_WHEEL_H */
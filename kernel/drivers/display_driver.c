@@ -27,6 +27,11 @@ typedef struct {
 #ifdef DRIVERS_BAREMETAL
     volatile int cursor_dirty;
     volatile uint16_t *vga;
+#else
+    /* Last frame sent to the terminal; refresh_vga emits only the cells
+     * that differ from it. */
+    uint16_t shadow[VGA_ROWS * VGA_COLS];
+    int shadow_valid;
 #endif
 } display_impl_t;
 
@@ -37,8 +42,9 @@ static void host_putchar(display_driver_t *drv, char c) {
 }
 
 static void host_clear(display_driver_t *drv) {
-    (void)drv;
+    display_impl_t *impl = (display_impl_t *)drv->impl;
     printf("\033[2J\033[H");
+    impl->shadow_valid = 0;
 }
 
 static void host_set_cursor(display_driver_t *drv, int row, int col) {
@@ -46,20 +52,58 @@ static void host_set_cursor(display_driver_t *drv, int row, int col) {
     printf("\033[%d;%dH", row + 1, col + 1);
 }
 
+/* Unchanged cells shorter than this between two changed runs are re-sent
+ * rather than skipped: cheaper than another cursor-position sequence. */
+#define VGA_RUN_MERGE_GAP 6
+
+/* VGA colour index -> ANSI colour index */
+static const uint8_t s_vga_to_ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+static void host_set_attr(uint8_t attr) {
+    int fg = (attr & 0x08 ? 90 : 30) + s_vga_to_ansi[attr & 0x07];
+    int bg = 40 + s_vga_to_ansi[(attr >> 4) & 0x07];
+    printf("\033[%d;%dm", fg, bg);
+}
+
+/* Repaint only changed runs of the 80x25 text frame: one cursor move per
+ * run, one SGR sequence only where the attribute changes. */
 static void host_refresh_vga(display_driver_t *drv, const void *vga_buf) {
-    (void)drv;
+    display_impl_t *impl = (display_impl_t *)drv->impl;
     const uint16_t *cells = (const uint16_t *)vga_buf;
-    printf("\033[2J\033[H");
+    int full = !impl->shadow_valid;
+    int attr = -1;        /* terminal attribute unknown until first SGR */
+    int emitted = 0;
+    if (full)
+        printf("\033[2J");
     for (int r = 0; r < VGA_ROWS; r++) {
-        for (int c = 0; c < VGA_COLS; c++) {
-            uint16_t word = cells[r * VGA_COLS + c];
-            char ch = (char)(word & 0xFF);
-            if (ch < 32 && ch != '\n') ch = ' ';
-            putchar(ch);
+        const uint16_t *row = cells + r * VGA_COLS;
+        uint16_t *shadow = impl->shadow + r * VGA_COLS;
+        int c = 0;
+        while (c < VGA_COLS) {
+            if (!full && row[c] == shadow[c]) { c++; continue; }
+            /* Extend the run across short unchanged gaps. */
+            int end = c + 1, gap = 0;
+            for (int k = c + 1; k < VGA_COLS; k++) {
+                if (full || row[k] != shadow[k]) { end = k + 1; gap = 0; }
+                else if (++gap >= VGA_RUN_MERGE_GAP) break;
+            }
+            printf("\033[%d;%dH", r + 1, c + 1);
+            for (; c < end; c++) {
+                uint8_t a = (uint8_t)(row[c] >> 8);
+                if (a != attr) { host_set_attr(a); attr = a; }
+                char ch = (char)(row[c] & 0xFF);
+                if (ch < 32 || ch == 127) ch = ' ';
+                putchar(ch);
+                shadow[c] = row[c];
+            }
+            emitted = 1;
         }
-        if (r < VGA_ROWS - 1) putchar('\n');
     }
-    fflush(stdout);
+    impl->shadow_valid = 1;
+    if (emitted) {
+        printf("\033[0m");
+        fflush(stdout);
+    }
 }
 
 static void host_flush_cursor(display_driver_t *drv) {
@@ -0,0 +1,82 @@
+/* Dispatch microbenchmark: runs the same guest loop through the switch and
+ * threaded dispatchers, checks they end in identical CPU state and reports
+ * guest MIPS for each.  Usage: bench_vm_dispatch [iterations] */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "VM/devices/vm_bcache.h"
+#include "VM/devices/vm_cpu.h"
+#include "VM/devices/vm_exec.h"
+#include "VM/devices/vm_mem.h"
+
+#define LOOP_BODY_INSNS 7
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void load_loop(vm_mem_t *mem, vm_cpu_t *cpu, uint32_t iterations) {
+    uint8_t code[] = {
+        0xB9, 0, 0, 0, 0,   /* 0:  mov ecx, iterations */
+        0x40,               /* 5:  inc eax */
+        0x01, 0xD8,         /* 6:  add eax, ebx */
+        0x43,               /* 8:  inc ebx */
+        0x50,               /* 9:  push eax */
+        0x5A,               /* 10: pop edx */
+        0x83, 0xE9, 0x01,   /* 11: sub ecx, 1 */
+        0x75, 0xF3,         /* 14: jnz 5 */
+        0xF4,               /* 16: hlt */
+    };
+    memcpy(&code[1], &iterations, 4);
+    vm_mem_load(mem, 0x7c00, code, sizeof(code));
+    vm_cpu_init(cpu);
+    cpu->esp = 0x7000;
+}
+
+static double run(vm_mem_t *mem, vm_bcache_t *bc, vm_dispatch_t mode, uint32_t iterations,
+                  vm_cpu_t *out, uint64_t *insns) {
+    load_loop(mem, out, iterations);
+    vm_bcache_flush(bc);
+    *insns = 0;
+    double t0 = now_sec();
+    while (!out->halted) {
+        int n = vm_exec_run(out, mem, bc, 1 << 20, mode);
+        if (n == 0) break;
+        *insns += (uint64_t)n;
+    }
+    return now_sec() - t0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000000u;
+    vm_mem_t mem;
+    vm_bcache_t bc;
+    assert(vm_mem_init(&mem) == 0);
+    assert(vm_bcache_init(&bc, &mem) == 0);
+
+    vm_cpu_t a, b;
+    uint64_t na, nb;
+    double ta = run(&mem, &bc, VM_DISPATCH_SWITCH, iterations, &a, &na);
+    double tb = run(&mem, &bc, VM_DISPATCH_THREADED, iterations, &b, &nb);
+
+    uint64_t expect = 1 + (uint64_t)iterations * LOOP_BODY_INSNS + 1;
+    assert(a.halted && b.halted);
+    assert(na == expect && nb == expect);
+    assert(a.eax == b.eax && a.ebx == b.ebx && a.ecx == b.ecx && a.edx == b.edx);
+    assert(a.esp == b.esp && a.eip == b.eip && vm_cpu_eflags(&a) == vm_cpu_eflags(&b));
+    assert(a.ebx == iterations && a.ecx == 0);
+
+    printf("vm dispatch: %llu guest instructions per mode\n", (unsigned long long)expect);
+    printf("  %-28s %8.1f MIPS\n", vm_dispatch_name(VM_DISPATCH_SWITCH), (double)na / ta / 1e6);
+    printf("  %-28s %8.1f MIPS  (x%.2f)\n", vm_dispatch_name(VM_DISPATCH_THREADED), (double)nb / tb / 1e6, ta / tb);
+
+    vm_bcache_destroy(&bc);
+    vm_mem_destroy(&mem);
+    return 0;
+}
@@ -548,10 +548,45 @@ static int test_device_model_null_params(void) {
     return 0;
 }
 
+/* Run refresh_vga with stdout captured; returns bytes written (or -1). */
+static long capture_refresh(const uint16_t *cells, char *out, size_t cap) {
+    fflush(stdout);
+    FILE *tmp = tmpfile();
+    if (!tmp) return -1;
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    g_display_driver->refresh_vga(g_display_driver, cells);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    rewind(tmp);
+    long n = (long)fread(out, 1, cap - 1, tmp);
+    out[n] = '\0';
+    fclose(tmp);
+    return n;
+}
+
 static int test_display(void) {
     ASSERT(g_display_driver != NULL);
     g_display_driver->putchar(g_display_driver, 'X');
     g_display_driver->clear(g_display_driver);
+
+    /* Dirty-cell refresh: after the first full frame only changed runs go out. */
+    static uint16_t cells[VGA_ROWS * VGA_COLS];
+    static char out[32768];
+    for (int i = 0; i < VGA_ROWS * VGA_COLS; i++)
+        cells[i] = (uint16_t)(0x0700 | ' ');
+    long full = capture_refresh(cells, out, sizeof(out));
+    ASSERT(full >= VGA_ROWS * VGA_COLS);
+    ASSERT(capture_refresh(cells, out, sizeof(out)) == 0);      /* unchanged */
+    cells[3 * VGA_COLS + 10] = (uint16_t)(0x0700 | 'A');
+    cells[3 * VGA_COLS + 11] = (uint16_t)(0x1F00 | 'B');
+    long n = capture_refresh(cells, out, sizeof(out));
+    ASSERT(n > 0 && n < 48);
+    ASSERT(strstr(out, "\033[4;11H") != NULL);
+    ASSERT(strstr(out, "\033[97;44mB") != NULL);
+    g_display_driver->clear(g_display_driver);                   /* forces full frame */
+    ASSERT(capture_refresh(cells, out, sizeof(out)) >= VGA_ROWS * VGA_COLS);
     return 0;
 }
 
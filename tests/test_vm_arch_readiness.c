@@ -22,10 +22,13 @@ pic_driver_t      *g_pic_driver = &s_pic_driver;
 
 /* Minimal shims for vm_io/vm_arch dependencies. */
 int __attribute__((weak)) vm_host_kbd_pop(vm_host_t *host, uint8_t *out) { (void)host; (void)out; return -1; }
+int __attribute__((weak)) vm_host_kbd_pending(vm_host_t *host) { (void)host; return 0; }
 uint64_t __attribute__((weak)) vm_host_ticks(vm_host_t *host) { (void)host; return 0; }
 int __attribute__((weak)) vm_disk_is_active(void) { return 1; }
 int __attribute__((weak)) vm_disk_read_sector(uint32_t lba, void *out512) { (void)lba; (void)out512; return -1; }
 int __attribute__((weak)) vm_disk_write_sector(uint32_t lba, const void *in512) { (void)lba; (void)in512; return -1; }
+int __attribute__((weak)) vm_disk_flush(void) { return 0; }
+uint32_t __attribute__((weak)) vm_disk_sectors(void) { return 0; }
 
 int main(void) {
     uint8_t ram[4096] = {0};
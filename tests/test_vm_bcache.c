@@ -0,0 +1,87 @@
+/* Decoded block cache: block splitting, hits, and invalidation on guest stores. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "VM/devices/vm_bcache.h"
+#include "VM/devices/vm_mem.h"
+
+static const void *bind_op(vm_opcode_t op) {
+    static const char tags[VM_OP_UNKNOWN + 1];
+    return &tags[op];
+}
+
+int main(void) {
+    vm_mem_t mem;
+    vm_bcache_t bc;
+    assert(vm_mem_init(&mem) == 0);
+    assert(vm_bcache_init(&bc, &mem) == 0);
+
+    /* MOV AL,'A'; INC EAX; JMP -5; NOP  -> block of 3 ending at the JMP */
+    const uint8_t code[] = { 0xB0, 'A', 0x40, 0xEB, 0xFB, 0x90 };
+    assert(vm_mem_load(&mem, 0x7c00, code, sizeof(code)) == 0);
+
+    vm_bblock_t *b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->valid && b->count == 3);
+    assert(b->insns[0].op == VM_OP_MOV && b->insns[2].op == VM_OP_JMP);
+    assert(vm_bcache_lookup(&bc, 0x7c00) == b);
+    assert(bc.hits == 1 && bc.misses == 1);
+
+    /* Store into the code page: block dropped, next lookup sees new bytes. */
+    vm_mem_write8(&mem, 0x7c02, 0x48);   /* INC -> DEC */
+    assert(!b->valid && bc.invalidations == 1);
+    b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->valid && b->insns[1].op == VM_OP_DEC);
+
+    /* The inline 32-bit store takes its fast path here and still fires
+     * the code watch. */
+    assert(vm_mem_read32(&mem, 0x7c00) == 0xEB4841B0u);
+    vm_mem_write32(&mem, 0x7c00, 0xEB4041B0u);   /* DEC -> INC */
+    assert(!b->valid && bc.invalidations == 2);
+    b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->insns[1].op == VM_OP_INC);
+
+    /* Unaligned and edge accesses go the checked way: a store straddling
+     * into the code page still invalidates, past-the-end reads are 0. */
+    vm_mem_write16(&mem, 0x7bff, 0x9090);
+    assert(!b->valid && vm_mem_read16(&mem, 0x7bff) == 0x9090);
+    assert(vm_mem_read32(&mem, (uint32_t)mem.size - 2) == 0);
+    vm_mem_write32(&mem, (uint32_t)mem.size - 4, 0x11223344u);
+    assert(vm_mem_read32(&mem, (uint32_t)mem.size - 4) == 0x11223344u);
+    assert(vm_mem_read16(&mem, (uint32_t)mem.size - 3) == 0x2233);
+    b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->valid && b->insns[0].op == VM_OP_NOP);
+    assert(vm_mem_load(&mem, 0x7c00, code, sizeof(code)) == 0);
+    b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->valid && b->insns[0].op == VM_OP_MOV);
+
+    /* Stores to other pages leave the block alone. */
+    vm_mem_write8(&mem, 0x20000, 0xAA);
+    assert(b->valid);
+
+    /* Blocks stop at page boundaries so paging can remap the next page. */
+    const uint8_t nops[4] = { 0x90, 0x90, 0x90, 0x90 };
+    assert(vm_mem_load(&mem, 0x8ffe, nops, sizeof(nops)) == 0);
+    b = vm_bcache_lookup(&bc, 0x8ffe);
+    assert(b && b->count == 2 && b->page_lo == b->page_hi);
+
+    /* Undecodable entry yields no block. */
+    vm_mem_write8(&mem, 0x9000, 0xFF);
+    assert(vm_bcache_lookup(&bc, 0x9000) == NULL);
+
+    uint64_t misses = bc.misses;
+    vm_bcache_flush(&bc);
+    assert(vm_bcache_lookup(&bc, 0x7c00) != NULL);
+    assert(bc.misses == misses + 1);
+
+    /* A bind hook tags each instruction with its handler as it is decoded. */
+    bc.bind = bind_op;
+    vm_bcache_flush(&bc);
+    b = vm_bcache_lookup(&bc, 0x7c00);
+    assert(b && b->insns[0].handler == bind_op(VM_OP_MOV) && b->insns[2].handler == bind_op(VM_OP_JMP));
+
+    vm_bcache_destroy(&bc);
+    vm_mem_destroy(&mem);
+    puts("vm bcache: OK");
+    return 0;
+}
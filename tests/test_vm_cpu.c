@@ -0,0 +1,112 @@
+/* vCPU address translation: software TLB must match the page-table walk.
+ * Lazy flags: deferred ZF/SF/CF/OF/PF/AF match x86 when materialized. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_cpu.h"
+
+#define RAM_SIZE (64 * 1024)
+static uint8_t ram[RAM_SIZE] __attribute__((aligned(4096)));
+
+static void put32(uint32_t addr, uint32_t v) {
+    memcpy(ram + addr, &v, 4);
+}
+
+static void test_lazy_flags(void) {
+    vm_cpu_t cpu;
+    vm_cpu_init(&cpu);
+    cpu.eflags = VM_FLAG_DF | VM_FLAG_ZF;
+
+    /* 0x7FFFFFFF + 1: signed overflow, no carry; DF untouched. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_ADD, 4, 0x7FFFFFFF, 1, 0x80000000U);
+    assert(cpu.eflags == (VM_FLAG_DF | VM_FLAG_ZF));   /* nothing computed yet */
+    assert(!vm_cpu_zf(&cpu));
+    assert(vm_cpu_eflags(&cpu) == (VM_FLAG_DF | VM_FLAG_SF | VM_FLAG_OF | VM_FLAG_AF | VM_FLAG_PF));
+
+    /* 0xFFFFFFFF + 1: carry out, zero result. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_ADD, 4, 0xFFFFFFFFU, 1, 0);
+    assert(vm_cpu_zf(&cpu));
+    assert(vm_cpu_eflags(&cpu) == (VM_FLAG_DF | VM_FLAG_CF | VM_FLAG_ZF | VM_FLAG_AF | VM_FLAG_PF));
+
+    /* CMP AL=1, 2 (8-bit): borrow, negative, odd parity of 0xFF is even. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_SUB, 1, 1, 2, (uint32_t)(1 - 2));
+    assert(cpu.lazy.result == 0xFF);
+    assert(vm_cpu_eflags(&cpu) == (VM_FLAG_DF | VM_FLAG_CF | VM_FLAG_SF | VM_FLAG_AF | VM_FLAG_PF));
+
+    /* CMP AL=0x80, 1 (8-bit): signed overflow, no borrow. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_SUB, 1, 0x80, 1, 0x7F);
+    assert(vm_cpu_eflags(&cpu) == (VM_FLAG_DF | VM_FLAG_OF | VM_FLAG_AF));
+
+    /* TEST: CF/OF clear, parity of 0x03 is even. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_LOGIC, 1, 0x0F, 0x03, 0x03);
+    vm_cpu_flags_commit(&cpu);
+    assert(cpu.lazy.op == VM_LAZY_NONE);
+    assert(cpu.eflags == (VM_FLAG_DF | VM_FLAG_PF));
+
+    /* Wholesale EFLAGS writes drop anything pending. */
+    vm_cpu_set_lazy(&cpu, VM_LAZY_SUB, 4, 5, 5, 0);
+    vm_cpu_set_eflags(&cpu, 0x2);
+    assert(!vm_cpu_zf(&cpu) && vm_cpu_eflags(&cpu) == 0x2);
+}
+
+int main(void) {
+    test_lazy_flags();
+
+    vm_cpu_t cpu;
+    vm_cpu_init(&cpu);
+
+    /* PD at 0x1000, PT at 0x2000: linear 0x00400000 -> 0x5000 (RW),
+     * linear 0x00401000 -> 0x6000 (read-only). */
+    put32(0x1000 + 1 * 4, 0x2000 | 0x3);
+    put32(0x2000 + 0 * 4, 0x5000 | 0x3);
+    put32(0x2000 + 1 * 4, 0x6000 | 0x1);
+
+    /* Paging off: identity, TLB untouched. */
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x1234, VM_ACCESS_READ) == 0x1234);
+    assert(cpu.tlb.hits == 0 && cpu.tlb.misses == 0);
+
+    vm_cpu_write_cr3(&cpu, 0x1000);
+    vm_cpu_write_cr0(&cpu, VM_CR0_PE | VM_CR0_PG);
+
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400010, VM_ACCESS_FETCH) == 0x5010);
+    assert(cpu.tlb.misses == 1);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400ffc, VM_ACCESS_WRITE) == 0x5ffc);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400020, VM_ACCESS_READ) == 0x5020);
+    assert(cpu.tlb.hits == 2 && cpu.tlb.misses == 1);
+
+    /* Stale until the guest reloads CR3, as on hardware. */
+    put32(0x2000 + 0 * 4, 0x7000 | 0x3);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400000, VM_ACCESS_READ) == 0x5000);
+    vm_cpu_write_cr3(&cpu, 0x1000);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400000, VM_ACCESS_READ) == 0x7000);
+
+    /* CR0.WP: read-only page caches R/X but writes keep walking. */
+    vm_cpu_write_cr0(&cpu, VM_CR0_PE | VM_CR0_PG | VM_CR0_WP);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00401004, VM_ACCESS_READ) == 0x6004);
+    uint64_t misses = cpu.tlb.misses;
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00401008, VM_ACCESS_WRITE) == 0x6008);
+    assert(cpu.tlb.misses == misses + 1);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x0040100c, VM_ACCESS_FETCH) == 0x600c);
+    assert(cpu.tlb.misses == misses + 1);
+
+    /* Not-present pages translate to the linear address and are not cached. */
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00800000, VM_ACCESS_READ) == 0x00800000);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00800000, VM_ACCESS_READ) == 0x00800000);
+    assert(cpu.tlb.misses == misses + 3);
+
+    /* Every TLB answer agrees with the uncached walker. */
+    for (uint32_t lin = 0x003ff000; lin < 0x00403000; lin += 0x400)
+        assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, lin, VM_ACCESS_READ) ==
+               vm_cpu_translate(ram, RAM_SIZE, cpu.cr0, cpu.cr3, lin));
+
+    /* Turning paging off flushes. */
+    uint64_t flushes = cpu.tlb.flushes;
+    vm_cpu_write_cr0(&cpu, VM_CR0_PE);
+    assert(cpu.tlb.flushes == flushes + 1);
+    assert(vm_cpu_translate_access(&cpu, ram, RAM_SIZE, 0x00400000, VM_ACCESS_READ) == 0x00400000);
+
+    puts("vm cpu: OK");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* Multi-instance VM: independent contexts run batches of guests on their own
+ * threads and match a sequential reference run; disks and checkpoint slots
+ * stay private to their context. Baseline reset and reverse execution are
+ * checked against straight runs. */
+#ifdef VM_ENABLE
+
+#include "vm.h"
+#include "vm_disk.h"
+#include "vm_host.h"
+#include "vm_mem.h"
+#include "vm_snapshot.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CTX_THREADS 4
+#define CTX_BATCH   8
+
+/* mov ecx,N ; mov al,ch ; L: out 0xF8,al ; sub ecx,1 ; jnz L ; cli ; hlt */
+static void make_guest(uint8_t *code, int prog) {
+    const uint8_t tmpl[] = { 0xB9, 0, 0, 0, 0, 0xB0, 0, 0xE6, 0xF8, 0x83, 0xE9, 0x01, 0x75, 0xF7, 0xFA, 0xF4 };
+    memcpy(code, tmpl, sizeof(tmpl));
+    code[1] = (uint8_t)(3 + prog * 5);
+    code[6] = (uint8_t)('a' + prog);
+}
+
+#define GUEST_LEN 16
+#define GUEST_OUT(prog) (3 + (prog) * 5)
+
+static uint32_t s_expect[CTX_BATCH];
+
+typedef struct worker {
+    int id;
+    int failed;
+} worker_t;
+
+static void *worker_fn(void *arg) {
+    worker_t *w = arg;
+    char path[64];
+    snprintf(path, sizeof(path), "vm_ctx_%d.img", w->id);
+    FILE *serial = tmpfile();
+    vm_ctx_config_t cfg = { .disk_path = path, .disk_size_mb = 1, .serial = serial };
+    vm_ctx_t *ctx = vm_ctx_create(&cfg);
+    if (!ctx || !serial) { w->failed = 1; return NULL; }
+
+    /* This thread's disk binding is the context's own image. */
+    uint8_t sector[VM_DISK_SECTOR_SIZE], back[VM_DISK_SECTOR_SIZE];
+    memset(sector, 0x40 + w->id, sizeof(sector));
+    if (vm_disk_write_sector(0, sector) != 0) w->failed = 1;
+
+    long expect_out = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int p = 0; p < CTX_BATCH; p++) {
+            uint8_t code[GUEST_LEN];
+            make_guest(code, (p + w->id) % CTX_BATCH);
+            if (vm_ctx_load(ctx, code, sizeof(code)) != 0) w->failed = 1;
+            vm_ctx_run(ctx);
+            if (vm_ctx_state_checksum(ctx) != s_expect[(p + w->id) % CTX_BATCH]) w->failed = 1;
+            expect_out += GUEST_OUT((p + w->id) % CTX_BATCH);
+        }
+    }
+
+    /* Checkpoint replay inside one context. */
+    uint8_t code[GUEST_LEN];
+    make_guest(code, w->id);
+    vm_ctx_load(ctx, code, sizeof(code));
+    if (vm_ctx_save_checkpoint(ctx) != 0) w->failed = 1;
+    vm_ctx_run(ctx);
+    uint32_t first = vm_ctx_state_checksum(ctx);
+    if (vm_ctx_restore_checkpoint(ctx) != 0) w->failed = 1;
+    vm_ctx_run(ctx);
+    if (vm_ctx_state_checksum(ctx) != first) w->failed = 1;
+    expect_out += 2 * GUEST_OUT(w->id);
+
+    if (vm_disk_read_sector(0, back) != 0 || memcmp(sector, back, sizeof(back)) != 0) w->failed = 1;
+    vm_ctx_destroy(ctx);
+    if (ftell(serial) != expect_out) w->failed = 1;
+    fclose(serial);
+    unlink(path);
+    return NULL;
+}
+
+/* Fork-server reset: a guest that writes its stack is captured once and
+ * reset between runs; every run matches the first and a cold load. */
+static int test_reset(void) {
+    /* mov esp,0x9000 ; mov ecx,16 ; mov al,'z' ; L: out 0xF8,al ; push ecx ;
+     * sub ecx,1 ; jnz L ; cli ; hlt */
+    static const uint8_t writer[] = {
+        0xBC, 0x00, 0x90, 0, 0, 0xB9, 16, 0, 0, 0, 0xB0, 'z',
+        0xE6, 0xF8, 0x51, 0x83, 0xE9, 0x01, 0x75, 0xF6, 0xFA, 0xF4
+    };
+    FILE *serial = tmpfile();
+    vm_ctx_config_t cfg = { .serial = serial };
+    vm_ctx_t *ctx = vm_ctx_create(&cfg);
+    if (!ctx || !serial) return -1;
+    vm_mem_t *mem = vm_host_mem(vm_ctx_host(ctx));
+    if (vm_ctx_reset(ctx) == 0) return -1;              /* nothing captured yet */
+    if (vm_ctx_load(ctx, writer, sizeof(writer)) != 0) return -1;
+    if (vm_ctx_capture_baseline(ctx) != 0) return -1;
+    vm_ctx_run(ctx);
+    uint32_t first = vm_ctx_state_checksum(ctx);
+    uint32_t top = vm_mem_read32(mem, 0x9000 - 4);
+    if (top != 16) return -1;
+    for (int i = 0; i < 200; i++) {
+        if (vm_ctx_reset(ctx) != 0) return -1;
+        if (vm_mem_read32(mem, 0x9000 - 4) != 0) return -1;
+        vm_ctx_run(ctx);
+        if (vm_ctx_state_checksum(ctx) != first || vm_mem_read32(mem, 0x9000 - 4) != top) return -1;
+    }
+    if (vm_ctx_load(ctx, writer, sizeof(writer)) != 0) return -1;
+    vm_ctx_run(ctx);
+    if (vm_ctx_state_checksum(ctx) != first) return -1;
+    vm_ctx_destroy(ctx);
+    long out = ftell(serial);
+    fclose(serial);
+    return out == 202 * 16 ? 0 : -1;
+}
+
+static uint32_t ram_hash(const vm_mem_t *mem) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < mem->size; i++)
+        h = (h ^ mem->ram[i]) * 16777619u;
+    return h;
+}
+
+/* Reverse execution: a guest filling memory runs past several checkpoint
+ * generations, steps back, and matches a straight run to the same point;
+ * the disk steps back with it. */
+static int test_run_back(void) {
+    /* mov edi,0x100000 ; mov ecx,150000 ; L: stosd ; add eax,3 ;
+     * sub ecx,1 ; jnz L ; cli ; hlt */
+    static const uint8_t filler[] = {
+        0xBF, 0x00, 0x00, 0x10, 0x00, 0xB9, 0xF0, 0x49, 0x02, 0x00,
+        0xAB, 0x83, 0xC0, 0x03, 0x83, 0xE9, 0x01, 0x75, 0xF7, 0xFA, 0xF4
+    };
+    uint8_t z[VM_DISK_SECTOR_SIZE], a[VM_DISK_SECTOR_SIZE], r[VM_DISK_SECTOR_SIZE];
+    memset(z, 'z', sizeof(z));
+    memset(a, 'a', sizeof(a));
+    unlink("vm_ctx_back.img");
+    vm_ctx_config_t cfg = { .ram_size_mb = 4, .disk_path = "vm_ctx_back.img", .disk_size_mb = 1 };
+    vm_ctx_t *ctx = vm_ctx_create(&cfg);
+    if (!ctx) return -1;
+    vm_host_t *host = vm_ctx_host(ctx);
+    vm_mem_t *mem = vm_host_mem(host);
+
+    if (vm_ctx_load(ctx, filler, sizeof(filler)) != 0) return -1;
+    vm_ctx_run_cycles(ctx, 3300);
+    uint32_t ref_sum = vm_ctx_state_checksum(ctx), ref_ram = ram_hash(mem);
+    uint64_t ref_clock = host->vm_clock;
+    vm_ctx_run_cycles(ctx, 700);
+    uint32_t end_sum = vm_ctx_state_checksum(ctx), end_ram = ram_hash(mem);
+
+    /* The straight run writes the disk between generations. */
+    if (vm_ctx_load(ctx, filler, sizeof(filler)) != 0) return -1;
+    if (vm_disk_write_sector(1, z) != 0) return -1;
+    vm_ctx_run_cycles(ctx, 3300);
+    if (vm_disk_write_sector(1, a) != 0) return -1;
+    vm_ctx_run_cycles(ctx, 700);
+    if (vm_disk_write_sector(2, a) != 0) return -1;
+    if (vm_ctx_state_checksum(ctx) != end_sum || ram_hash(mem) != end_ram) return -1;
+    if (vm_snapshot_generations() != VM_SNAPSHOT_GENERATIONS) return -1;
+    if (vm_ctx_run_back(ctx, host->vm_clock - ref_clock) != 0) return -1;
+    if (host->vm_clock != ref_clock || vm_ctx_state_checksum(ctx) != ref_sum || ram_hash(mem) != ref_ram)
+        return -1;
+    if (vm_disk_read_sector(1, r) != 0 || memcmp(r, z, sizeof(r)) != 0) return -1;
+    if (vm_disk_read_sector(2, r) != 0 || memcmp(r, a, sizeof(r)) == 0) return -1;
+    /* Forward again lands on the same end state. */
+    vm_ctx_run_cycles(ctx, 700);
+    if (vm_ctx_state_checksum(ctx) != end_sum || ram_hash(mem) != end_ram) return -1;
+    /* Further back than the ring reaches: refused, guest untouched. */
+    if (vm_ctx_run_back(ctx, host->vm_clock - 64) == 0) return -1;
+    if (vm_ctx_state_checksum(ctx) != end_sum) return -1;
+    vm_ctx_destroy(ctx);
+    /* Destroying the context merged and removed every overlay. */
+    if (access("vm_ctx_back.img.ckpt.0", F_OK) == 0) return -1;
+    unlink("vm_ctx_back.img");
+    return 0;
+}
+
+int main(void) {
+    /* Sequential reference: one context reused for the whole batch. */
+    FILE *sink = tmpfile();
+    vm_ctx_config_t cfg = { .serial = sink };
+    vm_ctx_t *ref = vm_ctx_create(&cfg);
+    if (!ref || !sink) {
+        fprintf(stderr, "vm_ctx_create failed\n");
+        return 1;
+    }
+    for (int p = 0; p < CTX_BATCH; p++) {
+        uint8_t code[GUEST_LEN];
+        make_guest(code, p);
+        if (vm_ctx_load(ref, code, sizeof(code)) != 0) return 1;
+        vm_ctx_run(ref);
+        s_expect[p] = vm_ctx_state_checksum(ref);
+    }
+    vm_ctx_destroy(ref);
+    fclose(sink);
+    for (int p = 1; p < CTX_BATCH; p++) {
+        if (s_expect[p] == s_expect[0]) {
+            fprintf(stderr, "guests not distinguishable by checksum\n");
+            return 1;
+        }
+    }
+
+    pthread_t th[CTX_THREADS];
+    worker_t w[CTX_THREADS];
+    for (int i = 0; i < CTX_THREADS; i++) {
+        w[i].id = i;
+        w[i].failed = 0;
+        if (pthread_create(&th[i], NULL, worker_fn, &w[i]) != 0) return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < CTX_THREADS; i++) {
+        pthread_join(th[i], NULL);
+        if (w[i].failed) {
+            fprintf(stderr, "context %d diverged\n", i);
+            failed = 1;
+        }
+    }
+    if (failed) return 1;
+    /* A disk path too long for its checkpoint overlay names is refused. */
+    char long_path[300];
+    memset(long_path, 'd', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = '\0';
+    vm_ctx_config_t long_cfg = { .disk_path = long_path };
+    if (vm_ctx_create(&long_cfg) != NULL) {
+        fprintf(stderr, "long disk path accepted\n");
+        return 1;
+    }
+    if (test_reset() != 0) {
+        fprintf(stderr, "baseline reset diverged\n");
+        return 1;
+    }
+    if (test_run_back() != 0) {
+        fprintf(stderr, "run back diverged\n");
+        return 1;
+    }
+    printf("vm ctx: %d threads x %d guests OK\n", CTX_THREADS, 2 * CTX_BATCH);
+    return 0;
+}
+
+#else
+
+int main(void) { return 0; }
+
+#endif
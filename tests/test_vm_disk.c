@@ -0,0 +1,200 @@
+/* Virtual disk write-back cache: read-your-writes, flush, eviction, the
+ * checkpoint overlay chain (restore, merge, commit) and shutdown all reach
+ * the backing file; images grow sparse. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VM/devices/vm_disk.h"
+
+#define IMG "tests/test_vm_disk.img"
+#define SNAP "tests/test_vm_disk_snap.img"
+#define SNAP2 "tests/test_vm_disk_snap2.img"
+
+static void fill(uint8_t *buf, uint32_t lba, uint8_t tag) {
+    for (int i = 0; i < VM_DISK_SECTOR_SIZE; i++)
+        buf[i] = (uint8_t)(lba * 31u + (uint32_t)i + tag);
+}
+
+/* Read a sector straight from the image file, bypassing the cache. */
+static void file_sector(const char *path, uint32_t lba, uint8_t *out) {
+    FILE *fp = fopen(path, "rb");
+    assert(fp);
+    assert(fseek(fp, (long)lba * VM_DISK_SECTOR_SIZE, SEEK_SET) == 0);
+    assert(fread(out, 1, VM_DISK_SECTOR_SIZE, fp) == VM_DISK_SECTOR_SIZE);
+    fclose(fp);
+}
+
+int main(void) {
+    uint8_t w[VM_DISK_SECTOR_SIZE], r[VM_DISK_SECTOR_SIZE], f[VM_DISK_SECTOR_SIZE];
+    unlink(IMG);
+    assert(vm_disk_init(IMG, 1) == 0);
+    assert(vm_disk_is_active());
+
+    /* Fresh image reads as zeros; out-of-range is rejected. */
+    assert(vm_disk_read_sector(5, r) == 0);
+    for (int i = 0; i < VM_DISK_SECTOR_SIZE; i++) assert(r[i] == 0);
+    assert(vm_disk_read_sector(2048, r) != 0);
+
+    /* Writes are cached until flushed. */
+    fill(w, 5, 1);
+    uint64_t gen = vm_disk_generation();
+    assert(vm_disk_write_sector(5, w) == 0);
+    assert(vm_disk_generation() != gen);
+    assert(vm_disk_read_sector(5, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    file_sector(IMG, 5, f);
+    assert(f[0] == 0 && f[VM_DISK_SECTOR_SIZE - 1] == 0);
+    assert(vm_disk_flush() == 0);
+    file_sector(IMG, 5, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+
+    /* A conflicting lba evicts (and writes back) the dirty line. */
+    fill(w, 6, 2);
+    assert(vm_disk_write_sector(6, w) == 0);
+    fill(w, 6 + VM_DISK_CACHE_SECTORS, 3);
+    assert(vm_disk_write_sector(6 + VM_DISK_CACHE_SECTORS, w) == 0);
+    fill(w, 6, 2);
+    file_sector(IMG, 6, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    assert(vm_disk_read_sector(6, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+
+    /* A run of dirty sectors is written back coalesced and intact. */
+    for (uint32_t lba = 100; lba < 140; lba++) {
+        fill(w, lba, 4);
+        assert(vm_disk_write_sector(lba, w) == 0);
+    }
+    assert(vm_disk_snapshot_save(SNAP) == 0);     /* flushes first */
+    for (uint32_t lba = 100; lba < 140; lba++) {
+        fill(w, lba, 4);
+        file_sector(IMG, lba, f);
+        assert(memcmp(f, w, sizeof(w)) == 0);
+    }
+    assert(vm_disk_overlay_sectors() == 0);
+
+    /* After the checkpoint, writes go to the overlay; the image keeps the
+     * checkpointed sectors. */
+    fill(w, 100, 9);
+    assert(vm_disk_write_sector(100, w) == 0);
+    fill(w, 1500, 9);
+    assert(vm_disk_write_sector(1500, w) == 0);
+    assert(vm_disk_flush() == 0);
+    assert(vm_disk_overlay_sectors() == 2);
+    fill(w, 100, 4);
+    file_sector(IMG, 100, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    fill(w, 100, 9);
+    file_sector(SNAP, 100, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    /* Evicted overlay sectors read back from the overlay. */
+    assert(vm_disk_read_sector(100 + VM_DISK_CACHE_SECTORS, r) == 0);
+    assert(vm_disk_read_sector(100, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+
+    /* Restore discards the overlay and cached state. */
+    fill(w, 101, 9);
+    assert(vm_disk_write_sector(101, w) == 0);
+    gen = vm_disk_generation();
+    assert(vm_disk_snapshot_restore(SNAP) == 0);
+    assert(vm_disk_generation() != gen);
+    assert(vm_disk_overlay_sectors() == 0);
+    fill(w, 100, 4);
+    assert(vm_disk_read_sector(100, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    fill(w, 101, 4);
+    assert(vm_disk_read_sector(101, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    assert(vm_disk_read_sector(1500, r) == 0);
+    for (int i = 0; i < VM_DISK_SECTOR_SIZE; i++) assert(r[i] == 0);
+    assert(vm_disk_snapshot_restore("tests/other.img") != 0);
+
+    /* Checkpoints stack: each has its own overlay, and going back to an
+     * older one drops the newer ones. */
+    fill(w, 102, 7);
+    assert(vm_disk_write_sector(102, w) == 0);
+    assert(vm_disk_snapshot_save(SNAP2) == 0);
+    assert(vm_disk_snapshot_save(SNAP2) != 0);    /* already in the chain */
+    assert(vm_disk_checkpoints() == 2);
+    fill(w, 102, 4);
+    file_sector(IMG, 102, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    fill(w, 102, 8);
+    assert(vm_disk_write_sector(102, w) == 0);
+    fill(w, 103, 8);
+    assert(vm_disk_write_sector(103, w) == 0);
+    assert(vm_disk_snapshot_restore(SNAP2) == 0);
+    fill(w, 102, 7);
+    assert(vm_disk_read_sector(102, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    fill(w, 103, 4);
+    assert(vm_disk_read_sector(103, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    assert(vm_disk_snapshot_restore(SNAP) == 0);
+    assert(vm_disk_checkpoints() == 1);
+    assert(access(SNAP2, F_OK) != 0);
+    fill(w, 102, 4);
+    assert(vm_disk_read_sector(102, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+
+    /* Merging a checkpoint folds it into the image; so does commit. */
+    fill(w, 102, 7);
+    assert(vm_disk_write_sector(102, w) == 0);
+    assert(vm_disk_snapshot_save(SNAP2) == 0);
+    assert(vm_disk_snapshot_merge(SNAP) == 0);
+    assert(vm_disk_checkpoints() == 1);
+    file_sector(IMG, 102, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    assert(vm_disk_snapshot_restore(SNAP) != 0);  /* merged */
+    fill(w, 103, 7);
+    assert(vm_disk_write_sector(103, w) == 0);
+    assert(vm_disk_commit() == 0);
+    assert(vm_disk_checkpoints() == 0);
+    file_sector(IMG, 103, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    assert(vm_disk_snapshot_restore(SNAP2) != 0); /* no checkpoint open */
+
+    /* A full chain merges its oldest checkpoint to make room. */
+    char path[64];
+    for (int k = 0; k <= VM_DISK_CHECKPOINTS; k++) {
+        fill(w, 300 + (uint32_t)k, 6);
+        assert(vm_disk_write_sector(300 + (uint32_t)k, w) == 0);
+        snprintf(path, sizeof(path), SNAP ".%d", k);
+        assert(vm_disk_snapshot_save(path) == 0);
+    }
+    assert(vm_disk_checkpoints() == VM_DISK_CHECKPOINTS);
+    assert(vm_disk_snapshot_restore(SNAP ".0") != 0);
+    fill(w, 301, 6);
+    file_sector(IMG, 301, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    assert(vm_disk_snapshot_restore(SNAP ".1") == 0);
+    assert(vm_disk_read_sector(302, r) == 0);
+    for (int i = 0; i < VM_DISK_SECTOR_SIZE; i++) assert(r[i] == 0);
+    assert(vm_disk_commit() == 0);
+
+    /* Shutdown writes back what is still cached, merging any overlay. */
+    assert(vm_disk_snapshot_save(SNAP) == 0);
+    fill(w, 1999, 5);
+    assert(vm_disk_write_sector(1999, w) == 0);
+    assert(vm_disk_flush() == 0);
+    fill(w, 2000, 5);
+    assert(vm_disk_write_sector(2000, w) == 0);
+    vm_disk_shutdown();
+    assert(!vm_disk_is_active());
+    file_sector(IMG, 2000, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+    fill(w, 1999, 5);
+    file_sector(IMG, 1999, f);
+    assert(memcmp(f, w, sizeof(w)) == 0);
+
+    /* A large image is created sparse; its holes read as zeros. */
+    struct stat st;
+    assert(vm_disk_init(IMG, 512) == 0);
+    assert(stat(IMG, &st) == 0 && st.st_size == 512L * 1024 * 1024);
+    assert((long)st.st_blocks * 512 < 4L * 1024 * 1024);
+    assert(vm_disk_read_sector(vm_disk_sectors() - 1, r) == 0);
+    for (int i = 0; i < VM_DISK_SECTOR_SIZE; i++) assert(r[i] == 0);
+    fill(w, 2000, 5);     /* existing content is kept */
+    assert(vm_disk_read_sector(2000, r) == 0 && memcmp(r, w, sizeof(w)) == 0);
+    vm_disk_shutdown();
+
+    unlink(IMG);
+    unlink(SNAP);
+    printf("vm disk: OK\n");
+    return 0;
+}
@@ -0,0 +1,220 @@
+/* IDE emulation: sector count, READ/WRITE (MULTIPLE), word/dword data port
+ * and string I/O against an in-memory disk; the paravirtual block ring. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_decode.h"
+#include "VM/devices/vm_io.h"
+#include "VM/devices/vm_mem.h"
+
+#define DISK_SECTORS 64
+static uint8_t s_disk[DISK_SECTORS][512];
+static int s_reads, s_writes, s_flushes;
+
+/* The in-memory disk overrides the shared stubs' detached one. */
+int vm_disk_is_active(void) { return 1; }
+int vm_disk_read_sector(uint32_t lba, void *out512) {
+    if (lba >= DISK_SECTORS) return -1;
+    memcpy(out512, s_disk[lba], 512);
+    s_reads++;
+    return 0;
+}
+int vm_disk_write_sector(uint32_t lba, const void *in512) {
+    if (lba >= DISK_SECTORS) return -1;
+    memcpy(s_disk[lba], in512, 512);
+    s_writes++;
+    return 0;
+}
+int vm_disk_flush(void) { s_flushes++; return 0; }
+uint32_t vm_disk_sectors(void) { return DISK_SECTORS; }
+
+static void ide_setup(uint32_t lba, uint8_t count, uint8_t cmd) {
+    vm_io_out(NULL, 0x1f2, count, 1);
+    vm_io_out(NULL, 0x1f3, lba & 0xFF, 1);
+    vm_io_out(NULL, 0x1f4, (lba >> 8) & 0xFF, 1);
+    vm_io_out(NULL, 0x1f5, (lba >> 16) & 0xFF, 1);
+    vm_io_out(NULL, 0x1f6, 0xE0 | ((lba >> 24) & 0x0F), 1);
+    vm_io_out(NULL, 0x1f7, cmd, 1);
+}
+
+static void test_decode(void) {
+    uint8_t code[16] = { 0xEC, 0x66, 0xED, 0xF3, 0x66, 0x6D, 0x66, 0xF3, 0x6F, 0xF3, 0x90 };
+    vm_instr_t in;
+    assert(vm_decode(code, 0, sizeof(code), &in) == 0);
+    assert(in.op == VM_OP_IN_DX && in.mem_size == 1 && in.size == 1);
+    assert(vm_decode(code, 1, sizeof(code), &in) == 0);
+    assert(in.op == VM_OP_IN_DX && in.mem_size == 2 && in.size == 2);
+    assert(vm_decode(code, 3, sizeof(code), &in) == 0);
+    assert(in.op == VM_OP_INS && in.mem_size == 2 && in.imm == 1 && in.size == 3);
+    assert(vm_decode(code, 6, sizeof(code), &in) == 0);
+    assert(in.op == VM_OP_OUTS && in.mem_size == 2 && in.imm == 1 && in.size == 3);
+    assert(vm_decode(code, 9, sizeof(code), &in) != 0);   /* REP NOP: unsupported */
+}
+
+static void test_multi_sector_words(void) {
+    for (int s = 0; s < DISK_SECTORS; s++)
+        for (int i = 0; i < 512; i++)
+            s_disk[s][i] = (uint8_t)(s * 3 + i);
+    ide_setup(4, 3, 0x20);
+    assert(vm_io_in(NULL, 0x1f7, 1) & 0x08);            /* DRQ */
+    for (int s = 4; s < 7; s++) {
+        for (int i = 0; i < 512; i += 2) {
+            uint32_t w = vm_io_in(NULL, 0x1f0, 2);
+            assert(w == (uint32_t)(s_disk[s][i] | (s_disk[s][i + 1] << 8)));
+        }
+    }
+    assert(!(vm_io_in(NULL, 0x1f7, 1) & 0x08));         /* command done */
+    assert(vm_io_in(NULL, 0x1f1, 1) == 0);
+}
+
+static void test_write_multiple_dwords(void) {
+    ide_setup(10, 2, 0xC5);
+    for (uint32_t i = 0; i < 256; i++)
+        vm_io_out(NULL, 0x1f0, 0xA5000000u | i, 4);
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t v;
+        memcpy(&v, &s_disk[10 + i / 128][(i % 128) * 4], 4);
+        assert(v == (0xA5000000u | i));
+    }
+    vm_io_out(NULL, 0x1f7, 0xE7, 1);
+    assert(s_flushes == 1);
+}
+
+static void test_string_io(void) {
+    vm_mem_t mem;
+    assert(vm_mem_init(&mem) == 0);
+    int reads = s_reads;
+    ide_setup(20, 8, 0xC4);
+    assert(vm_io_in_string(&mem, 0x1f0, 0x1000, 2, 8 * 256) == 8 * 256);
+    assert(s_reads - reads == 8);
+    for (int s = 0; s < 8; s++)
+        assert(memcmp(mem.ram + 0x1000 + s * 512, s_disk[20 + s], 512) == 0);
+    assert(vm_mem_page_dirty(&mem, 1) && !vm_mem_page_dirty(&mem, 2));   /* 4KB at 0x1000 */
+
+    for (int i = 0; i < 1024; i++) mem.ram[0x8000 + i] = (uint8_t)(0x5A ^ i);
+    ide_setup(40, 2, 0x30);
+    assert(vm_io_out_string(&mem, 0x1f0, 0x8000, 4, 256) == 256);
+    assert(memcmp(s_disk[40], mem.ram + 0x8000, 512) == 0);
+    assert(memcmp(s_disk[41], mem.ram + 0x8200, 512) == 0);
+    vm_mem_destroy(&mem);
+}
+
+static void test_set_multiple_and_abort(void) {
+    ide_setup(0, 3, 0xC6);                               /* not a power of two */
+    assert(vm_io_in(NULL, 0x1f7, 1) & 0x01);
+    assert(vm_io_in(NULL, 0x1f1, 1) == 0x04);
+    ide_setup(0, 0, 0xC6);                               /* disable multiple mode */
+    ide_setup(0, 1, 0xC4);
+    assert(vm_io_in(NULL, 0x1f7, 1) & 0x01);
+    ide_setup(0, 8, 0xC6);
+    assert(!(vm_io_in(NULL, 0x1f7, 1) & 0x01));
+}
+
+static uint32_t pci_read(uint32_t dev, uint32_t reg) {
+    vm_io_out(NULL, 0xCF8, 0x80000000u | (dev << 11) | reg, 4);
+    return vm_io_in(NULL, 0xCFC, 4);
+}
+
+static void pvb_desc(vm_mem_t *mem, uint32_t ring, uint32_t slot, uint8_t op, uint16_t count,
+                     uint32_t lba, uint32_t addr) {
+    uint8_t *d = mem->ram + ring + VM_PVB_RING_HDR + slot * VM_PVB_DESC_SIZE;
+    memset(d, 0, VM_PVB_DESC_SIZE);
+    d[0] = op;
+    d[1] = 0xFF;
+    memcpy(d + 2, &count, 2);
+    memcpy(d + 4, &lba, 4);
+    memcpy(d + 8, &addr, 4);
+}
+
+static uint8_t pvb_status(vm_mem_t *mem, uint32_t ring, uint32_t slot) {
+    return mem->ram[ring + VM_PVB_RING_HDR + slot * VM_PVB_DESC_SIZE + 1];
+}
+
+static void test_pvb(void) {
+    const uint32_t ring = 0x20000, base = VM_PVB_PORT_BASE;
+    vm_mem_t mem;
+    assert(vm_mem_init(&mem) == 0);
+    assert(pci_read(4, 0x00) == 0x44441234u);
+    assert(pci_read(4, 0x08) >> 8 == 0x018000u);
+    assert(pci_read(4, 0x10) == (VM_PVB_PORT_BASE | 1u));
+    assert((pci_read(4, 0x3C) & 0xFF) == VM_PVB_IRQ);
+    assert(vm_io_in(NULL, base + VM_PVB_REG_CAPACITY, 4) == DISK_SECTORS);
+
+    vm_io_out(&mem, base + VM_PVB_REG_RING_ADDR, ring, 4);
+    vm_io_out(&mem, base + VM_PVB_REG_RING_SIZE, 8, 4);
+    for (int i = 0; i < 1024; i++) mem.ram[0x40000 + i] = (uint8_t)(0xA5 ^ i);
+    pvb_desc(&mem, ring, 0, VM_PVB_OP_READ, 4, 8, 0x30000);
+    pvb_desc(&mem, ring, 1, VM_PVB_OP_WRITE, 2, 50, 0x40000);
+    pvb_desc(&mem, ring, 2, VM_PVB_OP_FLUSH, 0, 0, 0);
+    pvb_desc(&mem, ring, 3, VM_PVB_OP_READ, 2, DISK_SECTORS - 1, 0x30000);   /* past the disk */
+    pvb_desc(&mem, ring, 4, 9, 1, 0, 0x30000);
+    vm_mem_dirty_clear(&mem);
+    vm_io_port_stats_reset();
+    int reads = s_reads, writes = s_writes, flushes = s_flushes;
+
+    /* The whole batch runs off one doorbell write. */
+    vm_io_out(&mem, base + VM_PVB_REG_DOORBELL, 5, 4);
+    uint64_t exits_r, exits_w;
+    assert(vm_io_port_stats(base + VM_PVB_REG_DOORBELL, &exits_r, &exits_w) == 0 && exits_w == 1);
+    assert(s_reads - reads == 4 && s_writes - writes == 2 && s_flushes - flushes == 1);
+    for (int s = 0; s < 4; s++)
+        assert(memcmp(mem.ram + 0x30000 + s * 512, s_disk[8 + s], 512) == 0);
+    assert(vm_mem_page_dirty(&mem, 0x30) && !vm_mem_page_dirty(&mem, 0x40));
+    assert(memcmp(s_disk[50], mem.ram + 0x40000, 1024) == 0 && memcmp(s_disk[51], mem.ram + 0x40200, 512) == 0);
+    assert(pvb_status(&mem, ring, 0) == VM_PVB_ST_OK && pvb_status(&mem, ring, 1) == VM_PVB_ST_OK);
+    assert(pvb_status(&mem, ring, 2) == VM_PVB_ST_OK);
+    assert(pvb_status(&mem, ring, 3) == VM_PVB_ST_IOERR && pvb_status(&mem, ring, 4) == VM_PVB_ST_UNSUPP);
+    uint32_t used;
+    memcpy(&used, mem.ram + ring, 4);
+    assert(used == 5 && vm_io_in(NULL, base + VM_PVB_REG_USED, 4) == 5);
+    assert(vm_io_in(NULL, base + VM_PVB_REG_ISR, 4) == 1);
+    assert(vm_io_in(NULL, base + VM_PVB_REG_ISR, 4) == 0);      /* cleared by the read */
+
+    /* Indices are free-running and wrap around the ring. */
+    for (uint32_t i = 5; i < 11; i++)
+        pvb_desc(&mem, ring, i & 7, VM_PVB_OP_READ, 1, i, 0x50000 + i * 512);
+    vm_io_out(&mem, base + VM_PVB_REG_DOORBELL, 11, 4);
+    for (uint32_t i = 5; i < 11; i++) {
+        assert(pvb_status(&mem, ring, i & 7) == VM_PVB_ST_OK);
+        assert(memcmp(mem.ram + 0x50000 + i * 512, s_disk[i], 512) == 0);
+    }
+    assert(vm_io_in(NULL, base + VM_PVB_REG_USED, 4) == 11);
+
+    /* A bad ring size turns the ring off. */
+    vm_io_out(&mem, base + VM_PVB_REG_RING_SIZE, 6, 4);
+    assert(vm_io_in(NULL, base + VM_PVB_REG_RING_SIZE, 4) == 0);
+    reads = s_reads;
+    vm_io_out(&mem, base + VM_PVB_REG_DOORBELL, 1, 4);
+    assert(s_reads == reads && vm_io_in(NULL, base + VM_PVB_REG_USED, 4) == 0);
+
+    /* A READ into a buffer that starts on its own descriptor: the sectors
+     * that overwrite it do not change what the request does, and every
+     * page it filled is noted. */
+    memset(s_disk[20], 0xEE, 512);
+    vm_io_out(&mem, base + VM_PVB_REG_RING_SIZE, 8, 4);
+    pvb_desc(&mem, ring, 0, VM_PVB_OP_READ, 9, 20, ring + VM_PVB_RING_HDR);
+    vm_mem_dirty_clear(&mem);
+    reads = s_reads;
+    writes = s_writes;
+    vm_io_out(&mem, base + VM_PVB_REG_DOORBELL, 1, 4);
+    assert(s_reads - reads == 9 && s_writes == writes);
+    assert(vm_mem_page_dirty(&mem, (ring >> VM_PAGE_SHIFT) + 1));
+    for (int s = 1; s < 9; s++)
+        assert(memcmp(mem.ram + ring + VM_PVB_RING_HDR + s * 512, s_disk[20 + s], 512) == 0);
+    vm_mem_destroy(&mem);
+}
+
+int main(void) {
+    vm_io_init();
+    test_decode();
+    test_multi_sector_words();
+    test_write_multiple_dwords();
+    test_string_io();
+    test_set_multiple_and_abort();
+    test_pvb();
+    vm_io_shutdown();
+    printf("vm ide: OK\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+/* HLT idle wake path: vm_host_wait sleeps until its timeout unless a host
+ * event (keyboard push, vm_host_notify from another thread) arrives. */
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "VM/devices/vm_host.h"
+
+/* No disk attached in this test. */
+int vm_disk_is_active(void) { return 0; }
+int vm_disk_snapshot_save(const char *dest_path) { (void)dest_path; return -1; }
+int vm_disk_snapshot_restore(const char *src_path) { (void)src_path; return -1; }
+int vm_disk_snapshot_merge(const char *path) { (void)path; return -1; }
+int vm_disk_commit(void) { return -1; }
+uint64_t vm_disk_generation(void) { return 0; }
+size_t vm_io_regs_size(void) { return 0; }
+int vm_io_regs_save(void *buf, size_t len) { (void)buf; (void)len; return -1; }
+int vm_io_regs_load(const void *buf, size_t len) { (void)buf; (void)len; return -1; }
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *notifier(void *arg) {
+    struct timespec d = { 0, 20 * 1000000L };
+    nanosleep(&d, NULL);
+    vm_host_kbd_push((vm_host_t *)arg, 0x1C);
+    return NULL;
+}
+
+int main(void) {
+    vm_host_t host;
+    assert(vm_host_create(&host) == 0);
+
+    /* No event: times out after roughly the requested sleep. */
+    uint64_t seen = vm_host_events(&host);
+    uint64_t t0 = now_ns();
+    assert(vm_host_wait(&host, seen, 30 * 1000000ULL) == 0);
+    assert(now_ns() - t0 >= 25 * 1000000ULL);
+
+    /* An event raised before the wait is not lost. */
+    vm_host_notify(&host);
+    assert(vm_host_wait(&host, seen, 5 * 1000000000ULL) == 1);
+
+    /* Keyboard input from another thread wakes a long sleep early. */
+    seen = vm_host_events(&host);
+    assert(!vm_host_kbd_pending(&host));
+    pthread_t th;
+    assert(pthread_create(&th, NULL, notifier, &host) == 0);
+    t0 = now_ns();
+    assert(vm_host_wait(&host, seen, 5 * 1000000000ULL) == 1);
+    assert(now_ns() - t0 < 2 * 1000000000ULL);
+    pthread_join(th, NULL);
+    assert(vm_host_kbd_pending(&host));
+    uint8_t sc = 0;
+    assert(vm_host_kbd_pop(&host, &sc) == 0 && sc == 0x1C);
+    assert(!vm_host_kbd_pending(&host));
+
+    vm_host_destroy(&host);
+    printf("vm idle: OK\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+/* Port dispatch table: registration, overlap rejection, unclaimed ports
+ * and per-port access counters. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "VM/devices/vm_io.h"
+
+typedef struct {
+    uint32_t last_port;
+    uint32_t last_value;
+    int writes;
+} scratch_dev_t;
+
+static uint32_t scratch_read(void *ctx, struct vm_mem *mem, uint32_t port, int size) {
+    (void)mem; (void)size;
+    scratch_dev_t *d = ctx;
+    return d->last_value + (port - 0x300);
+}
+
+static void scratch_write(void *ctx, struct vm_mem *mem, uint32_t port, uint32_t value, int size) {
+    (void)mem; (void)size;
+    scratch_dev_t *d = ctx;
+    d->last_port = port;
+    d->last_value = value;
+    d->writes++;
+}
+
+int main(void) {
+    scratch_dev_t dev = { 0, 0, 0 };
+    uint64_t r, w;
+    vm_io_init();
+
+    assert(vm_io_register(0x300, 4, scratch_read, scratch_write, &dev) == 0);
+    assert(vm_io_register(0x302, 4, scratch_read, scratch_write, &dev) != 0);   /* overlap */
+    assert(vm_io_register(0x1f7, 1, scratch_read, NULL, NULL) != 0);            /* built-in IDE */
+    assert(vm_io_register(0xFFFF, 2, scratch_read, NULL, NULL) != 0);           /* past port space */
+
+    vm_io_out(NULL, 0x301, 0xAABBCCDD, 4);
+    assert(dev.writes == 1 && dev.last_port == 0x301);
+    assert(vm_io_in(NULL, 0x303, 4) == 0xAABBCCE0);
+    assert(vm_io_in(NULL, 0x303, 1) == 0xE0);
+
+    /* Unclaimed ports: 0xFF on read, writes dropped, still counted. */
+    assert(vm_io_in(NULL, 0x500, 1) == 0xFF);
+    vm_io_out(NULL, 0x500, 1, 1);
+    assert(vm_io_port_stats(0x500, &r, &w) == 0 && r == 1 && w == 1);
+
+    /* Built-in devices are reached through the same table. */
+    assert(vm_io_in(NULL, 0x40, 1) == 0);        /* no host bound: no tick source */
+    assert(vm_io_in(NULL, 0x1f7, 1) == 0x40);
+    assert(vm_io_in(NULL, 0x21, 1) == 0xFF);
+    vm_io_out(NULL, 0x43, 0x36, 1);
+    assert(vm_io_in(NULL, 0x43, 1) == 0x36);
+
+    assert(vm_io_port_stats(0x301, &r, &w) == 0 && r == 0 && w == 1);
+    assert(vm_io_port_stats(0x303, &r, &w) == 0 && r == 2 && w == 0);
+    vm_io_port_stats_reset();
+    assert(vm_io_port_stats(0x303, &r, &w) == 0 && r == 0 && w == 0);
+
+    vm_io_shutdown();
+    assert(vm_io_port_stats(0x303, &r, &w) != 0);
+    printf("vm io: OK\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+/* 8259 pair and IRQ injection: priority, cascade and EOI in the PIC model;
+ * the executor stops for INTR only with IF set, an injected vector enters
+ * its IVT handler and IRET resumes the interrupted code. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_bcache.h"
+#include "VM/devices/vm_cpu.h"
+#include "VM/devices/vm_exec.h"
+#include "VM/devices/vm_io.h"
+#include "VM/devices/vm_mem.h"
+#include "VM/devices/vm_pic.h"
+
+static vm_mem_t mem;
+static vm_bcache_t bc;
+
+/* ICW1..ICW4 for both chips (vectors 0x20/0x28), then unmask everything. */
+static void pic_program(vm_pic_t *pic) {
+    vm_pic_write(pic, VM_PIC_MASTER, 0, 0x11);
+    vm_pic_write(pic, VM_PIC_MASTER, 1, 0x20);
+    vm_pic_write(pic, VM_PIC_MASTER, 1, 0x04);
+    vm_pic_write(pic, VM_PIC_MASTER, 1, 0x01);
+    vm_pic_write(pic, VM_PIC_SLAVE, 0, 0x11);
+    vm_pic_write(pic, VM_PIC_SLAVE, 1, 0x28);
+    vm_pic_write(pic, VM_PIC_SLAVE, 1, 0x02);
+    vm_pic_write(pic, VM_PIC_SLAVE, 1, 0x01);
+}
+
+static void test_pic_model(void) {
+    vm_pic_t pic;
+    vm_pic_init(&pic);
+    assert(vm_pic_read(&pic, VM_PIC_MASTER, 1) == 0xFF);
+    vm_pic_raise(&pic, 0);
+    assert(!vm_pic_intr(&pic));          /* masked after reset */
+
+    pic_program(&pic);
+    assert(vm_pic_read(&pic, VM_PIC_MASTER, 1) == 0x00);
+    assert(!vm_pic_intr(&pic));          /* ICW1 dropped the stale request */
+
+    /* Fixed priority; a lower line waits while a higher one is in service. */
+    vm_pic_raise(&pic, 3);
+    vm_pic_raise(&pic, 1);
+    assert(vm_pic_intr(&pic));
+    assert(vm_pic_ack(&pic) == 0x21);
+    assert(!vm_pic_intr(&pic));
+    vm_pic_raise(&pic, 0);
+    assert(vm_pic_ack(&pic) == 0x20);    /* higher priority nests */
+    vm_pic_write(&pic, VM_PIC_MASTER, 0, 0x20);   /* EOI IRQ0 */
+    assert(!vm_pic_intr(&pic));
+    vm_pic_write(&pic, VM_PIC_MASTER, 0, 0x20);   /* EOI IRQ1 */
+    assert(vm_pic_ack(&pic) == 0x23);
+    vm_pic_write(&pic, VM_PIC_MASTER, 0, 0x63);   /* specific EOI IRQ3 */
+    assert(vm_pic_read(&pic, VM_PIC_MASTER, 0) == 0);
+
+    /* Slave lines arrive through master IR2. */
+    vm_pic_raise(&pic, 12);
+    assert(vm_pic_read(&pic, VM_PIC_SLAVE, 0) == 0x10);   /* IRR */
+    assert(vm_pic_ack(&pic) == 0x2C);
+    vm_pic_write(&pic, VM_PIC_SLAVE, 0, 0x0B);            /* OCW3: read ISR */
+    vm_pic_write(&pic, VM_PIC_MASTER, 0, 0x0B);
+    assert(vm_pic_read(&pic, VM_PIC_SLAVE, 0) == 0x10);
+    assert(vm_pic_read(&pic, VM_PIC_MASTER, 0) == 0x04);
+    vm_pic_raise(&pic, 14);
+    assert(!vm_pic_intr(&pic));          /* cascade still in service */
+    vm_pic_write(&pic, VM_PIC_SLAVE, 0, 0x20);
+    vm_pic_write(&pic, VM_PIC_MASTER, 0, 0x20);
+    assert(vm_pic_ack(&pic) == 0x2E);
+
+    /* OCW1 masks a line without losing its request. */
+    vm_pic_init(&pic);
+    pic_program(&pic);
+    vm_pic_write(&pic, VM_PIC_MASTER, 1, 0x01);
+    vm_pic_raise(&pic, 0);
+    assert(!vm_pic_intr(&pic));
+    vm_pic_write(&pic, VM_PIC_MASTER, 1, 0x00);
+    assert(vm_pic_ack(&pic) == 0x20);
+    assert(pic.acks == 1);
+}
+
+static void set_vector(uint8_t vec, uint16_t seg, uint16_t off) {
+    vm_mem_write(&mem, (uint32_t)vec * 4, &off, 2);
+    vm_mem_write(&mem, (uint32_t)vec * 4 + 2, &seg, 2);
+}
+
+static void test_injection(vm_dispatch_t mode) {
+    vm_cpu_t cpu;
+    vm_mem_zero(&mem);
+    vm_bcache_flush(&bc);
+    vm_io_init();
+    vm_io_out(&mem, 0x20, 0x11, 1);
+    vm_io_out(&mem, 0x21, 0x20, 1);
+    vm_io_out(&mem, 0x21, 0x04, 1);
+    vm_io_out(&mem, 0x21, 0x01, 1);
+    vm_io_out(&mem, 0x21, 0xFE, 1);      /* only IRQ0 */
+
+    /* IRQ0 handler at 0000:0600: INC EBX; MOV AL,0x20; OUT 0x20,AL; IRET */
+    static const uint8_t isr[] = { 0x43, 0xB0, 0x20, 0xE6, 0x20, 0xCF };
+    vm_mem_load(&mem, 0x0600, isr, sizeof(isr));
+    set_vector(0x20, 0x0000, 0x0600);
+    /* INT 0x30 handler: IRET */
+    static const uint8_t iret[] = { 0xCF };
+    vm_mem_load(&mem, 0x0700, iret, sizeof(iret));
+    set_vector(0x30, 0x0000, 0x0700);
+    /* 07C0:0000 INT 0x30; INC ECX; STI; spin: JMP spin */
+    static const uint8_t main_code[] = { 0xCD, 0x30, 0x41, 0xFB, 0xEB, 0xFE };
+    vm_mem_load(&mem, 0x7c00, main_code, sizeof(main_code));
+
+    vm_cpu_init(&cpu);
+    cpu.esp = 0x7000;
+    assert(vm_exec_run(&cpu, &mem, &bc, 4, mode) == 4);
+    assert(cpu.ecx == 1 && cpu.esp == 0x7000);   /* INT/IRET round trip */
+    assert(cpu.eip == 4 && (cpu.eflags & VM_FLAG_IF));
+
+    /* No request: the spin runs its full budget. */
+    assert(vm_exec_run(&cpu, &mem, &bc, 50, mode) == 50);
+    assert(cpu.eip == 4);
+
+    /* A masked line does not interrupt; IRQ0 stops the run at once. */
+    vm_io_raise_irq(1);
+    assert(!vm_io_intr());
+    vm_io_raise_irq(0);
+    assert(vm_io_intr());
+    assert(vm_exec_run(&cpu, &mem, &bc, 50, mode) == 0);
+    int vec = vm_io_inta();
+    assert(vec == 0x20);
+    assert(vm_exec_interrupt(&cpu, &mem, (uint8_t)vec) == 0);
+    assert(cpu.cs == 0 && cpu.eip == 0x0600 && !(cpu.eflags & VM_FLAG_IF));
+    assert(cpu.esp == 0x7000 - 6);
+
+    /* Handler runs with IF clear, EOIs and returns to the spin. */
+    vm_io_raise_irq(0);
+    assert(vm_exec_run(&cpu, &mem, &bc, 4, mode) == 4);
+    assert(cpu.ebx == 1);
+    assert(cpu.cs == 0x07c0 && cpu.eip == 4 && cpu.esp == 0x7000);
+    assert(cpu.eflags & VM_FLAG_IF);
+    assert(vm_io_intr());                /* the request raised meanwhile */
+    assert(vm_exec_run(&cpu, &mem, &bc, 50, mode) == 0);
+
+    /* CLI holds the request off. */
+    cpu.eflags &= ~VM_FLAG_IF;
+    assert(vm_exec_run(&cpu, &mem, &bc, 10, mode) == 10);
+
+    /* A halted CPU is woken by delivery. */
+    cpu.halted = 1;
+    assert(vm_exec_interrupt(&cpu, &mem, (uint8_t)vm_io_inta()) == 0);
+    assert(!cpu.halted && cpu.eip == 0x0600);
+
+    /* Vectors past the IDT limit are refused with nothing pushed. */
+    uint32_t sp = cpu.esp;
+    cpu.idt_limit = 0x7F;
+    assert(vm_exec_interrupt(&cpu, &mem, 0x20) == -1);
+    assert(cpu.esp == sp);
+    vm_io_shutdown();
+}
+
+int main(void) {
+    test_pic_model();
+    assert(vm_mem_init(&mem) == 0);
+    assert(vm_bcache_init(&bc, &mem) == 0);
+    vm_exec_bind(&bc);
+    test_injection(VM_DISPATCH_SWITCH);
+    test_injection(VM_DISPATCH_THREADED);
+    vm_bcache_destroy(&bc);
+    vm_mem_destroy(&mem);
+    puts("vm pic: OK");
+    return 0;
+}
@@ -0,0 +1,51 @@
+/* SDL frontend, headless: with the dummy video driver the window falls back
+ * to the software renderer; unchanged frames upload nothing and a one-cell
+ * change uploads once and redraws a single row. Needs libSDL2. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+
+#include "VM/devices/vm_host.h"
+#include "VM/devices/vm_mem.h"
+#include "VM/devices/vm_sdl.h"
+#include "VM/devices/vm_textfb.h"
+
+/* Monitor hooks referenced by vm_sdl_poll_events; not exercised here. */
+int vm_save_checkpoint(void) { return -1; }
+int vm_restore_checkpoint(void) { return -1; }
+int vm_snapshot_has_checkpoint(void) { return 0; }
+int vm_load_disk(const char *path) { (void)path; return -1; }
+int vm_save_snapshot_file(const char *path) { (void)path; return -1; }
+void vm_step_one(void) {}
+
+int main(void) {
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    assert(vm_sdl_init() == 0);
+    assert(vm_sdl_create_window(1) == 0);
+    assert(vm_sdl_is_active());
+
+    vm_host_t host;
+    assert(vm_host_create(&host) == 0);
+    vm_mem_t *mem = vm_host_mem(&host);
+    uint64_t uploads, rows;
+
+    vm_sdl_present(&host);
+    vm_sdl_frame_stats(&uploads, &rows);
+    assert(uploads == 1 && rows == VM_TEXTFB_ROWS);
+
+    vm_sdl_present(&host);
+    vm_sdl_frame_stats(&uploads, &rows);
+    assert(uploads == 1 && rows == VM_TEXTFB_ROWS);
+
+    vm_mem_write8(mem, GUEST_VGA_BASE + (12 * VM_TEXTFB_COLS + 40) * 2, 'Z');
+    vm_sdl_present(&host);
+    vm_sdl_frame_stats(&uploads, &rows);
+    assert(uploads == 2 && rows == VM_TEXTFB_ROWS + 1);
+
+    vm_host_destroy(&host);
+    vm_sdl_shutdown();
+    printf("vm sdl: OK\n");
+    return 0;
+}
@@ -0,0 +1,266 @@
+/* Snapshot files: the codec round-trips, a guest saved mid-run resumes in a
+ * fresh context exactly where it left off (RAM, disk, devices), mostly-zero
+ * state stays small on disk, and damaged or mismatched files (even ones
+ * with valid CRCs) are refused without touching the guest. */
+#ifdef VM_ENABLE
+
+#include "vm.h"
+#include "vm_disk.h"
+#include "vm_host.h"
+#include "vm_lz.h"
+#include "vm_mem.h"
+#include "vm_snapfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAP_PATH "vm_snapfile_test.vmsf"
+#define DISK_A    "vm_snapfile_a.img"
+#define DISK_B    "vm_snapfile_b.img"
+
+static int fail(const char *what) {
+    fprintf(stderr, "vm snapfile: %s\n", what);
+    return 1;
+}
+
+static uint32_t s_rng = 12345;
+static uint8_t rnd8(void) {
+    s_rng = s_rng * 1103515245u + 12345u;
+    return (uint8_t)(s_rng >> 16);
+}
+
+static int lz_roundtrip(const uint8_t *src, size_t n, size_t *clen_out) {
+    size_t cap = vm_lz_bound(n);
+    uint8_t *comp = malloc(cap + 1), *back = malloc(n + 1);
+    if (!comp || !back) return -1;
+    size_t clen = vm_lz_compress(src, n, comp, cap);
+    int ok = clen > 0 && vm_lz_decompress(comp, clen, back, n) == 0 && memcmp(src, back, n) == 0;
+    /* Any truncation must be rejected, never overrun. */
+    if (ok && clen > 1 && vm_lz_decompress(comp, clen - 1, back, n) == 0) ok = 0;
+    if (ok && n > 0 && vm_lz_decompress(comp, clen, back, n - 1) == 0) ok = 0;
+    if (clen_out) *clen_out = clen;
+    free(comp);
+    free(back);
+    return ok ? 0 : -1;
+}
+
+static int test_lz(void) {
+    static uint8_t buf[VM_SNAPFILE_CHUNK];
+    size_t clen;
+    for (size_t n = 0; n < 40; n++) {
+        for (size_t i = 0; i < n; i++) buf[i] = (uint8_t)(i % 3);
+        if (lz_roundtrip(buf, n, NULL) != 0) return fail("lz short input");
+    }
+    memset(buf, 0, sizeof(buf));
+    if (lz_roundtrip(buf, sizeof(buf), &clen) != 0 || clen > 512) return fail("lz zeros");
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)"mov eax, [ebx+4]\n"[i % 17] ^ (uint8_t)((i >> 11) & 1);
+    if (lz_roundtrip(buf, sizeof(buf), &clen) != 0 || clen > sizeof(buf) / 8) return fail("lz text");
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = rnd8();
+    if (lz_roundtrip(buf, sizeof(buf), &clen) != 0) return fail("lz random");
+    if (vm_lz_compress(buf, sizeof(buf), buf, 16) != 0) return fail("lz cap");
+    /* Match reaching before the start of the output. */
+    const uint8_t bad[] = { 0x14, 'a', 0x05, 0x00 };
+    uint8_t out[16];
+    if (vm_lz_decompress(bad, sizeof(bad), out, 9) == 0) return fail("lz bad offset");
+    return 0;
+}
+
+/* mov esp,0x9000 ; mov ecx,20000 ; L: push ecx ; pop eax ; sub ecx,1 ;
+ * jnz L ; mov al,'d' ; out 0xF8,al ; cli ; hlt */
+static const uint8_t s_guest[] = {
+    0xBC, 0x00, 0x90, 0, 0, 0xB9, 0x20, 0x4E, 0, 0,
+    0x51, 0x58, 0x83, 0xE9, 0x01, 0x75, 0xF9, 0xB0, 'd', 0xE6, 0xF8, 0xFA, 0xF4
+};
+
+static long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static int corrupt_at(const char *path, long off) {
+    FILE *f = fopen(path, "r+b");
+    if (!f) return -1;
+    fseek(f, off, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, off, SEEK_SET);
+    fputc(c ^ 0x40, f);
+    fclose(f);
+    return 0;
+}
+
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/* The file header is little-endian whatever the host: magic, version,
+ * page size, RAM size, disk sectors, then a CRC over the header with the
+ * CRC field zero. */
+static int check_header(const char *path, uint64_t ram_size) {
+    uint8_t h[32];
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    int ok = fread(h, 1, sizeof(h), f) == sizeof(h);
+    fclose(f);
+    if (!ok || memcmp(h, "VMSNAPF", 8) != 0) return -1;
+    if (get_le(h + 8, 4) != 1 || get_le(h + 12, 4) != 4096 || get_le(h + 16, 8) != ram_size) return -1;
+    uint32_t crc = (uint32_t)get_le(h + 28, 4);
+    put_le(h + 28, 0, 4);
+    return crc32_bytes(0, h, sizeof(h)) == crc ? 0 : -1;
+}
+
+/* Rewrite the payload of the first section of `type` (with flag bits
+ * `flags` set) at payload offset `at`, then fix up its CRC so only the
+ * content is wrong. Header 32 bytes; sections: type, flags, base, raw_len,
+ * stored_len, crc, reserved, all little-endian. */
+static int forge_section(const char *path, uint32_t type, uint32_t flags, size_t at, uint8_t value) {
+    FILE *f = fopen(path, "r+b");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    uint8_t *data = malloc((size_t)size);
+    fseek(f, 0, SEEK_SET);
+    int err = (!data || fread(data, 1, (size_t)size, f) != (size_t)size) ? -1 : 1;
+    size_t off = 32;
+    while (err == 1 && off + 40 <= (size_t)size) {
+        uint32_t t = (uint32_t)get_le(data + off, 4), fl = (uint32_t)get_le(data + off + 4, 4);
+        uint64_t stored = get_le(data + off + 24, 8);
+        if (t == type && (fl & flags) == flags && at < stored) {
+            data[off + 40 + at] = value;
+            put_le(data + off + 32, 0, 4);
+            put_le(data + off + 32, crc32_bytes(0, data + off, 40 + (size_t)stored), 4);
+            fseek(f, 0, SEEK_SET);
+            err = fwrite(data, 1, (size_t)size, f) == (size_t)size ? 0 : -1;
+        }
+        off += 40 + (size_t)stored;
+    }
+    free(data);
+    fclose(f);
+    return err;
+}
+
+static int test_resume(void) {
+    FILE *serial = tmpfile();
+    vm_ctx_config_t cfg = { .disk_path = DISK_A, .disk_size_mb = 1, .ram_size_mb = 4, .serial = serial };
+    vm_ctx_t *a = vm_ctx_create(&cfg);
+    if (!a || !serial) return fail("create");
+    vm_mem_t *mem = vm_host_mem(vm_ctx_host(a));
+
+    if (vm_ctx_load(a, s_guest, sizeof(s_guest)) != 0) return fail("load guest");
+    /* Some incompressible and some repetitive RAM, and a disk sector. */
+    for (uint32_t i = 0; i < 2 * VM_PAGE_SIZE; i++) {
+        uint8_t v = rnd8();
+        vm_mem_write(mem, 0x200000 + i, &v, 1);
+    }
+    for (uint32_t i = 0; i < 16 * VM_PAGE_SIZE; i += 4)
+        vm_mem_write32(mem, 0x300000 + i, i / 64);
+    uint8_t sector[VM_DISK_SECTOR_SIZE], back[VM_DISK_SECTOR_SIZE];
+    for (size_t i = 0; i < sizeof(sector); i++) sector[i] = (uint8_t)(i * 7);
+    if (vm_disk_write_sector(100, sector) != 0) return fail("disk write");
+
+    vm_ctx_run_cycles(a, 200);
+    if (vm_host_cpu(vm_ctx_host(a))->halted) return fail("guest finished too early");
+    if (vm_ctx_save_snapshot_file(a, SNAP_PATH) != 0) return fail("save");
+    long size = file_size(SNAP_PATH);
+    if (size <= 0 || size > 64 * 1024) return fail("file not compact");
+    if (check_header(SNAP_PATH, mem->size) != 0) return fail("header encoding");
+    uint8_t *ram_at_save = malloc(mem->size);
+    if (!ram_at_save) return fail("alloc");
+    memcpy(ram_at_save, mem->ram, mem->size);
+
+    vm_ctx_run(a);
+    uint32_t expect = vm_ctx_state_checksum(a);
+    long out_a = ftell(serial);
+
+    /* A fresh context with its own (different) disk resumes mid-loop. */
+    FILE *serial_b = tmpfile();
+    cfg.disk_path = DISK_B;
+    cfg.serial = serial_b;
+    vm_ctx_t *b = vm_ctx_create(&cfg);
+    if (!b || !serial_b) return fail("create b");
+    vm_mem_t *mem_b = vm_host_mem(vm_ctx_host(b));
+    memset(back, 0xEE, sizeof(back));
+    vm_disk_write_sector(100, back);
+    if (vm_ctx_load_snapshot_file(b, SNAP_PATH) != 0) return fail("load");
+    if (memcmp(mem_b->ram, ram_at_save, mem_b->size) != 0) return fail("RAM differs after load");
+    if (vm_disk_read_sector(100, back) != 0 || memcmp(back, sector, sizeof(back)) != 0)
+        return fail("disk differs after load");
+    vm_ctx_run(b);
+    if (vm_ctx_state_checksum(b) != expect) return fail("resumed run diverged");
+    if (ftell(serial_b) != 1 || out_a != 1) return fail("serial output");
+
+    /* Damaged files are refused and leave the guest as it was. */
+    long body = size / 2;
+    if (corrupt_at(SNAP_PATH, body) != 0) return fail("corrupt");
+    if (vm_ctx_load_snapshot_file(b, SNAP_PATH) == 0) return fail("corrupt file accepted");
+    if (vm_ctx_state_checksum(b) != expect) return fail("rejected load touched the guest");
+    corrupt_at(SNAP_PATH, body);
+    if (truncate(SNAP_PATH, size - 1) != 0) return fail("truncate");
+    if (vm_ctx_load_snapshot_file(b, SNAP_PATH) == 0) return fail("truncated file accepted");
+
+    /* A CRC-valid file whose LZ stream or register values are bad is
+     * refused before any section is applied. */
+    vm_ctx_save_snapshot_file(b, SNAP_PATH);
+    vm_mem_write32(mem_b, 0x200000, 0xC0FFEE);
+    vm_host_cpu(vm_ctx_host(b))->eax = 0x1234;
+    if (forge_section(SNAP_PATH, 4 /* RAM */, 1 /* LZ */, 0, 0x00) != 0) return fail("forge lz");
+    if (vm_ctx_load_snapshot_file(b, SNAP_PATH) == 0) return fail("bad LZ stream accepted");
+    if (vm_mem_read32(mem_b, 0x200000) != 0xC0FFEE || vm_host_cpu(vm_ctx_host(b))->eax != 0x1234)
+        return fail("bad LZ stream half-applied");
+    vm_ctx_save_snapshot_file(b, SNAP_PATH);
+    if (forge_section(SNAP_PATH, 3 /* DEV */, 0, 1, 0xFF) != 0) return fail("forge dev");   /* UART FIFO length */
+    if (vm_ctx_load_snapshot_file(b, SNAP_PATH) == 0) return fail("bad device registers accepted");
+    if (vm_mem_read32(mem_b, 0x200000) != 0xC0FFEE || vm_host_cpu(vm_ctx_host(b))->eax != 0x1234)
+        return fail("bad device registers half-applied");
+
+    /* Other RAM size: refused. */
+    vm_ctx_save_snapshot_file(b, SNAP_PATH);
+    vm_ctx_config_t small = { .ram_size_mb = 2 };
+    vm_ctx_t *c = vm_ctx_create(&small);
+    if (!c) return fail("create c");
+    if (vm_ctx_load_snapshot_file(c, SNAP_PATH) == 0) return fail("RAM size mismatch accepted");
+    vm_ctx_destroy(c);
+
+    free(ram_at_save);
+    vm_ctx_destroy(b);
+    vm_ctx_destroy(a);
+    fclose(serial_b);
+    fclose(serial);
+    unlink(SNAP_PATH);
+    unlink(DISK_A);
+    unlink(DISK_B);
+    return 0;
+}
+
+int main(void) {
+    if (test_lz() != 0) return 1;
+    if (test_resume() != 0) return 1;
+    printf("vm snapfile: OK\n");
+    return 0;
+}
+
+#else
+
+int main(void) { return 0; }
+
+#endif
@@ -0,0 +1,193 @@
+/* Incremental checkpoints: only dirty pages move, restore is exact. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "VM/devices/vm_host.h"
+#include "VM/devices/vm_mem.h"
+#include "VM/devices/vm_snapshot.h"
+
+/* A stand-in disk whose content never changes; checkpoints always open. */
+static int s_disk_active;
+int vm_disk_is_active(void) { return s_disk_active; }
+int vm_disk_snapshot_save(const char *dest_path) { (void)dest_path; return 0; }
+int vm_disk_snapshot_restore(const char *src_path) { (void)src_path; return 0; }
+int vm_disk_snapshot_merge(const char *path) { (void)path; return -1; }
+int vm_disk_commit(void) { return -1; }
+uint64_t vm_disk_generation(void) { return 0; }
+/* No device registers either. */
+size_t vm_io_regs_size(void) { return 0; }
+int vm_io_regs_save(void *buf, size_t len) { (void)buf; (void)len; return -1; }
+int vm_io_regs_load(const void *buf, size_t len) { (void)buf; (void)len; return -1; }
+
+static size_t resident_bytes(void) {
+    unsigned long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return (size_t)resident * 4096;
+}
+
+static uint32_t ram_hash(const vm_mem_t *mem) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < mem->size; i += 8) {
+        uint64_t v;
+        memcpy(&v, mem->ram + i, 8);
+        h = (h ^ (uint32_t)v ^ (uint32_t)(v >> 32)) * 16777619u;
+    }
+    return h;
+}
+
+static void scribble(vm_mem_t *mem, uint32_t seed) {
+    for (uint32_t i = 0; i < 64; i++) {
+        uint32_t addr = (seed * 7919u + i * 104729u) % (uint32_t)(mem->size - 4);
+        uint32_t v = seed ^ (i * 2654435761u);
+        vm_mem_write(mem, addr, &v, 4);
+    }
+}
+
+int main(void) {
+    vm_host_t host;
+    assert(vm_host_create(&host) == 0);
+    vm_mem_t *mem = vm_host_mem(&host);
+    uint8_t *expect = malloc(mem->size);
+    assert(expect);
+
+    scribble(mem, 1);
+    assert(vm_snapshot_save(&host) == 0);          /* pages written since boot */
+    for (size_t p = 0; p < vm_mem_page_count(mem); p++)
+        assert(!vm_mem_page_dirty(mem, (uint32_t)p));
+
+    scribble(mem, 2);
+    host.cpu.eax = 0x1234;
+    assert(vm_snapshot_save(&host) == 0);          /* dirty pages only */
+    memcpy(expect, mem->ram, mem->size);
+
+    scribble(mem, 3);
+    vm_mem_write8(mem, 0, 0x5A);
+    host.cpu.eax = 0xDEAD;
+    assert(vm_mem_page_dirty(mem, 0));
+    assert(vm_snapshot_restore(&host) == 0);
+    assert(memcmp(expect, mem->ram, mem->size) == 0);
+    assert(host.cpu.eax == 0x1234);
+    assert(!vm_mem_page_dirty(mem, 0));
+
+    /* Restoring twice is idempotent; saving right after restore is cheap. */
+    assert(vm_snapshot_restore(&host) == 0);
+    assert(memcmp(expect, mem->ram, mem->size) == 0);
+    scribble(mem, 4);
+    assert(vm_snapshot_restore(&host) == 0);
+    assert(memcmp(expect, mem->ram, mem->size) == 0);
+
+    /* Baseline reset sees writes made across checkpoints in between. */
+    scribble(mem, 7);
+    host.cpu.eax = 0xB00;
+    assert(vm_snapshot_baseline_capture(&host) == 0);
+    memcpy(expect, mem->ram, mem->size);
+    scribble(mem, 8);
+    assert(vm_snapshot_save(&host) == 0);
+    scribble(mem, 9);
+    host.cpu.eax = 0x99;
+    assert(vm_snapshot_restore(&host) == 0);
+    assert(vm_snapshot_baseline_reset(&host) == 0);
+    assert(memcmp(expect, mem->ram, mem->size) == 0);
+    assert(host.cpu.eax == 0xB00);
+    scribble(mem, 10);
+    assert(vm_snapshot_baseline_reset(&host) == 0);
+    assert(memcmp(expect, mem->ram, mem->size) == 0);
+
+    /* Generation ring: any kept generation comes back exactly, the ring
+     * stays bounded and restoring an older one drops the newer. */
+    uint32_t gen_hash[12];
+    vm_snapshot_discard();
+    assert(!vm_snapshot_has_checkpoint() && vm_snapshot_generations() == 0);
+    for (int g = 0; g < 12; g++) {
+        scribble(mem, 20 + (uint32_t)g);
+        host.cpu.eax = (uint32_t)g;
+        host.vm_clock = 1000u * (uint32_t)g;
+        assert(vm_snapshot_save(&host) == 0);
+        gen_hash[g] = ram_hash(mem);
+    }
+    assert(vm_snapshot_generations() == VM_SNAPSHOT_GENERATIONS);
+    assert(vm_snapshot_find_generation(11000) == 0 && vm_snapshot_find_generation(10999) == 1);
+    assert(vm_snapshot_find_generation(3999) == -1);
+    scribble(mem, 40);
+    assert(vm_snapshot_restore_generation(&host, VM_SNAPSHOT_GENERATIONS) != 0);
+    assert(vm_snapshot_restore_generation(&host, 3) == 0);
+    assert(ram_hash(mem) == gen_hash[8] && host.cpu.eax == 8 && host.vm_clock == 8000);
+    assert(vm_snapshot_generations() == VM_SNAPSHOT_GENERATIONS - 3);
+    scribble(mem, 41);
+    assert(vm_snapshot_save(&host) == 0);
+    assert(vm_snapshot_restore_generation(&host, 4) == 0);
+    assert(ram_hash(mem) == gen_hash[5] && host.cpu.eax == 5);
+    scribble(mem, 42);
+    assert(vm_snapshot_restore_generation(&host, 1) == 0);
+    assert(ram_hash(mem) == gen_hash[4] && vm_snapshot_generations() == 1);
+    assert(vm_snapshot_restore(&host) == 0 && ram_hash(mem) == gen_hash[4]);
+
+    /* A disk attached after a generation: going back past the first disk
+     * checkpoint would leave its overlay live, so it is refused. */
+    s_disk_active = 1;
+    assert(vm_snapshot_save(&host) == 0);
+    assert(vm_snapshot_generations() == 2);
+    assert(vm_snapshot_restore_generation(&host, 1) != 0 && vm_snapshot_generations() == 2);
+    assert(vm_snapshot_restore(&host) == 0 && ram_hash(mem) == gen_hash[4]);
+    s_disk_active = 0;
+
+    vm_snapshot_shutdown();
+    assert(!vm_snapshot_has_baseline() && vm_snapshot_baseline_reset(&host) != 0);
+    vm_host_destroy(&host);
+    free(expect);
+
+    /* Large guest RAM costs host memory only for the pages it touches,
+     * in RAM and in the checkpoint slot alike. */
+    size_t rss0 = resident_bytes();
+    assert(vm_host_create_sized(&host, (size_t)1024 * 1024 * 1024, 0) == 0);
+    mem = vm_host_mem(&host);
+    assert(mem->size == (size_t)1024 * 1024 * 1024);
+    assert(mem->ram[mem->size - 1] == 0 && mem->ram[mem->size / 2] == 0);
+    scribble(mem, 5);
+    uint32_t probe = 0;
+    vm_mem_read(mem, (5 * 7919u) % (uint32_t)(mem->size - 4), &probe, 4);
+    assert(vm_snapshot_save(&host) == 0);
+    scribble(mem, 6);
+    assert(vm_snapshot_restore(&host) == 0);
+    uint32_t again = 0;
+    vm_mem_read(mem, (5 * 7919u) % (uint32_t)(mem->size - 4), &again, 4);
+    assert(again == probe);
+    assert(resident_bytes() - rss0 < (size_t)64 * 1024 * 1024);
+
+    /* Reset drops the pages: RAM reads as zero again. */
+    vm_mem_zero(mem);
+    assert(mem->ram[GUEST_VGA_BASE] == 0 && mem->dirty_from_zero);
+    /* ...and so does the slot: the next checkpoint and baseline copy only
+     * the pages touched since, and restore still brings them back. */
+    assert(!vm_mem_page_dirty(mem, 0) && !vm_mem_page_dirty(mem, GUEST_VGA_BASE >> VM_PAGE_SHIFT));
+    size_t rss1 = resident_bytes();
+    scribble(mem, 7);
+    uint32_t zeroed_hash = ram_hash(mem);
+    assert(vm_snapshot_save(&host) == 0);
+    assert(vm_snapshot_baseline_capture(&host) == 0);
+    scribble(mem, 8);
+    assert(vm_snapshot_restore(&host) == 0 && ram_hash(mem) == zeroed_hash);
+    scribble(mem, 9);
+    assert(vm_snapshot_baseline_reset(&host) == 0 && ram_hash(mem) == zeroed_hash);
+    assert(resident_bytes() - rss1 < (size_t)8 * 1024 * 1024);
+    vm_mem_zero(mem);
+    assert(vm_snapshot_baseline_reset(&host) != 0);     /* capture again */
+    vm_snapshot_shutdown();
+    vm_host_destroy(&host);
+    assert(vm_mem_init_size(mem, VM_MEM_MIN_SIZE - 1, 0) != 0);
+    /* THP advice keeps the mapping 2MB aligned. */
+    assert(vm_mem_init_size(mem, (size_t)64 * 1024 * 1024 + 100, VM_MEM_THP) == 0);
+    assert(((uintptr_t)mem->ram & (2 * 1024 * 1024 - 1)) == 0 && mem->size % VM_PAGE_SIZE == 0);
+    vm_mem_write8(mem, (uint32_t)mem->size - 1, 0x77);
+    assert(vm_mem_read8(mem, (uint32_t)mem->size - 1) == 0x77);
+    vm_mem_destroy(mem);
+    puts("vm snapshot: OK");
+    return 0;
+}
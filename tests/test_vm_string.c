@@ -0,0 +1,237 @@
+/* REP string ops: bulk runs split at page/segment boundaries must leave
+ * memory, SI/DI/CX, EIP and flags exactly as element-by-element x86 would,
+ * and a REP op must be resumable after any number of runs. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_bcache.h"
+#include "VM/devices/vm_cpu.h"
+#include "VM/devices/vm_exec.h"
+#include "VM/devices/vm_io.h"
+#include "VM/devices/vm_mem.h"
+
+static vm_mem_t mem;
+static vm_bcache_t bc;
+static vm_dispatch_t mode;
+
+/* Load `code` + HLT at 0x7c00 and run it to completion. */
+static void run(vm_cpu_t *cpu, const uint8_t *code, size_t n) {
+    uint8_t buf[32];
+    memcpy(buf, code, n);
+    buf[n] = 0xF4;
+    vm_mem_load(&mem, 0x7c00, buf, n + 1);
+    vm_bcache_flush(&bc);
+    while (!cpu->halted)
+        assert(vm_exec_run(cpu, &mem, &bc, 1000, mode) > 0);
+}
+
+static void cpu_reset(vm_cpu_t *cpu) {
+    vm_cpu_init(cpu);
+    cpu->esp = 0x7000;
+}
+
+static void test_stos(void) {
+    vm_cpu_t cpu;
+    /* REP STOSD across a page boundary, non-uniform pattern. */
+    cpu_reset(&cpu);
+    cpu.es = 0x0100;                 /* ES:DI = 0x1000 + 0x0ff8 */
+    cpu.edi = 0xABCD0FF8;
+    cpu.ecx = 0x77770006;
+    cpu.eax = 0x11223344;
+    const uint8_t rep_stosd[] = { 0xF3, 0xAB };
+    run(&cpu, rep_stosd, sizeof(rep_stosd));
+    for (uint32_t a = 0x1ff8; a < 0x2010; a += 4) {
+        uint32_t v;
+        vm_mem_read(&mem, a, &v, 4);
+        assert(v == 0x11223344);
+    }
+    assert(vm_mem_read8(&mem, 0x2010) == 0);
+    assert(cpu.ecx == 0x77770000 && cpu.edi == 0xABCD1010);
+    assert(cpu.eip == 3);
+
+    /* STOSB with DF=1 walks down. */
+    cpu_reset(&cpu);
+    cpu.eflags = VM_FLAG_DF;
+    cpu.edi = 0x3005;
+    cpu.ecx = 4;
+    cpu.eax = 0x5A;
+    const uint8_t rep_stosb[] = { 0xF3, 0xAA };
+    run(&cpu, rep_stosb, sizeof(rep_stosb));
+    assert(vm_mem_read8(&mem, 0x3001) == 0 && vm_mem_read8(&mem, 0x3002) == 0x5A && vm_mem_read8(&mem, 0x3005) == 0x5A);
+    assert(vm_mem_read8(&mem, 0x3006) == 0 && (cpu.edi & 0xFFFF) == 0x3001 && cpu.ecx == 0);
+}
+
+static void test_movs(void) {
+    vm_cpu_t cpu;
+    uint8_t pat[300];
+    for (int i = 0; i < 300; i++) pat[i] = (uint8_t)(i * 7 + 1);
+    vm_mem_load(&mem, 0x4f80, pat, sizeof(pat));
+
+    /* REP MOVSB crossing a page on both sides. */
+    cpu_reset(&cpu);
+    cpu.esi = 0x4f80;
+    cpu.edi = 0x6f00;
+    cpu.ecx = 300;
+    const uint8_t rep_movsb[] = { 0xF3, 0xA4 };
+    run(&cpu, rep_movsb, sizeof(rep_movsb));
+    uint8_t got[300];
+    vm_mem_read(&mem, 0x6f00, got, sizeof(got));
+    assert(memcmp(got, pat, sizeof(pat)) == 0);
+    assert(cpu.esi == 0x4f80 + 300 && cpu.edi == 0x6f00 + 300 && cpu.ecx == 0);
+
+    /* Overlapping forward copy (dst = src + 1) replicates the first byte. */
+    cpu_reset(&cpu);
+    vm_mem_write8(&mem, 0x8000, 0xEE);
+    cpu.esi = 0x8000;
+    cpu.edi = 0x8001;
+    cpu.ecx = 16;
+    run(&cpu, rep_movsb, sizeof(rep_movsb));
+    for (uint32_t a = 0x8000; a <= 0x8010; a++)
+        assert(vm_mem_read8(&mem, a) == 0xEE);
+
+    /* 16-bit MOVSW, SI wrapping at the top of the segment. */
+    cpu_reset(&cpu);
+    cpu.ds = 0x0900;                 /* DS:FFFE = 0x18ffe, DS:0000 = 0x9000 */
+    vm_mem_write16(&mem, 0x18ffe, 0xBEEF);
+    vm_mem_write16(&mem, 0x9000, 0xCAFE);
+    cpu.esi = 0xFFFE;
+    cpu.edi = 0xA000;
+    cpu.ecx = 2;
+    const uint8_t rep_movsw[] = { 0xF3, 0x66, 0xA5 };
+    run(&cpu, rep_movsw, sizeof(rep_movsw));
+    assert(vm_mem_read16(&mem, 0xA000) == 0xBEEF && vm_mem_read16(&mem, 0xA002) == 0xCAFE);
+    assert(cpu.esi == 0x0002 && cpu.edi == 0xA004);
+}
+
+static void test_cmps_scas_lods(void) {
+    vm_cpu_t cpu;
+    const uint8_t a[] = "hello world";
+    const uint8_t b[] = "hello_world";
+    vm_mem_load(&mem, 0xB000, a, sizeof(a));
+    vm_mem_load(&mem, 0xC000, b, sizeof(b));
+
+    /* REPE CMPSB stops after the mismatch at index 5 with its flags. */
+    cpu_reset(&cpu);
+    cpu.esi = 0xB000;
+    cpu.edi = 0xC000;
+    cpu.ecx = sizeof(a);
+    const uint8_t repe_cmpsb[] = { 0xF3, 0xA6 };
+    run(&cpu, repe_cmpsb, sizeof(repe_cmpsb));
+    assert(cpu.ecx == sizeof(a) - 6 && cpu.esi == 0xB006 && cpu.edi == 0xC006);
+    assert(!vm_cpu_zf(&cpu) && (vm_cpu_eflags(&cpu) & VM_FLAG_CF));   /* ' ' < '_' */
+
+    /* REPNE SCASB finds 'w'. */
+    cpu_reset(&cpu);
+    cpu.edi = 0xB000;
+    cpu.ecx = 100;
+    cpu.eax = 'w';
+    const uint8_t repne_scasb[] = { 0xF2, 0xAE };
+    run(&cpu, repne_scasb, sizeof(repne_scasb));
+    assert(vm_cpu_zf(&cpu) && cpu.edi == 0xB007 && cpu.ecx == 100 - 7);
+
+    /* REP LODSB leaves the last element in AL. */
+    cpu_reset(&cpu);
+    cpu.eax = 0x12345600;
+    cpu.esi = 0xB000;
+    cpu.ecx = 5;
+    const uint8_t rep_lodsb[] = { 0xF3, 0xAC };
+    run(&cpu, rep_lodsb, sizeof(rep_lodsb));
+    assert(cpu.eax == 0x1234566F && cpu.esi == 0xB005);
+}
+
+/* A REP op is resumable: stopping after each run leaves EIP on the
+ * instruction with CX/DI describing the remaining work. */
+static void test_interruptible(void) {
+    vm_cpu_t cpu;
+    cpu_reset(&cpu);
+    cpu.edi = 0xD000;
+    cpu.ecx = 3 * VM_PAGE_SIZE;
+    cpu.eax = 0;
+    const uint8_t code[] = { 0xF3, 0xAA, 0xF4 };
+    vm_mem_load(&mem, 0x7c00, code, sizeof(code));
+    vm_bcache_flush(&bc);
+    assert(vm_exec_run(&cpu, &mem, &bc, 1, mode) == 1);
+    assert(cpu.eip == 0 && cpu.ecx == 2 * VM_PAGE_SIZE && cpu.edi == 0xE000);
+    assert(vm_exec_run(&cpu, &mem, &bc, 2, mode) == 2);
+    assert(cpu.eip == 2 && cpu.ecx == 0 && cpu.edi == 0);   /* DI wrapped */
+    assert(vm_exec_run(&cpu, &mem, &bc, 5, mode) == 1 && cpu.halted);
+}
+
+/* With paging on, an element that straddles a page goes to two frames:
+ * linear 0x20000 maps to 0x30000, linear 0x21000 to 0x50000. */
+static void test_paged_straddle(void) {
+    vm_cpu_t cpu;
+    vm_mem_write32(&mem, 0x80000, 0x81000 | 3);
+    vm_mem_write32(&mem, 0x81000 + 0x20 * 4, 0x30000 | 3);
+    vm_mem_write32(&mem, 0x81000 + 0x21 * 4, 0x50000 | 3);
+    cpu_reset(&cpu);
+    cpu.cr0 |= VM_CR0_PG;
+    cpu.cr3 = 0x80000;
+    cpu.es = cpu.ds = 0x2000;
+    cpu.edi = cpu.esi = 0x0FFE;
+    cpu.eax = 0x11223344;
+    const uint8_t stosd_lodsd[] = { 0xAB, 0xB8, 0, 0, 0, 0, 0xAD };
+    run(&cpu, stosd_lodsd, sizeof(stosd_lodsd));
+    assert(vm_mem_read16(&mem, 0x30FFE) == 0x3344 && vm_mem_read16(&mem, 0x50000) == 0x1122);
+    assert(vm_mem_read16(&mem, 0x31000) == 0);
+    assert(cpu.eax == 0x11223344 && cpu.edi == 0x1002 && cpu.esi == 0x1002);
+
+    /* INSW splits the port word the same way. */
+    uint32_t port_word = vm_io_in(&mem, 0x80, 2);
+    vm_mem_write16(&mem, 0x50000, 0);
+    cpu_reset(&cpu);
+    cpu.cr0 |= VM_CR0_PG;
+    cpu.cr3 = 0x80000;
+    cpu.es = 0x2000;
+    cpu.edi = 0x0FFF;
+    cpu.edx = 0x80;
+    const uint8_t insw[] = { 0x66, 0x6D };
+    run(&cpu, insw, sizeof(insw));
+    assert(vm_mem_read8(&mem, 0x30FFF) == (uint8_t)port_word);
+    assert(vm_mem_read8(&mem, 0x50000) == (uint8_t)(port_word >> 8));
+    assert(vm_mem_read8(&mem, 0x31000) == 0 && cpu.edi == 0x1001);
+}
+
+/* A straddling element whose second page maps outside guest RAM faults:
+ * the run stops on the instruction with SI, CX and EAX untouched. */
+static void test_straddle_fault(void) {
+    vm_cpu_t cpu;
+    vm_mem_write32(&mem, 0x80000, 0x81000 | 3);
+    vm_mem_write32(&mem, 0x81000 + 0x20 * 4, 0x30000 | 3);
+    vm_mem_write32(&mem, 0x81000 + 0x21 * 4, 0xFFFFF000 | 3);
+    cpu_reset(&cpu);
+    cpu.cr0 |= VM_CR0_PG;
+    cpu.cr3 = 0x80000;
+    cpu.ds = 0x2000;
+    cpu.esi = 0x0FFE;
+    cpu.ecx = 4;
+    cpu.eax = 0x55667788;
+    const uint8_t rep_lodsd[] = { 0xF3, 0xAD, 0xF4 };
+    vm_mem_load(&mem, 0x7c00, rep_lodsd, sizeof(rep_lodsd));
+    vm_bcache_flush(&bc);
+    assert(vm_exec_run(&cpu, &mem, &bc, 10, mode) == 0);
+    assert(cpu.eip == 0 && !cpu.halted);
+    assert(cpu.esi == 0x0FFE && cpu.ecx == 4 && cpu.eax == 0x55667788);
+    vm_mem_write32(&mem, 0x81000 + 0x21 * 4, 0x50000 | 3);
+}
+
+int main(void) {
+    assert(vm_mem_init(&mem) == 0);
+    assert(vm_bcache_init(&bc, &mem) == 0);
+    for (int m = 0; m < 2; m++) {
+        mode = m ? VM_DISPATCH_THREADED : VM_DISPATCH_SWITCH;
+        vm_mem_zero(&mem);
+        test_stos();
+        test_movs();
+        test_cmps_scas_lods();
+        test_interruptible();
+        test_paged_straddle();
+        test_straddle_fault();
+    }
+    vm_bcache_destroy(&bc);
+    vm_mem_destroy(&mem);
+    puts("vm string: OK");
+    return 0;
+}
@@ -6,7 +6,6 @@
 #include "VM/devices/vm_io.h"
 #include "VM/devices/vm_mem.h"
 #include "fl/syscall.h"
-#include "drivers.h"
 
 #define VM_SYS_PORT_NO      0xE0
 #define VM_SYS_PORT_ARG0    0xE1
@@ -17,21 +16,6 @@
 #define VM_SYS_PORT_ARG0_HI 0xE7
 #define VM_SYS_PORT_RET_HI  0xEB
 
-/* Satisfy vm_io link-time globals for this focused bridge test. */
-block_driver_t    *g_block_driver = NULL;
-keyboard_driver_t *g_keyboard_driver = NULL;
-display_driver_t  *g_display_driver = NULL;
-timer_driver_t    *g_timer_driver = NULL;
-pic_driver_t      *g_pic_driver = NULL;
-
-/* Minimal host/disk shims used by vm_io in this test. */
-typedef struct vm_host vm_host_t;
-int __attribute__((weak)) vm_host_kbd_pop(vm_host_t *host, uint8_t *out) { (void)host; (void)out; return -1; }
-uint64_t __attribute__((weak)) vm_host_ticks(vm_host_t *host) { (void)host; return 0; }
-int __attribute__((weak)) vm_disk_is_active(void) { return 0; }
-int __attribute__((weak)) vm_disk_read_sector(uint32_t lba, void *out512) { (void)lba; (void)out512; return -1; }
-int __attribute__((weak)) vm_disk_write_sector(uint32_t lba, const void *in512) { (void)lba; (void)in512; return -1; }
-
 static void write_sys_arg64(uint32_t arg, uintptr_t value) {
     vm_io_out(NULL, VM_SYS_PORT_ARG0 + arg, (uint32_t)value, 4);
     vm_io_out(NULL, VM_SYS_PORT_ARG0_HI + arg, (uint32_t)(value >> 32), 4);
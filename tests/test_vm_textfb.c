@@ -0,0 +1,63 @@
+/* Text rasterizer: full first frame, then only rows whose cells changed;
+ * glyph and attribute colours land in the right pixels. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_font.h"
+#include "VM/devices/vm_textfb.h"
+
+static uint8_t s_vga[VM_TEXTFB_COLS * VM_TEXTFB_ROWS * 2];
+
+static void put_cell(int row, int col, char ch, uint8_t attr) {
+    s_vga[(row * VM_TEXTFB_COLS + col) * 2] = (uint8_t)ch;
+    s_vga[(row * VM_TEXTFB_COLS + col) * 2 + 1] = attr;
+}
+
+static uint32_t pixel(const vm_textfb_t *fb, int x, int y) {
+    return fb->pixels[(size_t)y * VM_TEXTFB_WIDTH + x];
+}
+
+int main(void) {
+    vm_textfb_t fb;
+    assert(vm_textfb_init(&fb) == 0);
+    for (int r = 0; r < VM_TEXTFB_ROWS; r++)
+        for (int c = 0; c < VM_TEXTFB_COLS; c++)
+            put_cell(r, c, ' ', 0x07);
+
+    assert(vm_textfb_update(&fb, s_vga) == VM_TEXTFB_ROWS);
+    assert(fb.dirty_lo == 0 && fb.dirty_hi == VM_TEXTFB_ROWS - 1);
+    assert(pixel(&fb, 0, 0) == vm_textfb_palette[0]);
+    assert(vm_textfb_update(&fb, s_vga) == 0);
+    assert(fb.dirty_lo == -1);
+
+    /* One cell on row 7 and one on row 9: two rows, span 7..9. */
+    put_cell(7, 3, 'A', 0x1E);
+    put_cell(9, 0, ' ', 0x40);
+    assert(vm_textfb_update(&fb, s_vga) == 2);
+    assert(fb.dirty_lo == 7 && fb.dirty_hi == 9);
+    assert(pixel(&fb, 0, 9 * VM_TEXTFB_CELL_H) == vm_textfb_palette[4]);
+
+    /* The 'A' glyph: every set font bit is yellow, every clear bit blue,
+     * and each font row covers two scanlines. */
+    int x0 = 3 * VM_TEXTFB_CELL_W, y0 = 7 * VM_TEXTFB_CELL_H;
+    for (int gy = 0; gy < VM_FONT_HEIGHT; gy++) {
+        for (int gx = 0; gx < VM_FONT_W; gx++) {
+            uint32_t want = (vm_font_8x8['A'][gy] & (1 << (7 - gx))) ? vm_textfb_palette[0x0E] : vm_textfb_palette[0x01];
+            assert(pixel(&fb, x0 + gx, y0 + gy * 2) == want);
+            assert(pixel(&fb, x0 + gx, y0 + gy * 2 + 1) == want);
+        }
+    }
+
+    /* Non-ASCII bytes render as blanks; invalidate redraws everything. */
+    put_cell(0, 0, (char)0xB0, 0x07);
+    assert(vm_textfb_update(&fb, s_vga) == 1);
+    vm_textfb_invalidate(&fb);
+    assert(vm_textfb_update(&fb, s_vga) == VM_TEXTFB_ROWS);
+    assert(fb.rows_drawn == 2 * VM_TEXTFB_ROWS + 3);
+
+    vm_textfb_destroy(&fb);
+    printf("vm textfb: OK\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+/* UART tx FIFO: output is batched and flushed on newline, a full FIFO,
+ * the virtual-time deadline and an explicit flush; LSR tracks the FIFO. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "VM/devices/vm_uart.h"
+
+static size_t host_bytes(FILE *fp, char *buf, size_t cap) {
+    fflush(fp);
+    long pos = ftell(fp);
+    rewind(fp);
+    size_t n = fread(buf, 1, cap, fp);
+    fseek(fp, pos, SEEK_SET);
+    return n;
+}
+
+static void put(vm_uart_t *u, const char *s, uint64_t now) {
+    while (*s) vm_uart_write(u, VM_UART_THR, (uint8_t)*s++, now);
+}
+
+int main(void) {
+    char buf[1024];
+    FILE *fp = tmpfile();
+    assert(fp);
+    vm_uart_t u;
+    vm_uart_init(&u, fp);
+    assert(vm_uart_read(&u, VM_UART_LSR) == (VM_UART_LSR_THRE | VM_UART_LSR_TEMT));
+
+    /* Partial line stays in the FIFO; newline flushes it in one write. */
+    put(&u, "boot", 0);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 0);
+    assert(vm_uart_read(&u, VM_UART_LSR) == VM_UART_LSR_THRE);
+    put(&u, " ok\n", 1);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 8 && memcmp(buf, "boot ok\n", 8) == 0);
+    assert(u.host_writes == 1);
+
+    /* Deadline: nothing before VM_UART_FLUSH_TICKS, flushed at it. */
+    put(&u, "tick", 100);
+    vm_uart_poll(&u, 100 + VM_UART_FLUSH_TICKS - 1);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 8);
+    vm_uart_poll(&u, 100 + VM_UART_FLUSH_TICKS);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 12);
+
+    /* A full FIFO flushes without a newline. */
+    for (int i = 0; i < VM_UART_FIFO_SIZE; i++)
+        vm_uart_tx(&u, 'x', 200);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 12 + VM_UART_FIFO_SIZE);
+    assert(u.host_writes == 3);
+
+    /* Exit flush. */
+    vm_uart_tx(&u, '!', 300);
+    vm_uart_flush(&u);
+    assert(host_bytes(fp, buf, sizeof(buf)) == 13 + VM_UART_FIFO_SIZE);
+
+    /* DLAB redirects offsets 0/1 to the divisor latch, not the FIFO. */
+    vm_uart_write(&u, VM_UART_LCR, 0x83, 0);
+    vm_uart_write(&u, VM_UART_THR, 0x0C, 0);
+    vm_uart_write(&u, VM_UART_IER, 0x00, 0);
+    assert(vm_uart_read(&u, VM_UART_THR) == 0x0C);
+    vm_uart_write(&u, VM_UART_LCR, 0x03, 0);
+    assert(u.len == 0);
+    vm_uart_write(&u, VM_UART_SCR, 0x5A, 0);
+    assert(vm_uart_read(&u, VM_UART_SCR) == 0x5A);
+
+    fclose(fp);
+    printf("vm uart: OK\n");
+    return 0;
+}
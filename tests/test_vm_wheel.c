@@ -0,0 +1,76 @@
+/* Virtual-time event wheel: earliest-deadline lookup across slots and
+ * turns, in-order firing, periodic re-arm from callbacks and cancel. */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "VM/devices/vm_wheel.h"
+
+static vm_wheel_t w;
+static uint64_t log_due[64];
+static int log_id[64];
+static int log_len;
+
+static void record(void *ctx, uint64_t due) {
+    log_id[log_len] = (int)(intptr_t)ctx;
+    log_due[log_len++] = due;
+}
+
+static vm_wheel_event_t periodic;
+static void periodic_fn(void *ctx, uint64_t due) {
+    record(ctx, due);
+    vm_wheel_schedule(&w, &periodic, due + 64);
+}
+
+int main(void) {
+    vm_wheel_event_t a, b, far;
+    vm_wheel_init(&w, 0);
+    assert(vm_wheel_next(&w) == VM_WHEEL_NONE);
+
+    vm_wheel_event_init(&a, record, (void *)1);
+    vm_wheel_event_init(&b, record, (void *)2);
+    vm_wheel_event_init(&far, record, (void *)3);
+    vm_wheel_schedule(&w, &a, 100);
+    vm_wheel_schedule(&w, &b, 70);
+    /* Same slot as a/b modulo the wheel, but several turns out. */
+    vm_wheel_schedule(&w, &far, 100 + 3ull * VM_WHEEL_SLOTS * VM_WHEEL_GRAN);
+    assert(vm_wheel_next(&w) == 70);
+
+    assert(vm_wheel_advance(&w, 69) == 0);
+    assert(vm_wheel_advance(&w, 100) == 2);
+    assert(log_len == 2 && log_id[0] == 2 && log_due[0] == 70 && log_id[1] == 1 && log_due[1] == 100);
+
+    /* Only the far event remains: found by the fallback scan. */
+    assert(vm_wheel_next(&w) == 100 + 3ull * VM_WHEEL_SLOTS * VM_WHEEL_GRAN);
+    vm_wheel_cancel(&w, &far);
+    assert(w.armed == 0);
+    assert(vm_wheel_next(&w) == VM_WHEEL_NONE);
+    vm_wheel_cancel(&w, &far);    /* not armed: no-op */
+    assert(w.armed == 0);
+
+    /* Re-arming moves an event rather than duplicating it. */
+    vm_wheel_schedule(&w, &a, 5000);
+    vm_wheel_schedule(&w, &a, 300);
+    assert(vm_wheel_next(&w) == 300);
+    vm_wheel_cancel(&w, &a);
+    assert(w.armed == 0);
+
+    /* A periodic event fired across a long jump fires once per period,
+     * each time with its own due time. */
+    log_len = 0;
+    vm_wheel_event_init(&periodic, periodic_fn, (void *)4);
+    vm_wheel_schedule(&w, &periodic, 164);
+    assert(vm_wheel_advance(&w, 164 + 64 * 4) == 5);
+    for (int i = 0; i < 5; i++)
+        assert(log_id[i] == 4 && log_due[i] == 164 + 64u * (unsigned)i);
+    assert(vm_wheel_next(&w) == 164 + 64 * 5);
+
+    /* A deadline already in the past fires on the next advance. */
+    vm_wheel_schedule(&w, &b, 10);
+    assert(vm_wheel_next(&w) == w.now);
+    log_len = 0;
+    assert(vm_wheel_advance(&w, w.now) == 1 && log_id[0] == 2);
+
+    printf("vm wheel: OK\n");
+    return 0;
+}
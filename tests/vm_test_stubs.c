@@ -0,0 +1,23 @@
+/* Link-time globals and host/disk shims for the VM device tests that build
+ * vm_io and the executor without a host or a disk image. The shims are weak
+ * so a test that needs a real disk (test_vm_ide) supplies its own. */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "drivers.h"
+
+block_driver_t    *g_block_driver = NULL;
+keyboard_driver_t *g_keyboard_driver = NULL;
+display_driver_t  *g_display_driver = NULL;
+timer_driver_t    *g_timer_driver = NULL;
+pic_driver_t      *g_pic_driver = NULL;
+
+typedef struct vm_host vm_host_t;
+int __attribute__((weak)) vm_host_kbd_pop(vm_host_t *host, uint8_t *out) { (void)host; (void)out; return -1; }
+int __attribute__((weak)) vm_host_kbd_pending(vm_host_t *host) { (void)host; return 0; }
+uint64_t __attribute__((weak)) vm_host_ticks(vm_host_t *host) { (void)host; return 0; }
+int __attribute__((weak)) vm_disk_is_active(void) { return 0; }
+int __attribute__((weak)) vm_disk_read_sector(uint32_t lba, void *out512) { (void)lba; (void)out512; return -1; }
+int __attribute__((weak)) vm_disk_write_sector(uint32_t lba, const void *in512) { (void)lba; (void)in512; return -1; }
+int __attribute__((weak)) vm_disk_flush(void) { return 0; }
+uint32_t __attribute__((weak)) vm_disk_sectors(void) { return 0; }